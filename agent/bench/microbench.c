@@ -0,0 +1,479 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Microbenchmarks for the agent's hot paths
+ *
+ * Times the message envelopes and reader in protocol.c, the response
+ * builder in msgpack.c, the argument parsers in helpers.c, the strings
+ * scanner and the session cipher over realistic payloads. protocol.c and
+ * strings.c are included directly so their static functions can be called;
+ * the rest of the agent is linked as usual.
+ *
+ * Allocations are counted by wrapping malloc/calloc/realloc at link time
+ * (-Wl,--wrap=...). Allocations made inside libc (fopen, strdup) are not
+ * counted.
+ *
+ * Usage: microbench [-t seconds] [filter]
+ *
+ * Output follows the Go benchmark format, so results from different
+ * architectures or commits can be compared with benchstat.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "../src/protocol.c"
+#include "../src/commands/system/strings.c"
+
+#if EDB_FEATURE_CRYPTO
+#include "crypto.h"
+#endif
+
+/* =============================================================================
+ * Allocation Counting
+ * ============================================================================= */
+
+static uint64_t g_allocs = 0;
+static uint64_t g_alloc_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    g_allocs++;
+    g_alloc_bytes += size;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    g_allocs++;
+    g_alloc_bytes += nmemb * size;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    g_allocs++;
+    g_alloc_bytes += size;
+    return __real_realloc(ptr, size);
+}
+
+/* =============================================================================
+ * Payloads
+ * ============================================================================= */
+
+#define LS_ENTRIES      100
+#define PS_PROCS        500
+#define DATA_CHUNK      (64 * 1024)
+#define STRINGS_SIZE    (1024 * 1024)
+#define ARRAY_PATHS     64
+
+static volatile size_t g_sink;
+
+static uint32_t g_rng = 0x12345678;
+
+static uint32_t rng_next(void)
+{
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 17;
+    g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+static uint8_t  g_chunk[DATA_CHUNK];
+static uint8_t *g_binary;               /* ELF-like mix of code and strings */
+static FILE    *g_binary_file;
+
+static char g_ls_names[LS_ENTRIES][32];
+static char g_ps_cmdlines[PS_PROCS][64];
+static const char *g_ps_names[] = { "httpd", "dnsmasq", "udhcpc", "dropbear", "kworker/0:1" };
+
+static resp_builder_t g_ls_payload;     /* Encoded 100-entry ls response */
+static resp_builder_t g_request;        /* push request envelope */
+static resp_builder_t g_args;           /* push args map */
+static resp_builder_t g_array_args;     /* elfinfo args with 64 paths */
+
+static void encode_ls(resp_builder_t *rb)
+{
+    rb_map(rb, 1);
+    rb_lit(rb, "entries");
+    rb_array(rb, LS_ENTRIES);
+    for (int i = 0; i < LS_ENTRIES; i++) {
+        rb_map(rb, 5);
+        rb_lit(rb, "name");
+        rb_str(rb, g_ls_names[i]);
+        rb_lit(rb, "type");
+        rb_str(rb, i % 10 == 0 ? "dir" : "file");
+        rb_lit(rb, "size");
+        rb_uint(rb, 1000 + (uint64_t)i * 4099);
+        rb_lit(rb, "mode");
+        rb_uint(rb, 0755);
+        rb_lit(rb, "mtime");
+        rb_uint(rb, 1700000000 + (uint64_t)i);
+    }
+}
+
+static void setup_payloads(void)
+{
+    for (size_t i = 0; i < sizeof(g_chunk); i++) {
+        g_chunk[i] = (uint8_t)rng_next();
+    }
+
+    /* Alternate random "code" with printable runs, like a stripped binary */
+    g_binary = malloc(STRINGS_SIZE);
+    size_t pos = 0;
+    while (pos < STRINGS_SIZE) {
+        size_t run = 8 + rng_next() % 64;
+        bool text = rng_next() % 3 == 0;
+        for (size_t i = 0; i < run && pos < STRINGS_SIZE; i++) {
+            g_binary[pos++] = text ? (uint8_t)(' ' + rng_next() % 95) : (uint8_t)rng_next();
+        }
+    }
+    g_binary_file = fmemopen(g_binary, STRINGS_SIZE, "rb");
+
+    for (int i = 0; i < LS_ENTRIES; i++) {
+        snprintf(g_ls_names[i], sizeof(g_ls_names[i]), "libfoo-%03d.so.1.2", i);
+    }
+    for (int i = 0; i < PS_PROCS; i++) {
+        snprintf(g_ps_cmdlines[i], sizeof(g_ps_cmdlines[i]), "/usr/sbin/%s -f /etc/%d.conf",
+                 g_ps_names[i % 5], i);
+    }
+
+    rb_init(&g_ls_payload, 4096);
+    encode_ls(&g_ls_payload);
+
+    rb_init(&g_args, 256);
+    rb_map(&g_args, 4);
+    rb_lit(&g_args, "size");
+    rb_uint(&g_args, 1234567);
+    rb_lit(&g_args, "mode");
+    rb_uint(&g_args, 0644);
+    rb_lit(&g_args, "force");
+    rb_bool(&g_args, true);
+    rb_lit(&g_args, "path");
+    rb_lit(&g_args, "/usr/lib/libcrypto.so.1.0.0");
+
+    rb_init(&g_request, 256);
+    rb_map(&g_request, 4);
+    rb_lit(&g_request, "type");
+    rb_lit(&g_request, "req");
+    rb_lit(&g_request, "id");
+    rb_uint(&g_request, 4242);
+    rb_lit(&g_request, "cmd");
+    rb_lit(&g_request, "push");
+    rb_lit(&g_request, "args");
+    rb_raw(&g_request, g_args.buf, g_args.len);
+
+    rb_init(&g_array_args, 4096);
+    rb_map(&g_array_args, 2);
+    rb_lit(&g_array_args, "brief");
+    rb_uint(&g_array_args, 1);
+    rb_lit(&g_array_args, "paths");
+    rb_array(&g_array_args, ARRAY_PATHS);
+    for (int i = 0; i < ARRAY_PATHS; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/usr/sbin/daemon-%02d", i);
+        rb_str(&g_array_args, path);
+    }
+}
+
+/* =============================================================================
+ * Benchmarks
+ * ============================================================================= */
+
+/*
+ * Data frame envelope as built by proto_send_data. The chunk is sent in place
+ * and never copied, so this reports ns/op for the envelope only, no MB/s.
+ */
+static void bench_mp_data_frame(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint8_t buf[ENV_BUF_SIZE];
+        resp_builder_t rb;
+        rb_init_buf(&rb, buf, sizeof(buf));
+        rb_map(&rb, 5);
+        rb_env(&rb, ENV_TYPE_DATA);
+        rb_env(&rb, ENV_ID);
+        rb_uint(&rb, 7);
+        rb_env(&rb, ENV_SEQ);
+        rb_uint(&rb, (uint32_t)i);
+        rb_env(&rb, ENV_DONE_FALSE);
+        rb_env(&rb, ENV_DATA);
+        rb_bin_header(&rb, DATA_CHUNK);
+        g_sink = rb.len + (size_t)g_chunk[i % DATA_CHUNK];
+        rb_free(&rb);
+    }
+}
+
+/* Response envelope around a pre-encoded ls payload, as proto_send_response */
+static void bench_mp_response_envelope(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint8_t buf[ENV_BUF_SIZE];
+        resp_builder_t rb;
+        rb_init_buf(&rb, buf, sizeof(buf));
+        rb_map(&rb, 4);
+        rb_env(&rb, ENV_TYPE_RESP);
+        rb_env(&rb, ENV_ID);
+        rb_uint(&rb, 1);
+        rb_env(&rb, ENV_OK_TRUE);
+        rb_env(&rb, ENV_DATA);
+        g_sink = rb.len + g_ls_payload.len;
+        rb_free(&rb);
+    }
+}
+
+/* Request envelope walk, as handle_request */
+static void bench_mp_read_request(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        mp_reader_t r;
+        mp_reader_init(&r, g_request.buf, g_request.len);
+
+        size_t count = 0;
+        mp_read_map(&r, &count);
+        for (size_t k = 0; k < count; k++) {
+            const char *key, *val;
+            size_t key_len, val_len;
+            uint64_t id;
+            mp_read_str(&r, &key, &key_len);
+            if (key_len == 2) {
+                mp_read_uint(&r, &id);
+                g_sink = id;
+            } else if (key_len == 4 && memcmp(key, "args", 4) == 0) {
+                r.pos = r.len;
+            } else {
+                mp_read_str(&r, &val, &val_len);
+                g_sink = val_len;
+            }
+        }
+    }
+}
+
+/* ls response as built by cmd_ls */
+static void bench_rb_ls(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        resp_builder_t rb;
+        rb_init(&rb, 4096);
+        encode_ls(&rb);
+        g_sink = rb.len;
+        rb_free(&rb);
+    }
+}
+
+/* ps response as built by cmd_ps */
+static void bench_rb_ps(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        resp_builder_t rb;
+        rb_init(&rb, 8192);
+        rb_map(&rb, 1);
+        rb_lit(&rb, "processes");
+        rb_array(&rb, PS_PROCS);
+        for (int p = 0; p < PS_PROCS; p++) {
+            rb_map(&rb, 5);
+            rb_lit(&rb, "pid");
+            rb_uint(&rb, 100 + (uint64_t)p);
+            rb_lit(&rb, "ppid");
+            rb_uint(&rb, 1);
+            rb_lit(&rb, "name");
+            rb_str(&rb, g_ps_names[p % 5]);
+            rb_lit(&rb, "state");
+            rb_lit(&rb, "sleeping");
+            rb_lit(&rb, "cmdline");
+            rb_str(&rb, g_ps_cmdlines[p]);
+        }
+        g_sink = rb.len;
+        rb_free(&rb);
+    }
+}
+
+static void bench_parse_string_arg(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        char *s = parse_string_arg(g_args.buf, g_args.len, "path");
+        g_sink = (size_t)s;
+        edb_free(s);
+    }
+}
+
+static void bench_parse_uint_arg(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v = 0;
+        parse_uint_arg(g_args.buf, g_args.len, "mode", &v);
+        g_sink = v;
+    }
+}
+
+static void bench_parse_string_array_arg(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        size_t count = 0;
+        char **arr = parse_string_array_arg(g_array_args.buf, g_array_args.len, "paths", &count);
+        g_sink = count;
+        free_string_array(arr);
+    }
+}
+
+static void bench_strings_scan(size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        size_t len = 0;
+        bool truncated = false;
+        rewind(g_binary_file);
+        char *out = strings_scan(NULL, g_binary_file, 4, SIZE_MAX, &len, &truncated);
+        g_sink = len;
+        edb_free(out);
+    }
+}
+
+#if EDB_FEATURE_CRYPTO
+/* Sealing one data frame, as secure_sendv */
+static void bench_aead_seal(size_t n)
+{
+    static uint8_t out[DATA_CHUNK];
+    uint8_t key[AEAD_KEY_SIZE] = { 1 };
+    uint8_t nonce[AEAD_NONCE_SIZE] = { 0 };
+    uint8_t len_be[4] = { 0 };
+
+    for (size_t i = 0; i < n; i++) {
+        uint8_t tag[AEAD_TAG_SIZE];
+        aead_ctx_t aead;
+        nonce[4] = (uint8_t)i;
+        aead_init(&aead, key, nonce, len_be, sizeof(len_be));
+        aead_encrypt(&aead, out, g_chunk, DATA_CHUNK);
+        aead_tag(&aead, tag);
+        g_sink = tag[0];
+    }
+}
+
+/* One side of the key exchange in the handshake */
+static void bench_x25519(size_t n)
+{
+    uint8_t priv[X25519_SIZE] = { 9 };
+    uint8_t pub[X25519_SIZE];
+
+    for (size_t i = 0; i < n; i++) {
+        priv[0] = (uint8_t)i;
+        x25519_public(pub, priv);
+        g_sink = pub[0];
+    }
+}
+#endif
+
+typedef struct {
+    const char  *name;
+    void       (*fn)(size_t n);
+    size_t       bytes;          /* Bytes processed per op, 0 = none */
+} bench_t;
+
+static const bench_t benches[] = {
+    { "MpDataFrame64K",         bench_mp_data_frame,            0 },
+    { "MpResponseEnvelopeLs100", bench_mp_response_envelope,    0 },
+    { "MpReadRequest",          bench_mp_read_request,          0 },
+    { "RbLs100",                bench_rb_ls,                    0 },
+    { "RbPs500",                bench_rb_ps,                    0 },
+    { "ParseStringArg",         bench_parse_string_arg,         0 },
+    { "ParseUintArg",           bench_parse_uint_arg,           0 },
+    { "ParseStringArrayArg64",  bench_parse_string_array_arg,   0 },
+    { "StringsScan1M",          bench_strings_scan,             STRINGS_SIZE },
+#if EDB_FEATURE_CRYPTO
+    { "AeadSeal64K",            bench_aead_seal,                DATA_CHUNK },
+    { "X25519",                 bench_x25519,                   0 },
+#endif
+    { NULL, NULL, 0 },
+};
+
+/* =============================================================================
+ * Runner
+ * ============================================================================= */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Grow the iteration count until one run takes at least target_ns, the
+ * same way Go's testing package does.
+ */
+static void run_bench(const bench_t *b, uint64_t target_ns)
+{
+    size_t n = 1;
+    uint64_t elapsed, allocs, bytes;
+
+    for (;;) {
+        uint64_t a0 = g_allocs, b0 = g_alloc_bytes;
+        uint64_t t0 = now_ns();
+        b->fn(n);
+        elapsed = now_ns() - t0;
+        allocs = g_allocs - a0;
+        bytes = g_alloc_bytes - b0;
+
+        if (elapsed >= target_ns || n >= 1000000000) break;
+
+        /* Predict from the last run, grow by at most 100x per step */
+        uint64_t per_op = elapsed / n ? elapsed / n : 1;
+        size_t next = (size_t)(target_ns * 6 / 5 / per_op);
+        if (next > n * 100) next = n * 100;
+        if (next <= n) next = n + 1;
+        n = next;
+    }
+
+    printf("Benchmark%-28s %10zu %14.1f ns/op", b->name, n, (double)elapsed / n);
+    if (b->bytes) {
+        printf(" %10.2f MB/s", (double)b->bytes * n / ((double)elapsed / 1e9) / 1e6);
+    }
+    printf(" %10llu B/op %8llu allocs/op\n",
+           (unsigned long long)(bytes / n), (unsigned long long)(allocs / n));
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = 1.0;
+    const char *filter = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [-t seconds] [filter]\n", argv[0]);
+            return 1;
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    setup_payloads();
+    if (!g_binary || !g_binary_file) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        printf("goos: linux\ngoarch: %s\nkernel: %s\n", uts.machine, uts.release);
+    }
+    printf("pkg: edb-agent\n");
+
+    for (const bench_t *b = benches; b->name; b++) {
+        if (filter && !strstr(b->name, filter)) continue;
+        run_bench(b, (uint64_t)(seconds * 1e9));
+    }
+
+    return 0;
+}
@@ -3,49 +3,20 @@
  * https://github.com/Necromancer-Labs/embbridge
  *
  * Internal header for command implementations.
- * Provides shared utilities: argument parsing, response building, path helpers.
+ * Provides shared utilities: argument parsing, path helpers, and the response
+ * builder (msgpack.h).
  */
 
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
 #include "edb.h"
+#include "msgpack.h"
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
 
-/* =============================================================================
- * Response Builder
- *
- * A simple buffer builder for constructing MessagePack responses.
- * Grows automatically as needed.
- * ============================================================================= */
-
-typedef struct {
-    uint8_t *buf;
-    size_t   cap;
-    size_t   len;
-} resp_builder_t;
-
-/* Initialize a response builder with given capacity */
-int rb_init(resp_builder_t *rb, size_t cap);
-
-/* Free the response builder's buffer */
-void rb_free(resp_builder_t *rb);
-
-/* Write primitives */
-int rb_u8(resp_builder_t *rb, uint8_t v);
-int rb_u16be(resp_builder_t *rb, uint16_t v);
-int rb_u32be(resp_builder_t *rb, uint32_t v);
-int rb_raw(resp_builder_t *rb, const void *data, size_t len);
-
-/* Write MessagePack types */
-int rb_str(resp_builder_t *rb, const char *s);
-int rb_bin(resp_builder_t *rb, const uint8_t *data, size_t len);
-int rb_uint(resp_builder_t *rb, uint64_t v);
-int rb_map(resp_builder_t *rb, size_t count);
-int rb_array(resp_builder_t *rb, size_t count);
-
 /* =============================================================================
  * Argument Parsing
  *
@@ -55,7 +26,7 @@ int rb_array(resp_builder_t *rb, size_t count);
 
 /*
  * Parse a string value from a MessagePack map.
- * Returns allocated string (caller must free), or NULL if not found.
+ * Returns allocated string (caller must edb_free), or NULL if not found.
  */
 char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key);
 
@@ -65,4 +36,32 @@ char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key);
  */
 int parse_uint_arg(const uint8_t *args, size_t args_len, const char *key, uint64_t *out);
 
+/*
+ * Parse an array of strings from a MessagePack map.
+ * Returns a NULL-terminated allocated array (free with free_string_array),
+ * or NULL if not found or malformed. *count receives the number of strings.
+ */
+char **parse_string_array_arg(const uint8_t *args, size_t args_len, const char *key,
+                              size_t *count);
+void free_string_array(char **arr);
+
+/*
+ * Find a binary value in a MessagePack map.
+ * Returns a pointer into args (not a copy) and sets *out_len, or NULL if not found.
+ */
+const uint8_t *parse_bin_arg(const uint8_t *args, size_t args_len, const char *key,
+                             size_t *out_len);
+
+/* =============================================================================
+ * File Helpers (src/commands/file_transfer.c)
+ * ============================================================================= */
+
+/*
+ * Open a file for reading in full and find its size, asking the MTD layer
+ * for /dev/mtd* devices (which report 0 in st_size). Returns the open file,
+ * or NULL with *err set to a message for the client.
+ */
+FILE *pull_file_open(const char *path, uint64_t *size, uint32_t *mode,
+                     const char **err);
+
 #endif /* COMMANDS_H */
@@ -0,0 +1,145 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Compile-time configuration
+ *
+ * Each EDB_FEATURE_* switches a group of commands in (1) or out (0). The
+ * Makefile sets them from its FEATURE_* variables and leaves the matching
+ * source files out of the link, so a disabled group costs nothing. The
+ * core commands (ls, cat, pwd, cd, realpath, pull, push, throttle,
+ * kill-agent) are always built.
+ */
+
+#ifndef EDB_CONFIG_H
+#define EDB_CONFIG_H
+
+#ifndef EDB_FEATURE_FILEOPS
+#define EDB_FEATURE_FILEOPS 1   /* rm, mv, cp, mkdir, chmod, touch */
+#endif
+
+#ifndef EDB_FEATURE_SYSINFO
+#define EDB_FEATURE_SYSINFO 1   /* uname, whoami, ps, cpuinfo, mtd, dmesg */
+#endif
+
+#ifndef EDB_FEATURE_EXEC
+#define EDB_FEATURE_EXEC    1   /* exec, reboot */
+#endif
+
+#ifndef EDB_FEATURE_NET
+#define EDB_FEATURE_NET     1   /* ss, ip_addr, ip_route (netlink) */
+#endif
+
+#ifndef EDB_FEATURE_STRINGS
+#define EDB_FEATURE_STRINGS 1   /* strings */
+#endif
+
+#ifndef EDB_FEATURE_TRACE
+#define EDB_FEATURE_TRACE   1   /* profile, systrace (ptrace) */
+#endif
+
+#ifndef EDB_FEATURE_ELFINFO
+#define EDB_FEATURE_ELFINFO 1   /* elfinfo */
+#endif
+
+#ifndef EDB_FEATURE_VERIFY
+#define EDB_FEATURE_VERIFY  1   /* verify (SHA-256) */
+#endif
+
+#ifndef EDB_FEATURE_WATCH
+#define EDB_FEATURE_WATCH   1   /* watch_dir (inotify) */
+#endif
+
+#ifndef EDB_FEATURE_CHUNKS
+#define EDB_FEATURE_CHUNKS  1   /* hash_chunks (SHA-256) */
+#endif
+
+#ifndef EDB_FEATURE_SERIAL
+#define EDB_FEATURE_SERIAL  1   /* -s: serial/UART transport */
+#endif
+
+#ifndef EDB_FEATURE_CRYPTO
+#define EDB_FEATURE_CRYPTO  1   /* Session encryption (X25519, ChaCha20-Poly1305), -k */
+#endif
+
+#ifndef EDB_FEATURE_UPGRADE
+#define EDB_FEATURE_UPGRADE 1   /* upgrade (SHA-256, execve) */
+#endif
+
+/*
+ * Memory budget for each agent process (see mem.c), overridable at run time
+ * with -m. 0 picks a quarter of MemTotal, clamped to the MIN/MAX below.
+ */
+#ifndef EDB_MEM_BUDGET
+#define EDB_MEM_BUDGET      0
+#endif
+
+#ifndef EDB_MEM_BUDGET_MIN
+#define EDB_MEM_BUDGET_MIN  (2 * 1024 * 1024)   /* 2 MB */
+#endif
+
+#ifndef EDB_MEM_BUDGET_MAX
+#define EDB_MEM_BUDGET_MAX  (64 * 1024 * 1024)  /* 64 MB */
+#endif
+
+/*
+ * Largest data frame a pull sends. Requests that arrive during a transfer
+ * are answered between frames, so this bounds how long they wait behind
+ * bulk data; smaller frames cost a little throughput.
+ */
+#ifndef EDB_FRAME_SIZE
+#define EDB_FRAME_SIZE      (16 * 1024)         /* 16 KB */
+#endif
+
+/* Pulls one session can stream at once, sent round-robin */
+#ifndef EDB_MAX_STREAMS
+#define EDB_MAX_STREAMS     4
+#endif
+
+/*
+ * Messages a running request can read ahead of the session loop while it
+ * looks for its cancel. A client pipelining more than this behind it has
+ * its cancel read once the queue drains.
+ */
+#ifndef EDB_MAX_HELD
+#define EDB_MAX_HELD        16
+#endif
+
+/*
+ * Read-ahead for pulls: a reader thread keeps this many blocks of
+ * EDB_CHUNK_SIZE filled while the session loop sends, so slow flash reads
+ * overlap with the network. Each running pull holds them all.
+ */
+#ifndef EDB_READAHEAD
+#define EDB_READAHEAD       2
+#endif
+
+/*
+ * Most files one pull_many may send. The listing goes out as a single
+ * response, and a glob over all of /proc should fail fast rather than stream
+ * thousands of entries.
+ */
+#ifndef EDB_PULL_MANY_MAX
+#define EDB_PULL_MANY_MAX   256
+#endif
+
+/* Directories one session can watch at once (watch_dir) */
+#ifndef EDB_MAX_WATCHES
+#define EDB_MAX_WATCHES     16
+#endif
+
+/*
+ * Serial link (serial.c): data frames in flight before an acknowledgement
+ * (a power of two, at most 16) and the most data per frame. The window must
+ * cover the round trip or the line idles; each frame in it is buffered on
+ * both sides.
+ */
+#ifndef EDB_SERIAL_WINDOW
+#define EDB_SERIAL_WINDOW   16
+#endif
+
+#ifndef EDB_SERIAL_FRAME
+#define EDB_SERIAL_FRAME    1024
+#endif
+
+#endif /* EDB_CONFIG_H */
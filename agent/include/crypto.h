@@ -0,0 +1,75 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * X25519 (RFC 7748), ChaCha20-Poly1305 (RFC 8439) and HMAC-SHA256, small
+ * portable implementations for session encryption.
+ */
+
+#ifndef CRYPTO_H
+#define CRYPTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sha256.h"
+
+#define X25519_SIZE         32
+#define AEAD_KEY_SIZE       32
+#define AEAD_NONCE_SIZE     12
+#define AEAD_TAG_SIZE       16
+
+/* out = scalar * point; the scalar is clamped as RFC 7748 requires */
+void x25519(uint8_t out[X25519_SIZE], const uint8_t scalar[X25519_SIZE],
+            const uint8_t point[X25519_SIZE]);
+
+/* Public key of a private key (scalar * base point) */
+void x25519_public(uint8_t pub[X25519_SIZE], const uint8_t priv[X25519_SIZE]);
+
+typedef struct {
+    uint32_t state[16];
+    uint8_t  stream[64];
+    size_t   used;          /* Bytes of stream already consumed */
+} chacha20_ctx_t;
+
+typedef struct {
+    uint32_t r[5], s[4], h[5], pad[4];
+    uint8_t  buf[16];
+    size_t   buf_len;
+} poly1305_ctx_t;
+
+/*
+ * ChaCha20-Poly1305 as in RFC 8439, over a message that may arrive in any
+ * number of pieces: aead_init with the associated data, aead_encrypt or
+ * aead_decrypt for each piece (in place is fine), aead_tag at the end.
+ */
+typedef struct {
+    chacha20_ctx_t chacha;
+    poly1305_ctx_t poly;
+    uint64_t       ad_len;
+    uint64_t       len;
+} aead_ctx_t;
+
+void aead_init(aead_ctx_t *ctx, const uint8_t key[AEAD_KEY_SIZE],
+               const uint8_t nonce[AEAD_NONCE_SIZE],
+               const uint8_t *ad, size_t ad_len);
+void aead_encrypt(aead_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len);
+void aead_decrypt(aead_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len);
+void aead_tag(aead_ctx_t *ctx, uint8_t tag[AEAD_TAG_SIZE]);
+
+typedef struct {
+    sha256_ctx_t inner;
+    uint8_t      okey[64];  /* Key XOR opad, for the outer hash */
+} hmac_sha256_ctx_t;
+
+void hmac_sha256_init(hmac_sha256_ctx_t *ctx, const uint8_t *key, size_t key_len);
+void hmac_sha256_update(hmac_sha256_ctx_t *ctx, const void *data, size_t len);
+void hmac_sha256_final(hmac_sha256_ctx_t *ctx, uint8_t out[SHA256_DIGEST_SIZE]);
+
+/* Compare in time independent of the contents. Returns 0 if equal. */
+int crypto_verify(const uint8_t *a, const uint8_t *b, size_t len);
+
+/* Clear secrets in a way the compiler does not drop */
+void crypto_wipe(void *p, size_t len);
+
+#endif /* CRYPTO_H */
@@ -12,6 +12,8 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "config.h"
+
 /* =============================================================================
  * Constants
  * ============================================================================= */
@@ -33,8 +35,25 @@ typedef enum {
     MSG_REQ         = 3,
     MSG_RESP        = 4,
     MSG_DATA        = 5,
+    MSG_CANCEL      = 6,
 } msg_type_t;
 
+/*
+ * Binary data frames (frames version 2). Once both sides announced
+ * "frames": 2 in hello/hello_ack, data chunks travel as
+ *
+ *   [4 length BE][1 kind][1 flags][2 reserved][4 id BE][4 seq BE][payload]
+ *
+ * instead of MessagePack "data" maps; all other messages stay MessagePack.
+ * The length prefix is the usual one, and since a MessagePack message
+ * always starts with a map marker (0x80 and up), the kind byte tells the
+ * two apart.
+ */
+#define EDB_FRAMES_VERSION  2
+#define FRAME_KIND_DATA     0x01
+#define FRAME_FLAG_DONE     0x01
+#define FRAME_HDR_SIZE      12      /* After the length prefix */
+
 /* =============================================================================
  * Command Types
  * ============================================================================= */
@@ -70,6 +89,15 @@ typedef enum {
     CMD_CPUINFO,
     CMD_IP_ADDR,
     CMD_IP_ROUTE,
+    CMD_PROFILE,
+    CMD_SYSTRACE,
+    CMD_ELFINFO,
+    CMD_VERIFY,
+    CMD_THROTTLE,
+    CMD_PULL_MANY,
+    CMD_WATCH_DIR,
+    CMD_HASH_CHUNKS,
+    CMD_UPGRADE,
 } cmd_type_t;
 
 /* =============================================================================
@@ -79,25 +107,88 @@ typedef enum {
 typedef enum {
     MODE_CONNECT,   /* -c: Connect to client (reverse) */
     MODE_LISTEN,    /* -l: Listen for client (bind) */
+    MODE_SERIAL,    /* -s: Wait for client on a tty */
 } conn_mode_t;
 
 typedef struct {
     conn_mode_t mode;
     char        host[256];
     uint16_t    port;
+    const char *tty;            /* -s: device path */
+    unsigned    baud;           /* -b: line speed */
+    const char *secret;         /* -k: pre-shared secret, NULL = none */
+    size_t      mem_budget;     /* -m: bytes, 0 = default */
+    int         resume_fd;      /* -u: state from the image that exec'd this one, -1 = none */
+    int         listenfd;       /* Listening socket taken over on upgrade, -1 = none */
 } config_t;
 
 /* =============================================================================
  * Connection State
  * ============================================================================= */
 
+struct conn;
+
+/* Token bucket limiting a transfer or a whole session (sched.c) */
+typedef struct {
+    uint64_t    rate;           /* Bytes per second, 0 = unlimited */
+    uint64_t    tat;            /* Monotonic us at which the bucket is full again */
+} tbucket_t;
+
+/*
+ * A bulk transfer that the session loop sends one frame at a time
+ * (sched.c), so requests arriving meanwhile are answered in between.
+ * send_next sends one frame of at most max bytes, stores its size in
+ * *sent and returns 1 while more remain, 0 after the last one and -1 if
+ * the connection failed. close releases ctx.
+ */
+typedef struct {
+    uint32_t    id;             /* Request the stream answers */
+    int       (*send_next)(struct conn *conn, void *ctx, size_t max, size_t *sent);  /* NULL = free slot */
+    void      (*close)(void *ctx);
+    void        *ctx;
+    tbucket_t   bucket;         /* Per-transfer rate limit */
+} stream_t;
+
+/* A message read early by proto_cancelled(), waiting for proto_recv() */
 typedef struct {
+    uint8_t     *data;
+    size_t      len;
+    bool        cancel;         /* It is a cancel, for request cancel_id */
+    uint32_t    cancel_id;
+} held_msg_t;
+
+struct watch_state;             /* Directory watches (watch.c) */
+struct secure_state;            /* Session keys (secure.c) */
+
+typedef struct conn {
     int         sockfd;
+    conn_mode_t mode;           /* How the session was set up */
     char        cwd[EDB_PATH_MAX];
     uint8_t     *recvbuf;
     size_t      recvbuf_size;
+    held_msg_t  held[EDB_MAX_HELD]; /* FIFO of messages read early by proto_cancelled() */
+    size_t      held_head;      /* Oldest entry in held */
+    size_t      held_count;
+    uint64_t    deadline;       /* Current request's deadline_ms, monotonic ms (0 = none) */
+    stream_t    streams[EDB_MAX_STREAMS];
+    size_t      stream_next;    /* Round-robin position in streams */
+    tbucket_t   bucket;         /* Rate limit shared by all transfers (throttle) */
+    uint8_t     frames;         /* Data frames in use: EDB_FRAMES_VERSION if both sides have them */
+    struct watch_state *watch;  /* inotify state, made by the first watch_dir */
+    struct secure_state *secure; /* Key exchange and session keys */
+    bool        encrypted;      /* Messages after the handshake are sealed (secure.c) */
 } conn_t;
 
+/* A data chunk, or a cancel sent in its place, as parsed by proto_parse_data() */
+typedef struct {
+    uint32_t        id;
+    uint32_t        seq;
+    const uint8_t  *data;       /* Points into the message */
+    size_t          len;
+    bool            done;
+    bool            cancel;
+} data_msg_t;
+
 /* =============================================================================
  * Protocol Functions (protocol.c)
  * ============================================================================= */
@@ -110,18 +201,61 @@ int proto_send(conn_t *conn, const uint8_t *data, size_t len);
 
 /*
  * Receive a message from the connection.
- * Allocates buffer, caller must free.
+ * Allocates buffer, caller must edb_free().
  * Returns message length on success, -1 on error.
  */
 int proto_recv(conn_t *conn, uint8_t **data, size_t *len);
 
+/*
+ * Check whether the client has sent a cancel for request id. Non-blocking;
+ * long-running handlers call it between chunks. Other messages read while
+ * looking for it are queued (up to EDB_MAX_HELD) and returned in order by
+ * the next proto_recv() calls. Also returns true if the connection was
+ * lost, since there is no one left to send to.
+ */
+bool proto_cancelled(conn_t *conn, uint32_t id);
+
+/*
+ * Handle a cancel for a pull still streaming or a watch: stop it and send
+ * its "cancelled" error. A cancel for a request that already finished is
+ * ignored. Handlers that read their own data messages (push, upgrade) pass
+ * cancels meant for other requests here. Returns -1 if the send failed.
+ */
+int proto_cancel_stream(conn_t *conn, uint32_t id);
+
+/*
+ * Check, without blocking, whether a message from the client is waiting
+ * (held back or unread on the socket).
+ */
+bool proto_readable(conn_t *conn);
+
+/*
+ * Descriptor to poll() for a cancel while waiting on other fds, or -1 if
+ * the held-back queue is full (so proto_cancelled() would not read).
+ */
+int proto_cancel_fd(conn_t *conn);
+
+/*
+ * Milliseconds left before the current request's deadline_ms runs out:
+ * -1 if it has none (or conn is NULL), 0 once it has passed. Usable
+ * directly as a poll() timeout.
+ */
+int proto_time_left(const conn_t *conn);
+
+/*
+ * Check whether the current request's deadline has passed. Scanning
+ * handlers stop early and flag their results as truncated.
+ */
+bool proto_expired(const conn_t *conn);
+
 /*
  * Send hello message.
  */
 int proto_send_hello(conn_t *conn);
 
 /*
- * Receive and validate hello message.
+ * Receive the peer's hello or hello_ack and note which data frames it
+ * supports (conn->frames). Returns 0 on success, -1 on error.
  */
 int proto_recv_hello(conn_t *conn);
 
@@ -143,11 +277,125 @@ int proto_send_response(conn_t *conn, uint32_t id, bool ok,
 int proto_send_error(conn_t *conn, uint32_t id, const char *error);
 
 /*
- * Send a data chunk for file transfer.
+ * Send a data chunk for file transfer, as a binary frame if negotiated.
  */
 int proto_send_data(conn_t *conn, uint32_t id, uint32_t seq,
                     const uint8_t *data, size_t len, bool done);
 
+/*
+ * Parse a data chunk from the client, in either framing. Returns 0 on
+ * success, -1 if msg is neither a data chunk nor a cancel.
+ */
+int proto_parse_data(const uint8_t *msg, size_t msg_len, data_msg_t *out);
+
+/* =============================================================================
+ * Bulk Stream Scheduling (sched.c)
+ * ============================================================================= */
+
+/*
+ * Start a stream for request id, limited to rate bytes/s (0 = unlimited)
+ * on top of the session's limit. Returns 0 on success, -1 if all
+ * EDB_MAX_STREAMS slots are busy (check sched_has_room() before sending
+ * the request's first response).
+ */
+int sched_add(conn_t *conn, uint32_t id, uint64_t rate,
+              int (*send_next)(conn_t *, void *, size_t, size_t *),
+              void (*close_fn)(void *), void *ctx);
+
+/* Check whether another stream can be started */
+bool sched_has_room(const conn_t *conn);
+
+/* Check whether any stream still has frames to send */
+bool sched_active(const conn_t *conn);
+
+/*
+ * Send one frame from the next stream in round-robin order that its rate
+ * limits allow, closing it after its last frame. Returns 0 on success, -1
+ * if the connection failed.
+ */
+int sched_step(conn_t *conn);
+
+/*
+ * Milliseconds until some stream's rate limits let it send again; 0 if
+ * one can send now. Only meaningful while sched_active().
+ */
+int sched_wait_ms(const conn_t *conn);
+
+/* Set a bucket's rate in bytes/s (0 = unlimited), starting full */
+void tb_init(tbucket_t *tb, uint64_t rate);
+
+/*
+ * Block until both tb and the session's limit allow another bytes, then
+ * charge them. For transfers paced by the client (push); tb may be NULL.
+ */
+void sched_throttle(conn_t *conn, tbucket_t *tb, size_t bytes);
+
+/*
+ * Stop the stream for request id. Returns true if there was one; the
+ * caller sends the request's final response.
+ */
+bool sched_cancel(conn_t *conn, uint32_t id);
+
+/* Stop every stream, e.g. when the session ends */
+void sched_close_all(conn_t *conn);
+
+/* =============================================================================
+ * Device Fingerprint (fingerprint.c)
+ * ============================================================================= */
+
+/*
+ * Gather uname, user, cwd, CPU, memory, MTD and feature info once at
+ * startup and pre-encode it for the handshake.
+ * Returns 0 on success, -1 on error (hello is then sent without it).
+ */
+int fingerprint_init(void);
+
+/*
+ * Get the pre-encoded fingerprint map, or NULL if not available.
+ */
+const uint8_t *fingerprint_get(size_t *len);
+
+/*
+ * Encode a fresh fingerprint map with cwd as its "cwd" entry. Returns a
+ * buffer the caller must edb_free(), or NULL if out of memory.
+ */
+uint8_t *fingerprint_build(const char *cwd, size_t *len);
+
+/* =============================================================================
+ * Memory Budget (mem.c)
+ * ============================================================================= */
+
+/*
+ * Set the per-process memory budget in bytes. 0 uses EDB_MEM_BUDGET, or
+ * a quarter of MemTotal if that is 0 too. Call once at startup.
+ */
+void mem_init(size_t budget);
+
+/* Budget in bytes (0 = unlimited), live bytes and high-water mark */
+size_t mem_budget(void);
+size_t mem_used(void);
+size_t mem_peak(void);
+
+/* Bytes that can still be allocated (SIZE_MAX when unlimited) */
+size_t mem_available(void);
+
+/* Check whether an allocation of this size would fit the budget */
+bool mem_fits(size_t bytes);
+
+/* MemTotal from /proc/meminfo in KB, 0 if unknown */
+uint32_t mem_total_kb(void);
+
+/*
+ * Tracking allocator. Same contract as the libc functions, but fails with
+ * NULL once the budget would be exceeded. Memory from these must be
+ * released with edb_free() (never free()), and vice versa.
+ */
+void *edb_malloc(size_t size);
+void *edb_calloc(size_t n, size_t size);
+void *edb_realloc(void *ptr, size_t size);
+void  edb_free(void *ptr);
+char *edb_strdup(const char *s);
+
 /* =============================================================================
  * Transport Functions (transport.c)
  * ============================================================================= */
@@ -180,11 +428,227 @@ void transport_close(int sockfd);
  */
 int transport_send(int sockfd, const uint8_t *data, size_t len);
 
+/*
+ * Send several buffers with one writev() where possible. iov is modified.
+ */
+struct iovec;
+int transport_sendv(int sockfd, struct iovec *iov, int iovcnt);
+
 /*
  * Receive raw bytes.
  */
 int transport_recv(int sockfd, uint8_t *data, size_t len);
 
+/*
+ * Check, without blocking, whether bytes (or a hangup) are waiting.
+ */
+bool transport_readable(int sockfd);
+
+/*
+ * Wait up to timeout_ms for bytes (or a hangup). Returns true if they came.
+ */
+bool transport_wait_readable(int sockfd, int timeout_ms);
+
+/* =============================================================================
+ * Serial Transport (serial.c)
+ *
+ * A thread runs the link over the tty and hands each client session to
+ * serial_accept() as one end of a socketpair, so the session and the
+ * transport functions above work on it unchanged.
+ * ============================================================================= */
+
+typedef struct serial_link serial_link_t;
+
+/*
+ * Open a tty in raw mode at baud and start the link.
+ * Returns NULL on error (reported on stderr).
+ */
+serial_link_t *serial_open(const char *path, unsigned baud);
+
+/*
+ * Wait for a client to open the link.
+ * Returns the session's socket fd, -1 on error or signal.
+ */
+int serial_accept(serial_link_t *link);
+
+/*
+ * Restore the tty's settings. Call before exiting.
+ */
+void serial_close(serial_link_t *link);
+
+/* =============================================================================
+ * Session Encryption (secure.c)
+ *
+ * X25519 key exchange in hello/hello_ack, then ChaCha20-Poly1305 on every
+ * message. protocol.c seals and opens messages through these once
+ * conn->encrypted is set. Without EDB_FEATURE_CRYPTO no key is offered and
+ * sessions stay in clear.
+ * ============================================================================= */
+
+#define SECURE_KEY_SIZE     32      /* X25519 public key in hello/hello_ack */
+#define SECURE_SAVE_SIZE    80      /* Session keys and counters, see secure_save() */
+
+#if EDB_FEATURE_CRYPTO
+
+/*
+ * Set the pre-shared secret mixed into every session's keys. With one
+ * set, clients that do not encrypt are refused. Returns -1 if it is empty
+ * or too long.
+ */
+int secure_init(const char *secret);
+
+/*
+ * Make this session's key pair if needed and return the public key for
+ * hello/hello_ack (SECURE_KEY_SIZE bytes), or NULL if there is none to offer.
+ */
+const uint8_t *secure_offer(conn_t *conn);
+
+/* Note the key from the peer's hello/hello_ack */
+void secure_peer(conn_t *conn, const uint8_t *key, size_t len);
+
+/*
+ * After hello and hello_ack: derive the session keys and set
+ * conn->encrypted if both sides offered a key. Returns -1 if the session
+ * must not go on (no encryption although a secret is set, or a bad key).
+ */
+int secure_start(conn_t *conn);
+
+/* Seal and send one message made of iov (without its length prefix) */
+struct iovec;
+int secure_sendv(conn_t *conn, const struct iovec *iov, int iovcnt);
+
+/* Receive and open one message, as proto_recv() */
+int secure_recv(conn_t *conn, uint8_t **data, size_t *len);
+
+/* The secret given to secure_init(), and its length (0 if none) */
+size_t secure_secret(const char **secret);
+
+/*
+ * Copy the session's keys and message counters out for an upgraded image
+ * to carry on with (upgrade.c). Returns -1 if the session is not encrypted.
+ */
+int secure_save(const conn_t *conn, uint8_t out[SECURE_SAVE_SIZE]);
+
+/* Carry on with a session saved by secure_save(); sets conn->encrypted */
+int secure_restore(conn_t *conn, const uint8_t *in, size_t len);
+
+/* Wipe and release the session's keys */
+void secure_end(conn_t *conn);
+
+#else
+
+static inline int secure_init(const char *secret) { (void)secret; return -1; }
+
+static inline const uint8_t *secure_offer(conn_t *conn) { (void)conn; return NULL; }
+static inline void secure_peer(conn_t *conn, const uint8_t *key, size_t len)
+{
+    (void)conn; (void)key; (void)len;
+}
+static inline int secure_start(conn_t *conn) { (void)conn; return 0; }
+struct iovec;
+static inline int secure_sendv(conn_t *conn, const struct iovec *iov, int iovcnt)
+{
+    (void)conn; (void)iov; (void)iovcnt; return -1;
+}
+static inline int secure_recv(conn_t *conn, uint8_t **data, size_t *len)
+{
+    (void)conn; (void)data; (void)len; return -1;
+}
+static inline size_t secure_secret(const char **secret) { *secret = NULL; return 0; }
+static inline int secure_save(const conn_t *conn, uint8_t out[SECURE_SAVE_SIZE])
+{
+    (void)conn; (void)out; return -1;
+}
+static inline int secure_restore(conn_t *conn, const uint8_t *in, size_t len)
+{
+    (void)conn; (void)in; (void)len; return -1;
+}
+static inline void secure_end(conn_t *conn) { (void)conn; }
+
+#endif
+
+/* =============================================================================
+ * Hot Upgrade (upgrade.c)
+ *
+ * The upgrade command execs a new agent binary in the session's process,
+ * which carries on with the session (-u). Without EDB_FEATURE_UPGRADE
+ * there is no upgrade command and -u is refused.
+ * ============================================================================= */
+
+#if EDB_FEATURE_UPGRADE
+
+/*
+ * Read the state handed over by the image that exec'd this one from fd
+ * (-u) and fill in cfg: mode, memory budget, and listenfd if a bind mode
+ * listener was upgraded. Returns 0 on success, -1 on error.
+ */
+int upgrade_load(int fd, config_t *cfg);
+
+/*
+ * Carry on with the session handed over to upgrade_load(): socket, cwd,
+ * framing, limits and keys. Answers the upgrade request, and in bind mode
+ * has the listener follow. Returns 0 on success, -1 on error.
+ */
+int upgrade_resume(conn_t *conn);
+
+/*
+ * Bind mode listener: exec the image that child pid upgraded to, keeping
+ * listenfd. Returns only if that fails.
+ */
+void upgrade_listener(int listenfd, int pid);
+
+#else
+
+static inline int upgrade_load(int fd, config_t *cfg) { (void)fd; (void)cfg; return -1; }
+static inline int upgrade_resume(conn_t *conn) { (void)conn; return -1; }
+static inline void upgrade_listener(int listenfd, int pid) { (void)listenfd; (void)pid; }
+
+#endif
+
+/* =============================================================================
+ * Directory Watches (watch.c)
+ *
+ * Driven by the session loop like the streams (sched.c). Without
+ * EDB_FEATURE_WATCH these do nothing, and watch_wait() waits for the
+ * client alone.
+ * ============================================================================= */
+
+#if EDB_FEATURE_WATCH
+
+/* Check whether any watch is running */
+bool watch_active(const conn_t *conn);
+
+/*
+ * Read pending changes and send the batches that are due, closing watches
+ * whose directory is gone. Returns 0 on success, -1 if sending failed.
+ */
+int watch_step(conn_t *conn);
+
+/*
+ * Wait up to timeout_ms (-1 = no limit) for a message from the client, a
+ * change to a watched directory, or the next batch to fall due.
+ */
+void watch_wait(conn_t *conn, int timeout_ms);
+
+/* Stop the watch for request id. Returns true if there was one. */
+bool watch_cancel(conn_t *conn, uint32_t id);
+
+/* Stop every watch and release the session's inotify descriptor */
+void watch_close_all(conn_t *conn);
+
+#else
+
+static inline bool watch_active(const conn_t *conn) { (void)conn; return false; }
+static inline int watch_step(conn_t *conn) { (void)conn; return 0; }
+static inline void watch_wait(conn_t *conn, int timeout_ms)
+{
+    transport_wait_readable(conn->sockfd, timeout_ms);
+}
+static inline bool watch_cancel(conn_t *conn, uint32_t id) { (void)conn; (void)id; return false; }
+static inline void watch_close_all(conn_t *conn) { (void)conn; }
+
+#endif
+
 /* =============================================================================
  * Command Handlers (src/commands/)
  * ============================================================================= */
@@ -200,6 +664,12 @@ cmd_type_t cmd_parse(const char *name);
 int cmd_handle(conn_t *conn, uint32_t id, cmd_type_t cmd,
                const uint8_t *args, size_t args_len);
 
+/*
+ * Get the name of the index'th command built into this agent. (cmd_dispatch.c)
+ * Returns NULL past the last one.
+ */
+const char *cmd_name_at(size_t index);
+
 /* Basic commands (basic_commands.c) */
 int cmd_ls(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_cat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
@@ -209,6 +679,7 @@ int cmd_realpath(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
 
 /* File transfer (file_transfer.c) */
 int cmd_pull(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_pull_many(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 
 /* File operations (file_operations.c) */
@@ -225,6 +696,7 @@ int cmd_ps(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_netstat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_kill_agent(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_throttle(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_reboot(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_whoami(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_dmesg(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
@@ -233,6 +705,19 @@ int cmd_cpuinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 int cmd_mtd(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_ip_addr(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 int cmd_ip_route(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_profile(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_systrace(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_elfinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+int cmd_verify(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+
+/* Directory watches (watch.c) */
+int cmd_watch_dir(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+
+/* Content-defined chunk hashes (chunks.c) */
+int cmd_hash_chunks(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
+
+/* Hot upgrade (upgrade.c) */
+int cmd_upgrade(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len);
 
 /* =============================================================================
  * Path Utilities (src/commands/helpers.c)
@@ -240,7 +725,7 @@ int cmd_ip_route(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
 
 /*
  * Resolve a path relative to cwd.
- * Returns allocated string, caller must free.
+ * Returns allocated string, caller must edb_free().
  */
 char *path_resolve(const char *cwd, const char *path);
 
@@ -0,0 +1,125 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * MessagePack encoder shared by the protocol layer and all commands.
+ *
+ * resp_builder_t is a growable buffer; the rb_* functions append encoded
+ * values to it and pick the smallest encoding for each. Constant strings go
+ * through rb_lit(), which takes their length from the literal instead of
+ * calling strlen. Counts that are only known after the items are written
+ * (directory listings, filtered lists) use rb_map_begin()/rb_array_begin()
+ * and are patched in by rb_map_end()/rb_array_end().
+ */
+
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* =============================================================================
+ * Format Markers
+ * ============================================================================= */
+
+#define MP_FIXMAP       0x80
+#define MP_FIXARRAY     0x90
+#define MP_FIXSTR       0xa0
+#define MP_NIL          0xc0
+#define MP_FALSE        0xc2
+#define MP_TRUE         0xc3
+#define MP_BIN8         0xc4
+#define MP_BIN16        0xc5
+#define MP_BIN32        0xc6
+#define MP_EXT8         0xc7
+#define MP_EXT16        0xc8
+#define MP_EXT32        0xc9
+#define MP_FLOAT32      0xca
+#define MP_FLOAT64      0xcb
+#define MP_UINT8        0xcc
+#define MP_UINT16       0xcd
+#define MP_UINT32       0xce
+#define MP_UINT64       0xcf
+#define MP_INT8         0xd0
+#define MP_INT16        0xd1
+#define MP_INT32        0xd2
+#define MP_INT64        0xd3
+#define MP_FIXEXT1      0xd4
+#define MP_FIXEXT16     0xd8
+#define MP_STR8         0xd9
+#define MP_STR16        0xda
+#define MP_STR32        0xdb
+#define MP_ARRAY16      0xdc
+#define MP_ARRAY32      0xdd
+#define MP_MAP16        0xde
+#define MP_MAP32        0xdf
+
+/* =============================================================================
+ * Response Builder
+ * ============================================================================= */
+
+typedef struct {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   len;
+    bool     heap;      /* buf is ours to realloc/free */
+} resp_builder_t;
+
+/* Initialize a response builder with given capacity */
+int rb_init(resp_builder_t *rb, size_t cap);
+
+/*
+ * Initialize a response builder on a caller's buffer (e.g. on the stack),
+ * for small messages that then need no allocation. It moves to the heap if
+ * it outgrows the buffer, so rb_free is still needed.
+ */
+void rb_init_buf(resp_builder_t *rb, uint8_t *buf, size_t cap);
+
+/* Free the response builder's buffer */
+void rb_free(resp_builder_t *rb);
+
+/* Write primitives */
+int rb_u8(resp_builder_t *rb, uint8_t v);
+int rb_u16be(resp_builder_t *rb, uint16_t v);
+int rb_u32be(resp_builder_t *rb, uint32_t v);
+int rb_raw(resp_builder_t *rb, const void *data, size_t len);
+
+/* Write MessagePack types */
+int rb_nil(resp_builder_t *rb);
+int rb_bool(resp_builder_t *rb, bool v);
+int rb_uint(resp_builder_t *rb, uint64_t v);
+int rb_int(resp_builder_t *rb, int64_t v);
+int rb_str(resp_builder_t *rb, const char *s);
+int rb_str_n(resp_builder_t *rb, const char *s, size_t len);
+int rb_bin(resp_builder_t *rb, const uint8_t *data, size_t len);
+int rb_bin_header(resp_builder_t *rb, size_t len);  /* Payload sent separately */
+int rb_map(resp_builder_t *rb, size_t count);
+int rb_array(resp_builder_t *rb, size_t count);
+
+/*
+ * Write a string literal. The "" s "" makes anything but a literal fail to
+ * compile, so sizeof is always the string's length plus its terminator.
+ */
+#define rb_lit(rb, s)   rb_str_n((rb), "" s "", sizeof(s) - 1)
+
+/*
+ * Start a map or array whose count is not known yet. Writes a map32/array32
+ * header and returns its offset (or (size_t)-1 on allocation failure), to
+ * be passed to the matching _end call once the items are written.
+ */
+size_t rb_map_begin(resp_builder_t *rb);
+size_t rb_array_begin(resp_builder_t *rb);
+void rb_map_end(resp_builder_t *rb, size_t at, size_t count);
+void rb_array_end(resp_builder_t *rb, size_t at, size_t count);
+
+/*
+ * Write a bin header for len bytes and reserve the space, returning a
+ * pointer to fill in place (e.g. with fread) instead of copying through
+ * rb_bin. Always uses bin32 so rb_bin_shrink can lower the length if fewer
+ * bytes arrive; nothing else may be written in between.
+ */
+uint8_t *rb_bin_reserve(resp_builder_t *rb, size_t len);
+void rb_bin_shrink(resp_builder_t *rb, uint8_t *data, size_t reserved, size_t actual);
+
+#endif /* MSGPACK_H */
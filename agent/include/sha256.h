@@ -0,0 +1,27 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * SHA-256 (FIPS 180-4), small portable implementation for file hashing.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE  32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t count;         /* Bytes processed */
+    uint8_t  buf[64];
+    size_t   buf_len;
+} sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t *ctx);
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len);
+void sha256_final(sha256_ctx_t *ctx, uint8_t out[SHA256_DIGEST_SIZE]);
+
+#endif /* SHA256_H */
@@ -34,7 +34,7 @@ int cmd_ls(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     if (arg_path) {
         resolved = path_resolve(conn->cwd, arg_path);
-        free(arg_path);
+        edb_free(arg_path);
         if (!resolved) {
             return proto_send_error(conn, id, "out of memory");
         }
@@ -46,35 +46,28 @@ int cmd_ls(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     DIR *dir = opendir(path);
     if (!dir) {
         int err = errno;
-        if (resolved) free(resolved);
+        if (resolved) edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
-    /* First pass: count entries */
-    size_t count = 0;
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL) {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
-            continue;
-        }
-        count++;
-    }
-
     /* Build response */
     resp_builder_t rb;
     if (rb_init(&rb, 4096) < 0) {
         closedir(dir);
-        if (resolved) free(resolved);
+        if (resolved) edb_free(resolved);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    /* { "entries": [ ... ] } */
+    /*
+     * { "entries": [ ... ] }, in one pass: the count is patched in at the
+     * end, so it always matches even if the directory changes meanwhile.
+     */
     rb_map(&rb, 1);
-    rb_str(&rb, "entries");
-    rb_array(&rb, count);
+    rb_lit(&rb, "entries");
+    size_t entries = rb_array_begin(&rb);
+    size_t count = 0;
 
-    /* Second pass: build entries */
-    rewinddir(dir);
+    struct dirent *ent;
     while ((ent = readdir(dir)) != NULL) {
         if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
             continue;
@@ -92,32 +85,34 @@ int cmd_ls(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         /* Entry: { name, type, size, mode, mtime } */
         rb_map(&rb, 5);
 
-        rb_str(&rb, "name");
+        rb_lit(&rb, "name");
         rb_str(&rb, ent->d_name);
 
-        rb_str(&rb, "type");
+        rb_lit(&rb, "type");
         if (S_ISDIR(st.st_mode)) {
-            rb_str(&rb, "dir");
+            rb_lit(&rb, "dir");
         } else if (S_ISLNK(st.st_mode)) {
-            rb_str(&rb, "link");
+            rb_lit(&rb, "link");
         } else if (S_ISREG(st.st_mode)) {
-            rb_str(&rb, "file");
+            rb_lit(&rb, "file");
         } else {
-            rb_str(&rb, "other");
+            rb_lit(&rb, "other");
         }
 
-        rb_str(&rb, "size");
+        rb_lit(&rb, "size");
         rb_uint(&rb, (uint64_t)st.st_size);
 
-        rb_str(&rb, "mode");
+        rb_lit(&rb, "mode");
         rb_uint(&rb, (uint64_t)(st.st_mode & 0777));
 
-        rb_str(&rb, "mtime");
+        rb_lit(&rb, "mtime");
         rb_uint(&rb, (uint64_t)st.st_mtime);
+        count++;
     }
+    rb_array_end(&rb, entries, count);
 
     closedir(dir);
-    if (resolved) free(resolved);
+    if (resolved) edb_free(resolved);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
@@ -141,7 +136,7 @@ int cmd_pwd(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "path");
+    rb_lit(&rb, "path");
     rb_str(&rb, conn->cwd);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
@@ -164,7 +159,7 @@ int cmd_cd(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -172,22 +167,22 @@ int cmd_cd(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     /* Check if path exists and is a directory */
     if (!path_exists(resolved)) {
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, "no such directory");
     }
 
     if (!path_is_dir(resolved)) {
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, "not a directory");
     }
 
     /* Get the real path (resolve symlinks, .., etc) */
     char realpath_buf[EDB_PATH_MAX];
     if (realpath(resolved, realpath_buf) == NULL) {
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(errno));
     }
-    free(resolved);
+    edb_free(resolved);
 
     /* Update cwd */
     safe_strcpy(conn->cwd, realpath_buf, sizeof(conn->cwd));
@@ -201,7 +196,7 @@ int cmd_cd(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "path");
+    rb_lit(&rb, "path");
     rb_str(&rb, conn->cwd);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
@@ -225,7 +220,7 @@ int cmd_realpath(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
 
     /* Resolve relative to cwd */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -235,10 +230,10 @@ int cmd_realpath(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
     char realpath_buf[EDB_PATH_MAX];
     if (realpath(resolved, realpath_buf) == NULL) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
-    free(resolved);
+    edb_free(resolved);
 
     LOG("realpath: %s", realpath_buf);
 
@@ -249,7 +244,7 @@ int cmd_realpath(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "path");
+    rb_lit(&rb, "path");
     rb_str(&rb, realpath_buf);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
@@ -262,8 +257,14 @@ int cmd_realpath(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
  *
  * Read and return file contents.
  * Handles both regular files and virtual files (e.g. /proc, /sys).
+ *
+ * Optional "offset" and "length" args read a range, so files larger than
+ * the memory budget can still be read piecewise. Regular files are read
+ * straight into the response buffer; nothing else holds a second copy.
  * ============================================================================= */
 
+#define CAT_TOO_LARGE "file too large for agent memory, use a ranged read (offset/length) or pull"
+
 int cmd_cat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 {
     char *arg_path = parse_string_arg(args, args_len, "path");
@@ -271,9 +272,13 @@ int cmd_cat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         return proto_send_error(conn, id, "missing path argument");
     }
 
+    uint64_t offset = 0, length = 0;
+    parse_uint_arg(args, args_len, "offset", &offset);
+    parse_uint_arg(args, args_len, "length", &length);
+
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -283,96 +288,115 @@ int cmd_cat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     FILE *f = fopen(resolved, "rb");
     if (!f) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
-    free(resolved);
+    edb_free(resolved);
 
     /*
-     * Try to get file size via seeking. This works for regular files
-     * but fails for virtual files (e.g. /proc, /sys) which have no size.
+     * Regular files have a size. Virtual files (e.g. /proc, /sys) report 0
+     * and are read until EOF.
      */
-    long file_size = -1;
-    if (fseek(f, 0, SEEK_END) == 0) {
-        file_size = ftell(f);
-        if (file_size >= 0) {
-            fseek(f, 0, SEEK_SET);
-        }
+    struct stat st;
+    uint64_t file_size = 0;
+    if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+        file_size = (uint64_t)st.st_size;
+    }
+
+    if (offset > 0 && fseeko(f, (off_t)offset, SEEK_SET) != 0) {
+        int err = errno;
+        fclose(f);
+        return proto_send_error(conn, id, strerror(err));
     }
 
-    uint8_t *content = NULL;
+    resp_builder_t rb;
     size_t content_len = 0;
 
     if (file_size > 0) {
         /* Regular file with known size */
-        if (file_size > EDB_MAX_MSG_SIZE - 1024) {
+        uint64_t want = offset < file_size ? file_size - offset : 0;
+        if (length > 0 && length < want) {
+            want = length;
+        }
+
+        if (want > EDB_MAX_MSG_SIZE - 1024 || !mem_fits((size_t)want + 1024)) {
             fclose(f);
-            return proto_send_error(conn, id, "file too large");
+            return proto_send_error(conn, id, CAT_TOO_LARGE);
         }
 
-        content = malloc((size_t)file_size);
-        if (!content) {
+        if (rb_init(&rb, (size_t)want + 64) < 0) {
             fclose(f);
-            return proto_send_error(conn, id, "out of memory");
+            return proto_send_error(conn, id, CAT_TOO_LARGE);
         }
 
-        content_len = fread(content, 1, (size_t)file_size, f);
+        rb_map(&rb, 3);
+        rb_lit(&rb, "content");
+        uint8_t *content = rb_bin_reserve(&rb, (size_t)want);
+        content_len = fread(content, 1, (size_t)want, f);
+        rb_bin_shrink(&rb, content, (size_t)want, content_len);
     } else {
         /*
          * Virtual file or empty file - read in chunks until EOF.
          * This handles /proc, /sys, and other special files.
          */
-        size_t capacity = 4096;
-        content = malloc(capacity);
+        size_t limit = EDB_MAX_MSG_SIZE - 1024;
+        if (length > 0 && length < limit) {
+            limit = (size_t)length;
+        }
+
+        size_t capacity = limit < 4096 ? limit : 4096;
+        uint8_t *content = edb_malloc(capacity);
         if (!content) {
             fclose(f);
             return proto_send_error(conn, id, "out of memory");
         }
 
-        content_len = 0;
         size_t chunk;
         while ((chunk = fread(content + content_len, 1, capacity - content_len, f)) > 0) {
             content_len += chunk;
 
             /* Need more space? */
             if (content_len >= capacity) {
-                if (capacity >= EDB_MAX_MSG_SIZE - 1024) {
-                    free(content);
+                if (capacity >= limit) {
+                    if (length > 0) break;  /* Range complete */
+                    edb_free(content);
                     fclose(f);
-                    return proto_send_error(conn, id, "file too large");
+                    return proto_send_error(conn, id, CAT_TOO_LARGE);
                 }
                 capacity *= 2;
-                if (capacity > EDB_MAX_MSG_SIZE - 1024) {
-                    capacity = EDB_MAX_MSG_SIZE - 1024;
+                if (capacity > limit) {
+                    capacity = limit;
                 }
-                uint8_t *new_content = realloc(content, capacity);
+                uint8_t *new_content = edb_realloc(content, capacity);
                 if (!new_content) {
-                    free(content);
+                    edb_free(content);
                     fclose(f);
-                    return proto_send_error(conn, id, "out of memory");
+                    return proto_send_error(conn, id, CAT_TOO_LARGE);
                 }
                 content = new_content;
             }
         }
-    }
-    fclose(f);
-
-    /* Build response: { "content": <binary>, "size": <len> } */
-    resp_builder_t rb;
-    if (rb_init(&rb, content_len + 64) < 0) {
-        free(content);
-        return proto_send_error(conn, id, "out of memory");
-    }
 
-    rb_map(&rb, 2);
+        if (rb_init(&rb, content_len + 64) < 0) {
+            edb_free(content);
+            fclose(f);
+            return proto_send_error(conn, id, CAT_TOO_LARGE);
+        }
 
-    rb_str(&rb, "content");
-    rb_bin(&rb, content, content_len);
-    free(content);
+        rb_map(&rb, 3);
+        rb_lit(&rb, "content");
+        rb_bin(&rb, content, content_len);
+        edb_free(content);
+    }
+    fclose(f);
 
-    rb_str(&rb, "size");
+    /* { "content": <binary>, "size": <len>, "total": <file size> } */
+    rb_lit(&rb, "size");
     rb_uint(&rb, (uint64_t)content_len);
 
+    rb_lit(&rb, "total");
+    rb_uint(&rb, file_size > 0 ? file_size : (uint64_t)content_len);
+
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
     return ret;
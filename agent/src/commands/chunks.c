@@ -0,0 +1,204 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: hash_chunks - Split a file into content-defined chunks and hash them
+ *
+ * Lets a client that keeps a content-addressed store (the dump store in the
+ * Go client) pull only the chunks it does not have yet: it asks for the
+ * chunk list first, then pulls the missing ranges with pull's offset and
+ * length. Cut points are chosen by a gear rolling hash over the data itself
+ * (FastCDC with normalized chunking), so inserting or removing bytes only
+ * moves the boundaries next to the change, and identical data on different
+ * devices always yields identical chunks.
+ *
+ * The boundaries depend only on the content and on the constants below.
+ * Changing any of them is safe, but chunks hashed before no longer match
+ * those hashed after, so stores start deduplicating from scratch.
+ *
+ * Protocol:
+ *   1. Client sends: { cmd: "hash_chunks", args: { path: "/dev/mtd3" } }
+ *   2. Agent sends:  { ok: true, data: { size, mode, min, avg, max } }
+ *   3. Agent sends data messages of packed records, the last with done:
+ *        u32 length (big-endian), 32-byte SHA-256
+ *      one per chunk in file order; offsets are the running sum of lengths.
+ *
+ * The file is read once, on the session thread. A cancel stops it between
+ * messages and ends it with { ok: false, error: "cancelled" }, as does a
+ * read error with "read error".
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+
+#include "edb.h"
+#include "commands.h"
+#include "sha256.h"
+
+#define CHUNK_MIN       (4 * 1024)
+#define CHUNK_AVG       (16 * 1024)
+#define CHUNK_MAX       (64 * 1024)
+
+/*
+ * Normalized chunking: before CHUNK_AVG a cut needs 16 zero bits, after it
+ * 12, which keeps most chunks close to the average. The top bits of the
+ * gear hash depend on the last 32 bytes.
+ */
+#define CHUNK_MASK_S    0xffff0000u
+#define CHUNK_MASK_L    0xfff00000u
+
+#define CHUNK_GEAR_SEED 0x9e3779b9u
+
+#define CHUNKS_BUF_SIZE (2 * CHUNK_MAX)
+#define CHUNKS_BATCH    512         /* Records per data message */
+#define CHUNK_RECORD    (4 + SHA256_DIGEST_SIZE)
+
+static uint32_t gear[256];
+static bool gear_ready;
+
+/* Fill the gear table from a fixed xorshift32 sequence */
+static void gear_init(void)
+{
+    uint32_t x = CHUNK_GEAR_SEED;
+    for (size_t i = 0; i < 256; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        gear[i] = x;
+    }
+    gear_ready = true;
+}
+
+/*
+ * Length of the chunk starting at p, of the n bytes available. n must be at
+ * least CHUNK_MAX unless the data ends within it, so the cut never depends
+ * on how much happened to be read.
+ */
+static size_t chunk_cut(const uint8_t *p, size_t n)
+{
+    if (n <= CHUNK_MIN) return n;
+
+    size_t normal = n < CHUNK_AVG ? n : CHUNK_AVG;
+    size_t end = n < CHUNK_MAX ? n : CHUNK_MAX;
+    uint32_t h = 0;
+    size_t i = CHUNK_MIN;
+
+    for (; i < normal; i++) {
+        h = (h << 1) + gear[p[i]];
+        if (!(h & CHUNK_MASK_S)) return i + 1;
+    }
+    for (; i < end; i++) {
+        h = (h << 1) + gear[p[i]];
+        if (!(h & CHUNK_MASK_L)) return i + 1;
+    }
+    return end;
+}
+
+int cmd_hash_chunks(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    char *arg_path = parse_string_arg(args, args_len, "path");
+    if (!arg_path) {
+        return proto_send_error(conn, id, "missing path argument");
+    }
+
+    char *resolved = path_resolve(conn->cwd, arg_path);
+    edb_free(arg_path);
+    if (!resolved) {
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    uint64_t file_size;
+    uint32_t file_mode;
+    const char *err;
+    FILE *f = pull_file_open(resolved, &file_size, &file_mode, &err);
+    edb_free(resolved);
+    if (!f) {
+        return proto_send_error(conn, id, err);
+    }
+
+    uint8_t *buf = edb_malloc(CHUNKS_BUF_SIZE);
+    resp_builder_t rb;
+    if (!buf || rb_init(&rb, CHUNKS_BATCH * CHUNK_RECORD) < 0) {
+        edb_free(buf);
+        fclose(f);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    if (!gear_ready) gear_init();
+
+    rb_map(&rb, 5);
+    rb_lit(&rb, "size");
+    rb_uint(&rb, file_size);
+    rb_lit(&rb, "mode");
+    rb_uint(&rb, file_mode);
+    rb_lit(&rb, "min");
+    rb_uint(&rb, CHUNK_MIN);
+    rb_lit(&rb, "avg");
+    rb_uint(&rb, CHUNK_AVG);
+    rb_lit(&rb, "max");
+    rb_uint(&rb, CHUNK_MAX);
+
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb.len = 0;
+
+    size_t start = 0, end = 0, batched = 0;
+    uint64_t left = file_size;
+    uint32_t seq = 0;
+    bool eof = (left == 0);
+
+    while (ret == 0) {
+        /* Keep at least CHUNK_MAX bytes ahead unless the file ends first */
+        if (!eof && end - start < CHUNK_MAX) {
+            memmove(buf, buf + start, end - start);
+            end -= start;
+            start = 0;
+
+            size_t room = CHUNKS_BUF_SIZE - end;
+            if (room > left) room = (size_t)left;
+            size_t n = fread(buf + end, 1, room, f);
+            if (n < room && ferror(f)) {
+                ret = proto_send_error(conn, id, "read error");
+                break;
+            }
+            end += n;
+            left -= n;
+            if (n < room || left == 0) eof = true;
+        }
+
+        if (start == end) {
+            /* Also sent for an empty file, so every list ends with done */
+            LOG("hash_chunks: %lu bytes in %u messages",
+                (unsigned long)(file_size - left), seq + 1);
+            ret = proto_send_data(conn, id, seq, rb.buf, rb.len, true);
+            break;
+        }
+
+        size_t len = chunk_cut(buf + start, end - start);
+        uint8_t hash[SHA256_DIGEST_SIZE];
+        sha256_ctx_t ctx;
+        sha256_init(&ctx);
+        sha256_update(&ctx, buf + start, len);
+        sha256_final(&ctx, hash);
+        start += len;
+
+        rb_u32be(&rb, (uint32_t)len);
+        rb_raw(&rb, hash, sizeof(hash));
+
+        if (++batched == CHUNKS_BATCH) {
+            ret = proto_send_data(conn, id, seq++, rb.buf, rb.len, false);
+            rb.len = 0;
+            batched = 0;
+            if (ret == 0 && proto_cancelled(conn, id)) {
+                ret = proto_send_error(conn, id, "cancelled");
+                break;
+            }
+        }
+    }
+
+    rb_free(&rb);
+    edb_free(buf);
+    fclose(f);
+    return ret;
+}
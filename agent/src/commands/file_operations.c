@@ -34,7 +34,7 @@ int cmd_rm(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -44,7 +44,7 @@ int cmd_rm(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     struct stat st;
     if (stat(resolved, &st) < 0) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -59,12 +59,12 @@ int cmd_rm(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     if (ret < 0) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
     LOG("rm: removed %s", resolved);
-    free(resolved);
+    edb_free(resolved);
 
     /* Send empty success response */
     resp_builder_t rb;
@@ -94,43 +94,43 @@ int cmd_mv(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     char *dst = parse_string_arg(args, args_len, "dst");
     if (!dst) {
-        free(src);
+        edb_free(src);
         return proto_send_error(conn, id, "missing dst argument");
     }
 
     /* Resolve both paths */
     char *resolved_src = path_resolve(conn->cwd, src);
-    free(src);
+    edb_free(src);
     if (!resolved_src) {
-        free(dst);
+        edb_free(dst);
         return proto_send_error(conn, id, "out of memory");
     }
 
     char *resolved_dst = path_resolve(conn->cwd, dst);
-    free(dst);
+    edb_free(dst);
     if (!resolved_dst) {
-        free(resolved_src);
+        edb_free(resolved_src);
         return proto_send_error(conn, id, "out of memory");
     }
 
     /* Check source exists */
     if (!path_exists(resolved_src)) {
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, "source does not exist");
     }
 
     /* Perform the rename */
     if (rename(resolved_src, resolved_dst) < 0) {
         int err = errno;
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, strerror(err));
     }
 
     LOG("mv: %s -> %s", resolved_src, resolved_dst);
-    free(resolved_src);
-    free(resolved_dst);
+    edb_free(resolved_src);
+    edb_free(resolved_dst);
 
     /* Send empty success response */
     resp_builder_t rb;
@@ -164,7 +164,7 @@ int cmd_mkdir(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -173,12 +173,12 @@ int cmd_mkdir(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     /* Create the directory */
     if (mkdir(resolved, (mode_t)mode) < 0) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
     LOG("mkdir: created %s (mode %o)", resolved, (unsigned int)mode);
-    free(resolved);
+    edb_free(resolved);
 
     /* Send empty success response */
     resp_builder_t rb;
@@ -208,13 +208,13 @@ int cmd_chmod(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     uint64_t mode = 0;
     if (parse_uint_arg(args, args_len, "mode", &mode) < 0) {
-        free(arg_path);
+        edb_free(arg_path);
         return proto_send_error(conn, id, "missing mode argument");
     }
 
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -223,12 +223,12 @@ int cmd_chmod(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     /* Change permissions */
     if (chmod(resolved, (mode_t)mode) < 0) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
     LOG("chmod: %s -> %o", resolved, (unsigned int)mode);
-    free(resolved);
+    edb_free(resolved);
 
     /* Send empty success response */
     resp_builder_t rb;
@@ -259,22 +259,22 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     char *dst = parse_string_arg(args, args_len, "dst");
     if (!dst) {
-        free(src);
+        edb_free(src);
         return proto_send_error(conn, id, "missing dst argument");
     }
 
     /* Resolve both paths */
     char *resolved_src = path_resolve(conn->cwd, src);
-    free(src);
+    edb_free(src);
     if (!resolved_src) {
-        free(dst);
+        edb_free(dst);
         return proto_send_error(conn, id, "out of memory");
     }
 
     char *resolved_dst = path_resolve(conn->cwd, dst);
-    free(dst);
+    edb_free(dst);
     if (!resolved_dst) {
-        free(resolved_src);
+        edb_free(resolved_src);
         return proto_send_error(conn, id, "out of memory");
     }
 
@@ -282,8 +282,8 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     FILE *fsrc = fopen(resolved_src, "rb");
     if (!fsrc) {
         int err = errno;
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -292,15 +292,15 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     if (fstat(fileno(fsrc), &st) < 0) {
         int err = errno;
         fclose(fsrc);
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, strerror(err));
     }
 
     if (S_ISDIR(st.st_mode)) {
         fclose(fsrc);
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, "source is a directory");
     }
 
@@ -309,8 +309,8 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     if (!fdst) {
         int err = errno;
         fclose(fsrc);
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -325,8 +325,8 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
             fclose(fsrc);
             fclose(fdst);
             unlink(resolved_dst);  /* Clean up partial file */
-            free(resolved_src);
-            free(resolved_dst);
+            edb_free(resolved_src);
+            edb_free(resolved_dst);
             return proto_send_error(conn, id, strerror(err));
         }
         total += n;
@@ -336,8 +336,8 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         fclose(fsrc);
         fclose(fdst);
         unlink(resolved_dst);
-        free(resolved_src);
-        free(resolved_dst);
+        edb_free(resolved_src);
+        edb_free(resolved_dst);
         return proto_send_error(conn, id, "read error");
     }
 
@@ -348,8 +348,8 @@ int cmd_cp(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     chmod(resolved_dst, st.st_mode & 0777);
 
     LOG("cp: %s -> %s (%zu bytes)", resolved_src, resolved_dst, total);
-    free(resolved_src);
-    free(resolved_dst);
+    edb_free(resolved_src);
+    edb_free(resolved_dst);
 
     /* Send empty success response */
     resp_builder_t rb;
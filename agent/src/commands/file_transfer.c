@@ -2,7 +2,8 @@
  * embbridge - Embedded Debug Bridge
  * https://github.com/Necromancer-Labs/embbridge
  *
- * File transfer commands: pull (download), push (upload)
+ * File transfer commands: pull (download), pull_many (download by glob),
+ * push (upload)
  * These handle chunked file transfers for large files.
  * Includes support for MTD devices (/dev/mtd*) common on embedded systems.
  */
@@ -18,6 +19,8 @@
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <glob.h>
 
 #include "edb.h"
 #include "commands.h"
@@ -121,52 +124,237 @@ static uint64_t get_mtd_size(const char *path)
  * Command: pull (download file from device)
  *
  * Protocol:
- *   1. Client sends: { cmd: "pull", args: { path: "/path/to/file" } }
- *   2. Agent sends:  { ok: true, data: { size: N, mode: M } }
+ *   1. Client sends: { cmd: "pull", args: { path: "/path/to/file", rate: N,
+ *                                           offset: O, length: L } }
+ *   2. Agent sends:  { ok: true, data: { size: N, mode: M, length: L } }
  *   3. Agent sends:  { type: "data", seq: 0, data: <chunk>, done: false }
  *   4. Agent sends:  { type: "data", seq: 1, data: <chunk>, done: false }
  *   5. ...
  *   6. Agent sends:  { type: "data", seq: N, data: <chunk>, done: true }
  *
- * Files are sent in 64KB chunks to avoid memory issues on constrained devices.
+ * After the first response the file is streamed by the session loop (see
+ * sched.c) in chunks of up to EDB_FRAME_SIZE, interleaved with other pulls
+ * and with responses to any requests the client sends meanwhile. The
+ * optional rate (bytes/s) limits this transfer, on top of the session's
+ * throttle. offset and length (0 = to the end) pull part of the file; the
+ * response's length is the number of bytes that follow, size the whole
+ * file's. If the client sends { type: "cancel", id } the transfer stops
+ * before the next chunk and ends with { ok: false, error: "cancelled" }.
  * ============================================================================= */
 
-int cmd_pull(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+/*
+ * Reads run ahead of sends: a reader thread fills a ring of EDB_READAHEAD
+ * blocks (EDB_CHUNK_SIZE each, large reads suit flash) while the session
+ * loop sends the block before, so a dump takes about max(read, network)
+ * time instead of their sum. Each block goes out in one or more frames.
+ * If the thread cannot be started the sender reads the blocks itself.
+ */
+typedef struct {
+    FILE     *f;
+    uint32_t  id;
+    uint32_t  seq;
+    uint64_t  size;
+    uint64_t  read;             /* Bytes read so far (reader only) */
+    uint64_t  sent;             /* Bytes sent so far (sender only) */
+
+    /* Ring of blocks, shared with the reader under lock */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       /* A block was filled or released */
+    pthread_t reader;
+    bool      threaded;
+    uint8_t  *blocks;           /* EDB_READAHEAD * EDB_CHUNK_SIZE */
+    size_t    len[EDB_READAHEAD];
+    size_t    head;             /* Block being sent */
+    size_t    off;              /* Bytes of it already sent */
+    size_t    filled;           /* Blocks ready, head included */
+    bool      eof;              /* Nothing more will be read */
+    bool      error;            /* ... because a read failed */
+    bool      stop;             /* Stream closing, reader should quit */
+} pull_stream_t;
+
+#define PULL_THREAD_STACK   (64 * 1024)
+
+/*
+ * Read the next block into a free slot of the ring, waiting for one if
+ * all are full. Returns false once there is nothing more to read.
+ */
+static bool pull_fill(pull_stream_t *ps)
 {
-    char *arg_path = parse_string_arg(args, args_len, "path");
-    if (!arg_path) {
-        return proto_send_error(conn, id, "missing path argument");
+    pthread_mutex_lock(&ps->lock);
+    while (ps->filled == EDB_READAHEAD && !ps->stop) {
+        pthread_cond_wait(&ps->cond, &ps->lock);
     }
+    if (ps->stop || ps->eof) {
+        pthread_mutex_unlock(&ps->lock);
+        return false;
+    }
+    size_t slot = (ps->head + ps->filled) % EDB_READAHEAD;
+    pthread_mutex_unlock(&ps->lock);
+
+    /* The slot is ours until it is marked filled */
+    size_t to_read = EDB_CHUNK_SIZE;
+    if (ps->size - ps->read < to_read) to_read = (size_t)(ps->size - ps->read);
+
+    size_t n = fread(ps->blocks + slot * EDB_CHUNK_SIZE, 1, to_read, ps->f);
+    bool failed = (n == 0 && ferror(ps->f));
+    ps->read += n;
+
+    pthread_mutex_lock(&ps->lock);
+    ps->len[slot] = n;
+    if (n > 0) ps->filled++;
+    if (n == 0 || ps->read >= ps->size) {
+        ps->eof = true;
+        ps->error = failed;
+    }
+    pthread_cond_broadcast(&ps->cond);
+    bool more = !ps->eof;
+    pthread_mutex_unlock(&ps->lock);
+    return more;
+}
 
-    /* Resolve the path */
-    char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+static void *pull_reader(void *arg)
+{
+    while (pull_fill(arg)) {
+    }
+    return NULL;
+}
 
-    if (!resolved) {
-        return proto_send_error(conn, id, "out of memory");
+/* Send the next chunk of a pull (stream_t.send_next) */
+static int pull_send_next(conn_t *conn, void *ctx, size_t max, size_t *sent)
+{
+    pull_stream_t *ps = ctx;
+
+    /* Wait for the reader; at most one read is in flight */
+    pthread_mutex_lock(&ps->lock);
+    while (ps->filled == 0 && !ps->eof) {
+        if (ps->threaded) {
+            pthread_cond_wait(&ps->cond, &ps->lock);
+        } else {
+            pthread_mutex_unlock(&ps->lock);
+            pull_fill(ps);
+            pthread_mutex_lock(&ps->lock);
+        }
     }
 
-    /* Open the file */
-    FILE *f = fopen(resolved, "rb");
+    if (ps->filled == 0) {
+        bool failed = ps->error;
+        pthread_mutex_unlock(&ps->lock);
+        if (failed) {
+            return proto_send_error(conn, ps->id, "read error") < 0 ? -1 : 0;
+        }
+        /* File shrank since the first response: end it here */
+        LOG("pull: EOF after %lu of %lu bytes",
+            (unsigned long)ps->sent, (unsigned long)ps->size);
+        return proto_send_data(conn, ps->id, ps->seq, ps->blocks, 0, true) < 0 ? -1 : 0;
+    }
+
+    const uint8_t *chunk = ps->blocks + ps->head * EDB_CHUNK_SIZE + ps->off;
+    size_t n = ps->len[ps->head] - ps->off;
+    pthread_mutex_unlock(&ps->lock);
+
+    /* The head block stays filled, so the reader leaves it alone meanwhile */
+    if (n > max) n = max;
+    ps->sent += n;
+    *sent = n;
+    bool done = (ps->sent >= ps->size);
+
+    LOG("pull: sending chunk seq=%u, len=%zu, done=%d", ps->seq, n, done);
+
+    if (proto_send_data(conn, ps->id, ps->seq, chunk, n, done) < 0) {
+        return -1;
+    }
+
+    /* Hand the block back to the reader once it is all sent */
+    pthread_mutex_lock(&ps->lock);
+    ps->off += n;
+    if (ps->off == ps->len[ps->head]) {
+        ps->off = 0;
+        ps->head = (ps->head + 1) % EDB_READAHEAD;
+        ps->filled--;
+        pthread_cond_broadcast(&ps->cond);
+    }
+    pthread_mutex_unlock(&ps->lock);
+
+    ps->seq++;
+    if (done) {
+        LOG("pull: transfer complete, sent %lu bytes in %u chunks",
+            (unsigned long)ps->sent, ps->seq);
+        return 0;
+    }
+    return 1;
+}
+
+/* Release a pull's state (stream_t.close) */
+static void pull_close(void *ctx)
+{
+    pull_stream_t *ps = ctx;
+
+    if (ps->threaded) {
+        pthread_mutex_lock(&ps->lock);
+        ps->stop = true;
+        pthread_cond_broadcast(&ps->cond);
+        pthread_mutex_unlock(&ps->lock);
+        pthread_join(ps->reader, NULL);
+    }
+
+    pthread_cond_destroy(&ps->cond);
+    pthread_mutex_destroy(&ps->lock);
+    fclose(ps->f);
+    edb_free(ps->blocks);
+    edb_free(ps);
+}
+
+/* Set up a pull's ring and start its reader. Takes ownership of f. */
+static pull_stream_t *pull_open(FILE *f, uint32_t id, uint64_t size)
+{
+    pull_stream_t *ps = edb_calloc(1, sizeof(*ps));
+    if (!ps) return NULL;
+
+    ps->blocks = edb_malloc((size_t)EDB_READAHEAD * EDB_CHUNK_SIZE);
+    if (!ps->blocks) {
+        edb_free(ps);
+        return NULL;
+    }
+
+    ps->f = f;
+    ps->id = id;
+    ps->size = size;
+    pthread_mutex_init(&ps->lock, NULL);
+    pthread_cond_init(&ps->cond, NULL);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PULL_THREAD_STACK);
+    ps->threaded = (pthread_create(&ps->reader, &attr, pull_reader, ps) == 0);
+    pthread_attr_destroy(&attr);
+
+    if (!ps->threaded) {
+        LOG("pull: no reader thread, reading inline");
+    }
+    return ps;
+}
+
+/* Shared with hash_chunks (see commands.h) */
+FILE *pull_file_open(const char *path, uint64_t *size, uint32_t *mode,
+                     const char **err)
+{
+    FILE *f = fopen(path, "rb");
     if (!f) {
-        int err = errno;
-        free(resolved);
-        return proto_send_error(conn, id, strerror(err));
+        *err = strerror(errno);
+        return NULL;
     }
 
-    /* Get file info */
     struct stat st;
     if (fstat(fileno(f), &st) < 0) {
-        int err = errno;
+        *err = strerror(errno);
         fclose(f);
-        free(resolved);
-        return proto_send_error(conn, id, strerror(err));
+        return NULL;
     }
 
     if (S_ISDIR(st.st_mode)) {
         fclose(f);
-        free(resolved);
-        return proto_send_error(conn, id, "is a directory");
+        *err = "is a directory";
+        return NULL;
     }
 
     /*
@@ -177,89 +365,356 @@ int cmd_pull(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     if (file_size == 0) {
         /* Check if this is an MTD device */
-        uint64_t mtd_size = get_mtd_size(resolved);
+        uint64_t mtd_size = get_mtd_size(path);
         if (mtd_size > 0) {
             file_size = mtd_size;
             LOG("pull: detected MTD device, size=%lu", (unsigned long)file_size);
         }
     }
 
-    free(resolved);
-
     /*
      * For device files where we couldn't determine the size, return an error.
      * Regular empty files (size 0) are fine.
      */
     if (file_size == 0 && !S_ISREG(st.st_mode)) {
         fclose(f);
-        return proto_send_error(conn, id, "cannot determine device size");
+        *err = "cannot determine device size";
+        return NULL;
+    }
+
+    *size = file_size;
+    *mode = (uint32_t)(st.st_mode & 0777);
+    return f;
+}
+
+int cmd_pull(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    char *arg_path = parse_string_arg(args, args_len, "path");
+    if (!arg_path) {
+        return proto_send_error(conn, id, "missing path argument");
+    }
+
+    uint64_t rate = 0;          /* Unlimited unless asked */
+    parse_uint_arg(args, args_len, "rate", &rate);
+
+    uint64_t offset = 0, length = 0;    /* Whole file unless asked */
+    parse_uint_arg(args, args_len, "offset", &offset);
+    parse_uint_arg(args, args_len, "length", &length);
+
+    /* Resolve the path */
+    char *resolved = path_resolve(conn->cwd, arg_path);
+    edb_free(arg_path);
+
+    if (!resolved) {
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    uint64_t file_size;
+    uint32_t file_mode;
+    const char *err;
+    FILE *f = pull_file_open(resolved, &file_size, &file_mode, &err);
+    edb_free(resolved);
+    if (!f) {
+        return proto_send_error(conn, id, err);
+    }
+
+    /* A range, for clients that already have the rest (dump store) */
+    if (offset > file_size) {
+        fclose(f);
+        return proto_send_error(conn, id, "offset past end of file");
+    }
+    uint64_t want = file_size - offset;
+    if (length > 0 && length < want) {
+        want = length;
+    }
+    if (offset > 0 && fseeko(f, (off_t)offset, SEEK_SET) != 0) {
+        int e = errno;
+        fclose(f);
+        return proto_send_error(conn, id, strerror(e));
     }
 
-    uint32_t file_mode = (uint32_t)(st.st_mode & 0777);
+    LOG("pull: sending file, size=%lu, mode=%o, offset=%lu, length=%lu",
+        (unsigned long)file_size, file_mode, (unsigned long)offset, (unsigned long)want);
 
-    LOG("pull: sending file, size=%lu, mode=%o", (unsigned long)file_size, file_mode);
+    /* Check the stream can start before promising any data */
+    if (!sched_has_room(conn)) {
+        fclose(f);
+        return proto_send_error(conn, id, "too many transfers");
+    }
+
+    pull_stream_t *ps = NULL;
+    if (want > 0) {
+        ps = pull_open(f, id, want);
+        if (!ps) {
+            fclose(f);
+            return proto_send_error(conn, id, "out of memory");
+        }
+    }
 
     /* Send initial response with file info */
     resp_builder_t rb;
     if (rb_init(&rb, 64) < 0) {
-        fclose(f);
+        if (ps) pull_close(ps); else fclose(f);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    rb_map(&rb, 2);
-    rb_str(&rb, "size");
+    rb_map(&rb, 3);
+    rb_lit(&rb, "size");
     rb_uint(&rb, file_size);
-    rb_str(&rb, "mode");
+    rb_lit(&rb, "mode");
     rb_uint(&rb, file_mode);
+    rb_lit(&rb, "length");
+    rb_uint(&rb, want);
 
     if (proto_send_response(conn, id, true, rb.buf, rb.len, NULL) < 0) {
         rb_free(&rb);
-        fclose(f);
+        if (ps) pull_close(ps); else fclose(f);
         return -1;
     }
     rb_free(&rb);
 
-    /* Send file data in chunks */
-    uint8_t chunk[EDB_CHUNK_SIZE];
-    uint32_t seq = 0;
-    size_t total_sent = 0;
+    /* Empty file or range: the response is all there is */
+    if (!ps) {
+        fclose(f);
+        return 0;
+    }
+
+    /* The session loop sends the data from here on */
+    return sched_add(conn, id, rate, pull_send_next, pull_close, ps);
+}
 
-    while (total_sent < file_size) {
-        size_t to_read = file_size - total_sent;
-        if (to_read > EDB_CHUNK_SIZE) to_read = EDB_CHUNK_SIZE;
+/* =============================================================================
+ * Command: pull_many (download every file matching a set of globs)
+ *
+ * Protocol:
+ *   1. Client sends: { cmd: "pull_many", args: { paths: ["*.conf", "/var/log/messages*"], rate: N } }
+ *   2. Agent sends:  { ok: true, data: { files: [{ path, size, mode }, ...],
+ *                                        skipped: [{ path, error }, ...] } }
+ *   3. For each entry of files, in order: its data chunks, seq counting
+ *      from 0, the last with done: true (an empty file sends just that one)
+ *
+ * Patterns are expanded with glob(3) relative to the session's cwd; a
+ * pattern that matches nothing is tried as a plain path, so it shows up in
+ * skipped with the reason it could not be opened. Directories and devices
+ * of unknown size are skipped too. Everything after the first response is
+ * one stream (see sched.c), so the whole set costs one round trip and one
+ * rate limit, and a cancel stops it between chunks like a pull.
+ * ============================================================================= */
+
+typedef struct {
+    uint32_t  id;
+    char    **paths;            /* Files to send, as listed in the response */
+    uint64_t *sizes;
+    size_t    count;
+    size_t    next;             /* Index of the file being sent */
+    pull_stream_t *cur;         /* Its pull, once opened */
+} pull_many_t;
+
+static void pull_many_close(void *ctx)
+{
+    pull_many_t *pm = ctx;
+
+    if (pm->cur) pull_close(pm->cur);
+    for (size_t i = 0; i < pm->count; i++) {
+        edb_free(pm->paths[i]);
+    }
+    edb_free(pm->paths);
+    edb_free(pm->sizes);
+    edb_free(pm);
+}
+
+/* Send the next chunk of the current file, opening it first if need be */
+static int pull_many_send_next(conn_t *conn, void *ctx, size_t max, size_t *sent)
+{
+    pull_many_t *pm = ctx;
 
-        size_t n = fread(chunk, 1, to_read, f);
-        if (n == 0) {
-            if (ferror(f)) {
+    if (!pm->cur) {
+        uint64_t size;
+        uint32_t mode;
+        const char *err;
+        FILE *f = pull_file_open(pm->paths[pm->next], &size, &mode, &err);
+
+        /* Gone or emptied since the listing: end the entry here */
+        if (!f || pm->sizes[pm->next] == 0) {
+            if (f) {
                 fclose(f);
-                return proto_send_error(conn, id, "read error");
+            } else {
+                LOG("pull_many: %s: %s", pm->paths[pm->next], err);
+            }
+            if (proto_send_data(conn, pm->id, 0, (const uint8_t *)"", 0, true) < 0) {
+                return -1;
             }
-            break;  /* EOF */
+            return ++pm->next < pm->count ? 1 : 0;
         }
 
-        total_sent += n;
-        bool done = (total_sent >= file_size);
+        /* Send what was listed even if the file grew since */
+        pm->cur = pull_open(f, pm->id, pm->sizes[pm->next]);
+        if (!pm->cur) {
+            fclose(f);
+            return proto_send_error(conn, pm->id, "out of memory") < 0 ? -1 : 0;
+        }
+    }
 
-        LOG("pull: sending chunk seq=%u, len=%zu, done=%d", seq, n, done);
+    int ret = pull_send_next(conn, pm->cur, max, sent);
+    if (ret != 0) return ret;
 
-        if (proto_send_data(conn, id, seq, chunk, n, done) < 0) {
-            fclose(f);
-            return -1;
+    /* A failed read has already ended the request with an error */
+    bool failed = pm->cur->error;
+    pull_close(pm->cur);
+    pm->cur = NULL;
+    if (failed) return 0;
+
+    return ++pm->next < pm->count ? 1 : 0;
+}
+
+/* Add a file to the listing and the response */
+static int pull_many_add(pull_many_t *pm, resp_builder_t *rb, const char *path,
+                         uint64_t size, uint32_t mode)
+{
+    char *copy = edb_strdup(path);
+    if (!copy) return -1;
+    pm->paths[pm->count] = copy;
+    pm->sizes[pm->count] = size;
+    pm->count++;
+
+    rb_map(rb, 3);
+    rb_lit(rb, "path");
+    rb_str(rb, path);
+    rb_lit(rb, "size");
+    rb_uint(rb, size);
+    rb_lit(rb, "mode");
+    return rb_uint(rb, mode);
+}
+
+int cmd_pull_many(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    size_t npatterns;
+    char **patterns = parse_string_array_arg(args, args_len, "paths", &npatterns);
+    if (!patterns || npatterns == 0) {
+        free_string_array(patterns);
+        return proto_send_error(conn, id, "missing paths argument");
+    }
+
+    uint64_t rate = 0;          /* Unlimited unless asked */
+    parse_uint_arg(args, args_len, "rate", &rate);
+
+    if (!sched_has_room(conn)) {
+        free_string_array(patterns);
+        return proto_send_error(conn, id, "too many transfers");
+    }
+
+    /* Expand the patterns in order, each one's matches sorted */
+    glob_t g;
+    int gret = 0;
+    memset(&g, 0, sizeof(g));
+    for (size_t i = 0; i < npatterns && gret == 0; i++) {
+        char *resolved = path_resolve(conn->cwd, patterns[i]);
+        if (!resolved) {
+            gret = GLOB_NOSPACE;
+            break;
         }
+        gret = glob(resolved, GLOB_NOCHECK | (i > 0 ? GLOB_APPEND : 0), NULL, &g);
+        edb_free(resolved);
+    }
+    free_string_array(patterns);
 
-        seq++;
+    if (gret != 0) {
+        globfree(&g);
+        return proto_send_error(conn, id, "out of memory");
+    }
+    if (g.gl_pathc > EDB_PULL_MANY_MAX) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "too many files (%lu, limit %d)",
+                 (unsigned long)g.gl_pathc, EDB_PULL_MANY_MAX);
+        globfree(&g);
+        return proto_send_error(conn, id, msg);
     }
 
-    fclose(f);
-    LOG("pull: transfer complete, sent %zu bytes in %u chunks", total_sent, seq);
-    return 0;
+    /* Listed files go into the response, skipped ones aside until the end */
+    pull_many_t *pm = edb_calloc(1, sizeof(*pm));
+    resp_builder_t rb, skipped;
+    bool ok = false;
+    if (pm && rb_init(&rb, 256) == 0) {
+        if (rb_init(&skipped, 64) == 0) {
+            pm->id = id;
+            pm->paths = edb_calloc(g.gl_pathc + 1, sizeof(char *));
+            pm->sizes = edb_calloc(g.gl_pathc + 1, sizeof(uint64_t));
+            ok = pm->paths && pm->sizes;
+            if (!ok) rb_free(&skipped);
+        }
+        if (!ok) rb_free(&rb);
+    }
+    if (!ok) {
+        if (pm) pull_many_close(pm);
+        globfree(&g);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    /*
+     * Check each match now, so the response lists exactly what will be
+     * sent. Files are opened again one at a time while streaming.
+     */
+    rb_map(&rb, 2);
+    rb_lit(&rb, "files");
+    size_t files_at = rb_array_begin(&rb);
+    size_t nskipped = 0;
+
+    for (size_t i = 0; i < g.gl_pathc && ok; i++) {
+        uint64_t size;
+        uint32_t mode;
+        const char *err;
+        FILE *f = pull_file_open(g.gl_pathv[i], &size, &mode, &err);
+        if (!f) {
+            rb_map(&skipped, 2);
+            rb_lit(&skipped, "path");
+            rb_str(&skipped, g.gl_pathv[i]);
+            rb_lit(&skipped, "error");
+            ok = rb_str(&skipped, err) == 0;
+            nskipped++;
+            continue;
+        }
+        fclose(f);
+        ok = pull_many_add(pm, &rb, g.gl_pathv[i], size, mode) == 0;
+    }
+    globfree(&g);
+    rb_array_end(&rb, files_at, pm->count);
+
+    rb_lit(&rb, "skipped");
+    rb_array(&rb, nskipped);
+    if (rb_raw(&rb, skipped.buf, skipped.len) < 0 || files_at == (size_t)-1) {
+        ok = false;
+    }
+    rb_free(&skipped);
+
+    if (!ok) {
+        rb_free(&rb);
+        pull_many_close(pm);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    LOG("pull_many: %lu files, %lu skipped", (unsigned long)pm->count, (unsigned long)nskipped);
+
+    if (proto_send_response(conn, id, true, rb.buf, rb.len, NULL) < 0) {
+        rb_free(&rb);
+        pull_many_close(pm);
+        return -1;
+    }
+    rb_free(&rb);
+
+    if (pm->count == 0) {
+        pull_many_close(pm);
+        return 0;
+    }
+
+    /* The session loop sends the files from here on */
+    return sched_add(conn, id, rate, pull_many_send_next, pull_many_close, pm);
 }
 
 /* =============================================================================
  * Command: push (upload file to device)
  *
  * Protocol:
- *   1. Client sends: { cmd: "push", args: { path: "/path", size: N, mode: M } }
+ *   1. Client sends: { cmd: "push", args: { path: "/path", size: N, mode: M, rate: R } }
  *   2. Agent sends:  { ok: true, data: {} }
  *   3. Client sends: { type: "data", seq: 0, data: <chunk>, done: false }
  *   4. Client sends: { type: "data", seq: 1, data: <chunk>, done: false }
@@ -267,6 +722,11 @@ int cmd_pull(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
  *   6. Client sends: { type: "data", seq: N, data: <chunk>, done: true }
  *
  * The agent creates/overwrites the file and writes each chunk as it arrives.
+ * With a rate (bytes/s) or a session throttle it waits before taking each
+ * chunk, and TCP flow control slows the client down to match.
+ * A { type: "cancel", id } with the push's id removes the partial file and
+ * is answered with { ok: false, error: "cancelled" }. Cancels for a pull or
+ * watch running alongside are handled as usual and the push goes on.
  * ============================================================================= */
 
 int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
@@ -279,12 +739,18 @@ int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     uint64_t file_size = 0;
     uint64_t file_mode = 0644;  /* Default mode */
 
+    uint64_t rate = 0;          /* Unlimited unless asked */
+
     parse_uint_arg(args, args_len, "size", &file_size);
     parse_uint_arg(args, args_len, "mode", &file_mode);
+    parse_uint_arg(args, args_len, "rate", &rate);
+
+    tbucket_t bucket;
+    tb_init(&bucket, rate);
 
     /* Resolve the path */
     char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
+    edb_free(arg_path);
 
     if (!resolved) {
         return proto_send_error(conn, id, "out of memory");
@@ -297,7 +763,7 @@ int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     FILE *f = fopen(resolved, "wb");
     if (!f) {
         int err = errno;
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -308,7 +774,7 @@ int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     resp_builder_t rb;
     if (rb_init(&rb, 32) < 0) {
         fclose(f);
-        free(resolved);
+        edb_free(resolved);
         return proto_send_error(conn, id, "out of memory");
     }
 
@@ -317,14 +783,13 @@ int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     if (proto_send_response(conn, id, true, rb.buf, rb.len, NULL) < 0) {
         rb_free(&rb);
         fclose(f);
-        free(resolved);
+        edb_free(resolved);
         return -1;
     }
     rb_free(&rb);
 
-    /* Receive data chunks */
+    /* Receive data chunks (binary frames or MessagePack, see proto_parse_data) */
     size_t total_received = 0;
-    uint32_t expected_seq = 0;
 
     while (1) {
         uint8_t *msg = NULL;
@@ -333,125 +798,59 @@ int cmd_push(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         if (proto_recv(conn, &msg, &msg_len) < 0) {
             LOG("push: failed to receive data chunk");
             fclose(f);
-            free(resolved);
+            edb_free(resolved);
             return -1;
         }
 
-        /* Parse the data message */
-        /* Expected: { "type": "data", "id": N, "seq": N, "data": <bin>, "done": bool } */
-        size_t pos = 0;
-        bool done = false;
-        const uint8_t *chunk_data = NULL;
-        size_t chunk_len = 0;
-
-        /* Skip map header */
-        if (pos >= msg_len) goto parse_error;
-        uint8_t marker = msg[pos++];
-        size_t map_count;
-        if ((marker & 0xf0) == 0x80) {
-            map_count = marker & 0x0f;
-        } else {
-            goto parse_error;
+        data_msg_t chunk;
+        if (proto_parse_data(msg, msg_len, &chunk) < 0) {
+            LOG("push: parse error in data chunk");
+            edb_free(msg);
+            fclose(f);
+            edb_free(resolved);
+            return proto_send_error(conn, id, "invalid data chunk");
         }
 
-        for (size_t i = 0; i < map_count; i++) {
-            /* Read key */
-            if (pos >= msg_len) goto parse_error;
-            uint8_t km = msg[pos++];
-            size_t klen = 0;
-            if ((km & 0xe0) == 0xa0) {
-                klen = km & 0x1f;
-            } else {
-                goto parse_error;
+        /* A cancel for a pull or watch running alongside is not ours */
+        if (chunk.cancel && chunk.id != id) {
+            edb_free(msg);
+            if (proto_cancel_stream(conn, chunk.id) < 0) {
+                fclose(f);
+                edb_free(resolved);
+                return -1;
             }
+            continue;
+        }
 
-            if (pos + klen > msg_len) goto parse_error;
-            const char *key = (const char *)&msg[pos];
-            pos += klen;
-
-            /* Read value based on key */
-            if (klen == 4 && memcmp(key, "data", 4) == 0) {
-                /* Binary data */
-                if (pos >= msg_len) goto parse_error;
-                uint8_t vm = msg[pos++];
-                if (vm == 0xc4) {
-                    /* bin8 */
-                    if (pos >= msg_len) goto parse_error;
-                    chunk_len = msg[pos++];
-                } else if (vm == 0xc5) {
-                    /* bin16 */
-                    if (pos + 2 > msg_len) goto parse_error;
-                    chunk_len = (msg[pos] << 8) | msg[pos + 1];
-                    pos += 2;
-                } else if (vm == 0xc6) {
-                    /* bin32 */
-                    if (pos + 4 > msg_len) goto parse_error;
-                    chunk_len = ((size_t)msg[pos] << 24) |
-                                ((size_t)msg[pos + 1] << 16) |
-                                ((size_t)msg[pos + 2] << 8) |
-                                (size_t)msg[pos + 3];
-                    pos += 4;
-                } else {
-                    goto parse_error;
-                }
-                if (pos + chunk_len > msg_len) goto parse_error;
-                chunk_data = &msg[pos];
-                pos += chunk_len;
-            } else if (klen == 4 && memcmp(key, "done", 4) == 0) {
-                /* Boolean */
-                if (pos >= msg_len) goto parse_error;
-                uint8_t vm = msg[pos++];
-                done = (vm == 0xc3);  /* true */
-            } else {
-                /* Skip other values */
-                if (pos >= msg_len) goto parse_error;
-                uint8_t vm = msg[pos++];
-                if (vm <= 0x7f || vm == 0xc2 || vm == 0xc3) {
-                    /* fixint, false, true - no extra bytes */
-                } else if (vm == 0xcc) {
-                    pos++;
-                } else if (vm == 0xcd) {
-                    pos += 2;
-                } else if (vm == 0xce) {
-                    pos += 4;
-                } else if ((vm & 0xe0) == 0xa0) {
-                    pos += (vm & 0x1f);
-                } else if (vm == 0xd9) {
-                    if (pos >= msg_len) goto parse_error;
-                    pos += 1 + msg[pos];
-                }
-            }
+        if (chunk.cancel) {
+            LOG("push: cancelled after %zu bytes", total_received);
+            edb_free(msg);
+            fclose(f);
+            unlink(resolved);
+            edb_free(resolved);
+            return proto_send_error(conn, id, "cancelled");
         }
 
-        if (chunk_data && chunk_len > 0) {
-            if (fwrite(chunk_data, 1, chunk_len, f) != chunk_len) {
+        if (chunk.len > 0) {
+            sched_throttle(conn, &bucket, chunk.len);
+            if (fwrite(chunk.data, 1, chunk.len, f) != chunk.len) {
                 LOG("push: write error");
-                free(msg);
+                edb_free(msg);
                 fclose(f);
-                free(resolved);
+                edb_free(resolved);
                 return proto_send_error(conn, id, "write error");
             }
-            total_received += chunk_len;
+            total_received += chunk.len;
             LOG("push: received chunk seq=%u, len=%zu, done=%d",
-                expected_seq, chunk_len, done);
+                chunk.seq, chunk.len, chunk.done);
         }
 
-        free(msg);
-        expected_seq++;
-
-        if (done) break;
-        continue;
-
-    parse_error:
-        LOG("push: parse error in data chunk");
-        free(msg);
-        fclose(f);
-        free(resolved);
-        return proto_send_error(conn, id, "invalid data chunk");
+        edb_free(msg);
+        if (chunk.done) break;
     }
 
     fclose(f);
-    free(resolved);
+    edb_free(resolved);
 
     LOG("push: transfer complete, received %zu bytes", total_received);
     return 0;
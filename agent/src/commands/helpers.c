@@ -2,7 +2,7 @@
  * embbridge - Embedded Debug Bridge
  * https://github.com/Necromancer-Labs/embbridge
  *
- * Command helpers: argument parsing, response building, path utilities.
+ * Command helpers: argument parsing, path utilities.
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -15,159 +15,138 @@
 #include "commands.h"
 
 /* =============================================================================
- * Response Builder Implementation
+ * Argument Parsing
+ *
+ * MessagePack format reference (subset we use):
+ *   - fixmap:  0x80-0x8f (up to 15 key-value pairs)
+ *   - map16:   0xde + 2 bytes length
+ *   - fixstr:  0xa0-0xbf (up to 31 bytes)
+ *   - str8:    0xd9 + 1 byte length
+ *   - str16:   0xda + 2 bytes length
+ *   - fixint:  0x00-0x7f (0 to 127)
+ *   - uint8:   0xcc + 1 byte
+ *   - uint16:  0xcd + 2 bytes
+ *   - uint32:  0xce + 4 bytes
+ *   - uint64:  0xcf + 8 bytes
+ *   - true:    0xc3
+ *   - false:   0xc2
+ *   - nil:     0xc0
  * ============================================================================= */
 
-static int rb_ensure(resp_builder_t *rb, size_t need)
-{
-    if (rb->len + need <= rb->cap) return 0;
-    size_t new_cap = rb->cap * 2;
-    while (new_cap < rb->len + need) new_cap *= 2;
-    uint8_t *new_buf = realloc(rb->buf, new_cap);
-    if (!new_buf) return -1;
-    rb->buf = new_buf;
-    rb->cap = new_cap;
-    return 0;
-}
-
-int rb_init(resp_builder_t *rb, size_t cap)
-{
-    rb->buf = malloc(cap);
-    if (!rb->buf) return -1;
-    rb->cap = cap;
-    rb->len = 0;
-    return 0;
-}
-
-void rb_free(resp_builder_t *rb)
-{
-    free(rb->buf);
-    rb->buf = NULL;
-}
-
-int rb_u8(resp_builder_t *rb, uint8_t v)
+/*
+ * Skip over one MessagePack value of any type, including nested maps and
+ * arrays. Lets the parsers below step past values they don't understand.
+ */
+static int mp_skip_value(const uint8_t *buf, size_t len, size_t *pos, int depth)
 {
-    if (rb_ensure(rb, 1) < 0) return -1;
-    rb->buf[rb->len++] = v;
-    return 0;
-}
+    if (depth > 16 || *pos >= len) return -1;
+    uint8_t m = buf[(*pos)++];
+    size_t n = 0;
+    size_t items = 0;
+
+    if (m <= 0x7f || m >= 0xe0 || m == 0xc0 || m == 0xc2 || m == 0xc3) {
+        return 0;                                   /* fixint, nil, bool */
+    } else if ((m & 0xe0) == 0xa0) {
+        n = m & 0x1f;                               /* fixstr */
+    } else if ((m & 0xf0) == 0x80) {
+        items = (size_t)(m & 0x0f) * 2;             /* fixmap */
+    } else if ((m & 0xf0) == 0x90) {
+        items = m & 0x0f;                           /* fixarray */
+    } else {
+        switch (m) {
+            case 0xcc: case 0xd0: n = 1; break;     /* uint8, int8 */
+            case 0xcd: case 0xd1: n = 2; break;     /* uint16, int16 */
+            case 0xce: case 0xd2: case 0xca: n = 4; break;
+            case 0xcf: case 0xd3: case 0xcb: n = 8; break;
+            case 0xd4: n = 2; break;                /* fixext1 */
+            case 0xd5: n = 3; break;
+            case 0xd6: n = 5; break;
+            case 0xd7: n = 9; break;
+            case 0xd8: n = 17; break;
+            case 0xc4: case 0xd9:                   /* bin8, str8 */
+                if (*pos + 1 > len) return -1;
+                n = buf[*pos];
+                *pos += 1;
+                break;
+            case 0xc5: case 0xda:                   /* bin16, str16 */
+                if (*pos + 2 > len) return -1;
+                n = ((size_t)buf[*pos] << 8) | buf[*pos + 1];
+                *pos += 2;
+                break;
+            case 0xc6: case 0xdb:                   /* bin32, str32 */
+                if (*pos + 4 > len) return -1;
+                n = ((size_t)buf[*pos] << 24) | ((size_t)buf[*pos + 1] << 16) |
+                    ((size_t)buf[*pos + 2] << 8) | buf[*pos + 3];
+                *pos += 4;
+                break;
+            case 0xdc: case 0xde:                   /* array16, map16 */
+                if (*pos + 2 > len) return -1;
+                items = ((size_t)buf[*pos] << 8) | buf[*pos + 1];
+                if (m == 0xde) items *= 2;
+                *pos += 2;
+                break;
+            case 0xdd: case 0xdf:                   /* array32, map32 */
+                if (*pos + 4 > len) return -1;
+                items = ((size_t)buf[*pos] << 24) | ((size_t)buf[*pos + 1] << 16) |
+                        ((size_t)buf[*pos + 2] << 8) | buf[*pos + 3];
+                if (m == 0xdf) items *= 2;
+                *pos += 4;
+                break;
+            default:
+                return -1;
+        }
+    }
 
-int rb_u16be(resp_builder_t *rb, uint16_t v)
-{
-    if (rb_ensure(rb, 2) < 0) return -1;
-    rb->buf[rb->len++] = (v >> 8) & 0xff;
-    rb->buf[rb->len++] = v & 0xff;
-    return 0;
-}
+    if (n > len - *pos) return -1;
+    *pos += n;
 
-int rb_u32be(resp_builder_t *rb, uint32_t v)
-{
-    if (rb_ensure(rb, 4) < 0) return -1;
-    rb->buf[rb->len++] = (v >> 24) & 0xff;
-    rb->buf[rb->len++] = (v >> 16) & 0xff;
-    rb->buf[rb->len++] = (v >> 8) & 0xff;
-    rb->buf[rb->len++] = v & 0xff;
+    for (size_t i = 0; i < items; i++) {
+        if (mp_skip_value(buf, len, pos, depth + 1) < 0) return -1;
+    }
     return 0;
 }
 
-int rb_raw(resp_builder_t *rb, const void *data, size_t len)
+/*
+ * Find the value for key in a MessagePack map.
+ * Returns the offset of the value's first byte, or -1 if not found.
+ */
+static long find_arg(const uint8_t *args, size_t args_len, const char *key)
 {
-    if (rb_ensure(rb, len) < 0) return -1;
-    memcpy(rb->buf + rb->len, data, len);
-    rb->len += len;
-    return 0;
-}
+    if (!args || args_len == 0) return -1;
 
-int rb_str(resp_builder_t *rb, const char *s)
-{
-    size_t len = strlen(s);
-    if (len <= 31) {
-        if (rb_u8(rb, 0xa0 | (uint8_t)len) < 0) return -1;
-    } else if (len <= 0xff) {
-        if (rb_u8(rb, 0xd9) < 0) return -1;
-        if (rb_u8(rb, (uint8_t)len) < 0) return -1;
-    } else {
-        if (rb_u8(rb, 0xda) < 0) return -1;
-        if (rb_u16be(rb, (uint16_t)len) < 0) return -1;
-    }
-    return rb_raw(rb, s, len);
-}
+    size_t pos = 0;
+    size_t key_len = strlen(key);
+    uint8_t marker = args[pos++];
 
-int rb_bin(resp_builder_t *rb, const uint8_t *data, size_t len)
-{
-    /* MessagePack binary format:
-     * bin8:  0xc4 + 1 byte length + data
-     * bin16: 0xc5 + 2 bytes length + data
-     * bin32: 0xc6 + 4 bytes length + data
-     */
-    if (len <= 0xff) {
-        if (rb_u8(rb, 0xc4) < 0) return -1;
-        if (rb_u8(rb, (uint8_t)len) < 0) return -1;
-    } else if (len <= 0xffff) {
-        if (rb_u8(rb, 0xc5) < 0) return -1;
-        if (rb_u16be(rb, (uint16_t)len) < 0) return -1;
+    size_t map_count;
+    if ((marker & 0xf0) == 0x80) {
+        map_count = marker & 0x0f;
+    } else if (marker == 0xde) {
+        if (pos + 2 > args_len) return -1;
+        map_count = (args[pos] << 8) | args[pos + 1];
+        pos += 2;
     } else {
-        if (rb_u8(rb, 0xc6) < 0) return -1;
-        if (rb_u32be(rb, (uint32_t)len) < 0) return -1;
+        return -1;
     }
-    return rb_raw(rb, data, len);
-}
 
-int rb_uint(resp_builder_t *rb, uint64_t v)
-{
-    if (v <= 0x7f) {
-        return rb_u8(rb, (uint8_t)v);
-    } else if (v <= 0xff) {
-        if (rb_u8(rb, 0xcc) < 0) return -1;
-        return rb_u8(rb, (uint8_t)v);
-    } else if (v <= 0xffff) {
-        if (rb_u8(rb, 0xcd) < 0) return -1;
-        return rb_u16be(rb, (uint16_t)v);
-    } else {
-        if (rb_u8(rb, 0xce) < 0) return -1;
-        return rb_u32be(rb, (uint32_t)v);
-    }
-}
+    for (size_t i = 0; i < map_count; i++) {
+        size_t kpos = pos;
+        if (mp_skip_value(args, args_len, &pos, 0) < 0) return -1;
+
+        /* Compare string keys only */
+        uint8_t km = args[kpos];
+        size_t hdr = (km & 0xe0) == 0xa0 ? 1 : km == 0xd9 ? 2 : km == 0xda ? 3 : 0;
+        if (hdr && pos - kpos - hdr == key_len &&
+            memcmp(&args[kpos + hdr], key, key_len) == 0) {
+            return (long)pos;
+        }
 
-int rb_map(resp_builder_t *rb, size_t count)
-{
-    if (count <= 15) {
-        return rb_u8(rb, 0x80 | (uint8_t)count);
-    } else {
-        if (rb_u8(rb, 0xde) < 0) return -1;
-        return rb_u16be(rb, (uint16_t)count);
+        if (mp_skip_value(args, args_len, &pos, 0) < 0) return -1;
     }
-}
 
-int rb_array(resp_builder_t *rb, size_t count)
-{
-    if (count <= 15) {
-        return rb_u8(rb, 0x90 | (uint8_t)count);
-    } else {
-        if (rb_u8(rb, 0xdc) < 0) return -1;
-        return rb_u16be(rb, (uint16_t)count);
-    }
+    return -1;
 }
 
-/* =============================================================================
- * Argument Parsing
- *
- * MessagePack format reference (subset we use):
- *   - fixmap:  0x80-0x8f (up to 15 key-value pairs)
- *   - map16:   0xde + 2 bytes length
- *   - fixstr:  0xa0-0xbf (up to 31 bytes)
- *   - str8:    0xd9 + 1 byte length
- *   - str16:   0xda + 2 bytes length
- *   - fixint:  0x00-0x7f (0 to 127)
- *   - uint8:   0xcc + 1 byte
- *   - uint16:  0xcd + 2 bytes
- *   - uint32:  0xce + 4 bytes
- *   - uint64:  0xcf + 8 bytes
- *   - true:    0xc3
- *   - false:   0xc2
- *   - nil:     0xc0
- * ============================================================================= */
-
 char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key)
 {
     if (!args || args_len == 0) return NULL;
@@ -227,7 +206,7 @@ char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key)
             vlen = vm & 0x1f;
             if (pos + vlen > args_len) return NULL;
             if (is_target) {
-                char *result = malloc(vlen + 1);
+                char *result = edb_malloc(vlen + 1);
                 if (!result) return NULL;
                 memcpy(result, &args[pos], vlen);
                 result[vlen] = '\0';
@@ -240,7 +219,7 @@ char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key)
             vlen = args[pos++];
             if (pos + vlen > args_len) return NULL;
             if (is_target) {
-                char *result = malloc(vlen + 1);
+                char *result = edb_malloc(vlen + 1);
                 if (!result) return NULL;
                 memcpy(result, &args[pos], vlen);
                 result[vlen] = '\0';
@@ -254,7 +233,7 @@ char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key)
             pos += 2;
             if (pos + vlen > args_len) return NULL;
             if (is_target) {
-                char *result = malloc(vlen + 1);
+                char *result = edb_malloc(vlen + 1);
                 if (!result) return NULL;
                 memcpy(result, &args[pos], vlen);
                 result[vlen] = '\0';
@@ -276,7 +255,9 @@ char *parse_string_arg(const uint8_t *args, size_t args_len, const char *key)
         } else if (vm == 0xc0) {
             /* nil */
         } else {
-            return NULL;
+            /* arrays, maps, binary - skip */
+            pos--;
+            if (mp_skip_value(args, args_len, &pos, 0) < 0) return NULL;
         }
     }
 
@@ -388,14 +369,98 @@ int parse_uint_arg(const uint8_t *args, size_t args_len, const char *key, uint64
             if (pos + 2 > args_len) return -1;
             size_t slen = (args[pos] << 8) | args[pos + 1];
             pos += 2 + slen;
+        } else if (vm == 0xc0 || vm == 0xc2 || vm == 0xc3) {
+            /* nil/false/true */
         } else {
-            return -1;
+            /* arrays, maps, binary - skip */
+            pos--;
+            if (mp_skip_value(args, args_len, &pos, 0) < 0) return -1;
         }
     }
 
     return -1;
 }
 
+char **parse_string_array_arg(const uint8_t *args, size_t args_len, const char *key,
+                              size_t *count)
+{
+    *count = 0;
+
+    long off = find_arg(args, args_len, key);
+    if (off < 0) return NULL;
+
+    size_t pos = (size_t)off;
+    uint8_t m = args[pos++];
+    size_t n;
+    if ((m & 0xf0) == 0x90) {
+        n = m & 0x0f;
+    } else if (m == 0xdc) {
+        if (pos + 2 > args_len) return NULL;
+        n = (args[pos] << 8) | args[pos + 1];
+        pos += 2;
+    } else {
+        return NULL;
+    }
+
+    char **result = edb_calloc(n + 1, sizeof(char *));
+    if (!result) return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        if (pos >= args_len) goto fail;
+        uint8_t sm = args[pos];
+        size_t start = pos;
+        if (mp_skip_value(args, args_len, &pos, 0) < 0) goto fail;
+
+        size_t hdr = (sm & 0xe0) == 0xa0 ? 1 : sm == 0xd9 ? 2 : sm == 0xda ? 3 :
+                     sm == 0xdb ? 5 : 0;
+        if (!hdr) goto fail;
+
+        size_t slen = pos - start - hdr;
+        result[i] = edb_malloc(slen + 1);
+        if (!result[i]) goto fail;
+        memcpy(result[i], &args[start + hdr], slen);
+        result[i][slen] = '\0';
+    }
+
+    *count = n;
+    return result;
+
+fail:
+    free_string_array(result);
+    return NULL;
+}
+
+const uint8_t *parse_bin_arg(const uint8_t *args, size_t args_len, const char *key,
+                             size_t *out_len)
+{
+    long off = find_arg(args, args_len, key);
+    if (off < 0) return NULL;
+
+    size_t pos = (size_t)off;
+    size_t end = pos;
+    if (mp_skip_value(args, args_len, &end, 0) < 0) return NULL;
+
+    size_t hdr;
+    switch (args[pos]) {
+        case 0xc4: hdr = 2; break;  /* bin8 */
+        case 0xc5: hdr = 3; break;  /* bin16 */
+        case 0xc6: hdr = 5; break;  /* bin32 */
+        default:   return NULL;
+    }
+
+    *out_len = end - pos - hdr;
+    return &args[pos + hdr];
+}
+
+void free_string_array(char **arr)
+{
+    if (!arr) return;
+    for (char **p = arr; *p; p++) {
+        edb_free(*p);
+    }
+    edb_free(arr);
+}
+
 /* =============================================================================
  * Path Utilities
  * ============================================================================= */
@@ -405,13 +470,13 @@ char *path_resolve(const char *cwd, const char *path)
     char *result;
 
     if (path[0] == '/') {
-        result = strdup(path);
+        result = edb_strdup(path);
     } else {
         size_t cwd_len = strlen(cwd);
         size_t path_len = strlen(path);
         size_t total = cwd_len + 1 + path_len + 1;
 
-        result = malloc(total);
+        result = edb_malloc(total);
         if (!result) return NULL;
 
         if (cwd_len > 0 && cwd[cwd_len - 1] == '/') {
@@ -26,7 +26,7 @@ int cmd_cpuinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     /* Read entire file */
     size_t capacity = 4096;
     size_t len = 0;
-    char *buf = malloc(capacity);
+    char *buf = edb_malloc(capacity);
     if (!buf) {
         fclose(f);
         return proto_send_error(conn, id, "out of memory");
@@ -37,9 +37,9 @@ int cmd_cpuinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         len += n;
         if (len >= capacity) {
             capacity *= 2;
-            char *newbuf = realloc(buf, capacity);
+            char *newbuf = edb_realloc(buf, capacity);
             if (!newbuf) {
-                free(buf);
+                edb_free(buf);
                 fclose(f);
                 return proto_send_error(conn, id, "out of memory");
             }
@@ -53,15 +53,15 @@ int cmd_cpuinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     resp_builder_t rb;
     if (rb_init(&rb, len + 64) < 0) {
-        free(buf);
+        edb_free(buf);
         return proto_send_error(conn, id, "out of memory");
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "content");
+    rb_lit(&rb, "content");
     rb_bin(&rb, (uint8_t *)buf, len);
 
-    free(buf);
+    edb_free(buf);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
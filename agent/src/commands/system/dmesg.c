@@ -31,7 +31,7 @@ int cmd_dmesg(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         bufsize = 16384;  /* Default fallback */
     }
 
-    char *buf = malloc((size_t)bufsize);
+    char *buf = edb_malloc((size_t)bufsize);
     if (!buf) {
         return proto_send_error(conn, id, "out of memory");
     }
@@ -40,7 +40,7 @@ int cmd_dmesg(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     int len = klogctl(3, buf, bufsize);  /* SYSLOG_ACTION_READ_ALL */
     if (len < 0) {
         int err = errno;
-        free(buf);
+        edb_free(buf);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -48,15 +48,15 @@ int cmd_dmesg(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     resp_builder_t rb;
     if (rb_init(&rb, (size_t)len + 64) < 0) {
-        free(buf);
+        edb_free(buf);
         return proto_send_error(conn, id, "out of memory");
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "log");
+    rb_lit(&rb, "log");
     rb_bin(&rb, (uint8_t *)buf, (size_t)len);
 
-    free(buf);
+    edb_free(buf);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
@@ -0,0 +1,826 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: elfinfo - Inspect ELF binaries on the device
+ *
+ * Parses ELF32 and ELF64 files of either byte order with pread(), touching
+ * only the headers and tables it needs. Reports the file header, section
+ * and segment tables, DT_NEEDED entries, dynamic symbols and hardening flags,
+ * for many paths in one request.
+ *
+ * Stripped binaries (no section headers, as left by sstrip) are handled by
+ * walking PT_DYNAMIC and mapping its addresses through the PT_LOAD segments.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <elf.h>
+#include <sys/stat.h>
+
+#include "edb.h"
+#include "commands.h"
+
+#define ELFINFO_MAX_PATHS      1024
+#define ELFINFO_MAX_PHDRS      256
+#define ELFINFO_MAX_SHDRS      4096
+#define ELFINFO_MAX_DYN        4096
+#define ELFINFO_MAX_STRTAB     (1024 * 1024)
+#define ELFINFO_DEFAULT_SYMS   2048
+
+/* =============================================================================
+ * Endian/Class-neutral Field Access
+ *
+ * Structures are read as raw bytes and fields decoded by offset, so the same
+ * code handles ELF32/ELF64 and little/big endian files on any host.
+ * ============================================================================= */
+
+typedef struct {
+    int      fd;
+    off_t    size;
+    bool     is64;
+    bool     big;
+} elf_file_t;
+
+static uint64_t elf_get(const elf_file_t *ef, const uint8_t *p, size_t n)
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t idx = ef->big ? i : n - 1 - i;
+        v = (v << 8) | p[idx];
+    }
+    return v;
+}
+
+#define ELF_FIELD(ef, buf, T, field)                                           \
+    elf_get((ef), (const uint8_t *)(buf) +                                     \
+            ((ef)->is64 ? offsetof(Elf64_##T, field) : offsetof(Elf32_##T, field)), \
+            (ef)->is64 ? sizeof(((Elf64_##T *)0)->field) : sizeof(((Elf32_##T *)0)->field))
+
+#define ELF_SIZE(ef, T) ((ef)->is64 ? sizeof(Elf64_##T) : sizeof(Elf32_##T))
+
+/* Read exactly len bytes at off; fails on short reads or out-of-file ranges */
+static int elf_read(const elf_file_t *ef, uint64_t off, void *buf, size_t len)
+{
+    if (off > (uint64_t)ef->size || len > (uint64_t)ef->size - off) return -1;
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(ef->fd, (uint8_t *)buf + done, len - done, (off_t)(off + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* Allocate and read a table; returns NULL on failure */
+static uint8_t *elf_read_alloc(const elf_file_t *ef, uint64_t off, size_t len)
+{
+    uint8_t *buf = edb_malloc(len ? len : 1);
+    if (!buf) return NULL;
+    if (elf_read(ef, off, buf, len) < 0) {
+        edb_free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/* =============================================================================
+ * Name Tables
+ * ============================================================================= */
+
+typedef struct {
+    uint32_t    value;
+    const char *name;
+} elf_name_t;
+
+static const elf_name_t machine_names[] = {
+    { EM_386,     "x86" },
+    { EM_X86_64,  "x86-64" },
+    { EM_ARM,     "ARM" },
+    { EM_AARCH64, "AArch64" },
+    { EM_MIPS,    "MIPS" },
+    { EM_PPC,     "PowerPC" },
+    { EM_PPC64,   "PowerPC64" },
+    { EM_SH,      "SuperH" },
+    { EM_SPARC,   "SPARC" },
+    { EM_68K,     "m68k" },
+#ifdef EM_RISCV
+    { EM_RISCV,   "RISC-V" },
+#endif
+#ifdef EM_XTENSA
+    { EM_XTENSA,  "Xtensa" },
+#endif
+#ifdef EM_ARC
+    { EM_ARC,     "ARC" },
+#endif
+    { 0, NULL },
+};
+
+static const elf_name_t type_names[] = {
+    { ET_REL,  "REL" },
+    { ET_EXEC, "EXEC" },
+    { ET_DYN,  "DYN" },
+    { ET_CORE, "CORE" },
+    { 0, NULL },
+};
+
+static const elf_name_t segment_names[] = {
+    { PT_NULL,         "NULL" },
+    { PT_LOAD,         "LOAD" },
+    { PT_DYNAMIC,      "DYNAMIC" },
+    { PT_INTERP,       "INTERP" },
+    { PT_NOTE,         "NOTE" },
+    { PT_PHDR,         "PHDR" },
+    { PT_TLS,          "TLS" },
+    { PT_GNU_EH_FRAME, "GNU_EH_FRAME" },
+    { PT_GNU_STACK,    "GNU_STACK" },
+    { PT_GNU_RELRO,    "GNU_RELRO" },
+    { 0x70000000,      "ARCH_SPECIFIC" },   /* PT_MIPS_REGINFO / PT_ARM_EXIDX */
+    { 0x70000001,      "ARCH_SPECIFIC" },
+    { 0x70000003,      "MIPS_ABIFLAGS" },
+    { 0, NULL },
+};
+
+static const elf_name_t section_names[] = {
+    { SHT_NULL,        "NULL" },
+    { SHT_PROGBITS,    "PROGBITS" },
+    { SHT_SYMTAB,      "SYMTAB" },
+    { SHT_STRTAB,      "STRTAB" },
+    { SHT_RELA,        "RELA" },
+    { SHT_HASH,        "HASH" },
+    { SHT_DYNAMIC,     "DYNAMIC" },
+    { SHT_NOTE,        "NOTE" },
+    { SHT_NOBITS,      "NOBITS" },
+    { SHT_REL,         "REL" },
+    { SHT_DYNSYM,      "DYNSYM" },
+    { SHT_INIT_ARRAY,  "INIT_ARRAY" },
+    { SHT_FINI_ARRAY,  "FINI_ARRAY" },
+    { SHT_GNU_HASH,    "GNU_HASH" },
+    { SHT_GNU_versym,  "VERSYM" },
+    { SHT_GNU_verneed, "VERNEED" },
+    { SHT_GNU_verdef,  "VERDEF" },
+    { 0, NULL },
+};
+
+static const char *sym_type_names[] = {
+    "NOTYPE", "OBJECT", "FUNC", "SECTION", "FILE", "COMMON", "TLS",
+};
+
+static const char *sym_bind_names[] = {
+    "LOCAL", "GLOBAL", "WEAK",
+};
+
+static const char *elf_name(const elf_name_t *table, uint32_t value, char *buf, size_t bufsz)
+{
+    for (const elf_name_t *e = table; e->name; e++) {
+        if (e->value == value) return e->name;
+    }
+    snprintf(buf, bufsz, "0x%x", value);
+    return buf;
+}
+
+/* =============================================================================
+ * Parsed ELF Image
+ * ============================================================================= */
+
+typedef struct {
+    elf_file_t ef;
+
+    uint16_t   type;
+    uint16_t   machine;
+    uint64_t   entry;
+
+    uint8_t   *phdrs;
+    size_t     phnum;
+    uint8_t   *shdrs;
+    size_t     shnum;
+    char      *shstrtab;
+    size_t     shstrtab_len;
+
+    char       interp[256];
+
+    /* Dynamic section */
+    uint8_t   *dyn;
+    size_t     dyn_count;
+    char      *dynstr;
+    size_t     dynstr_len;
+    uint8_t   *dynsym;
+    size_t     dynsym_count;
+
+    bool       has_symtab;
+} elf_image_t;
+
+static void elf_image_free(elf_image_t *img)
+{
+    edb_free(img->phdrs);
+    edb_free(img->shdrs);
+    edb_free(img->shstrtab);
+    edb_free(img->dyn);
+    edb_free(img->dynstr);
+    edb_free(img->dynsym);
+}
+
+/* Map a virtual address to a file offset using PT_LOAD segments */
+static int vaddr_to_offset(const elf_image_t *img, uint64_t vaddr, uint64_t *off)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t phsz = ELF_SIZE(ef, Phdr);
+
+    for (size_t i = 0; i < img->phnum; i++) {
+        const uint8_t *ph = img->phdrs + i * phsz;
+        if (ELF_FIELD(ef, ph, Phdr, p_type) != PT_LOAD) continue;
+
+        uint64_t va = ELF_FIELD(ef, ph, Phdr, p_vaddr);
+        uint64_t filesz = ELF_FIELD(ef, ph, Phdr, p_filesz);
+        if (vaddr >= va && vaddr < va + filesz) {
+            *off = ELF_FIELD(ef, ph, Phdr, p_offset) + (vaddr - va);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const char *dynstr_at(const elf_image_t *img, uint64_t idx)
+{
+    if (!img->dynstr || idx >= img->dynstr_len) return NULL;
+    return img->dynstr + idx;
+}
+
+static const char *shstr_at(const elf_image_t *img, uint64_t idx)
+{
+    if (!img->shstrtab || idx >= img->shstrtab_len) return "";
+    return img->shstrtab + idx;
+}
+
+/* Read a string table and make sure it is NUL-terminated */
+static char *read_strtab(const elf_file_t *ef, uint64_t off, uint64_t len, size_t *out_len)
+{
+    if (len == 0 || len > ELFINFO_MAX_STRTAB) return NULL;
+
+    char *s = (char *)elf_read_alloc(ef, off, (size_t)len + 1);
+    if (!s) {
+        /* Table may end exactly at EOF; retry without the spare byte */
+        s = edb_malloc((size_t)len + 1);
+        if (!s || elf_read(ef, off, s, (size_t)len) < 0) {
+            edb_free(s);
+            return NULL;
+        }
+    }
+    s[len] = '\0';
+    *out_len = (size_t)len;
+    return s;
+}
+
+static uint64_t dyn_lookup(const elf_image_t *img, int64_t tag, bool *found)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t dsz = ELF_SIZE(ef, Dyn);
+
+    for (size_t i = 0; i < img->dyn_count; i++) {
+        const uint8_t *d = img->dyn + i * dsz;
+        if ((int64_t)ELF_FIELD(ef, d, Dyn, d_tag) == tag) {
+            if (found) *found = true;
+            return ELF_FIELD(ef, d, Dyn, d_un);
+        }
+    }
+    if (found) *found = false;
+    return 0;
+}
+
+static int elf_load(elf_image_t *img, const char *path, char *err, size_t errsz)
+{
+    elf_file_t *ef = &img->ef;
+    uint8_t ident[EI_NIDENT];
+    uint8_t ehdr[sizeof(Elf64_Ehdr)];
+    struct stat st;
+
+    ef->fd = open(path, O_RDONLY);
+    if (ef->fd < 0) {
+        snprintf(err, errsz, "%s", strerror(errno));
+        return -1;
+    }
+    if (fstat(ef->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        snprintf(err, errsz, "not a regular file");
+        return -1;
+    }
+    ef->size = st.st_size;
+
+    if (elf_read(ef, 0, ident, sizeof(ident)) < 0 ||
+        memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        snprintf(err, errsz, "not an ELF file");
+        return -1;
+    }
+    if ((ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64) ||
+        (ident[EI_DATA] != ELFDATA2LSB && ident[EI_DATA] != ELFDATA2MSB)) {
+        snprintf(err, errsz, "unsupported ELF class or encoding");
+        return -1;
+    }
+    ef->is64 = ident[EI_CLASS] == ELFCLASS64;
+    ef->big = ident[EI_DATA] == ELFDATA2MSB;
+
+    if (elf_read(ef, 0, ehdr, ELF_SIZE(ef, Ehdr)) < 0) {
+        snprintf(err, errsz, "truncated ELF header");
+        return -1;
+    }
+
+    img->type = (uint16_t)ELF_FIELD(ef, ehdr, Ehdr, e_type);
+    img->machine = (uint16_t)ELF_FIELD(ef, ehdr, Ehdr, e_machine);
+    img->entry = ELF_FIELD(ef, ehdr, Ehdr, e_entry);
+
+    /* Program headers */
+    uint64_t phoff = ELF_FIELD(ef, ehdr, Ehdr, e_phoff);
+    size_t phnum = (size_t)ELF_FIELD(ef, ehdr, Ehdr, e_phnum);
+    size_t phentsize = (size_t)ELF_FIELD(ef, ehdr, Ehdr, e_phentsize);
+    if (phoff && phnum && phnum <= ELFINFO_MAX_PHDRS && phentsize == ELF_SIZE(ef, Phdr)) {
+        img->phdrs = elf_read_alloc(ef, phoff, phnum * phentsize);
+        if (img->phdrs) img->phnum = phnum;
+    }
+
+    /* Section headers (often missing on stripped embedded binaries) */
+    uint64_t shoff = ELF_FIELD(ef, ehdr, Ehdr, e_shoff);
+    size_t shnum = (size_t)ELF_FIELD(ef, ehdr, Ehdr, e_shnum);
+    size_t shentsize = (size_t)ELF_FIELD(ef, ehdr, Ehdr, e_shentsize);
+    size_t shstrndx = (size_t)ELF_FIELD(ef, ehdr, Ehdr, e_shstrndx);
+    size_t shsz = ELF_SIZE(ef, Shdr);
+    if (shoff && shnum && shnum <= ELFINFO_MAX_SHDRS && shentsize == shsz) {
+        img->shdrs = elf_read_alloc(ef, shoff, shnum * shentsize);
+        if (img->shdrs) img->shnum = shnum;
+    }
+    if (img->shdrs && shstrndx < img->shnum) {
+        const uint8_t *sh = img->shdrs + shstrndx * shsz;
+        img->shstrtab = read_strtab(ef, ELF_FIELD(ef, sh, Shdr, sh_offset),
+                                    ELF_FIELD(ef, sh, Shdr, sh_size), &img->shstrtab_len);
+    }
+
+    /* Interpreter and dynamic segment */
+    size_t phsz = ELF_SIZE(ef, Phdr);
+    for (size_t i = 0; i < img->phnum; i++) {
+        const uint8_t *ph = img->phdrs + i * phsz;
+        uint32_t ptype = (uint32_t)ELF_FIELD(ef, ph, Phdr, p_type);
+        uint64_t off = ELF_FIELD(ef, ph, Phdr, p_offset);
+        uint64_t filesz = ELF_FIELD(ef, ph, Phdr, p_filesz);
+
+        if (ptype == PT_INTERP && filesz > 0) {
+            size_t n = filesz < sizeof(img->interp) ? (size_t)filesz : sizeof(img->interp) - 1;
+            if (elf_read(ef, off, img->interp, n) == 0) {
+                img->interp[n] = '\0';
+            } else {
+                img->interp[0] = '\0';
+            }
+        } else if (ptype == PT_DYNAMIC && !img->dyn) {
+            size_t count = (size_t)(filesz / ELF_SIZE(ef, Dyn));
+            if (count > ELFINFO_MAX_DYN) count = ELFINFO_MAX_DYN;
+            img->dyn = elf_read_alloc(ef, off, count * ELF_SIZE(ef, Dyn));
+            if (img->dyn) img->dyn_count = count;
+        }
+    }
+
+    /* Symbol tables: prefer section headers, fall back to dynamic tags */
+    uint64_t dynsym_off = 0, dynsym_size = 0;
+    uint64_t dynstr_off = 0, dynstr_size = 0;
+
+    for (size_t i = 0; i < img->shnum; i++) {
+        const uint8_t *sh = img->shdrs + i * shsz;
+        uint32_t stype = (uint32_t)ELF_FIELD(ef, sh, Shdr, sh_type);
+
+        if (stype == SHT_SYMTAB) {
+            img->has_symtab = true;
+        } else if (stype == SHT_DYNSYM && !dynsym_off) {
+            dynsym_off = ELF_FIELD(ef, sh, Shdr, sh_offset);
+            dynsym_size = ELF_FIELD(ef, sh, Shdr, sh_size);
+
+            size_t link = (size_t)ELF_FIELD(ef, sh, Shdr, sh_link);
+            if (link < img->shnum) {
+                const uint8_t *ls = img->shdrs + link * shsz;
+                dynstr_off = ELF_FIELD(ef, ls, Shdr, sh_offset);
+                dynstr_size = ELF_FIELD(ef, ls, Shdr, sh_size);
+            }
+        }
+    }
+
+    if (img->dyn_count && (!dynsym_off || !dynstr_off)) {
+        bool have_strtab, have_symtab, have_hash;
+        uint64_t strtab = dyn_lookup(img, DT_STRTAB, &have_strtab);
+        uint64_t strsz = dyn_lookup(img, DT_STRSZ, NULL);
+        uint64_t symtab = dyn_lookup(img, DT_SYMTAB, &have_symtab);
+        uint64_t hash = dyn_lookup(img, DT_HASH, &have_hash);
+        size_t syment = ELF_SIZE(ef, Sym);
+
+        if (have_strtab && vaddr_to_offset(img, strtab, &dynstr_off) == 0) {
+            dynstr_size = strsz;
+        }
+
+        if (have_symtab && vaddr_to_offset(img, symtab, &dynsym_off) == 0) {
+            uint64_t hash_off;
+            uint8_t hdr[8];
+
+            if (have_hash && vaddr_to_offset(img, hash, &hash_off) == 0 &&
+                elf_read(ef, hash_off, hdr, sizeof(hdr)) == 0) {
+                /* DT_HASH: nbucket, nchain; nchain == number of symbols */
+                dynsym_size = elf_get(ef, hdr + 4, 4) * syment;
+            } else if (have_strtab && strtab > symtab) {
+                /* GNU hash only: .dynstr conventionally follows .dynsym */
+                dynsym_size = (strtab - symtab) / syment * syment;
+            }
+        }
+    }
+
+    if (dynstr_off && dynstr_size) {
+        img->dynstr = read_strtab(ef, dynstr_off, dynstr_size, &img->dynstr_len);
+    }
+    if (dynsym_off && dynsym_size) {
+        size_t syment = ELF_SIZE(ef, Sym);
+        size_t count = (size_t)(dynsym_size / syment);
+        if (count > 65536) count = 65536;
+        img->dynsym = elf_read_alloc(ef, dynsym_off, count * syment);
+        if (img->dynsym) img->dynsym_count = count;
+    }
+
+    return 0;
+}
+
+/* =============================================================================
+ * Security Flags
+ * ============================================================================= */
+
+typedef struct {
+    bool        nx;
+    bool        pie;
+    const char *relro;
+    bool        canary;
+    bool        fortify;
+    bool        stripped;
+    bool        rpath;
+} elf_security_t;
+
+static void elf_security(const elf_image_t *img, elf_security_t *sec)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t phsz = ELF_SIZE(ef, Phdr);
+    bool has_relro = false;
+
+    memset(sec, 0, sizeof(*sec));
+
+    for (size_t i = 0; i < img->phnum; i++) {
+        const uint8_t *ph = img->phdrs + i * phsz;
+        uint32_t ptype = (uint32_t)ELF_FIELD(ef, ph, Phdr, p_type);
+        if (ptype == PT_GNU_STACK) {
+            /* Without PT_GNU_STACK the stack is executable on most arches */
+            sec->nx = !(ELF_FIELD(ef, ph, Phdr, p_flags) & PF_X);
+        } else if (ptype == PT_GNU_RELRO) {
+            has_relro = true;
+        }
+    }
+
+    bool have_flags, have_flags1, have_bindnow;
+    uint64_t flags = dyn_lookup(img, DT_FLAGS, &have_flags);
+    uint64_t flags1 = dyn_lookup(img, DT_FLAGS_1, &have_flags1);
+    dyn_lookup(img, DT_BIND_NOW, &have_bindnow);
+
+    bool now = have_bindnow || (have_flags && (flags & DF_BIND_NOW)) ||
+               (have_flags1 && (flags1 & DF_1_NOW));
+    sec->relro = has_relro ? (now ? "full" : "partial") : "none";
+
+    sec->pie = img->type == ET_DYN &&
+               (img->interp[0] || (have_flags1 && (flags1 & 0x08000000)));  /* DF_1_PIE */
+
+    bool have_rpath, have_runpath;
+    dyn_lookup(img, DT_RPATH, &have_rpath);
+    dyn_lookup(img, DT_RUNPATH, &have_runpath);
+    sec->rpath = have_rpath || have_runpath;
+
+    /* Section headers gone entirely counts as stripped too */
+    sec->stripped = !img->has_symtab;
+
+    size_t syment = ELF_SIZE(ef, Sym);
+    for (size_t i = 0; i < img->dynsym_count; i++) {
+        const uint8_t *sym = img->dynsym + i * syment;
+        const char *name = dynstr_at(img, ELF_FIELD(ef, sym, Sym, st_name));
+        if (!name || !name[0]) continue;
+
+        if (strcmp(name, "__stack_chk_fail") == 0 || strcmp(name, "__stack_chk_guard") == 0) {
+            sec->canary = true;
+        } else if (strncmp(name, "__", 2) == 0) {
+            size_t len = strlen(name);
+            if (len > 4 && strcmp(name + len - 4, "_chk") == 0) {
+                sec->fortify = true;
+            }
+        }
+    }
+}
+
+/* =============================================================================
+ * Encoding
+ * ============================================================================= */
+
+typedef struct {
+    bool   sections;
+    bool   segments;
+    size_t max_syms;
+} elfinfo_opts_t;
+
+static void rb_needed(resp_builder_t *rb, const elf_image_t *img)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t dsz = ELF_SIZE(ef, Dyn);
+    size_t count = 0;
+
+    for (size_t i = 0; i < img->dyn_count; i++) {
+        const uint8_t *d = img->dyn + i * dsz;
+        if ((int64_t)ELF_FIELD(ef, d, Dyn, d_tag) == DT_NEEDED &&
+            dynstr_at(img, ELF_FIELD(ef, d, Dyn, d_un))) {
+            count++;
+        }
+    }
+
+    rb_array(rb, count);
+    for (size_t i = 0; i < img->dyn_count; i++) {
+        const uint8_t *d = img->dyn + i * dsz;
+        if ((int64_t)ELF_FIELD(ef, d, Dyn, d_tag) != DT_NEEDED) continue;
+        const char *name = dynstr_at(img, ELF_FIELD(ef, d, Dyn, d_un));
+        if (name) rb_str(rb, name);
+    }
+}
+
+static void rb_sections(resp_builder_t *rb, const elf_image_t *img)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t shsz = ELF_SIZE(ef, Shdr);
+    char tbuf[16];
+
+    rb_array(rb, img->shnum);
+    for (size_t i = 0; i < img->shnum; i++) {
+        const uint8_t *sh = img->shdrs + i * shsz;
+        rb_map(rb, 6);
+        rb_lit(rb, "name");
+        rb_str(rb, shstr_at(img, ELF_FIELD(ef, sh, Shdr, sh_name)));
+        rb_lit(rb, "type");
+        rb_str(rb, elf_name(section_names, (uint32_t)ELF_FIELD(ef, sh, Shdr, sh_type),
+                            tbuf, sizeof(tbuf)));
+        rb_lit(rb, "addr");
+        rb_uint(rb, ELF_FIELD(ef, sh, Shdr, sh_addr));
+        rb_lit(rb, "offset");
+        rb_uint(rb, ELF_FIELD(ef, sh, Shdr, sh_offset));
+        rb_lit(rb, "size");
+        rb_uint(rb, ELF_FIELD(ef, sh, Shdr, sh_size));
+        rb_lit(rb, "flags");
+        rb_uint(rb, ELF_FIELD(ef, sh, Shdr, sh_flags));
+    }
+}
+
+static void rb_segments(resp_builder_t *rb, const elf_image_t *img)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t phsz = ELF_SIZE(ef, Phdr);
+    char tbuf[16];
+
+    rb_array(rb, img->phnum);
+    for (size_t i = 0; i < img->phnum; i++) {
+        const uint8_t *ph = img->phdrs + i * phsz;
+        uint64_t flags = ELF_FIELD(ef, ph, Phdr, p_flags);
+        char fstr[4] = {
+            (flags & PF_R) ? 'R' : '-',
+            (flags & PF_W) ? 'W' : '-',
+            (flags & PF_X) ? 'X' : '-',
+            '\0',
+        };
+
+        rb_map(rb, 6);
+        rb_lit(rb, "type");
+        rb_str(rb, elf_name(segment_names, (uint32_t)ELF_FIELD(ef, ph, Phdr, p_type),
+                            tbuf, sizeof(tbuf)));
+        rb_lit(rb, "offset");
+        rb_uint(rb, ELF_FIELD(ef, ph, Phdr, p_offset));
+        rb_lit(rb, "vaddr");
+        rb_uint(rb, ELF_FIELD(ef, ph, Phdr, p_vaddr));
+        rb_lit(rb, "filesz");
+        rb_uint(rb, ELF_FIELD(ef, ph, Phdr, p_filesz));
+        rb_lit(rb, "memsz");
+        rb_uint(rb, ELF_FIELD(ef, ph, Phdr, p_memsz));
+        rb_lit(rb, "flags");
+        rb_str(rb, fstr);
+    }
+}
+
+static void rb_symbols(resp_builder_t *rb, const elf_image_t *img, size_t max)
+{
+    const elf_file_t *ef = &img->ef;
+    size_t syment = ELF_SIZE(ef, Sym);
+    size_t count = 0;
+
+    /* Symbol 0 is always the null symbol */
+    for (size_t i = 1; i < img->dynsym_count && count < max; i++) {
+        const char *name = dynstr_at(img, ELF_FIELD(ef, img->dynsym + i * syment, Sym, st_name));
+        if (name && name[0]) count++;
+    }
+
+    rb_array(rb, count);
+    size_t written = 0;
+    for (size_t i = 1; i < img->dynsym_count && written < count; i++) {
+        const uint8_t *sym = img->dynsym + i * syment;
+        const char *name = dynstr_at(img, ELF_FIELD(ef, sym, Sym, st_name));
+        if (!name || !name[0]) continue;
+
+        uint8_t info = (uint8_t)ELF_FIELD(ef, sym, Sym, st_info);
+        uint8_t stype = ELF32_ST_TYPE(info);
+        uint8_t sbind = ELF32_ST_BIND(info);
+        uint16_t shndx = (uint16_t)ELF_FIELD(ef, sym, Sym, st_shndx);
+
+        rb_map(rb, 5);
+        rb_lit(rb, "name");
+        rb_str(rb, name);
+        rb_lit(rb, "type");
+        rb_str(rb, stype < sizeof(sym_type_names) / sizeof(sym_type_names[0]) ?
+                   sym_type_names[stype] : "OTHER");
+        rb_lit(rb, "bind");
+        rb_str(rb, sbind < sizeof(sym_bind_names) / sizeof(sym_bind_names[0]) ?
+                   sym_bind_names[sbind] : "OTHER");
+        rb_lit(rb, "value");
+        rb_uint(rb, ELF_FIELD(ef, sym, Sym, st_value));
+        rb_lit(rb, "defined");
+        rb_bool(rb, shndx != SHN_UNDEF);
+        written++;
+    }
+}
+
+static void rb_elf(resp_builder_t *rb, const char *path, const elf_image_t *img,
+                   const elfinfo_opts_t *opts)
+{
+    const elf_file_t *ef = &img->ef;
+    char mbuf[16], tbuf[16];
+    elf_security_t sec;
+    elf_security(img, &sec);
+
+    bool have_soname;
+    uint64_t soname_idx = dyn_lookup(img, DT_SONAME, &have_soname);
+    const char *soname = have_soname ? dynstr_at(img, soname_idx) : NULL;
+
+    size_t fields = 10;
+    if (img->interp[0]) fields++;
+    if (soname) fields++;
+    if (opts->sections) fields++;
+    if (opts->segments) fields++;
+    if (opts->max_syms) fields++;
+
+    rb_map(rb, fields);
+    rb_lit(rb, "path");
+    rb_str(rb, path);
+    rb_lit(rb, "class");
+    rb_uint(rb, ef->is64 ? 64 : 32);
+    rb_lit(rb, "endian");
+    rb_str(rb, ef->big ? "big" : "little");
+    rb_lit(rb, "type");
+    rb_str(rb, elf_name(type_names, img->type, tbuf, sizeof(tbuf)));
+    rb_lit(rb, "machine");
+    rb_str(rb, elf_name(machine_names, img->machine, mbuf, sizeof(mbuf)));
+    rb_lit(rb, "entry");
+    rb_uint(rb, img->entry);
+    if (img->interp[0]) {
+        rb_lit(rb, "interp");
+        rb_str(rb, img->interp);
+    }
+    if (soname) {
+        rb_lit(rb, "soname");
+        rb_str(rb, soname);
+    }
+    rb_lit(rb, "needed");
+    rb_needed(rb, img);
+
+    rb_lit(rb, "security");
+    rb_map(rb, 7);
+    rb_lit(rb, "nx");
+    rb_bool(rb, sec.nx);
+    rb_lit(rb, "pie");
+    rb_bool(rb, sec.pie);
+    rb_lit(rb, "relro");
+    rb_str(rb, sec.relro);
+    rb_lit(rb, "canary");
+    rb_bool(rb, sec.canary);
+    rb_lit(rb, "fortify");
+    rb_bool(rb, sec.fortify);
+    rb_lit(rb, "stripped");
+    rb_bool(rb, sec.stripped);
+    rb_lit(rb, "rpath");
+    rb_bool(rb, sec.rpath);
+
+    rb_lit(rb, "num_sections");
+    rb_uint(rb, img->shnum);
+    rb_lit(rb, "num_symbols");
+    rb_uint(rb, img->dynsym_count ? img->dynsym_count - 1 : 0);
+
+    if (opts->sections) {
+        rb_lit(rb, "sections");
+        rb_sections(rb, img);
+    }
+    if (opts->segments) {
+        rb_lit(rb, "segments");
+        rb_segments(rb, img);
+    }
+    if (opts->max_syms) {
+        rb_lit(rb, "symbols");
+        rb_symbols(rb, img, opts->max_syms);
+    }
+}
+
+/* =============================================================================
+ * Command: elfinfo
+ *
+ * Request args:
+ *   paths    - array of file paths (or "path" for a single file)
+ *   brief    - if non-zero, skip section/segment tables and symbols
+ *   symbols  - max dynamic symbols per file (default 2048, 0 = none)
+ *
+ * Response: { files: [ {path, class, endian, ...} | {path, error} ] }
+ * ============================================================================= */
+
+int cmd_elfinfo(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    size_t npaths = 0;
+    char **paths = parse_string_array_arg(args, args_len, "paths", &npaths);
+    if (!paths) {
+        char *single = parse_string_arg(args, args_len, "path");
+        if (!single) {
+            return proto_send_error(conn, id, "missing paths argument");
+        }
+        paths = edb_calloc(2, sizeof(char *));
+        if (!paths) {
+            edb_free(single);
+            return proto_send_error(conn, id, "out of memory");
+        }
+        paths[0] = single;
+        npaths = 1;
+    }
+    if (npaths > ELFINFO_MAX_PATHS) {
+        free_string_array(paths);
+        return proto_send_error(conn, id, "too many paths");
+    }
+
+    uint64_t brief = 0;
+    uint64_t max_syms = ELFINFO_DEFAULT_SYMS;
+    parse_uint_arg(args, args_len, "brief", &brief);
+    parse_uint_arg(args, args_len, "symbols", &max_syms);
+
+    elfinfo_opts_t opts;
+    opts.sections = !brief;
+    opts.segments = !brief;
+    opts.max_syms = brief ? 0 : (size_t)max_syms;
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 1024 + npaths * 512) < 0) {
+        free_string_array(paths);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    rb_map(&rb, 1);
+    rb_lit(&rb, "files");
+    rb_array(&rb, npaths);
+
+    for (size_t i = 0; i < npaths; i++) {
+        char *resolved = path_resolve(conn->cwd, paths[i]);
+        if (!resolved) {
+            rb_free(&rb);
+            free_string_array(paths);
+            return proto_send_error(conn, id, "out of memory");
+        }
+
+        elf_image_t img;
+        memset(&img, 0, sizeof(img));
+        char err[128];
+
+        if (elf_load(&img, resolved, err, sizeof(err)) == 0) {
+            rb_elf(&rb, resolved, &img, &opts);
+        } else {
+            rb_map(&rb, 2);
+            rb_lit(&rb, "path");
+            rb_str(&rb, resolved);
+            rb_lit(&rb, "error");
+            rb_str(&rb, err);
+        }
+
+        if (img.ef.fd >= 0) close(img.ef.fd);
+        elf_image_free(&img);
+        edb_free(resolved);
+    }
+    free_string_array(paths);
+
+    if (rb.len > EDB_MAX_MSG_SIZE - 1024) {
+        rb_free(&rb);
+        return proto_send_error(conn, id, "response too large (use brief or fewer paths)");
+    }
+
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    return ret;
+}
@@ -5,45 +5,112 @@
  * Command: exec - Execute a something directly (execv)
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
 #include <errno.h>
 
 #include "edb.h"
 #include "commands.h"
 
-/* Read all data from a file descriptor into a dynamically allocated buffer */
-static char *read_fd_all(int fd, size_t *out_len)
+/* Output captured from one of the child's pipes */
+typedef struct {
+    int     fd;     /* Read end, -1 once at EOF */
+    char   *buf;
+    size_t  len;
+    size_t  cap;
+} capture_t;
+
+/*
+ * Read what is available on a capture's pipe. At most limit bytes are kept;
+ * past that (or once the memory budget is hit) the rest is read and dropped
+ * so the child never blocks on a full pipe, and *truncated is set.
+ * Closes the fd at EOF.
+ */
+static void capture_read(capture_t *c, size_t limit, bool *truncated)
 {
-    char *buf = NULL;
-    size_t cap = 0;
-    size_t len = 0;
     char tmp[4096];
-    ssize_t n;
+    ssize_t n = read(c->fd, tmp, sizeof(tmp));
+    if (n < 0 && errno == EINTR) return;
+    if (n <= 0) {
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
 
-    while ((n = read(fd, tmp, sizeof(tmp))) > 0) {
-        if (len + (size_t)n > cap) {
-            size_t newcap = cap ? cap * 2 : 4096;
-            if (newcap < len + (size_t)n) {
-                newcap = len + (size_t)n;
-            }
-            char *newbuf = realloc(buf, newcap);
-            if (!newbuf) {
-                free(buf);
-                return NULL;
-            }
-            buf = newbuf;
-            cap = newcap;
+    size_t keep = (size_t)n;
+    if (c->len + keep > limit) {
+        keep = limit > c->len ? limit - c->len : 0;
+        *truncated = true;
+    }
+    if (keep == 0) return;
+
+    if (c->len + keep > c->cap) {
+        size_t newcap = c->cap ? c->cap * 2 : 4096;
+        if (newcap < c->len + keep) {
+            newcap = c->len + keep;
+        }
+        if (newcap > limit) {
+            newcap = limit;
         }
-        memcpy(buf + len, tmp, (size_t)n);
-        len += (size_t)n;
+        char *newbuf = edb_realloc(c->buf, newcap);
+        if (!newbuf) {
+            /* Over budget: keep what we have */
+            *truncated = true;
+            return;
+        }
+        c->buf = newbuf;
+        c->cap = newcap;
     }
+    memcpy(c->buf + c->len, tmp, keep);
+    c->len += keep;
+}
 
-    *out_len = len;
-    return buf ? buf : calloc(1, 1);  /* Return empty string if nothing read */
+/* How capture_output() ended */
+typedef enum {
+    CAPTURE_DONE,       /* Child closed both pipes */
+    CAPTURE_DEADLINE,   /* Request deadline_ms passed */
+    CAPTURE_CANCELLED,  /* Client sent a cancel */
+} capture_end_t;
+
+/*
+ * Collect stdout and stderr until the child closes both, watching the
+ * connection for a cancel and the clock for the request deadline.
+ */
+static capture_end_t capture_output(conn_t *conn, uint32_t id, capture_t *out,
+                                    capture_t *err, size_t limit, bool *truncated)
+{
+    while (out->fd >= 0 || err->fd >= 0) {
+        int timeout = proto_time_left(conn);
+        if (timeout == 0) {
+            return CAPTURE_DEADLINE;
+        }
+
+        struct pollfd pfds[3] = {
+            { .fd = out->fd, .events = POLLIN },
+            { .fd = err->fd, .events = POLLIN },
+            { .fd = proto_cancel_fd(conn), .events = POLLIN },
+        };
+
+        if (poll(pfds, 3, timeout) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (pfds[2].revents && proto_cancelled(conn, id)) {
+            return CAPTURE_CANCELLED;
+        }
+        if (pfds[0].revents) capture_read(out, limit, truncated);
+        if (pfds[1].revents) capture_read(err, limit, truncated);
+    }
+
+    return CAPTURE_DONE;
 }
 
 /* Parse command string into argv array (space-separated) */
@@ -51,7 +118,7 @@ static char **parse_argv(char *cmd, int *argc_out)
 {
     int argc = 0;
     int cap = 16;
-    char **argv = malloc((size_t)cap * sizeof(char *));
+    char **argv = edb_malloc((size_t)cap * sizeof(char *));
     if (!argv) return NULL;
 
     char *p = cmd;
@@ -75,9 +142,9 @@ static char **parse_argv(char *cmd, int *argc_out)
         /* Grow argv if needed */
         if (argc >= cap - 1) {
             cap *= 2;
-            char **newargv = realloc(argv, (size_t)cap * sizeof(char *));
+            char **newargv = edb_realloc(argv, (size_t)cap * sizeof(char *));
             if (!newargv) {
-                free(argv);
+                edb_free(argv);
                 return NULL;
             }
             argv = newargv;
@@ -104,8 +171,8 @@ int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     int argc;
     char **argv = parse_argv(command, &argc);
     if (!argv || argc == 0) {
-        free(command);
-        free(argv);
+        edb_free(command);
+        edb_free(argv);
         return proto_send_error(conn, id, "invalid command");
     }
 
@@ -116,16 +183,16 @@ int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     int stdout_pipe[2], stderr_pipe[2];
     if (pipe(stdout_pipe) < 0) {
         int err = errno;
-        free(command);
-        free(argv);
+        edb_free(command);
+        edb_free(argv);
         return proto_send_error(conn, id, strerror(err));
     }
     if (pipe(stderr_pipe) < 0) {
         int err = errno;
         close(stdout_pipe[0]);
         close(stdout_pipe[1]);
-        free(command);
-        free(argv);
+        edb_free(command);
+        edb_free(argv);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -136,8 +203,8 @@ int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         close(stdout_pipe[1]);
         close(stderr_pipe[0]);
         close(stderr_pipe[1]);
-        free(command);
-        free(argv);
+        edb_free(command);
+        edb_free(argv);
         return proto_send_error(conn, id, strerror(err));
     }
 
@@ -169,13 +236,26 @@ int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     close(stdout_pipe[1]);  /* Close write ends */
     close(stderr_pipe[1]);
 
-    /* Read stdout and stderr */
-    size_t stdout_len = 0, stderr_len = 0;
-    char *stdout_buf = read_fd_all(stdout_pipe[0], &stdout_len);
-    char *stderr_buf = read_fd_all(stderr_pipe[0], &stderr_len);
+    /*
+     * Read stdout and stderr. Each may use a quarter of the free budget, so
+     * both plus the response built from them still fit.
+     */
+    size_t limit = mem_available() / 4;
+    if (limit > EDB_MAX_MSG_SIZE / 2 - 1024) {
+        limit = EDB_MAX_MSG_SIZE / 2 - 1024;
+    }
+
+    bool truncated = false;
+    capture_t out = { .fd = stdout_pipe[0] };
+    capture_t err = { .fd = stderr_pipe[0] };
+    capture_end_t end = capture_output(conn, id, &out, &err, limit, &truncated);
 
-    close(stdout_pipe[0]);
-    close(stderr_pipe[0]);
+    if (end != CAPTURE_DONE) {
+        /* Don't leave the child running or unreaped */
+        kill(pid, SIGKILL);
+        if (out.fd >= 0) close(out.fd);
+        if (err.fd >= 0) close(err.fd);
+    }
 
     /* Wait for child to finish */
     int status = 0;
@@ -188,39 +268,54 @@ int cmd_exec(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         exit_code = 128 + WTERMSIG(status);
     }
 
-    free(command);
-    free(argv);
+    edb_free(command);
+    edb_free(argv);
 
-    if (!stdout_buf || !stderr_buf) {
-        free(stdout_buf);
-        free(stderr_buf);
-        return proto_send_error(conn, id, "out of memory");
+    char *stdout_buf = out.buf;
+    char *stderr_buf = err.buf;
+    size_t stdout_len = out.len;
+    size_t stderr_len = err.len;
+
+    if (end == CAPTURE_DEADLINE) {
+        /* Out of time: send what the child wrote so far */
+        LOG("exec: deadline passed, killed pid %d", (int)pid);
+        truncated = true;
+    }
+
+    if (end == CAPTURE_CANCELLED) {
+        LOG("exec: cancelled, killed pid %d", (int)pid);
+        edb_free(stdout_buf);
+        edb_free(stderr_buf);
+        return proto_send_error(conn, id, "cancelled");
     }
 
-    LOG("exec: exit_code=%d, stdout=%zu bytes, stderr=%zu bytes",
-        exit_code, stdout_len, stderr_len);
+    LOG("exec: exit_code=%d, stdout=%zu bytes, stderr=%zu bytes%s",
+        exit_code, stdout_len, stderr_len, truncated ? " (truncated)" : "");
 
-    /* Build response: { stdout: bytes, stderr: bytes, exit_code: int } */
+    /* Build response: { stdout: bytes, stderr: bytes, exit_code: int, truncated: bool } */
     resp_builder_t rb;
     if (rb_init(&rb, 256 + stdout_len + stderr_len) < 0) {
-        free(stdout_buf);
-        free(stderr_buf);
+        edb_free(stdout_buf);
+        edb_free(stderr_buf);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    rb_map(&rb, 3);
+    rb_map(&rb, 4);
 
-    rb_str(&rb, "stdout");
+    rb_lit(&rb, "stdout");
     rb_bin(&rb, (uint8_t *)stdout_buf, stdout_len);
 
-    rb_str(&rb, "stderr");
+    rb_lit(&rb, "stderr");
     rb_bin(&rb, (uint8_t *)stderr_buf, stderr_len);
 
-    rb_str(&rb, "exit_code");
+    rb_lit(&rb, "exit_code");
     rb_uint(&rb, (uint64_t)exit_code);
 
-    free(stdout_buf);
-    free(stderr_buf);
+    rb_lit(&rb, "truncated");
+    rb_bool(&rb, truncated);
+
+    edb_free(stdout_buf);
+    edb_free(stderr_buf);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
@@ -207,7 +207,7 @@ int cmd_ip_addr(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "content");
+    rb_lit(&rb, "content");
     rb_bin(&rb, (uint8_t *)output, offset);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
@@ -305,7 +305,7 @@ int cmd_ip_route(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "content");
+    rb_lit(&rb, "content");
     rb_bin(&rb, (uint8_t *)output, offset);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
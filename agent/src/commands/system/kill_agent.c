@@ -43,7 +43,7 @@ int cmd_kill_agent(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_l
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "killed_pid");
+    rb_lit(&rb, "killed_pid");
     rb_uint(&rb, (uint64_t)ppid);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
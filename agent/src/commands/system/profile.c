@@ -0,0 +1,866 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: profile - Sample CPU usage with perf_event_open
+ *
+ * Opens one sampling event per CPU (either for a single pid or system-wide),
+ * drains the perf mmap ring buffers and streams compact sample records to
+ * the client. When sampling finishes, samples are aggregated on the device
+ * and a top-symbols summary is sent as a final response.
+ *
+ * Works on targets without the perf userspace tool, as long as the kernel
+ * was built with CONFIG_PERF_EVENTS.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "edb.h"
+#include "commands.h"
+
+#define PROFILE_DEFAULT_FREQ      99
+#define PROFILE_MAX_FREQ          10000
+#define PROFILE_DEFAULT_DURATION  1000      /* ms */
+#define PROFILE_MAX_DURATION      60000     /* ms */
+#define PROFILE_DEFAULT_TOP       20
+#define PROFILE_MAX_STACK         16        /* callchain entries streamed per sample */
+#define PROFILE_RING_PAGES        8         /* data pages per CPU, must be a power of 2 */
+
+/* =============================================================================
+ * Per-CPU perf event
+ * ============================================================================= */
+
+typedef struct {
+    int       fd;
+    uint8_t  *base;     /* mmap'd metadata page + ring */
+    size_t    map_len;
+} perf_cpu_t;
+
+static long sys_perf_event_open(struct perf_event_attr *attr, pid_t pid,
+                                int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/* =============================================================================
+ * Sample aggregation
+ *
+ * Samples are counted per (pid, ip) in an open-addressing hash table while
+ * sampling runs. Symbolization happens once at the end, over unique ips only.
+ * ============================================================================= */
+
+typedef struct {
+    uint64_t ip;
+    uint32_t pid;
+    uint32_t count;
+    bool     kernel;
+    char    *sym;       /* Filled in by symbolization */
+    char    *module;
+} prof_entry_t;
+
+typedef struct {
+    prof_entry_t *slots;
+    size_t        cap;      /* power of 2 */
+    size_t        used;
+} prof_table_t;
+
+static size_t prof_hash(uint64_t ip, uint32_t pid)
+{
+    uint64_t h = ip ^ ((uint64_t)pid << 32);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+static int prof_table_init(prof_table_t *t, size_t cap)
+{
+    t->slots = edb_calloc(cap, sizeof(prof_entry_t));
+    if (!t->slots) return -1;
+    t->cap = cap;
+    t->used = 0;
+    return 0;
+}
+
+static int prof_table_grow(prof_table_t *t)
+{
+    prof_table_t nt;
+    if (prof_table_init(&nt, t->cap * 2) < 0) return -1;
+
+    for (size_t i = 0; i < t->cap; i++) {
+        prof_entry_t *e = &t->slots[i];
+        if (e->count == 0) continue;
+        size_t j = prof_hash(e->ip, e->pid) & (nt.cap - 1);
+        while (nt.slots[j].count != 0) j = (j + 1) & (nt.cap - 1);
+        nt.slots[j] = *e;
+        nt.used++;
+    }
+
+    edb_free(t->slots);
+    *t = nt;
+    return 0;
+}
+
+static int prof_table_add(prof_table_t *t, uint64_t ip, uint32_t pid, bool kernel)
+{
+    if ((t->used + 1) * 4 > t->cap * 3) {
+        if (prof_table_grow(t) < 0) return -1;
+    }
+
+    size_t j = prof_hash(ip, pid) & (t->cap - 1);
+    while (t->slots[j].count != 0) {
+        if (t->slots[j].ip == ip && t->slots[j].pid == pid) {
+            t->slots[j].count++;
+            return 0;
+        }
+        j = (j + 1) & (t->cap - 1);
+    }
+
+    t->slots[j].ip = ip;
+    t->slots[j].pid = pid;
+    t->slots[j].kernel = kernel;
+    t->slots[j].count = 1;
+    t->used++;
+    return 0;
+}
+
+/* =============================================================================
+ * User-space symbolization via /proc/[pid]/maps
+ *
+ * Without symbol tables we resolve user addresses to "module+0xoffset" where
+ * offset is the file offset, which the client can map back to a local copy of
+ * the binary. Maps are snapshotted the first time a pid is seen, so samples
+ * from short-lived processes still resolve.
+ * ============================================================================= */
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t offset;
+    char     name[128];
+} map_region_t;
+
+typedef struct {
+    uint32_t      pid;
+    map_region_t *regions;
+    size_t        count;
+} pid_maps_t;
+
+typedef struct {
+    pid_maps_t *procs;
+    size_t      count;
+    size_t      cap;
+} maps_cache_t;
+
+static pid_maps_t *maps_lookup(maps_cache_t *mc, uint32_t pid)
+{
+    for (size_t i = 0; i < mc->count; i++) {
+        if (mc->procs[i].pid == pid) return &mc->procs[i];
+    }
+    return NULL;
+}
+
+static void maps_load(maps_cache_t *mc, uint32_t pid)
+{
+    if (pid == 0 || maps_lookup(mc, pid)) return;
+
+    if (mc->count >= mc->cap) {
+        size_t ncap = mc->cap ? mc->cap * 2 : 32;
+        pid_maps_t *np = edb_realloc(mc->procs, ncap * sizeof(pid_maps_t));
+        if (!np) return;
+        mc->procs = np;
+        mc->cap = ncap;
+    }
+
+    pid_maps_t *pm = &mc->procs[mc->count++];
+    pm->pid = pid;
+    pm->regions = NULL;
+    pm->count = 0;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%u/maps", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    size_t cap = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long start, end, offset;
+        char perms[8];
+        int name_pos = 0;
+
+        /* Format: start-end perms offset dev inode [path] */
+        if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n",
+                   &start, &end, perms, &offset, &name_pos) < 4) {
+            continue;
+        }
+        if (perms[2] != 'x') continue;  /* Only executable mappings */
+
+        if (pm->count >= cap) {
+            size_t ncap = cap ? cap * 2 : 16;
+            map_region_t *nr = edb_realloc(pm->regions, ncap * sizeof(map_region_t));
+            if (!nr) break;
+            pm->regions = nr;
+            cap = ncap;
+        }
+
+        map_region_t *r = &pm->regions[pm->count++];
+        r->start = start;
+        r->end = end;
+        r->offset = offset;
+
+        const char *name = name_pos > 0 ? line + name_pos : "";
+        const char *slash = strrchr(name, '/');
+        if (slash) name = slash + 1;
+        safe_strcpy(r->name, name[0] ? name : "[anon]", sizeof(r->name));
+        r->name[strcspn(r->name, "\n")] = '\0';
+    }
+    fclose(f);
+}
+
+static void maps_free(maps_cache_t *mc)
+{
+    for (size_t i = 0; i < mc->count; i++) {
+        edb_free(mc->procs[i].regions);
+    }
+    edb_free(mc->procs);
+}
+
+static void symbolize_user(maps_cache_t *mc, prof_entry_t *e)
+{
+    char buf[160];
+    pid_maps_t *pm = maps_lookup(mc, e->pid);
+
+    if (pm) {
+        for (size_t i = 0; i < pm->count; i++) {
+            map_region_t *r = &pm->regions[i];
+            if (e->ip >= r->start && e->ip < r->end) {
+                snprintf(buf, sizeof(buf), "%s+0x%llx", r->name,
+                         (unsigned long long)(e->ip - r->start + r->offset));
+                e->sym = edb_strdup(buf);
+                e->module = edb_strdup(r->name);
+                return;
+            }
+        }
+    }
+
+    snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)e->ip);
+    e->sym = edb_strdup(buf);
+    e->module = edb_strdup("[unknown]");
+}
+
+/* =============================================================================
+ * Kernel symbolization via /proc/kallsyms
+ *
+ * Two passes keep memory bounded: first collect text symbol addresses only and
+ * resolve each kernel ip to the nearest preceding symbol, then re-read the file
+ * to fetch names for just the addresses that were hit.
+ * ============================================================================= */
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static bool kallsyms_is_text(char type)
+{
+    return type == 't' || type == 'T' || type == 'w' || type == 'W';
+}
+
+static void symbolize_kernel(prof_entry_t *entries, size_t n)
+{
+    size_t nkernel = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (entries[i].kernel) nkernel++;
+    }
+    if (nkernel == 0) return;
+
+    FILE *f = fopen("/proc/kallsyms", "r");
+    if (!f) return;
+
+    /* Pass 1: text symbol addresses */
+    uint64_t *addrs = NULL;
+    size_t naddrs = 0, cap = 0;
+    char line[256];
+
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long addr;
+        char type;
+        if (sscanf(line, "%llx %c", &addr, &type) != 2) continue;
+        if (addr == 0 || !kallsyms_is_text(type)) continue;  /* kptr_restrict hides addresses as 0 */
+
+        if (naddrs >= cap) {
+            size_t ncap = cap ? cap * 2 : 4096;
+            uint64_t *na = edb_realloc(addrs, ncap * sizeof(uint64_t));
+            if (!na) break;
+            addrs = na;
+            cap = ncap;
+        }
+        addrs[naddrs++] = addr;
+    }
+
+    if (naddrs == 0) {
+        edb_free(addrs);
+        fclose(f);
+        return;
+    }
+    qsort(addrs, naddrs, sizeof(uint64_t), cmp_u64);
+
+    /* Resolve each kernel ip to its symbol start address */
+    uint64_t *wanted = edb_malloc(nkernel * sizeof(uint64_t));
+    uint64_t *entry_sym = edb_malloc(n * sizeof(uint64_t));
+    if (!wanted || !entry_sym) {
+        edb_free(wanted);
+        edb_free(entry_sym);
+        edb_free(addrs);
+        fclose(f);
+        return;
+    }
+
+    size_t nwanted = 0;
+    for (size_t i = 0; i < n; i++) {
+        entry_sym[i] = 0;
+        if (!entries[i].kernel) continue;
+
+        size_t lo = 0, hi = naddrs;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (addrs[mid] <= entries[i].ip) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == 0) continue;
+        entry_sym[i] = addrs[lo - 1];
+        wanted[nwanted++] = addrs[lo - 1];
+    }
+    edb_free(addrs);
+    qsort(wanted, nwanted, sizeof(uint64_t), cmp_u64);
+
+    /* Pass 2: names for the symbols that were hit */
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long addr;
+        char type;
+        char name[128];
+        if (sscanf(line, "%llx %c %127s", &addr, &type, name) != 3) continue;
+        if (!kallsyms_is_text(type)) continue;
+        if (!bsearch(&(uint64_t){ addr }, wanted, nwanted, sizeof(uint64_t), cmp_u64)) continue;
+
+        for (size_t i = 0; i < n; i++) {
+            if (entry_sym[i] == addr && !entries[i].sym) {
+                entries[i].sym = edb_strdup(name);
+            }
+        }
+    }
+    fclose(f);
+    edb_free(wanted);
+    edb_free(entry_sym);
+}
+
+static int cmp_entry_sym(const void *a, const void *b)
+{
+    const prof_entry_t *x = a, *y = b;
+    return strcmp(x->sym, y->sym);
+}
+
+static int cmp_entry_module(const void *a, const void *b)
+{
+    const prof_entry_t *x = a, *y = b;
+    return strcmp(x->module, y->module);
+}
+
+static int cmp_entry_count(const void *a, const void *b)
+{
+    const prof_entry_t *x = a, *y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Merge entries with equal keys (sorted by cmp), then sort by count.
+ * Returns the number of merged entries at the front of the array.
+ */
+static size_t merge_by(prof_entry_t *e, size_t n,
+                       int (*cmp)(const void *, const void *))
+{
+    if (n == 0) return 0;
+    qsort(e, n, sizeof(prof_entry_t), cmp);
+
+    size_t out = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (cmp(&e[out], &e[i]) == 0) {
+            e[out].count += e[i].count;
+        } else {
+            e[++out] = e[i];
+        }
+    }
+    out++;
+
+    qsort(e, out, sizeof(prof_entry_t), cmp_entry_count);
+    return out;
+}
+
+/* =============================================================================
+ * Sample streaming
+ *
+ * Records are packed big-endian, like the rest of the wire protocol:
+ *   u32 pid, u32 tid, u64 ip, u8 nr, nr x u64 callchain
+ * and batched into EDB_CHUNK_SIZE data messages.
+ * ============================================================================= */
+
+typedef struct {
+    conn_t  *conn;
+    uint32_t id;
+    uint32_t seq;
+    uint8_t  buf[EDB_CHUNK_SIZE];
+    size_t   len;
+    bool     failed;
+} sample_stream_t;
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+static void put_be64(uint8_t *p, uint64_t v)
+{
+    put_be32(p, (uint32_t)(v >> 32));
+    put_be32(p + 4, (uint32_t)v);
+}
+
+static int stream_flush(sample_stream_t *s, bool done)
+{
+    if (s->failed) return -1;
+    if (s->len == 0 && !done) return 0;
+
+    if (proto_send_data(s->conn, s->id, s->seq++, s->buf, s->len, done) < 0) {
+        s->failed = true;
+        return -1;
+    }
+    s->len = 0;
+    return 0;
+}
+
+static int stream_sample(sample_stream_t *s, uint32_t pid, uint32_t tid,
+                         uint64_t ip, const uint64_t *chain, uint8_t nr)
+{
+    size_t need = 17 + (size_t)nr * 8;
+    if (s->len + need > sizeof(s->buf)) {
+        if (stream_flush(s, false) < 0) return -1;
+    }
+
+    uint8_t *p = s->buf + s->len;
+    put_be32(p, pid);
+    put_be32(p + 4, tid);
+    put_be64(p + 8, ip);
+    p[16] = nr;
+    for (uint8_t i = 0; i < nr; i++) {
+        put_be64(p + 17 + (size_t)i * 8, chain[i]);
+    }
+    s->len += need;
+    return 0;
+}
+
+/* =============================================================================
+ * Ring buffer draining
+ * ============================================================================= */
+
+typedef struct {
+    prof_table_t     table;
+    maps_cache_t     maps;
+    sample_stream_t *stream;
+    uint64_t         samples;
+    uint64_t         lost;
+} profile_state_t;
+
+/* Copy len bytes from the ring at offset pos, handling wrap-around */
+static void ring_copy(const uint8_t *data, size_t data_size, uint64_t pos,
+                      void *dst, size_t len)
+{
+    size_t off = (size_t)(pos & (data_size - 1));
+    size_t first = data_size - off;
+    if (first > len) first = len;
+    memcpy(dst, data + off, first);
+    if (len > first) {
+        memcpy((uint8_t *)dst + first, data, len - first);
+    }
+}
+
+static void handle_sample(profile_state_t *st, const uint8_t *rec, size_t len, uint16_t misc)
+{
+    /* sample_type = IP | TID | CALLCHAIN */
+    if (len < 8 + 8 + 8) return;
+
+    uint64_t ip, nr;
+    uint32_t pid, tid;
+    memcpy(&ip, rec, 8);
+    memcpy(&pid, rec + 8, 4);
+    memcpy(&tid, rec + 12, 4);
+    memcpy(&nr, rec + 16, 8);
+
+    if (nr > (len - 24) / 8) nr = (len - 24) / 8;
+    const uint8_t *chain_raw = rec + 24;
+
+    /* Drop PERF_CONTEXT_* markers from the callchain and cap its depth */
+    uint64_t chain[PROFILE_MAX_STACK];
+    uint8_t depth = 0;
+    for (uint64_t i = 0; i < nr && depth < PROFILE_MAX_STACK; i++) {
+        uint64_t addr;
+        memcpy(&addr, chain_raw + i * 8, 8);
+        if (addr >= (uint64_t)PERF_CONTEXT_MAX) continue;
+        chain[depth++] = addr;
+    }
+
+    bool kernel = (misc & PERF_RECORD_MISC_CPUMODE_MASK) == PERF_RECORD_MISC_KERNEL;
+
+    st->samples++;
+    if (!kernel) maps_load(&st->maps, pid);
+    prof_table_add(&st->table, ip, kernel ? 0 : pid, kernel);
+    stream_sample(st->stream, pid, tid, ip, chain, depth);
+}
+
+static void drain_ring(profile_state_t *st, perf_cpu_t *pc, size_t page_size)
+{
+    struct perf_event_mmap_page *meta = (struct perf_event_mmap_page *)pc->base;
+    uint8_t *data = pc->base + page_size;
+    size_t data_size = pc->map_len - page_size;
+
+    uint64_t head = meta->data_head;
+    __sync_synchronize();   /* Read data only after reading data_head */
+    uint64_t tail = meta->data_tail;
+
+    uint8_t rec[4096];
+    while (tail < head) {
+        struct perf_event_header hdr;
+        ring_copy(data, data_size, tail, &hdr, sizeof(hdr));
+        if (hdr.size < sizeof(hdr)) break;  /* Corrupt ring, give up on it */
+
+        size_t body = hdr.size - sizeof(hdr);
+        if (body <= sizeof(rec)) {
+            ring_copy(data, data_size, tail + sizeof(hdr), rec, body);
+
+            if (hdr.type == PERF_RECORD_SAMPLE) {
+                handle_sample(st, rec, body, hdr.misc);
+            } else if (hdr.type == PERF_RECORD_LOST && body >= 16) {
+                uint64_t lost;
+                memcpy(&lost, rec + 8, 8);
+                st->lost += lost;
+            }
+        }
+        tail += hdr.size;
+    }
+
+    __sync_synchronize();   /* Finish reading before releasing the space */
+    meta->data_tail = tail;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* =============================================================================
+ * Command: profile
+ *
+ * Protocol:
+ *   1. Client sends: { cmd: "profile", args: { pid, duration, freq, event, top } }
+ *   2. Agent sends:  { ok: true, data: { cpus, freq, duration } }
+ *   3. Agent sends:  { type: "data", data: <packed samples>, done: false } ...
+ *   4. Agent sends:  { type: "data", data: <packed samples>, done: true }
+ *   5. Agent sends:  { ok: true, data: { samples, lost, top: [...], modules: [...] } }
+ * ============================================================================= */
+
+int cmd_profile(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    uint64_t pid = 0;           /* 0 = system-wide */
+    uint64_t duration = PROFILE_DEFAULT_DURATION;
+    uint64_t freq = PROFILE_DEFAULT_FREQ;
+    uint64_t top = PROFILE_DEFAULT_TOP;
+
+    parse_uint_arg(args, args_len, "pid", &pid);
+    parse_uint_arg(args, args_len, "duration", &duration);
+    parse_uint_arg(args, args_len, "freq", &freq);
+    parse_uint_arg(args, args_len, "top", &top);
+
+    if (duration == 0 || duration > PROFILE_MAX_DURATION) duration = PROFILE_DEFAULT_DURATION;
+    if (freq == 0 || freq > PROFILE_MAX_FREQ) freq = PROFILE_DEFAULT_FREQ;
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_CPU_CLOCK;
+
+    char *event = parse_string_arg(args, args_len, "event");
+    if (event) {
+        if (strcmp(event, "cycles") == 0) {
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        } else if (strcmp(event, "cpu-clock") != 0) {
+            edb_free(event);
+            return proto_send_error(conn, id, "unknown event (use cpu-clock or cycles)");
+        }
+        edb_free(event);
+    }
+
+    attr.freq = 1;
+    attr.sample_freq = freq;
+    attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+    attr.disabled = 1;
+    attr.inherit = pid != 0;    /* Follow threads/children of the target */
+    attr.exclude_hv = 1;
+    attr.watermark = 1;
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (page_size <= 0) page_size = 4096;
+    if (ncpus <= 0) ncpus = 1;
+
+    size_t map_len = (size_t)page_size * (1 + PROFILE_RING_PAGES);
+    attr.wakeup_watermark = (uint32_t)((size_t)page_size * PROFILE_RING_PAGES / 4);
+
+    perf_cpu_t *cpus = edb_calloc((size_t)ncpus, sizeof(perf_cpu_t));
+    struct pollfd *pfds = edb_calloc((size_t)ncpus, sizeof(struct pollfd));
+    if (!cpus || !pfds) {
+        edb_free(cpus);
+        edb_free(pfds);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    /* Open one event per CPU; offline CPUs fail with ENODEV and are skipped */
+    int nopen = 0;
+    int open_err = 0;
+    for (long cpu = 0; cpu < ncpus; cpu++) {
+        long fd = sys_perf_event_open(&attr, pid ? (pid_t)pid : -1, (int)cpu, -1, 0);
+        if (fd < 0) {
+            if (errno != ENODEV) open_err = errno;
+            continue;
+        }
+
+        void *base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, (int)fd, 0);
+        if (base == MAP_FAILED) {
+            open_err = errno;
+            close((int)fd);
+            continue;
+        }
+
+        cpus[nopen].fd = (int)fd;
+        cpus[nopen].base = base;
+        cpus[nopen].map_len = map_len;
+        pfds[nopen].fd = (int)fd;
+        pfds[nopen].events = POLLIN;
+        nopen++;
+    }
+
+    if (nopen == 0) {
+        edb_free(cpus);
+        edb_free(pfds);
+        if (open_err == EACCES || open_err == EPERM) {
+            return proto_send_error(conn, id,
+                "permission denied (check /proc/sys/kernel/perf_event_paranoid)");
+        }
+        if (open_err == ENOENT || open_err == ENOSYS || open_err == EOPNOTSUPP) {
+            return proto_send_error(conn, id, "perf events not supported by this kernel");
+        }
+        return proto_send_error(conn, id, strerror(open_err ? open_err : ENODEV));
+    }
+
+    LOG("profile: pid=%lu cpus=%d freq=%lu duration=%lums",
+        (unsigned long)pid, nopen, (unsigned long)freq, (unsigned long)duration);
+
+    profile_state_t st;
+    memset(&st, 0, sizeof(st));
+
+    sample_stream_t *stream = edb_calloc(1, sizeof(sample_stream_t));
+    int ret = 0;
+
+    if (!stream || prof_table_init(&st.table, 1024) < 0) {
+        ret = proto_send_error(conn, id, "out of memory");
+        goto cleanup;
+    }
+    stream->conn = conn;
+    stream->id = id;
+    st.stream = stream;
+
+    /* Initial response: sampling parameters */
+    resp_builder_t rb;
+    if (rb_init(&rb, 64) < 0) {
+        ret = proto_send_error(conn, id, "out of memory");
+        goto cleanup;
+    }
+    rb_map(&rb, 3);
+    rb_lit(&rb, "cpus");
+    rb_uint(&rb, (uint64_t)nopen);
+    rb_lit(&rb, "freq");
+    rb_uint(&rb, freq);
+    rb_lit(&rb, "duration");
+    rb_uint(&rb, duration);
+    ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    if (ret < 0) goto cleanup;
+
+    for (int i = 0; i < nopen; i++) {
+        ioctl(cpus[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    /*
+     * Sample until the duration elapses (or the client cancels, which ends
+     * sampling early with the summary so far), draining rings as they fill
+     */
+    uint64_t deadline = now_ms() + duration;
+    while (!stream->failed) {
+        uint64_t now = now_ms();
+        if (now >= deadline) break;
+        if (proto_cancelled(conn, id)) break;
+
+        uint64_t wait = deadline - now;
+        if (wait > 100) wait = 100;
+        poll(pfds, (nfds_t)nopen, (int)wait);
+
+        for (int i = 0; i < nopen; i++) {
+            drain_ring(&st, &cpus[i], (size_t)page_size);
+        }
+    }
+
+    for (int i = 0; i < nopen; i++) {
+        ioctl(cpus[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        drain_ring(&st, &cpus[i], (size_t)page_size);
+    }
+
+    if (stream_flush(stream, true) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    LOG("profile: %lu samples, %lu lost, %zu unique ips",
+        (unsigned long)st.samples, (unsigned long)st.lost, st.table.used);
+
+    /* Compact the table and symbolize unique ips */
+    prof_entry_t *entries = st.table.slots;
+    size_t n = 0;
+    for (size_t i = 0; i < st.table.cap; i++) {
+        if (entries[i].count) entries[n++] = entries[i];
+    }
+
+    symbolize_kernel(entries, n);
+    for (size_t i = 0; i < n; i++) {
+        if (!entries[i].kernel) {
+            symbolize_user(&st.maps, &entries[i]);
+            continue;
+        }
+        if (!entries[i].sym) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)entries[i].ip);
+            entries[i].sym = edb_strdup(buf);
+        }
+        entries[i].module = edb_strdup("[kernel]");
+    }
+
+    /*
+     * Merging moves entries around and drops duplicates, so remember every
+     * string up front and free them all once the summary is sent.
+     */
+    char **owned = edb_malloc((n ? n : 1) * 2 * sizeof(char *));
+    prof_entry_t *mods = edb_malloc((n ? n : 1) * sizeof(prof_entry_t));
+    if (!owned || !mods) {
+        for (size_t i = 0; i < n; i++) {
+            edb_free(entries[i].sym);
+            edb_free(entries[i].module);
+        }
+        edb_free(owned);
+        edb_free(mods);
+        ret = proto_send_error(conn, id, "out of memory");
+        goto cleanup;
+    }
+
+    size_t nowned = 0;
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        owned[nowned++] = entries[i].sym;
+        owned[nowned++] = entries[i].module;
+        if (entries[i].sym && entries[i].module) {
+            entries[m++] = entries[i];   /* Drop entries whose strings failed to allocate */
+        }
+    }
+    n = m;
+
+    memcpy(mods, entries, n * sizeof(prof_entry_t));
+    size_t nmods = merge_by(mods, n, cmp_entry_module);
+    size_t nsyms = merge_by(entries, n, cmp_entry_sym);
+
+    if (nsyms > top) nsyms = (size_t)top;
+    if (nmods > top) nmods = (size_t)top;
+
+    /* Final response: aggregated summary */
+    if (rb_init(&rb, 256 + nsyms * 64 + nmods * 32) < 0) {
+        ret = proto_send_error(conn, id, "out of memory");
+    } else {
+        rb_map(&rb, 4);
+
+        rb_lit(&rb, "samples");
+        rb_uint(&rb, st.samples);
+
+        rb_lit(&rb, "lost");
+        rb_uint(&rb, st.lost);
+
+        rb_lit(&rb, "top");
+        rb_array(&rb, nsyms);
+        for (size_t i = 0; i < nsyms; i++) {
+            rb_map(&rb, 3);
+            rb_lit(&rb, "sym");
+            rb_str(&rb, entries[i].sym);
+            rb_lit(&rb, "module");
+            rb_str(&rb, entries[i].module);
+            rb_lit(&rb, "count");
+            rb_uint(&rb, entries[i].count);
+        }
+
+        rb_lit(&rb, "modules");
+        rb_array(&rb, nmods);
+        for (size_t i = 0; i < nmods; i++) {
+            rb_map(&rb, 2);
+            rb_lit(&rb, "name");
+            rb_str(&rb, mods[i].module);
+            rb_lit(&rb, "count");
+            rb_uint(&rb, mods[i].count);
+        }
+
+        ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+        rb_free(&rb);
+    }
+
+    for (size_t i = 0; i < nowned; i++) {
+        edb_free(owned[i]);
+    }
+    edb_free(owned);
+    edb_free(mods);
+
+cleanup:
+    for (int i = 0; i < nopen; i++) {
+        munmap(cpus[i].base, cpus[i].map_len);
+        close(cpus[i].fd);
+    }
+    edb_free(cpus);
+    edb_free(pfds);
+    edb_free(stream);
+    edb_free(st.table.slots);
+    maps_free(&st.maps);
+    return ret;
+}
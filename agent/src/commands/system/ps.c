@@ -118,20 +118,26 @@ int cmd_ps(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     proc_info_t *procs = NULL;
     size_t nprocs = 0;
     size_t capacity = 256;
+    bool truncated = false;
 
     proc = opendir("/proc");
     if (!proc) {
         return proto_send_error(conn, id, strerror(errno));
     }
 
-    procs = malloc(capacity * sizeof(proc_info_t));
+    procs = edb_malloc(capacity * sizeof(proc_info_t));
     if (!procs) {
         closedir(proc);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    /* Enumerate /proc for PIDs */
+    /* Enumerate /proc for PIDs, up to the request deadline */
     while ((entry = readdir(proc)) != NULL) {
+        if (proto_expired(conn)) {
+            truncated = true;
+            break;
+        }
+
         /* Skip non-numeric entries */
         if (!isdigit((unsigned char)entry->d_name[0])) {
             continue;
@@ -145,9 +151,9 @@ int cmd_ps(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         /* Grow array if needed */
         if (nprocs >= capacity) {
             capacity *= 2;
-            proc_info_t *tmp = realloc(procs, capacity * sizeof(proc_info_t));
+            proc_info_t *tmp = edb_realloc(procs, capacity * sizeof(proc_info_t));
             if (!tmp) {
-                free(procs);
+                edb_free(procs);
                 closedir(proc);
                 return proto_send_error(conn, id, "out of memory");
             }
@@ -161,17 +167,20 @@ int cmd_ps(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
     closedir(proc);
 
-    LOG("ps: found %zu processes", nprocs);
+    LOG("ps: found %zu processes%s", nprocs, truncated ? " (deadline)" : "");
 
-    /* Build response: { "processes": [ { pid, ppid, name, state, cmdline }, ... ] } */
+    /*
+     * Build response:
+     * { "processes": [ { pid, ppid, name, state, cmdline }, ... ], "truncated": bool }
+     */
     resp_builder_t rb;
     if (rb_init(&rb, 8192) < 0) {
-        free(procs);
+        edb_free(procs);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    rb_map(&rb, 1);
-    rb_str(&rb, "processes");
+    rb_map(&rb, 2);
+    rb_lit(&rb, "processes");
 
     /* Array of processes */
     rb_array(&rb, nprocs);
@@ -179,24 +188,27 @@ int cmd_ps(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     for (size_t i = 0; i < nprocs; i++) {
         rb_map(&rb, 5);
 
-        rb_str(&rb, "pid");
+        rb_lit(&rb, "pid");
         rb_uint(&rb, (uint64_t)procs[i].pid);
 
-        rb_str(&rb, "ppid");
+        rb_lit(&rb, "ppid");
         rb_uint(&rb, (uint64_t)procs[i].ppid);
 
-        rb_str(&rb, "name");
+        rb_lit(&rb, "name");
         rb_str(&rb, procs[i].name);
 
-        rb_str(&rb, "state");
+        rb_lit(&rb, "state");
         char state_str[2] = { procs[i].state, '\0' };
         rb_str(&rb, state_str);
 
-        rb_str(&rb, "cmdline");
+        rb_lit(&rb, "cmdline");
         rb_str(&rb, procs[i].cmdline);
     }
 
-    free(procs);
+    rb_lit(&rb, "truncated");
+    rb_bool(&rb, truncated);
+
+    edb_free(procs);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
@@ -30,8 +30,8 @@ int cmd_reboot(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
 
     rb_map(&rb, 1);
-    rb_str(&rb, "status");
-    rb_str(&rb, "rebooting");
+    rb_lit(&rb, "status");
+    rb_lit(&rb, "rebooting");
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
@@ -61,8 +61,13 @@ typedef struct {
     char          name[64];
 } inode_map_t;
 
-/* Build inode->pid map by scanning /proc/[pid]/fd/ */
-static inode_map_t *build_inode_map(size_t *count_out)
+/*
+ * Build inode->pid map by scanning /proc/[pid]/fd/. This is the slow part
+ * of ss on busy devices, so it stops at the request deadline with
+ * *truncated set (sockets of unscanned processes then show no owner).
+ */
+static inode_map_t *build_inode_map(const conn_t *conn, size_t *count_out,
+                                    bool *truncated)
 {
     DIR *proc;
     struct dirent *pid_ent;
@@ -70,12 +75,12 @@ static inode_map_t *build_inode_map(size_t *count_out)
     size_t count = 0;
     size_t cap = 256;
 
-    map = malloc(cap * sizeof(inode_map_t));
+    map = edb_malloc(cap * sizeof(inode_map_t));
     if (!map) return NULL;
 
     proc = opendir("/proc");
     if (!proc) {
-        free(map);
+        edb_free(map);
         return NULL;
     }
 
@@ -83,6 +88,11 @@ static inode_map_t *build_inode_map(size_t *count_out)
         /* Skip non-numeric entries */
         if (!isdigit((unsigned char)pid_ent->d_name[0])) continue;
 
+        if (proto_expired(conn)) {
+            *truncated = true;
+            break;
+        }
+
         int pid = atoi(pid_ent->d_name);
         if (pid <= 0) continue;
 
@@ -122,11 +132,11 @@ static inode_map_t *build_inode_map(size_t *count_out)
                 /* Grow map if needed */
                 if (count >= cap) {
                     cap *= 2;
-                    inode_map_t *newmap = realloc(map, cap * sizeof(inode_map_t));
+                    inode_map_t *newmap = edb_realloc(map, cap * sizeof(inode_map_t));
                     if (!newmap) {
                         closedir(fd_dir);
                         closedir(proc);
-                        free(map);
+                        edb_free(map);
                         return NULL;
                     }
                     map = newmap;
@@ -251,7 +261,7 @@ static int parse_net_file(const char *path, const char *proto, int is_tcp, int i
         /* Grow array if needed */
         if (*nconns >= *cap) {
             *cap *= 2;
-            conn_info_t *newconns = realloc(*conns, *cap * sizeof(conn_info_t));
+            conn_info_t *newconns = edb_realloc(*conns, *cap * sizeof(conn_info_t));
             if (!newconns) {
                 fclose(f);
                 return -1;
@@ -298,7 +308,8 @@ int cmd_netstat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     /* Build inode->pid map first */
     size_t map_count = 0;
-    inode_map_t *inode_map = build_inode_map(&map_count);
+    bool truncated = false;
+    inode_map_t *inode_map = build_inode_map(conn, &map_count, &truncated);
     /* inode_map can be NULL if we lack permissions, continue anyway */
 
     /* Collect connections */
@@ -306,9 +317,9 @@ int cmd_netstat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     size_t nconns = 0;
     size_t cap = 128;
 
-    conns = malloc(cap * sizeof(conn_info_t));
+    conns = edb_malloc(cap * sizeof(conn_info_t));
     if (!conns) {
-        free(inode_map);
+        edb_free(inode_map);
         return proto_send_error(conn, id, "out of memory");
     }
 
@@ -318,51 +329,54 @@ int cmd_netstat(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     parse_net_file("/proc/net/udp",  "udp",  0, 0, inode_map, map_count, &conns, &nconns, &cap);
     parse_net_file("/proc/net/udp6", "udp6", 0, 1, inode_map, map_count, &conns, &nconns, &cap);
 
-    free(inode_map);
+    edb_free(inode_map);
 
-    LOG("ss: found %zu connections", nconns);
+    LOG("ss: found %zu connections%s", nconns, truncated ? " (deadline)" : "");
 
     /* Build response */
     resp_builder_t rb;
     if (rb_init(&rb, 4096) < 0) {
-        free(conns);
+        edb_free(conns);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    rb_map(&rb, 1);
-    rb_str(&rb, "connections");
+    rb_map(&rb, 2);
+    rb_lit(&rb, "connections");
     rb_array(&rb, nconns);
 
     for (size_t i = 0; i < nconns; i++) {
         conn_info_t *c = &conns[i];
         rb_map(&rb, 8);
 
-        rb_str(&rb, "proto");
+        rb_lit(&rb, "proto");
         rb_str(&rb, c->proto);
 
-        rb_str(&rb, "local_addr");
+        rb_lit(&rb, "local_addr");
         rb_str(&rb, c->local_addr);
 
-        rb_str(&rb, "local_port");
+        rb_lit(&rb, "local_port");
         rb_uint(&rb, c->local_port);
 
-        rb_str(&rb, "remote_addr");
+        rb_lit(&rb, "remote_addr");
         rb_str(&rb, c->remote_addr);
 
-        rb_str(&rb, "remote_port");
+        rb_lit(&rb, "remote_port");
         rb_uint(&rb, c->remote_port);
 
-        rb_str(&rb, "state");
+        rb_lit(&rb, "state");
         rb_str(&rb, c->state);
 
-        rb_str(&rb, "pid");
+        rb_lit(&rb, "pid");
         rb_uint(&rb, (uint64_t)c->pid);
 
-        rb_str(&rb, "process");
+        rb_lit(&rb, "process");
         rb_str(&rb, c->process);
     }
 
-    free(conns);
+    rb_lit(&rb, "truncated");
+    rb_bool(&rb, truncated);
+
+    edb_free(conns);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
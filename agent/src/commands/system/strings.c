@@ -13,47 +13,36 @@
 #include "edb.h"
 #include "commands.h"
 
-int cmd_strings(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+/*
+ * Scan a stream for runs of printable ASCII (plus tab) of at least min_len
+ * characters. Returns an allocated buffer of newline-separated strings
+ * (caller must edb_free) and sets *out_len, or NULL if out of memory.
+ * Scanning stops with *truncated set once the output would pass limit
+ * bytes or the memory budget, or at conn's request deadline (conn may be
+ * NULL for no deadline).
+ */
+static char *strings_scan(const conn_t *conn, FILE *f, size_t min_len,
+                          size_t limit, size_t *out_len, bool *truncated)
 {
-    char *arg_path = parse_string_arg(args, args_len, "path");
-    if (!arg_path) {
-        return proto_send_error(conn, id, "missing path argument");
-    }
-
-    /* Get optional min_len parameter (default: 4) */
-    uint64_t min_len = 4;
-    parse_uint_arg(args, args_len, "min_len", &min_len);
-
-    /* Resolve the path */
-    char *resolved = path_resolve(conn->cwd, arg_path);
-    free(arg_path);
-
-    if (!resolved) {
-        return proto_send_error(conn, id, "out of memory");
-    }
-
-    FILE *f = fopen(resolved, "rb");
-    if (!f) {
-        int err = errno;
-        free(resolved);
-        return proto_send_error(conn, id, strerror(err));
-    }
-    free(resolved);
-
-    /* Read file and extract strings */
     size_t capacity = 4096;
     size_t output_len = 0;
-    char *output = malloc(capacity);
+    char *output = edb_malloc(capacity);
     if (!output) {
-        fclose(f);
-        return proto_send_error(conn, id, "out of memory");
+        return NULL;
     }
 
     char current_string[1024];
     size_t current_len = 0;
+    size_t scanned = 0;
     int c;
 
     while ((c = fgetc(f)) != EOF) {
+        /* Check the clock once per 64 KB of input */
+        if ((++scanned & 0xffff) == 0 && proto_expired(conn)) {
+            *truncated = true;
+            break;
+        }
+
         /* Check if printable ASCII (32-126) or tab/newline */
         if ((c >= 32 && c <= 126) || c == '\t') {
             if (current_len < sizeof(current_string) - 1) {
@@ -61,18 +50,22 @@ int cmd_strings(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
             }
         } else {
             /* End of string - check if long enough */
-            if (current_len >= (size_t)min_len) {
+            if (current_len >= min_len) {
                 current_string[current_len] = '\0';
 
                 /* Grow output buffer if needed */
                 size_t needed = output_len + current_len + 2;
+                if (needed > limit) {
+                    *truncated = true;
+                    break;
+                }
                 if (needed > capacity) {
                     while (needed > capacity) capacity *= 2;
-                    char *new_output = realloc(output, capacity);
+                    if (capacity > limit) capacity = limit;
+                    char *new_output = edb_realloc(output, capacity);
                     if (!new_output) {
-                        free(output);
-                        fclose(f);
-                        return proto_send_error(conn, id, "out of memory");
+                        *truncated = true;
+                        break;
                     }
                     output = new_output;
                 }
@@ -87,15 +80,20 @@ int cmd_strings(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
     }
 
     /* Handle last string */
-    if (current_len >= (size_t)min_len) {
+    if (!*truncated && current_len >= min_len) {
         current_string[current_len] = '\0';
         size_t needed = output_len + current_len + 2;
+        if (needed > limit) {
+            *truncated = true;
+            *out_len = output_len;
+            return output;
+        }
         if (needed > capacity) {
-            char *new_output = realloc(output, needed);
+            char *new_output = edb_realloc(output, needed);
             if (!new_output) {
-                free(output);
-                fclose(f);
-                return proto_send_error(conn, id, "out of memory");
+                *truncated = true;
+                *out_len = output_len;
+                return output;
             }
             output = new_output;
         }
@@ -104,21 +102,70 @@ int cmd_strings(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
         output[output_len++] = '\n';
     }
 
+    *out_len = output_len;
+    return output;
+}
+
+int cmd_strings(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    char *arg_path = parse_string_arg(args, args_len, "path");
+    if (!arg_path) {
+        return proto_send_error(conn, id, "missing path argument");
+    }
+
+    /* Get optional min_len parameter (default: 4) */
+    uint64_t min_len = 4;
+    parse_uint_arg(args, args_len, "min_len", &min_len);
+
+    /* Resolve the path */
+    char *resolved = path_resolve(conn->cwd, arg_path);
+    edb_free(arg_path);
+
+    if (!resolved) {
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    FILE *f = fopen(resolved, "rb");
+    if (!f) {
+        int err = errno;
+        edb_free(resolved);
+        return proto_send_error(conn, id, strerror(err));
+    }
+    edb_free(resolved);
+
+    /*
+     * Read file and extract strings. The output may use half the free
+     * budget, leaving the other half for the response built from it.
+     */
+    size_t limit = mem_available() / 2;
+    if (limit > EDB_MAX_MSG_SIZE - 1024) {
+        limit = EDB_MAX_MSG_SIZE - 1024;
+    }
+
+    bool truncated = false;
+    size_t output_len = 0;
+    char *output = strings_scan(conn, f, (size_t)min_len, limit, &output_len, &truncated);
     fclose(f);
+    if (!output) {
+        return proto_send_error(conn, id, "out of memory");
+    }
 
-    LOG("strings: extracted %zu bytes of strings", output_len);
+    LOG("strings: extracted %zu bytes of strings%s", output_len,
+        truncated ? " (truncated)" : "");
 
     resp_builder_t rb;
     if (rb_init(&rb, output_len + 64) < 0) {
-        free(output);
+        edb_free(output);
         return proto_send_error(conn, id, "out of memory");
     }
 
-    rb_map(&rb, 1);
-    rb_str(&rb, "content");
+    rb_map(&rb, 2);
+    rb_lit(&rb, "content");
     rb_bin(&rb, (uint8_t *)output, output_len);
+    rb_lit(&rb, "truncated");
+    rb_bool(&rb, truncated);
 
-    free(output);
+    edb_free(output);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
     rb_free(&rb);
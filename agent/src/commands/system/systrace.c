@@ -0,0 +1,959 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: systrace - Per-syscall counts and latency histograms via ptrace
+ *
+ * Seizes every thread of the target (PTRACE_SEIZE + PTRACE_O_TRACESYSGOOD),
+ * times each syscall from entry stop to exit stop and accumulates per-syscall
+ * counts, error counts and log2 latency histograms in the agent. Only
+ * aggregates go over the link: one data message per reporting interval, and
+ * a summary response when tracing ends.
+ *
+ * Syscall numbers come from PTRACE_GET_SYSCALL_INFO (Linux 5.3+), falling
+ * back to reading the syscall number register on older kernels. The fallback
+ * cannot see return values, so errors are only counted on newer kernels.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "edb.h"
+#include "commands.h"
+
+/* Older C libraries lack the seize-era requests */
+#ifndef PTRACE_SEIZE
+#define PTRACE_SEIZE            0x4206
+#endif
+#ifndef PTRACE_INTERRUPT
+#define PTRACE_INTERRUPT        0x4207
+#endif
+#ifndef PTRACE_LISTEN
+#define PTRACE_LISTEN           0x4208
+#endif
+#ifndef PTRACE_EVENT_STOP
+#define PTRACE_EVENT_STOP       128
+#endif
+
+#define EDB_PTRACE_GET_SYSCALL_INFO  0x420e
+#define EDB_SYSCALL_INFO_ENTRY       1
+#define EDB_SYSCALL_INFO_EXIT        2
+
+#define SYSTRACE_DEFAULT_DURATION  5000     /* ms */
+#define SYSTRACE_MAX_DURATION      300000   /* ms */
+#define SYSTRACE_DEFAULT_INTERVAL  1000     /* ms */
+#define SYSTRACE_MIN_INTERVAL      100      /* ms */
+#define SYSTRACE_TICK_MS           50       /* wakeup period for deadline checks */
+#define SYSTRACE_HIST_BUCKETS      24       /* log2 microsecond buckets, up to ~8s */
+#define SYSTRACE_DETACH_TIMEOUT    1000     /* ms */
+
+/* Mirrors struct ptrace_syscall_info from the kernel uapi */
+typedef struct {
+    uint8_t  op;
+    uint8_t  pad[3];
+    uint32_t arch;
+    uint64_t instruction_pointer;
+    uint64_t stack_pointer;
+    union {
+        struct {
+            uint64_t nr;
+            uint64_t args[6];
+        } entry;
+        struct {
+            int64_t  rval;
+            uint8_t  is_error;
+        } exit;
+        uint8_t raw[64];
+    } u;
+} edb_syscall_info_t;
+
+/* =============================================================================
+ * Syscall Names
+ *
+ * Built from <sys/syscall.h> so numbers are always right for the target
+ * architecture. Syscalls not listed here are reported by number only.
+ * ============================================================================= */
+
+typedef struct {
+    long        nr;
+    const char *name;
+} syscall_name_t;
+
+static const syscall_name_t syscall_names[] = {
+#ifdef SYS_read
+    { SYS_read, "read" },
+#endif
+#ifdef SYS_write
+    { SYS_write, "write" },
+#endif
+#ifdef SYS_open
+    { SYS_open, "open" },
+#endif
+#ifdef SYS_openat
+    { SYS_openat, "openat" },
+#endif
+#ifdef SYS_close
+    { SYS_close, "close" },
+#endif
+#ifdef SYS_stat
+    { SYS_stat, "stat" },
+#endif
+#ifdef SYS_fstat
+    { SYS_fstat, "fstat" },
+#endif
+#ifdef SYS_lstat
+    { SYS_lstat, "lstat" },
+#endif
+#ifdef SYS_stat64
+    { SYS_stat64, "stat64" },
+#endif
+#ifdef SYS_fstat64
+    { SYS_fstat64, "fstat64" },
+#endif
+#ifdef SYS_newfstatat
+    { SYS_newfstatat, "newfstatat" },
+#endif
+#ifdef SYS_fstatat64
+    { SYS_fstatat64, "fstatat64" },
+#endif
+#ifdef SYS_statx
+    { SYS_statx, "statx" },
+#endif
+#ifdef SYS_lseek
+    { SYS_lseek, "lseek" },
+#endif
+#ifdef SYS__llseek
+    { SYS__llseek, "_llseek" },
+#endif
+#ifdef SYS_pread64
+    { SYS_pread64, "pread64" },
+#endif
+#ifdef SYS_pwrite64
+    { SYS_pwrite64, "pwrite64" },
+#endif
+#ifdef SYS_readv
+    { SYS_readv, "readv" },
+#endif
+#ifdef SYS_writev
+    { SYS_writev, "writev" },
+#endif
+#ifdef SYS_ioctl
+    { SYS_ioctl, "ioctl" },
+#endif
+#ifdef SYS_fcntl
+    { SYS_fcntl, "fcntl" },
+#endif
+#ifdef SYS_fcntl64
+    { SYS_fcntl64, "fcntl64" },
+#endif
+#ifdef SYS_fsync
+    { SYS_fsync, "fsync" },
+#endif
+#ifdef SYS_fdatasync
+    { SYS_fdatasync, "fdatasync" },
+#endif
+#ifdef SYS_getdents64
+    { SYS_getdents64, "getdents64" },
+#endif
+#ifdef SYS_mmap
+    { SYS_mmap, "mmap" },
+#endif
+#ifdef SYS_mmap2
+    { SYS_mmap2, "mmap2" },
+#endif
+#ifdef SYS_munmap
+    { SYS_munmap, "munmap" },
+#endif
+#ifdef SYS_mprotect
+    { SYS_mprotect, "mprotect" },
+#endif
+#ifdef SYS_brk
+    { SYS_brk, "brk" },
+#endif
+#ifdef SYS_poll
+    { SYS_poll, "poll" },
+#endif
+#ifdef SYS_ppoll
+    { SYS_ppoll, "ppoll" },
+#endif
+#ifdef SYS_select
+    { SYS_select, "select" },
+#endif
+#ifdef SYS__newselect
+    { SYS__newselect, "_newselect" },
+#endif
+#ifdef SYS_pselect6
+    { SYS_pselect6, "pselect6" },
+#endif
+#ifdef SYS_epoll_wait
+    { SYS_epoll_wait, "epoll_wait" },
+#endif
+#ifdef SYS_epoll_pwait
+    { SYS_epoll_pwait, "epoll_pwait" },
+#endif
+#ifdef SYS_epoll_ctl
+    { SYS_epoll_ctl, "epoll_ctl" },
+#endif
+#ifdef SYS_futex
+    { SYS_futex, "futex" },
+#endif
+#ifdef SYS_nanosleep
+    { SYS_nanosleep, "nanosleep" },
+#endif
+#ifdef SYS_clock_nanosleep
+    { SYS_clock_nanosleep, "clock_nanosleep" },
+#endif
+#ifdef SYS_clock_gettime
+    { SYS_clock_gettime, "clock_gettime" },
+#endif
+#ifdef SYS_gettimeofday
+    { SYS_gettimeofday, "gettimeofday" },
+#endif
+#ifdef SYS_socket
+    { SYS_socket, "socket" },
+#endif
+#ifdef SYS_connect
+    { SYS_connect, "connect" },
+#endif
+#ifdef SYS_accept
+    { SYS_accept, "accept" },
+#endif
+#ifdef SYS_accept4
+    { SYS_accept4, "accept4" },
+#endif
+#ifdef SYS_bind
+    { SYS_bind, "bind" },
+#endif
+#ifdef SYS_listen
+    { SYS_listen, "listen" },
+#endif
+#ifdef SYS_sendto
+    { SYS_sendto, "sendto" },
+#endif
+#ifdef SYS_recvfrom
+    { SYS_recvfrom, "recvfrom" },
+#endif
+#ifdef SYS_sendmsg
+    { SYS_sendmsg, "sendmsg" },
+#endif
+#ifdef SYS_recvmsg
+    { SYS_recvmsg, "recvmsg" },
+#endif
+#ifdef SYS_send
+    { SYS_send, "send" },
+#endif
+#ifdef SYS_recv
+    { SYS_recv, "recv" },
+#endif
+#ifdef SYS_socketcall
+    { SYS_socketcall, "socketcall" },
+#endif
+#ifdef SYS_setsockopt
+    { SYS_setsockopt, "setsockopt" },
+#endif
+#ifdef SYS_getsockopt
+    { SYS_getsockopt, "getsockopt" },
+#endif
+#ifdef SYS_pipe
+    { SYS_pipe, "pipe" },
+#endif
+#ifdef SYS_pipe2
+    { SYS_pipe2, "pipe2" },
+#endif
+#ifdef SYS_dup
+    { SYS_dup, "dup" },
+#endif
+#ifdef SYS_dup2
+    { SYS_dup2, "dup2" },
+#endif
+#ifdef SYS_dup3
+    { SYS_dup3, "dup3" },
+#endif
+#ifdef SYS_clone
+    { SYS_clone, "clone" },
+#endif
+#ifdef SYS_fork
+    { SYS_fork, "fork" },
+#endif
+#ifdef SYS_vfork
+    { SYS_vfork, "vfork" },
+#endif
+#ifdef SYS_execve
+    { SYS_execve, "execve" },
+#endif
+#ifdef SYS_wait4
+    { SYS_wait4, "wait4" },
+#endif
+#ifdef SYS_kill
+    { SYS_kill, "kill" },
+#endif
+#ifdef SYS_rt_sigaction
+    { SYS_rt_sigaction, "rt_sigaction" },
+#endif
+#ifdef SYS_rt_sigprocmask
+    { SYS_rt_sigprocmask, "rt_sigprocmask" },
+#endif
+#ifdef SYS_rt_sigreturn
+    { SYS_rt_sigreturn, "rt_sigreturn" },
+#endif
+#ifdef SYS_sched_yield
+    { SYS_sched_yield, "sched_yield" },
+#endif
+#ifdef SYS_getpid
+    { SYS_getpid, "getpid" },
+#endif
+#ifdef SYS_gettid
+    { SYS_gettid, "gettid" },
+#endif
+#ifdef SYS_access
+    { SYS_access, "access" },
+#endif
+#ifdef SYS_faccessat
+    { SYS_faccessat, "faccessat" },
+#endif
+#ifdef SYS_readlink
+    { SYS_readlink, "readlink" },
+#endif
+#ifdef SYS_readlinkat
+    { SYS_readlinkat, "readlinkat" },
+#endif
+#ifdef SYS_unlink
+    { SYS_unlink, "unlink" },
+#endif
+#ifdef SYS_unlinkat
+    { SYS_unlinkat, "unlinkat" },
+#endif
+#ifdef SYS_rename
+    { SYS_rename, "rename" },
+#endif
+#ifdef SYS_renameat
+    { SYS_renameat, "renameat" },
+#endif
+#ifdef SYS_mkdir
+    { SYS_mkdir, "mkdir" },
+#endif
+#ifdef SYS_mkdirat
+    { SYS_mkdirat, "mkdirat" },
+#endif
+#ifdef SYS_exit
+    { SYS_exit, "exit" },
+#endif
+#ifdef SYS_exit_group
+    { SYS_exit_group, "exit_group" },
+#endif
+    { -1, NULL },
+};
+
+static const char *syscall_name(long nr)
+{
+    for (const syscall_name_t *s = syscall_names; s->name; s++) {
+        if (s->nr == nr) return s->name;
+    }
+    return NULL;
+}
+
+/* =============================================================================
+ * Statistics
+ * ============================================================================= */
+
+typedef struct {
+    long     nr;
+    uint64_t count;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t hist[SYSTRACE_HIST_BUCKETS];
+} sc_stat_t;
+
+typedef struct {
+    sc_stat_t *v;
+    size_t     n;
+    size_t     cap;
+} sc_table_t;
+
+static sc_stat_t *sc_table_get(sc_table_t *t, long nr)
+{
+    for (size_t i = 0; i < t->n; i++) {
+        if (t->v[i].nr == nr) return &t->v[i];
+    }
+
+    if (t->n >= t->cap) {
+        size_t ncap = t->cap ? t->cap * 2 : 32;
+        sc_stat_t *nv = edb_realloc(t->v, ncap * sizeof(sc_stat_t));
+        if (!nv) return NULL;
+        t->v = nv;
+        t->cap = ncap;
+    }
+
+    sc_stat_t *s = &t->v[t->n++];
+    memset(s, 0, sizeof(*s));
+    s->nr = nr;
+    return s;
+}
+
+/* Bucket i holds latencies in [2^i, 2^(i+1)) microseconds; bucket 0 also holds < 1us */
+static int latency_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    int b = 0;
+    while (us > 1 && b < SYSTRACE_HIST_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static void sc_record(sc_table_t *t, long nr, uint64_t ns, bool error)
+{
+    sc_stat_t *s = sc_table_get(t, nr);
+    if (!s) return;
+
+    s->count++;
+    if (error) s->errors++;
+    s->total_ns += ns;
+    if (ns > s->max_ns) s->max_ns = ns;
+    s->hist[latency_bucket(ns)]++;
+}
+
+static int cmp_stat_total(const void *a, const void *b)
+{
+    const sc_stat_t *x = a, *y = b;
+    return (x->total_ns < y->total_ns) - (x->total_ns > y->total_ns);
+}
+
+/* Encode a table as an array of per-syscall maps, busiest first */
+static void rb_sc_table(resp_builder_t *rb, sc_table_t *t)
+{
+    qsort(t->v, t->n, sizeof(sc_stat_t), cmp_stat_total);
+
+    rb_array(rb, t->n);
+    for (size_t i = 0; i < t->n; i++) {
+        sc_stat_t *s = &t->v[i];
+        const char *name = syscall_name(s->nr);
+
+        /* Trim trailing empty buckets */
+        size_t nb = SYSTRACE_HIST_BUCKETS;
+        while (nb > 0 && s->hist[nb - 1] == 0) nb--;
+
+        rb_map(rb, name ? 7 : 6);
+        rb_lit(rb, "nr");
+        rb_uint(rb, (uint64_t)s->nr);
+        if (name) {
+            rb_lit(rb, "name");
+            rb_str(rb, name);
+        }
+        rb_lit(rb, "count");
+        rb_uint(rb, s->count);
+        rb_lit(rb, "errors");
+        rb_uint(rb, s->errors);
+        rb_lit(rb, "total_us");
+        rb_uint(rb, s->total_ns / 1000);
+        rb_lit(rb, "max_us");
+        rb_uint(rb, s->max_ns / 1000);
+        rb_lit(rb, "hist");
+        rb_array(rb, nb);
+        for (size_t b = 0; b < nb; b++) {
+            rb_uint(rb, s->hist[b]);
+        }
+    }
+}
+
+/* =============================================================================
+ * Tracees
+ * ============================================================================= */
+
+typedef struct {
+    pid_t    tid;
+    bool     in_syscall;
+    bool     stopped;       /* Only tracked while detaching */
+    int      pending_sig;   /* Signal to re-inject on detach */
+    long     nr;
+    uint64_t t_entry;
+} tracee_t;
+
+typedef struct {
+    tracee_t *v;
+    size_t    n;
+    size_t    cap;
+    bool      have_info;    /* PTRACE_GET_SYSCALL_INFO works */
+    bool      probed;
+} trace_state_t;
+
+static tracee_t *tracee_find(trace_state_t *ts, pid_t tid)
+{
+    for (size_t i = 0; i < ts->n; i++) {
+        if (ts->v[i].tid == tid) return &ts->v[i];
+    }
+    return NULL;
+}
+
+static tracee_t *tracee_add(trace_state_t *ts, pid_t tid)
+{
+    tracee_t *t = tracee_find(ts, tid);
+    if (t) return t;
+
+    if (ts->n >= ts->cap) {
+        size_t ncap = ts->cap ? ts->cap * 2 : 16;
+        tracee_t *nv = edb_realloc(ts->v, ncap * sizeof(tracee_t));
+        if (!nv) return NULL;
+        ts->v = nv;
+        ts->cap = ncap;
+    }
+
+    t = &ts->v[ts->n++];
+    memset(t, 0, sizeof(*t));
+    t->tid = tid;
+    return t;
+}
+
+static void tracee_remove(trace_state_t *ts, pid_t tid)
+{
+    for (size_t i = 0; i < ts->n; i++) {
+        if (ts->v[i].tid == tid) {
+            ts->v[i] = ts->v[--ts->n];
+            return;
+        }
+    }
+}
+
+/* Seize and interrupt every thread listed in /proc/[pid]/task */
+static int seize_threads(trace_state_t *ts, pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int)pid);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    long opts = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE;
+    int err = 0;
+    struct dirent *ent;
+
+    while ((ent = readdir(dir)) != NULL) {
+        pid_t tid = (pid_t)atoi(ent->d_name);
+        if (tid <= 0 || tracee_find(ts, tid)) continue;
+
+        if (ptrace(PTRACE_SEIZE, tid, NULL, (void *)opts) < 0) {
+            if (errno != ESRCH) err = errno;  /* Thread may have just exited */
+            continue;
+        }
+        ptrace(PTRACE_INTERRUPT, tid, NULL, NULL);
+        tracee_add(ts, tid);
+    }
+    closedir(dir);
+
+    if (ts->n == 0) {
+        errno = err ? err : ESRCH;
+        return -1;
+    }
+    return 0;
+}
+
+/* =============================================================================
+ * Syscall Number Retrieval
+ * ============================================================================= */
+
+/* Read the syscall number register directly (kernels before 5.3) */
+static int read_syscall_nr(pid_t tid, long *nr)
+{
+#if defined(__x86_64__)
+    errno = 0;
+    long v = ptrace(PTRACE_PEEKUSER, tid, (void *)(8 * 15), NULL);    /* orig_rax */
+    if (errno) return -1;
+    *nr = v;
+    return 0;
+#elif defined(__i386__)
+    errno = 0;
+    long v = ptrace(PTRACE_PEEKUSER, tid, (void *)(4 * 11), NULL);    /* orig_eax */
+    if (errno) return -1;
+    *nr = v;
+    return 0;
+#elif defined(__arm__)
+    errno = 0;
+    long v = ptrace(PTRACE_PEEKUSER, tid, (void *)(4 * 7), NULL);     /* r7 (EABI) */
+    if (errno) return -1;
+    *nr = v;
+    return 0;
+#elif defined(__mips__)
+    errno = 0;
+    long v = ptrace(PTRACE_PEEKUSER, tid, (void *)2, NULL);           /* v0 */
+    if (errno) return -1;
+    *nr = v;
+    return 0;
+#elif defined(__aarch64__)
+    uint64_t regs[34];                                                /* user_pt_regs */
+    struct iovec iov = { regs, sizeof(regs) };
+    if (ptrace(PTRACE_GETREGSET, tid, (void *)1 /* NT_PRSTATUS */, &iov) < 0) return -1;
+    *nr = (long)regs[8];                                              /* x8 */
+    return 0;
+#else
+    (void)tid;
+    (void)nr;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * Work out whether this stop is a syscall entry or exit.
+ * Returns EDB_SYSCALL_INFO_ENTRY / _EXIT, or -1 if nothing usable was found.
+ */
+static int get_syscall_stop(trace_state_t *ts, tracee_t *t, long *nr, bool *is_error)
+{
+    *is_error = false;
+
+    if (!ts->probed || ts->have_info) {
+        edb_syscall_info_t info;
+        memset(&info, 0, sizeof(info));
+        long n = ptrace(EDB_PTRACE_GET_SYSCALL_INFO, t->tid, (void *)sizeof(info), &info);
+        if (!ts->probed) {
+            ts->probed = true;
+            ts->have_info = n > 0;
+            LOG("systrace: PTRACE_GET_SYSCALL_INFO %s", ts->have_info ? "available" : "unavailable");
+        }
+        if (ts->have_info) {
+            if (info.op == EDB_SYSCALL_INFO_ENTRY) {
+                *nr = (long)info.u.entry.nr;
+                return EDB_SYSCALL_INFO_ENTRY;
+            }
+            if (info.op == EDB_SYSCALL_INFO_EXIT) {
+                *is_error = info.u.exit.is_error != 0;
+                return EDB_SYSCALL_INFO_EXIT;
+            }
+            return -1;
+        }
+    }
+
+    /* Fallback: stops alternate entry/exit per thread */
+    if (t->in_syscall) return EDB_SYSCALL_INFO_EXIT;
+    if (read_syscall_nr(t->tid, nr) < 0) return -1;
+    return EDB_SYSCALL_INFO_ENTRY;
+}
+
+/* =============================================================================
+ * Helpers
+ * ============================================================================= */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void tick_handler(int sig)
+{
+    (void)sig;  /* Only here to interrupt waitpid() */
+}
+
+static bool is_stop_signal(int sig)
+{
+    return sig == SIGSTOP || sig == SIGTSTP || sig == SIGTTIN || sig == SIGTTOU;
+}
+
+static int send_interval(conn_t *conn, uint32_t id, uint32_t seq,
+                         sc_table_t *t, uint64_t elapsed_ms)
+{
+    resp_builder_t rb;
+    if (rb_init(&rb, 128 + t->n * 64) < 0) return -1;
+
+    rb_map(&rb, 2);
+    rb_lit(&rb, "elapsed_ms");
+    rb_uint(&rb, elapsed_ms);
+    rb_lit(&rb, "syscalls");
+    rb_sc_table(&rb, t);
+
+    int ret = proto_send_data(conn, id, seq, rb.buf, rb.len, false);
+    rb_free(&rb);
+    return ret;
+}
+
+/* Stop every remaining thread and detach, re-injecting pending signals */
+static void detach_all(trace_state_t *ts)
+{
+    for (size_t i = 0; i < ts->n; i++) {
+        ts->v[i].stopped = false;
+        ts->v[i].pending_sig = 0;
+        ptrace(PTRACE_INTERRUPT, ts->v[i].tid, NULL, NULL);
+    }
+
+    uint64_t deadline = now_ns() + (uint64_t)SYSTRACE_DETACH_TIMEOUT * 1000000ULL;
+    for (;;) {
+        size_t waiting = 0;
+        for (size_t i = 0; i < ts->n; i++) {
+            if (!ts->v[i].stopped) waiting++;
+        }
+        if (waiting == 0 || now_ns() >= deadline) break;
+
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            tracee_remove(ts, tid);
+            continue;
+        }
+
+        tracee_t *t = tracee_find(ts, tid);
+        if (!t || !WIFSTOPPED(status)) continue;
+
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        t->stopped = true;
+        if (event == 0 && sig != (SIGTRAP | 0x80)) {
+            t->pending_sig = sig;   /* Signal-delivery-stop */
+        }
+    }
+
+    for (size_t i = 0; i < ts->n; i++) {
+        ptrace(PTRACE_DETACH, ts->v[i].tid, NULL, (void *)(long)ts->v[i].pending_sig);
+    }
+}
+
+/* =============================================================================
+ * Command: systrace
+ *
+ * Protocol:
+ *   1. Client sends: { cmd: "systrace", args: { pid, duration, interval } }
+ *   2. Agent sends:  { ok: true, data: { pid, threads, interval } }
+ *   3. Agent sends:  { type: "data", data: <msgpack interval stats>, done: false } ...
+ *   4. Agent sends:  { type: "data", data: <empty>, done: true }
+ *   5. Agent sends:  { ok: true, data: { duration_ms, threads, exited, syscalls: [...] } }
+ * ============================================================================= */
+
+int cmd_systrace(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    uint64_t pid = 0;
+    uint64_t duration = SYSTRACE_DEFAULT_DURATION;
+    uint64_t interval = SYSTRACE_DEFAULT_INTERVAL;
+
+    if (parse_uint_arg(args, args_len, "pid", &pid) < 0 || pid == 0) {
+        return proto_send_error(conn, id, "missing pid argument");
+    }
+    parse_uint_arg(args, args_len, "duration", &duration);
+    parse_uint_arg(args, args_len, "interval", &interval);
+
+    if (duration == 0 || duration > SYSTRACE_MAX_DURATION) duration = SYSTRACE_DEFAULT_DURATION;
+    if (interval < SYSTRACE_MIN_INTERVAL) interval = SYSTRACE_MIN_INTERVAL;
+
+    if ((pid_t)pid == getpid()) {
+        return proto_send_error(conn, id, "cannot trace the agent itself");
+    }
+
+    /*
+     * The bind-mode SIGCHLD reaper would swallow ptrace stops, so take over
+     * SIGCHLD while tracing. SIGALRM ticks interrupt waitpid() so deadlines
+     * are honoured even when the target makes no syscalls.
+     */
+    struct sigaction sa, old_chld, old_alrm;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &sa, &old_chld);
+    sa.sa_handler = tick_handler;
+    sigaction(SIGALRM, &sa, &old_alrm);
+
+    trace_state_t ts;
+    memset(&ts, 0, sizeof(ts));
+    sc_table_t total, window;
+    memset(&total, 0, sizeof(total));
+    memset(&window, 0, sizeof(window));
+
+    int ret = 0;
+
+    if (seize_threads(&ts, (pid_t)pid) < 0) {
+        int err = errno;
+        if (err == EPERM) {
+            ret = proto_send_error(conn, id,
+                "permission denied (check /proc/sys/kernel/yama/ptrace_scope)");
+        } else {
+            ret = proto_send_error(conn, id, strerror(err));
+        }
+        goto restore;
+    }
+
+    LOG("systrace: pid=%lu threads=%zu duration=%lums interval=%lums",
+        (unsigned long)pid, ts.n, (unsigned long)duration, (unsigned long)interval);
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 64) < 0) {
+        detach_all(&ts);
+        ret = proto_send_error(conn, id, "out of memory");
+        goto restore;
+    }
+    rb_map(&rb, 3);
+    rb_lit(&rb, "pid");
+    rb_uint(&rb, pid);
+    rb_lit(&rb, "threads");
+    rb_uint(&rb, ts.n);
+    rb_lit(&rb, "interval");
+    rb_uint(&rb, interval);
+    ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    if (ret < 0) {
+        detach_all(&ts);
+        goto restore;
+    }
+
+    struct itimerval tick;
+    memset(&tick, 0, sizeof(tick));
+    tick.it_interval.tv_usec = SYSTRACE_TICK_MS * 1000;
+    tick.it_value.tv_usec = SYSTRACE_TICK_MS * 1000;
+    setitimer(ITIMER_REAL, &tick, NULL);
+
+    uint64_t start = now_ns();
+    uint64_t deadline = start + duration * 1000000ULL;
+    uint64_t next_report = start + interval * 1000000ULL;
+    uint64_t next_cancel_check = start;
+    uint32_t seq = 0;
+    bool exited = false;
+
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= deadline) break;
+
+        /* A cancel stops tracing early; the totals so far are still sent */
+        if (now >= next_cancel_check) {
+            if (proto_cancelled(conn, id)) break;
+            next_cancel_check = now + SYSTRACE_TICK_MS * 1000000ULL;
+        }
+
+        if (now >= next_report) {
+            if (send_interval(conn, id, seq++, &window, (now - start) / 1000000) < 0) {
+                ret = -1;
+                break;
+            }
+            window.n = 0;
+            next_report += interval * 1000000ULL;
+        }
+
+        int status;
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0) {
+            if (errno == EINTR) continue;
+            exited = true;  /* ECHILD: nothing left to trace */
+            break;
+        }
+
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            tracee_remove(&ts, tid);
+            if (ts.n == 0) {
+                exited = true;
+                break;
+            }
+            continue;
+        }
+        if (!WIFSTOPPED(status)) continue;
+
+        /* New clone children can report before the parent's clone event */
+        tracee_t *t = tracee_add(&ts, tid);
+        int sig = WSTOPSIG(status);
+        int event = status >> 16;
+        int inject = 0;
+
+        if (sig == (SIGTRAP | 0x80)) {
+            long nr = -1;
+            bool is_error;
+            int op = t ? get_syscall_stop(&ts, t, &nr, &is_error) : -1;
+            uint64_t ts_now = now_ns();
+
+            if (op == EDB_SYSCALL_INFO_ENTRY) {
+                t->in_syscall = true;
+                t->nr = nr;
+                t->t_entry = ts_now;
+            } else if (op == EDB_SYSCALL_INFO_EXIT && t->in_syscall) {
+                uint64_t ns = ts_now - t->t_entry;
+                sc_record(&total, t->nr, ns, is_error);
+                sc_record(&window, t->nr, ns, is_error);
+                t->in_syscall = false;
+            } else if (t) {
+                t->in_syscall = false;  /* Exit without a seen entry (attached mid-call) */
+            }
+        } else if (event == PTRACE_EVENT_STOP) {
+            if (is_stop_signal(sig)) {
+                ptrace(PTRACE_LISTEN, tid, NULL, NULL);   /* Group-stop: stay stopped */
+                continue;
+            }
+        } else if (event == PTRACE_EVENT_CLONE) {
+            unsigned long child = 0;
+            ptrace(PTRACE_GETEVENTMSG, tid, NULL, &child);
+            if (child) tracee_add(&ts, (pid_t)child);
+        } else if (event == 0) {
+            inject = sig;   /* Signal-delivery-stop: pass the signal on */
+        }
+
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *)(long)inject);
+    }
+
+    memset(&tick, 0, sizeof(tick));
+    setitimer(ITIMER_REAL, &tick, NULL);
+
+    uint64_t elapsed_ms = (now_ns() - start) / 1000000;
+
+    if (!exited) {
+        /* Keep the tick running so detach can time out on stuck threads */
+        tick.it_interval.tv_usec = SYSTRACE_TICK_MS * 1000;
+        tick.it_value.tv_usec = SYSTRACE_TICK_MS * 1000;
+        setitimer(ITIMER_REAL, &tick, NULL);
+        detach_all(&ts);
+        memset(&tick, 0, sizeof(tick));
+        setitimer(ITIMER_REAL, &tick, NULL);
+    }
+
+    LOG("systrace: done after %lums, %zu syscalls seen", (unsigned long)elapsed_ms, total.n);
+
+    if (ret < 0) goto restore;
+
+    if (window.n > 0) {
+        if (send_interval(conn, id, seq++, &window, elapsed_ms) < 0) {
+            ret = -1;
+            goto restore;
+        }
+    }
+    if (proto_send_data(conn, id, seq, NULL, 0, true) < 0) {
+        ret = -1;
+        goto restore;
+    }
+
+    if (rb_init(&rb, 256 + total.n * 96) < 0) {
+        ret = proto_send_error(conn, id, "out of memory");
+        goto restore;
+    }
+    rb_map(&rb, 4);
+    rb_lit(&rb, "duration_ms");
+    rb_uint(&rb, elapsed_ms);
+    rb_lit(&rb, "threads");
+    rb_uint(&rb, ts.n);
+    rb_lit(&rb, "exited");
+    rb_bool(&rb, exited);
+    rb_lit(&rb, "syscalls");
+    rb_sc_table(&rb, &total);
+    ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+
+restore:
+    sigaction(SIGALRM, &old_alrm, NULL);
+    sigaction(SIGCHLD, &old_chld, NULL);
+    edb_free(ts.v);
+    edb_free(total.v);
+    edb_free(window.v);
+    return ret;
+}
@@ -0,0 +1,163 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: throttle - Limit how hard this session's transfers hit the device
+ *
+ * Sets a rate limit shared by all pulls and pushes of the session (see
+ * sched.c), and lowers the CPU (nice) and I/O (ioprio_set) priority of
+ * every thread of the process serving it. Linux keeps both per thread, so
+ * the pull read-ahead threads already running are changed one by one from
+ * /proc/self/task; threads started later copy the session thread's. In
+ * bind mode the process is the forked child for this client only, so other
+ * sessions and the listener are unaffected.
+ *
+ * Args (all optional, only those given change):
+ *   rate     bytes/s for all transfers together, 0 = unlimited
+ *   nice     0-19, as nice(1); lowering it again needs root
+ *   ioclass  1 realtime, 2 best-effort, 3 idle, as ionice(1) -c
+ *   iolevel  0-7 within realtime/best-effort, as ionice(1) -n (default 4)
+ *
+ * Responds with the settings now in effect.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+
+#include "edb.h"
+#include "commands.h"
+
+/* From <linux/ioprio.h>, which older toolchains lack */
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_PRIO_MASK        ((1UL << IOPRIO_CLASS_SHIFT) - 1)
+
+static int ioprio_set_thread(pid_t tid, int prio)
+{
+#ifdef SYS_ioprio_set
+    return (int)syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)tid, prio);
+#else
+    (void)tid;
+    (void)prio;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int nice_set_thread(pid_t tid, int nice_val)
+{
+    return setpriority(PRIO_PROCESS, (id_t)tid, nice_val);
+}
+
+/*
+ * Apply set to every thread of this process. A thread that exits meanwhile
+ * is skipped. Returns -1 with errno set on the first other failure.
+ */
+static int set_all_threads(int (*set)(pid_t tid, int val), int val)
+{
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir) {
+        return set(0, val);     /* No /proc: at least the session thread */
+    }
+
+    int ret = 0;
+    int err = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+
+        pid_t tid = (pid_t)atoi(ent->d_name);
+        if (set(tid, val) < 0 && errno != ESRCH) {
+            ret = -1;
+            err = errno;
+            break;
+        }
+    }
+
+    closedir(dir);
+    errno = err;
+    return ret;
+}
+
+static int ioprio_get_self(void)
+{
+#ifdef SYS_ioprio_get
+    return (int)syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+#else
+    return -1;
+#endif
+}
+
+int cmd_throttle(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    uint64_t rate, nice_val, ioclass, iolevel;
+    bool has_rate = parse_uint_arg(args, args_len, "rate", &rate) == 0;
+    bool has_nice = parse_uint_arg(args, args_len, "nice", &nice_val) == 0;
+    bool has_ioclass = parse_uint_arg(args, args_len, "ioclass", &ioclass) == 0;
+    if (parse_uint_arg(args, args_len, "iolevel", &iolevel) < 0) {
+        iolevel = 4;
+    }
+
+    /* Check everything before changing anything */
+    if (has_nice && nice_val > 19) {
+        return proto_send_error(conn, id, "nice must be 0-19");
+    }
+    if (has_ioclass && (ioclass < 1 || ioclass > 3)) {
+        return proto_send_error(conn, id, "ioclass must be 1 (realtime), 2 (best-effort) or 3 (idle)");
+    }
+    if (has_ioclass && iolevel > 7) {
+        return proto_send_error(conn, id, "iolevel must be 0-7");
+    }
+
+    if (has_nice && set_all_threads(nice_set_thread, (int)nice_val) < 0) {
+        return proto_send_error(conn, id, strerror(errno));
+    }
+    if (has_ioclass) {
+        /* The idle class has no levels */
+        int level = ioclass == 3 ? 0 : (int)iolevel;
+        int prio = ((int)ioclass << IOPRIO_CLASS_SHIFT) | level;
+        if (set_all_threads(ioprio_set_thread, prio) < 0) {
+            return proto_send_error(conn, id, strerror(errno));
+        }
+    }
+    if (has_rate) {
+        tb_init(&conn->bucket, rate);
+    }
+
+    LOG("throttle: rate=%lu B/s", (unsigned long)conn->bucket.rate);
+
+    /* Report what is in effect now */
+    errno = 0;
+    int cur_nice = getpriority(PRIO_PROCESS, 0);
+    if (cur_nice == -1 && errno != 0) cur_nice = 0;
+
+    int prio = ioprio_get_self();
+    if (prio < 0) prio = 0;
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 64) < 0) {
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    rb_map(&rb, 4);
+    rb_lit(&rb, "rate");
+    rb_uint(&rb, conn->bucket.rate);
+    rb_lit(&rb, "nice");
+    rb_uint(&rb, cur_nice > 0 ? (uint64_t)cur_nice : 0);
+    rb_lit(&rb, "ioclass");
+    rb_uint(&rb, (uint64_t)prio >> IOPRIO_CLASS_SHIFT);
+    rb_lit(&rb, "iolevel");
+    rb_uint(&rb, (uint64_t)prio & IOPRIO_PRIO_MASK);
+
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    return ret;
+}
@@ -30,19 +30,19 @@ int cmd_uname(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     rb_map(&rb, 5);
 
-    rb_str(&rb, "sysname");
+    rb_lit(&rb, "sysname");
     rb_str(&rb, uts.sysname);
 
-    rb_str(&rb, "nodename");
+    rb_lit(&rb, "nodename");
     rb_str(&rb, uts.nodename);
 
-    rb_str(&rb, "release");
+    rb_lit(&rb, "release");
     rb_str(&rb, uts.release);
 
-    rb_str(&rb, "version");
+    rb_lit(&rb, "version");
     rb_str(&rb, uts.version);
 
-    rb_str(&rb, "machine");
+    rb_lit(&rb, "machine");
     rb_str(&rb, uts.machine);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
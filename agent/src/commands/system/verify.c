@@ -0,0 +1,396 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Command: verify - Check files against a SHA-256 manifest
+ *
+ * The client sends a packed manifest of (path, size, sha256) records. Files
+ * whose size already differs are reported without being read. The rest are
+ * hashed by a pool of worker threads on multi-core targets, or streamed one
+ * by one on the session thread when only one CPU is online. Only mismatches,
+ * missing files and errors are sent back.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "edb.h"
+#include "commands.h"
+#include "sha256.h"
+
+#define VERIFY_MANIFEST_VERSION  1
+#define VERIFY_MAX_ENTRIES       200000
+#define VERIFY_MAX_THREADS       8
+#define VERIFY_BUF_SIZE          (64 * 1024)
+#define VERIFY_THREAD_STACK      (128 * 1024)
+#define VERIFY_MAX_REPORT        10000    /* Per list, totals stay exact */
+
+typedef enum {
+    VERIFY_OK,
+    VERIFY_SIZE,        /* Size differs, not hashed */
+    VERIFY_HASH,        /* Same size, different content */
+    VERIFY_MISSING,
+    VERIFY_ERROR,
+} verify_status_t;
+
+typedef struct {
+    char            *path;          /* Resolved path */
+    uint64_t         size;          /* Expected */
+    const uint8_t   *hash;          /* Expected, points into the request */
+    verify_status_t  status;
+    uint64_t         actual_size;
+    uint8_t          actual_hash[SHA256_DIGEST_SIZE];
+    int              err;
+} verify_entry_t;
+
+typedef struct {
+    verify_entry_t  *entries;
+    size_t           count;
+    size_t           next;          /* Claimed with __sync_fetch_and_add */
+} verify_job_t;
+
+/* =============================================================================
+ * Manifest Parsing
+ *
+ * Format (all integers big-endian):
+ *   u8  version (1)
+ *   repeated:
+ *     u16 path_len, path bytes, u64 size, 32-byte SHA-256
+ * ============================================================================= */
+
+static void free_entries(verify_entry_t *entries, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        edb_free(entries[i].path);
+    }
+    edb_free(entries);
+}
+
+static int parse_manifest(const char *cwd, const uint8_t *m, size_t len,
+                          verify_entry_t **out, size_t *out_count, const char **err)
+{
+    if (len < 1 || m[0] != VERIFY_MANIFEST_VERSION) {
+        *err = "unsupported manifest version";
+        return -1;
+    }
+
+    /* Count records first so the table is allocated once */
+    size_t count = 0;
+    size_t pos = 1;
+    while (pos < len) {
+        if (pos + 2 > len) goto malformed;
+        size_t plen = ((size_t)m[pos] << 8) | m[pos + 1];
+        size_t rec = 2 + plen + 8 + SHA256_DIGEST_SIZE;
+        if (plen == 0 || rec > len - pos) goto malformed;
+        pos += rec;
+        if (++count > VERIFY_MAX_ENTRIES) {
+            *err = "manifest has too many entries";
+            return -1;
+        }
+    }
+
+    verify_entry_t *entries = edb_calloc(count ? count : 1, sizeof(verify_entry_t));
+    if (!entries) {
+        *err = "out of memory";
+        return -1;
+    }
+
+    pos = 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t plen = ((size_t)m[pos] << 8) | m[pos + 1];
+        pos += 2;
+
+        char path[EDB_PATH_MAX];
+        size_t copy = plen < sizeof(path) ? plen : sizeof(path) - 1;
+        memcpy(path, &m[pos], copy);
+        path[copy] = '\0';
+        pos += plen;
+
+        uint64_t size = 0;
+        for (int b = 0; b < 8; b++) {
+            size = (size << 8) | m[pos + b];
+        }
+        pos += 8;
+
+        entries[i].path = path_resolve(cwd, path);
+        entries[i].size = size;
+        entries[i].hash = &m[pos];
+        pos += SHA256_DIGEST_SIZE;
+
+        if (!entries[i].path) {
+            free_entries(entries, count);
+            *err = "out of memory";
+            return -1;
+        }
+    }
+
+    *out = entries;
+    *out_count = count;
+    return 0;
+
+malformed:
+    *err = "malformed manifest";
+    return -1;
+}
+
+/* =============================================================================
+ * Hashing
+ * ============================================================================= */
+
+static void verify_one(verify_entry_t *e, uint8_t *buf, size_t bufsz)
+{
+    int fd = open(e->path, O_RDONLY);
+    if (fd < 0) {
+        e->err = errno;
+        e->status = (errno == ENOENT || errno == ENOTDIR) ? VERIFY_MISSING : VERIFY_ERROR;
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        e->err = errno;
+        e->status = VERIFY_ERROR;
+        close(fd);
+        return;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        e->err = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+        e->status = VERIFY_ERROR;
+        close(fd);
+        return;
+    }
+
+    e->actual_size = (uint64_t)st.st_size;
+    if (e->actual_size != e->size) {
+        e->status = VERIFY_SIZE;
+        close(fd);
+        return;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    sha256_ctx_t ctx;
+    sha256_init(&ctx);
+    for (;;) {
+        ssize_t n = read(fd, buf, bufsz);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            e->err = errno;
+            e->status = VERIFY_ERROR;
+            close(fd);
+            return;
+        }
+        if (n == 0) break;
+        sha256_update(&ctx, buf, (size_t)n);
+    }
+    close(fd);
+
+    sha256_final(&ctx, e->actual_hash);
+    e->status = memcmp(e->actual_hash, e->hash, SHA256_DIGEST_SIZE) == 0 ? VERIFY_OK : VERIFY_HASH;
+}
+
+/* Pull entries off the shared queue until it is empty */
+static void verify_drain(verify_job_t *job, uint8_t *buf)
+{
+    for (;;) {
+        size_t i = __sync_fetch_and_add(&job->next, 1);
+        if (i >= job->count) break;
+        verify_one(&job->entries[i], buf, VERIFY_BUF_SIZE);
+    }
+}
+
+static void *verify_worker(void *arg)
+{
+    verify_job_t *job = arg;
+    uint8_t *buf = edb_malloc(VERIFY_BUF_SIZE);
+    if (buf) {
+        verify_drain(job, buf);
+        edb_free(buf);
+    }
+    return NULL;
+}
+
+/*
+ * Hash everything in the job. The calling thread always works too, so a
+ * failed pthread_create only costs parallelism. Returns the thread count used.
+ */
+static int verify_run(verify_job_t *job, uint8_t *buf, int nthreads)
+{
+    pthread_t tids[VERIFY_MAX_THREADS];
+    int started = 0;
+
+    if (nthreads > 1) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, VERIFY_THREAD_STACK);
+
+        for (int i = 0; i < nthreads - 1; i++) {
+            if (pthread_create(&tids[started], &attr, verify_worker, job) != 0) break;
+            started++;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    verify_drain(job, buf);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    return started + 1;
+}
+
+/* =============================================================================
+ * Command: verify
+ *
+ * Request args:
+ *   manifest - packed manifest (see above)
+ *   threads  - worker threads, 0 = one per online CPU (default)
+ *
+ * Response: { checked, ok, elapsed_ms, threads,
+ *             totals: {mismatches, missing, errors},
+ *             mismatches: [{path, reason, size, hash?}],
+ *             missing: [path], errors: [{path, error}] }
+ *
+ * Each list holds at most VERIFY_MAX_REPORT entries, totals has the real
+ * counts so a client can tell when a list was cut short.
+ * ============================================================================= */
+
+int cmd_verify(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    size_t mlen = 0;
+    const uint8_t *manifest = parse_bin_arg(args, args_len, "manifest", &mlen);
+    if (!manifest) {
+        return proto_send_error(conn, id, "missing manifest argument");
+    }
+
+    uint64_t threads = 0;
+    parse_uint_arg(args, args_len, "threads", &threads);
+    if (threads == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = ncpu > 0 ? (uint64_t)ncpu : 1;
+    }
+    if (threads > VERIFY_MAX_THREADS) threads = VERIFY_MAX_THREADS;
+
+    verify_entry_t *entries = NULL;
+    size_t count = 0;
+    const char *err = NULL;
+    if (parse_manifest(conn->cwd, manifest, mlen, &entries, &count, &err) < 0) {
+        return proto_send_error(conn, id, err);
+    }
+
+    uint8_t *buf = edb_malloc(VERIFY_BUF_SIZE);
+    if (!buf) {
+        free_entries(entries, count);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    verify_job_t job = { entries, count, 0 };
+    int used = verify_run(&job, buf, count > 1 ? (int)threads : 1);
+    edb_free(buf);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    uint64_t elapsed_ms = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000 +
+                          (uint64_t)((t1.tv_nsec - t0.tv_nsec) / 1000000);
+
+    size_t n_ok = 0, n_bad = 0, n_missing = 0, n_err = 0;
+    for (size_t i = 0; i < count; i++) {
+        switch (entries[i].status) {
+            case VERIFY_OK:      n_ok++; break;
+            case VERIFY_SIZE:
+            case VERIFY_HASH:    n_bad++; break;
+            case VERIFY_MISSING: n_missing++; break;
+            case VERIFY_ERROR:   n_err++; break;
+        }
+    }
+
+    LOG("verify: %zu files, %zu ok, %zu mismatched, %zu missing, %zu errors, %d threads, %lums",
+        count, n_ok, n_bad, n_missing, n_err, used, (unsigned long)elapsed_ms);
+
+    size_t r_bad = n_bad < VERIFY_MAX_REPORT ? n_bad : VERIFY_MAX_REPORT;
+    size_t r_missing = n_missing < VERIFY_MAX_REPORT ? n_missing : VERIFY_MAX_REPORT;
+    size_t r_err = n_err < VERIFY_MAX_REPORT ? n_err : VERIFY_MAX_REPORT;
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 256 + (r_bad + r_missing + r_err) * 128) < 0) {
+        free_entries(entries, count);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    rb_map(&rb, 8);
+    rb_lit(&rb, "checked");
+    rb_uint(&rb, count);
+    rb_lit(&rb, "ok");
+    rb_uint(&rb, n_ok);
+    rb_lit(&rb, "elapsed_ms");
+    rb_uint(&rb, elapsed_ms);
+    rb_lit(&rb, "threads");
+    rb_uint(&rb, (uint64_t)used);
+
+    rb_lit(&rb, "totals");
+    rb_map(&rb, 3);
+    rb_lit(&rb, "mismatches");
+    rb_uint(&rb, n_bad);
+    rb_lit(&rb, "missing");
+    rb_uint(&rb, n_missing);
+    rb_lit(&rb, "errors");
+    rb_uint(&rb, n_err);
+
+    rb_lit(&rb, "mismatches");
+    rb_array(&rb, r_bad);
+    for (size_t i = 0, n = 0; i < count && n < r_bad; i++) {
+        verify_entry_t *e = &entries[i];
+        if (e->status != VERIFY_SIZE && e->status != VERIFY_HASH) continue;
+
+        bool hashed = e->status == VERIFY_HASH;
+        rb_map(&rb, hashed ? 4 : 3);
+        rb_lit(&rb, "path");
+        rb_str(&rb, e->path);
+        rb_lit(&rb, "reason");
+        rb_str(&rb, hashed ? "hash" : "size");
+        rb_lit(&rb, "size");
+        rb_uint(&rb, e->actual_size);
+        if (hashed) {
+            rb_lit(&rb, "hash");
+            rb_bin(&rb, e->actual_hash, SHA256_DIGEST_SIZE);
+        }
+        n++;
+    }
+
+    rb_lit(&rb, "missing");
+    rb_array(&rb, r_missing);
+    for (size_t i = 0, n = 0; i < count && n < r_missing; i++) {
+        if (entries[i].status != VERIFY_MISSING) continue;
+        rb_str(&rb, entries[i].path);
+        n++;
+    }
+
+    rb_lit(&rb, "errors");
+    rb_array(&rb, r_err);
+    for (size_t i = 0, n = 0; i < count && n < r_err; i++) {
+        if (entries[i].status != VERIFY_ERROR) continue;
+        rb_map(&rb, 2);
+        rb_lit(&rb, "path");
+        rb_str(&rb, entries[i].path);
+        rb_lit(&rb, "error");
+        rb_str(&rb, strerror(entries[i].err));
+        n++;
+    }
+
+    free_entries(entries, count);
+
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    return ret;
+}
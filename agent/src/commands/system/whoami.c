@@ -29,13 +29,13 @@ int cmd_whoami(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
 
     rb_map(&rb, 3);
 
-    rb_str(&rb, "user");
+    rb_lit(&rb, "user");
     rb_str(&rb, pw ? pw->pw_name : "unknown");
 
-    rb_str(&rb, "uid");
+    rb_lit(&rb, "uid");
     rb_uint(&rb, (uint64_t)uid);
 
-    rb_str(&rb, "gid");
+    rb_lit(&rb, "gid");
     rb_uint(&rb, (uint64_t)gid);
 
     int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
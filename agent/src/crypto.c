@@ -0,0 +1,584 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * X25519, ChaCha20-Poly1305 and HMAC-SHA256
+ *
+ * Chosen for targets without AES or carry-less multiply instructions (most
+ * MIPS and ARMv5 parts): everything here is 32-bit additions, rotations
+ * and 32x32->64 multiplies, which every core has. Like sha256.c, plain C
+ * with no alignment or endianness assumptions.
+ *
+ * Field elements of X25519 are ten signed limbs of alternately 26 and 25
+ * bits (radix 2^25.5, as in the ref10 code), so products fit 64 bits on a
+ * 32-bit CPU. Poly1305 uses five 26-bit limbs in the same way. Neither
+ * branches nor indexes memory on secret data.
+ */
+
+#include <string.h>
+
+#include "crypto.h"
+
+static uint32_t load32_le(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void store32_le(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void store64_le(uint8_t *p, uint64_t v)
+{
+    store32_le(p, (uint32_t)v);
+    store32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+void crypto_wipe(void *p, size_t len)
+{
+    volatile uint8_t *v = p;
+    while (len--) *v++ = 0;
+}
+
+int crypto_verify(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    uint8_t diff = 0;
+    for (size_t i = 0; i < len; i++) diff |= a[i] ^ b[i];
+    return diff ? -1 : 0;
+}
+
+/* =============================================================================
+ * X25519
+ * ============================================================================= */
+
+typedef int32_t fe[10];
+
+/* Bits in limb i: 26 for even i, 25 for odd */
+#define FE_BITS(i)  (26 - ((i) & 1))
+
+/*
+ * Carry 64-bit limb sums back into a field element, leaving every limb
+ * within about half its width either side of zero. The top carry wraps
+ * around times 19, since 2^255 = 19 (mod p).
+ */
+static void fe_carry(fe h, int64_t t[10])
+{
+    int64_t c;
+    for (int i = 0; i < 10; i++) {
+        int bits = FE_BITS(i);
+        c = (t[i] + ((int64_t)1 << (bits - 1))) >> bits;
+        t[i] -= c * ((int64_t)1 << bits);
+        if (i < 9) {
+            t[i + 1] += c;
+        } else {
+            t[0] += c * 19;
+        }
+    }
+    c = (t[0] + ((int64_t)1 << 25)) >> 26;
+    t[0] -= c * ((int64_t)1 << 26);
+    t[1] += c;
+
+    for (int i = 0; i < 10; i++) h[i] = (int32_t)t[i];
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    for (int i = 0; i < 10; i++) h[i] = f[i] + g[i];
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    for (int i = 0; i < 10; i++) h[i] = f[i] - g[i];
+}
+
+/*
+ * Limb i sits at bit ceil(25.5 i), so limbs i and j multiply into limb
+ * i + j, with a factor 2 when both are odd (25.5 + 25.5 rounds up twice)
+ * and 19 when i + j wraps past limb 9. Inputs may be sums or differences
+ * of two carried elements.
+ */
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    int64_t t[10] = { 0 };
+
+    for (int i = 0; i < 10; i++) {
+        for (int j = 0; j < 10; j++) {
+            int64_t p = (int64_t)f[i] * g[j];
+            if (i & j & 1) p *= 2;
+            if (i + j < 10) {
+                t[i + j] += p;
+            } else {
+                t[i + j - 10] += p * 19;
+            }
+        }
+    }
+    fe_carry(h, t);
+}
+
+static void fe_mul_small(fe h, const fe f, int32_t k)
+{
+    int64_t t[10];
+    for (int i = 0; i < 10; i++) t[i] = (int64_t)f[i] * k;
+    fe_carry(h, t);
+}
+
+/* Swap f and g if b is 1, without branching on b */
+static void fe_cswap(fe f, fe g, uint32_t b)
+{
+    int32_t mask = -(int32_t)b;
+    for (int i = 0; i < 10; i++) {
+        int32_t x = mask & (f[i] ^ g[i]);
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+static void fe_frombytes(fe h, const uint8_t s[32])
+{
+    uint64_t acc = 0;
+    int have = 0;
+    size_t pos = 0;
+
+    /* 255 bits; the top bit of s[31] is ignored as RFC 7748 says */
+    for (int i = 0; i < 10; i++) {
+        int bits = FE_BITS(i);
+        while (have < bits) {
+            acc |= (uint64_t)s[pos++] << have;
+            have += 8;
+        }
+        h[i] = (int32_t)(acc & (((uint64_t)1 << bits) - 1));
+        acc >>= bits;
+        have -= bits;
+    }
+}
+
+/* Fully reduce mod p = 2^255 - 19 and write 32 bytes little-endian */
+static void fe_tobytes(uint8_t s[32], const fe f)
+{
+    int32_t h[10];
+    memcpy(h, f, sizeof(h));
+
+    /* q = 1 if h >= p, found by carrying h + 19 through all limbs */
+    int32_t q = (19 * h[9] + ((int32_t)1 << 24)) >> 25;
+    for (int i = 0; i < 10; i++) q = (h[i] + q) >> FE_BITS(i);
+
+    /* h - q p = h + 19 q - q 2^255; the last carry out is the 2^255 */
+    h[0] += 19 * q;
+    for (int i = 0; i < 9; i++) {
+        int bits = FE_BITS(i);
+        int32_t c = h[i] >> bits;
+        h[i + 1] += c;
+        h[i] -= c * ((int32_t)1 << bits);
+    }
+    h[9] &= ((int32_t)1 << 25) - 1;
+
+    uint64_t acc = 0;
+    int have = 0;
+    size_t pos = 0;
+    for (int i = 0; i < 10; i++) {
+        acc |= (uint64_t)(uint32_t)h[i] << have;
+        have += FE_BITS(i);
+        while (have >= 8) {
+            s[pos++] = (uint8_t)acc;
+            acc >>= 8;
+            have -= 8;
+        }
+    }
+    s[pos] = (uint8_t)acc;     /* Last 7 bits */
+}
+
+/* z^(p - 2) = 1/z; p - 2 = 2^255 - 21 has every bit set but 2 and 4 */
+static void fe_invert(fe out, const fe z)
+{
+    fe r = { 1 };
+    for (int i = 254; i >= 0; i--) {
+        fe_mul(r, r, r);
+        if (i != 2 && i != 4) fe_mul(r, r, z);
+    }
+    memcpy(out, r, sizeof(fe));
+}
+
+void x25519(uint8_t out[X25519_SIZE], const uint8_t scalar[X25519_SIZE],
+            const uint8_t point[X25519_SIZE])
+{
+    uint8_t k[32];
+    memcpy(k, scalar, sizeof(k));
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    fe x1, x2 = { 1 }, z2 = { 0 }, x3, z3 = { 1 };
+    fe a, aa, b, bb, e, c, d, da, cb;
+    fe_frombytes(x1, point);
+    memcpy(x3, x1, sizeof(fe));
+
+    /* Montgomery ladder, RFC 7748 section 5 */
+    uint32_t swap = 0;
+    for (int t = 254; t >= 0; t--) {
+        uint32_t bit = (k[t >> 3] >> (t & 7)) & 1;
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_mul(aa, a, a);
+        fe_sub(b, x2, z2);
+        fe_mul(bb, b, b);
+        fe_sub(e, aa, bb);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+
+        fe_add(x3, da, cb);
+        fe_mul(x3, x3, x3);
+        fe_sub(z3, da, cb);
+        fe_mul(z3, z3, z3);
+        fe_mul(z3, z3, x1);
+        fe_mul(x2, aa, bb);
+        fe_mul_small(z2, e, 121665);
+        fe_add(z2, z2, aa);
+        fe_mul(z2, z2, e);
+    }
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_tobytes(out, x2);
+
+    crypto_wipe(k, sizeof(k));
+    crypto_wipe(x2, sizeof(fe));
+    crypto_wipe(x3, sizeof(fe));
+}
+
+void x25519_public(uint8_t pub[X25519_SIZE], const uint8_t priv[X25519_SIZE])
+{
+    static const uint8_t base[X25519_SIZE] = { 9 };
+    x25519(pub, priv, base);
+}
+
+/* =============================================================================
+ * ChaCha20
+ * ============================================================================= */
+
+#define ROTL(x, n)  (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QR(a, b, c, d) do {                         \
+    a += b; d ^= a; d = ROTL(d, 16);                \
+    c += d; b ^= c; b = ROTL(b, 12);                \
+    a += b; d ^= a; d = ROTL(d, 8);                 \
+    c += d; b ^= c; b = ROTL(b, 7);                 \
+} while (0)
+
+static void chacha20_init(chacha20_ctx_t *ctx, const uint8_t key[32],
+                          const uint8_t nonce[12], uint32_t counter)
+{
+    ctx->state[0] = 0x61707865;     /* "expand 32-byte k" */
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) ctx->state[4 + i] = load32_le(key + 4 * i);
+    ctx->state[12] = counter;
+    for (int i = 0; i < 3; i++) ctx->state[13 + i] = load32_le(nonce + 4 * i);
+    ctx->used = sizeof(ctx->stream);
+}
+
+/*
+ * One block of key stream words for the current counter, then advance it.
+ * The state is kept in sixteen locals rather than an array so compilers
+ * hold it in registers; MIPS and ARM have enough for all of it.
+ */
+static void chacha20_core(chacha20_ctx_t *ctx, uint32_t out[16])
+{
+    const uint32_t *s = ctx->state;
+    uint32_t x0 = s[0], x1 = s[1], x2 = s[2], x3 = s[3];
+    uint32_t x4 = s[4], x5 = s[5], x6 = s[6], x7 = s[7];
+    uint32_t x8 = s[8], x9 = s[9], x10 = s[10], x11 = s[11];
+    uint32_t x12 = s[12], x13 = s[13], x14 = s[14], x15 = s[15];
+
+    for (int i = 0; i < 10; i++) {
+        QR(x0, x4, x8,  x12);
+        QR(x1, x5, x9,  x13);
+        QR(x2, x6, x10, x14);
+        QR(x3, x7, x11, x15);
+        QR(x0, x5, x10, x15);
+        QR(x1, x6, x11, x12);
+        QR(x2, x7, x8,  x13);
+        QR(x3, x4, x9,  x14);
+    }
+
+    out[0] = x0 + s[0];     out[1] = x1 + s[1];
+    out[2] = x2 + s[2];     out[3] = x3 + s[3];
+    out[4] = x4 + s[4];     out[5] = x5 + s[5];
+    out[6] = x6 + s[6];     out[7] = x7 + s[7];
+    out[8] = x8 + s[8];     out[9] = x9 + s[9];
+    out[10] = x10 + s[10];  out[11] = x11 + s[11];
+    out[12] = x12 + s[12];  out[13] = x13 + s[13];
+    out[14] = x14 + s[14];  out[15] = x15 + s[15];
+    ctx->state[12]++;
+}
+
+/* Next 64 bytes of key stream into ctx->stream */
+static void chacha20_block(chacha20_ctx_t *ctx)
+{
+    uint32_t x[16];
+    chacha20_core(ctx, x);
+    for (int i = 0; i < 16; i++) store32_le(ctx->stream + 4 * i, x[i]);
+    ctx->used = 0;
+}
+
+static void chacha20_xor(chacha20_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len)
+{
+    /* Finish the key stream left over from the last call */
+    while (len > 0 && ctx->used < sizeof(ctx->stream)) {
+        *out++ = *in++ ^ ctx->stream[ctx->used++];
+        len--;
+    }
+
+    /* Whole blocks a word at a time, without staging the key stream */
+    while (len >= 64) {
+        uint32_t x[16];
+        chacha20_core(ctx, x);
+        for (int i = 0; i < 16; i++) {
+            store32_le(out + 4 * i, load32_le(in + 4 * i) ^ x[i]);
+        }
+        out += 64;
+        in += 64;
+        len -= 64;
+    }
+
+    if (len > 0) {
+        chacha20_block(ctx);
+        for (size_t i = 0; i < len; i++) out[i] = in[i] ^ ctx->stream[i];
+        ctx->used = len;
+    }
+}
+
+/* =============================================================================
+ * Poly1305
+ * ============================================================================= */
+
+static void poly1305_init(poly1305_ctx_t *ctx, const uint8_t key[32])
+{
+    /* r with the bits RFC 8439 clears, split into 26-bit limbs */
+    ctx->r[0] = load32_le(key + 0) & 0x3ffffff;
+    ctx->r[1] = (load32_le(key + 3) >> 2) & 0x3ffff03;
+    ctx->r[2] = (load32_le(key + 6) >> 4) & 0x3ffc0ff;
+    ctx->r[3] = (load32_le(key + 9) >> 6) & 0x3f03fff;
+    ctx->r[4] = (load32_le(key + 12) >> 8) & 0x00fffff;
+    for (int i = 0; i < 4; i++) ctx->s[i] = ctx->r[i + 1] * 5;
+    for (int i = 0; i < 4; i++) ctx->pad[i] = load32_le(key + 16 + 4 * i);
+    memset(ctx->h, 0, sizeof(ctx->h));
+    ctx->buf_len = 0;
+}
+
+/*
+ * h = (h + m) * r mod 2^130 - 5 for each 16-byte block. Only whole blocks
+ * occur: the AEAD pads everything it authenticates to 16 bytes.
+ */
+static void poly1305_blocks(poly1305_ctx_t *ctx, const uint8_t *m, size_t blocks)
+{
+    const uint32_t r0 = ctx->r[0], r1 = ctx->r[1], r2 = ctx->r[2], r3 = ctx->r[3], r4 = ctx->r[4];
+    const uint32_t s1 = ctx->s[0], s2 = ctx->s[1], s3 = ctx->s[2], s4 = ctx->s[3];
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+
+    while (blocks--) {
+        h0 += load32_le(m + 0) & 0x3ffffff;
+        h1 += (load32_le(m + 3) >> 2) & 0x3ffffff;
+        h2 += (load32_le(m + 6) >> 4) & 0x3ffffff;
+        h3 += (load32_le(m + 9) >> 6) & 0x3ffffff;
+        h4 += (load32_le(m + 12) >> 8) | (1 << 24);
+
+        uint64_t d0 = (uint64_t)h0 * r0 + (uint64_t)h1 * s4 + (uint64_t)h2 * s3 +
+                      (uint64_t)h3 * s2 + (uint64_t)h4 * s1;
+        uint64_t d1 = (uint64_t)h0 * r1 + (uint64_t)h1 * r0 + (uint64_t)h2 * s4 +
+                      (uint64_t)h3 * s3 + (uint64_t)h4 * s2;
+        uint64_t d2 = (uint64_t)h0 * r2 + (uint64_t)h1 * r1 + (uint64_t)h2 * r0 +
+                      (uint64_t)h3 * s4 + (uint64_t)h4 * s3;
+        uint64_t d3 = (uint64_t)h0 * r3 + (uint64_t)h1 * r2 + (uint64_t)h2 * r1 +
+                      (uint64_t)h3 * r0 + (uint64_t)h4 * s4;
+        uint64_t d4 = (uint64_t)h0 * r4 + (uint64_t)h1 * r3 + (uint64_t)h2 * r2 +
+                      (uint64_t)h3 * r1 + (uint64_t)h4 * r0;
+
+        uint32_t c;
+        c = (uint32_t)(d0 >> 26); h0 = (uint32_t)d0 & 0x3ffffff;
+        d1 += c; c = (uint32_t)(d1 >> 26); h1 = (uint32_t)d1 & 0x3ffffff;
+        d2 += c; c = (uint32_t)(d2 >> 26); h2 = (uint32_t)d2 & 0x3ffffff;
+        d3 += c; c = (uint32_t)(d3 >> 26); h3 = (uint32_t)d3 & 0x3ffffff;
+        d4 += c; c = (uint32_t)(d4 >> 26); h4 = (uint32_t)d4 & 0x3ffffff;
+        h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+        h1 += c;
+
+        m += 16;
+    }
+
+    ctx->h[0] = h0; ctx->h[1] = h1; ctx->h[2] = h2; ctx->h[3] = h3; ctx->h[4] = h4;
+}
+
+static void poly1305_update(poly1305_ctx_t *ctx, const uint8_t *m, size_t len)
+{
+    if (ctx->buf_len > 0) {
+        size_t n = 16 - ctx->buf_len;
+        if (n > len) n = len;
+        memcpy(ctx->buf + ctx->buf_len, m, n);
+        ctx->buf_len += n;
+        m += n;
+        len -= n;
+        if (ctx->buf_len < 16) return;
+        poly1305_blocks(ctx, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+
+    poly1305_blocks(ctx, m, len / 16);
+    m += len & ~(size_t)15;
+    len &= 15;
+
+    memcpy(ctx->buf, m, len);
+    ctx->buf_len = len;
+}
+
+/* Zero-fill a partly filled block, as the AEAD does after AD and text */
+static void poly1305_pad(poly1305_ctx_t *ctx)
+{
+    if (ctx->buf_len == 0) return;
+    memset(ctx->buf + ctx->buf_len, 0, 16 - ctx->buf_len);
+    poly1305_blocks(ctx, ctx->buf, 1);
+    ctx->buf_len = 0;
+}
+
+static void poly1305_final(poly1305_ctx_t *ctx, uint8_t tag[16])
+{
+    uint32_t h0 = ctx->h[0], h1 = ctx->h[1], h2 = ctx->h[2], h3 = ctx->h[3], h4 = ctx->h[4];
+    uint32_t c, g0, g1, g2, g3, g4, mask;
+
+    c = h1 >> 26; h1 &= 0x3ffffff;
+    h2 += c; c = h2 >> 26; h2 &= 0x3ffffff;
+    h3 += c; c = h3 >> 26; h3 &= 0x3ffffff;
+    h4 += c; c = h4 >> 26; h4 &= 0x3ffffff;
+    h0 += c * 5; c = h0 >> 26; h0 &= 0x3ffffff;
+    h1 += c;
+
+    /* g = h - p; use it if that did not borrow, i.e. h >= p */
+    g0 = h0 + 5; c = g0 >> 26; g0 &= 0x3ffffff;
+    g1 = h1 + c; c = g1 >> 26; g1 &= 0x3ffffff;
+    g2 = h2 + c; c = g2 >> 26; g2 &= 0x3ffffff;
+    g3 = h3 + c; c = g3 >> 26; g3 &= 0x3ffffff;
+    g4 = h4 + c - (1u << 26);
+
+    mask = (g4 >> 31) - 1;
+    h0 = (h0 & ~mask) | (g0 & mask);
+    h1 = (h1 & ~mask) | (g1 & mask);
+    h2 = (h2 & ~mask) | (g2 & mask);
+    h3 = (h3 & ~mask) | (g3 & mask);
+    h4 = (h4 & ~mask) | (g4 & mask);
+
+    /* tag = (h + pad) mod 2^128 */
+    uint64_t f;
+    f = (uint64_t)(h0 | (h1 << 26)) + ctx->pad[0];
+    store32_le(tag + 0, (uint32_t)f);
+    f = (uint64_t)((h1 >> 6) | (h2 << 20)) + ctx->pad[1] + (f >> 32);
+    store32_le(tag + 4, (uint32_t)f);
+    f = (uint64_t)((h2 >> 12) | (h3 << 14)) + ctx->pad[2] + (f >> 32);
+    store32_le(tag + 8, (uint32_t)f);
+    f = (uint64_t)((h3 >> 18) | (h4 << 8)) + ctx->pad[3] + (f >> 32);
+    store32_le(tag + 12, (uint32_t)f);
+}
+
+/* =============================================================================
+ * ChaCha20-Poly1305 AEAD
+ * ============================================================================= */
+
+void aead_init(aead_ctx_t *ctx, const uint8_t key[AEAD_KEY_SIZE],
+               const uint8_t nonce[AEAD_NONCE_SIZE],
+               const uint8_t *ad, size_t ad_len)
+{
+    /* Block 0 keys Poly1305, the text starts at block 1 */
+    chacha20_init(&ctx->chacha, key, nonce, 0);
+    chacha20_block(&ctx->chacha);
+    poly1305_init(&ctx->poly, ctx->chacha.stream);
+    ctx->chacha.used = sizeof(ctx->chacha.stream);
+
+    poly1305_update(&ctx->poly, ad, ad_len);
+    poly1305_pad(&ctx->poly);
+    ctx->ad_len = ad_len;
+    ctx->len = 0;
+}
+
+void aead_encrypt(aead_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len)
+{
+    chacha20_xor(&ctx->chacha, out, in, len);
+    poly1305_update(&ctx->poly, out, len);
+    ctx->len += len;
+}
+
+void aead_decrypt(aead_ctx_t *ctx, uint8_t *out, const uint8_t *in, size_t len)
+{
+    poly1305_update(&ctx->poly, in, len);
+    chacha20_xor(&ctx->chacha, out, in, len);
+    ctx->len += len;
+}
+
+void aead_tag(aead_ctx_t *ctx, uint8_t tag[AEAD_TAG_SIZE])
+{
+    uint8_t lens[16];
+    poly1305_pad(&ctx->poly);
+    store64_le(lens, ctx->ad_len);
+    store64_le(lens + 8, ctx->len);
+    poly1305_update(&ctx->poly, lens, sizeof(lens));
+    poly1305_final(&ctx->poly, tag);
+    crypto_wipe(ctx, sizeof(*ctx));
+}
+
+/* =============================================================================
+ * HMAC-SHA256
+ * ============================================================================= */
+
+void hmac_sha256_init(hmac_sha256_ctx_t *ctx, const uint8_t *key, size_t key_len)
+{
+    uint8_t k[64] = { 0 };
+    if (key_len > sizeof(k)) {
+        sha256_ctx_t h;
+        sha256_init(&h);
+        sha256_update(&h, key, key_len);
+        sha256_final(&h, k);
+    } else if (key_len > 0) {
+        memcpy(k, key, key_len);
+    }
+
+    uint8_t ipad[64];
+    for (size_t i = 0; i < 64; i++) {
+        ipad[i] = k[i] ^ 0x36;
+        ctx->okey[i] = k[i] ^ 0x5c;
+    }
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, ipad, sizeof(ipad));
+
+    crypto_wipe(k, sizeof(k));
+    crypto_wipe(ipad, sizeof(ipad));
+}
+
+void hmac_sha256_update(hmac_sha256_ctx_t *ctx, const void *data, size_t len)
+{
+    sha256_update(&ctx->inner, data, len);
+}
+
+void hmac_sha256_final(hmac_sha256_ctx_t *ctx, uint8_t out[SHA256_DIGEST_SIZE])
+{
+    uint8_t inner[SHA256_DIGEST_SIZE];
+    sha256_final(&ctx->inner, inner);
+
+    sha256_ctx_t outer;
+    sha256_init(&outer);
+    sha256_update(&outer, ctx->okey, sizeof(ctx->okey));
+    sha256_update(&outer, inner, sizeof(inner));
+    sha256_final(&outer, out);
+
+    crypto_wipe(ctx, sizeof(*ctx));
+}
@@ -0,0 +1,176 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Device fingerprint sent with hello/hello_ack
+ *
+ * Clients used to follow every handshake with uname, whoami and pwd
+ * requests before they could show the device. The same information (plus a
+ * few cheap extras) is gathered once at startup, encoded as a MessagePack
+ * map and embedded in the handshake as the "device" field. In bind mode the
+ * encoded map is built before forking, so every session reuses it. An
+ * upgraded session builds its own, with the cwd it carried over.
+ *
+ * {
+ *   "sysname", "nodename", "release", "version", "machine",
+ *   "user", "uid", "gid", "cwd", "cpu", "mem_total_kb", "mem_budget_kb",
+ *   "mtd_count", "features": ["ls", "cat", ...]
+ * }
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+
+#include "edb.h"
+#include "commands.h"
+
+static uint8_t *g_fingerprint = NULL;
+static size_t   g_fingerprint_len = 0;
+
+/*
+ * Pick a human-readable CPU description. The key differs per architecture,
+ * so take the most specific one present.
+ */
+static void read_cpu_model(char *out, size_t size)
+{
+    static const char *keys[] = {
+        "model name",       /* x86, ARM64 */
+        "cpu model",        /* MIPS */
+        "Processor",        /* Older ARM */
+        "system type",      /* MIPS SoC */
+        "Hardware",         /* ARM board */
+    };
+    int best = -1;
+
+    out[0] = '\0';
+
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f) return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (!colon) continue;
+
+        for (int i = 0; i < (int)(sizeof(keys) / sizeof(keys[0])); i++) {
+            if (best >= 0 && i >= best) break;
+            if (strncmp(line, keys[i], strlen(keys[i])) != 0) continue;
+
+            char *val = colon + 1;
+            while (*val == ' ' || *val == '\t') val++;
+            val[strcspn(val, "\n")] = '\0';
+            if (*val == '\0') continue;
+
+            safe_strcpy(out, val, size);
+            best = i;
+            break;
+        }
+    }
+
+    fclose(f);
+}
+
+static uint32_t count_mtd(void)
+{
+    uint32_t count = 0;
+
+    FILE *f = fopen("/proc/mtd", "r");
+    if (!f) return 0;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "mtd", 3) == 0) count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+uint8_t *fingerprint_build(const char *cwd, size_t *len)
+{
+    struct utsname uts;
+    if (uname(&uts) < 0) {
+        memset(&uts, 0, sizeof(uts));
+    }
+
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+    struct passwd *pw = getpwuid(uid);
+
+    char cpu[128];
+    read_cpu_model(cpu, sizeof(cpu));
+
+    size_t num_features = 0;
+    while (cmd_name_at(num_features)) num_features++;
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 512) < 0) {
+        return NULL;
+    }
+
+    rb_map(&rb, 14);
+
+    rb_lit(&rb, "sysname");
+    rb_str(&rb, uts.sysname);
+    rb_lit(&rb, "nodename");
+    rb_str(&rb, uts.nodename);
+    rb_lit(&rb, "release");
+    rb_str(&rb, uts.release);
+    rb_lit(&rb, "version");
+    rb_str(&rb, uts.version);
+    rb_lit(&rb, "machine");
+    rb_str(&rb, uts.machine);
+
+    rb_lit(&rb, "user");
+    rb_str(&rb, pw ? pw->pw_name : "unknown");
+    rb_lit(&rb, "uid");
+    rb_uint(&rb, (uint64_t)uid);
+    rb_lit(&rb, "gid");
+    rb_uint(&rb, (uint64_t)gid);
+
+    rb_lit(&rb, "cwd");
+    rb_str(&rb, cwd);
+    rb_lit(&rb, "cpu");
+    rb_str(&rb, cpu);
+    rb_lit(&rb, "mem_total_kb");
+    rb_uint(&rb, mem_total_kb());
+    rb_lit(&rb, "mem_budget_kb");
+    rb_uint(&rb, (uint64_t)(mem_budget() / 1024));
+    rb_lit(&rb, "mtd_count");
+    rb_uint(&rb, count_mtd());
+
+    rb_lit(&rb, "features");
+    rb_array(&rb, num_features);
+    for (size_t i = 0; i < num_features; i++) {
+        rb_str(&rb, cmd_name_at(i));
+    }
+
+    LOG("Fingerprint: %s %s %s, %zu bytes", uts.nodename, uts.machine, cpu, rb.len);
+    *len = rb.len;
+    return rb.buf;
+}
+
+int fingerprint_init(void)
+{
+    char cwd[EDB_PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        safe_strcpy(cwd, "/", sizeof(cwd));
+    }
+
+    /* Kept for the process lifetime */
+    g_fingerprint = fingerprint_build(cwd, &g_fingerprint_len);
+    return g_fingerprint ? 0 : -1;
+}
+
+const uint8_t *fingerprint_get(size_t *len)
+{
+    *len = g_fingerprint_len;
+    return g_fingerprint;
+}
@@ -7,6 +7,8 @@
  * Usage:
  *   ./edb-agent -c <host:port>   Connect to client (reverse)
  *   ./edb-agent -l <port>        Listen for client (bind)
+ *   ./edb-agent -s <tty>         Wait for client on a serial line
+ *   ./edb-agent -u <fd>          Take over from an upgraded agent (upgrade.c)
  */
 
 #define _POSIX_C_SOURCE 200809L
@@ -26,6 +28,9 @@
 
 static volatile int g_running = 1;
 
+/* Bind mode: session that upgraded and wants the listener to follow */
+static volatile sig_atomic_t g_upgrade_pid = 0;
+
 /* -----------------------------------------------------------------------------
  * Signal Handling
  * ----------------------------------------------------------------------------- */
@@ -43,6 +48,15 @@ static void sigchld_handler(int sig)
     while (waitpid(-1, NULL, WNOHANG) > 0);
 }
 
+#if EDB_FEATURE_UPGRADE
+static void upgrade_handler(int sig, siginfo_t *info, void *ctx)
+{
+    (void)sig;
+    (void)ctx;
+    g_upgrade_pid = info->si_pid;
+}
+#endif
+
 static void setup_signals(void)
 {
     struct sigaction sa;
@@ -59,6 +73,13 @@ static void setup_signals(void)
     sa.sa_handler = sigchld_handler;
     sa.sa_flags = SA_RESTART;  /* Restart interrupted syscalls */
     sigaction(SIGCHLD, &sa, NULL);
+
+#if EDB_FEATURE_UPGRADE
+    /* An upgraded session asks the listener to follow (interrupts accept) */
+    sa.sa_sigaction = upgrade_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGUSR1, &sa, NULL);
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -71,10 +92,29 @@ static void print_usage(const char *prog)
     fprintf(stderr, "Usage:\n");
     fprintf(stderr, "  %s -c <host:port>   Connect to client (reverse)\n", prog);
     fprintf(stderr, "  %s -l <port>        Listen for client (bind)\n", prog);
+#if EDB_FEATURE_SERIAL
+    fprintf(stderr, "  %s -s <tty>         Wait for client on a serial line\n", prog);
+#endif
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -m <size>[K|M]      Memory budget (default: 1/4 of RAM)\n");
+#if EDB_FEATURE_SERIAL
+    fprintf(stderr, "  -b <baud>           Serial line speed (default: 115200)\n");
+#endif
+#if EDB_FEATURE_CRYPTO
+    fprintf(stderr, "  -k <secret>         Require encrypted sessions keyed with this secret\n");
+#endif
     fprintf(stderr, "\n");
     fprintf(stderr, "Examples:\n");
     fprintf(stderr, "  %s -c 192.168.1.100:1337\n", prog);
     fprintf(stderr, "  %s -l 1337\n", prog);
+    fprintf(stderr, "  %s -l 1337 -m 4M\n", prog);
+#if EDB_FEATURE_SERIAL
+    fprintf(stderr, "  %s -s /dev/ttyS0 -b 921600\n", prog);
+#endif
+#if EDB_FEATURE_CRYPTO
+    fprintf(stderr, "  %s -l 1337 -k s3cret\n", prog);
+#endif
 }
 
 /* -----------------------------------------------------------------------------
@@ -104,15 +144,53 @@ static int parse_host_port(const char *str, char *host, size_t host_size, uint16
     return 0;
 }
 
+/* Parse a size like 4096, 512K or 4M */
+static int parse_size(const char *str, size_t *out)
+{
+    char *end;
+    unsigned long long v = strtoull(str, &end, 10);
+    if (end == str) {
+        return -1;
+    }
+
+    if (*end == 'K' || *end == 'k') {
+        v *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        v *= 1024 * 1024;
+        end++;
+    }
+    if (*end != '\0' || v == 0) {
+        return -1;
+    }
+
+    *out = (size_t)v;
+    return 0;
+}
+
 static int parse_args(int argc, char *argv[], config_t *cfg)
 {
     memset(cfg, 0, sizeof(*cfg));
     cfg->port = EDB_DEFAULT_PORT;
+    cfg->baud = 115200;
+    cfg->resume_fd = -1;
+    cfg->listenfd = -1;
 
     if (argc < 3) {
         return -1;
     }
 
+    /* Started by upgrade: everything else comes from the old image */
+    if (strcmp(argv[1], "-u") == 0) {
+#if EDB_FEATURE_UPGRADE
+        cfg->resume_fd = atoi(argv[2]);
+        return argc == 3 ? 0 : -1;
+#else
+        fprintf(stderr, "Error: Built without upgrade support (FEATURE_UPGRADE=0)\n");
+        return -1;
+#endif
+    }
+
     if (strcmp(argv[1], "-c") == 0) {
         /* Connect mode (reverse) */
         cfg->mode = MODE_CONNECT;
@@ -128,10 +206,44 @@ static int parse_args(int argc, char *argv[], config_t *cfg)
             fprintf(stderr, "Error: Invalid port\n");
             return -1;
         }
+    } else if (strcmp(argv[1], "-s") == 0) {
+        /* Serial mode */
+#if EDB_FEATURE_SERIAL
+        cfg->mode = MODE_SERIAL;
+        cfg->tty = argv[2];
+#else
+        fprintf(stderr, "Error: Built without serial support (FEATURE_SERIAL=0)\n");
+        return -1;
+#endif
     } else {
         return -1;
     }
 
+    /* Options */
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            if (parse_size(argv[++i], &cfg->mem_budget) < 0) {
+                fprintf(stderr, "Error: Invalid memory budget\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            cfg->baud = (unsigned)atoi(argv[++i]);
+            if (cfg->baud == 0) {
+                fprintf(stderr, "Error: Invalid baud rate\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+#if EDB_FEATURE_CRYPTO
+            cfg->secret = argv[++i];
+#else
+            fprintf(stderr, "Error: Built without encryption (FEATURE_CRYPTO=0)\n");
+            return -1;
+#endif
+        } else {
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -141,9 +253,6 @@ static int parse_args(int argc, char *argv[], config_t *cfg)
 
 static int do_handshake(conn_t *conn, conn_mode_t mode)
 {
-    uint8_t *msg = NULL;
-    size_t msg_len;
-
     if (mode == MODE_CONNECT) {
         /* Reverse mode: agent sends hello first */
         LOG("Sending hello...");
@@ -154,22 +263,18 @@ static int do_handshake(conn_t *conn, conn_mode_t mode)
 
         /* Wait for hello_ack */
         LOG("Waiting for hello_ack...");
-        if (proto_recv(conn, &msg, &msg_len) < 0) {
+        if (proto_recv_hello(conn) < 0) {
             LOG("Failed to receive hello_ack");
             return -1;
         }
-        /* TODO: Validate hello_ack */
-        free(msg);
 
     } else {
         /* Bind mode: agent receives hello first */
         LOG("Waiting for hello...");
-        if (proto_recv(conn, &msg, &msg_len) < 0) {
+        if (proto_recv_hello(conn) < 0) {
             LOG("Failed to receive hello");
             return -1;
         }
-        /* TODO: Validate hello */
-        free(msg);
 
         /* Send hello_ack */
         LOG("Sending hello_ack...");
@@ -179,6 +284,11 @@ static int do_handshake(conn_t *conn, conn_mode_t mode)
         }
     }
 
+    /* Everything after hello_ack is sealed if both offered a key */
+    if (secure_start(conn) < 0) {
+        return -1;
+    }
+
     LOG("Handshake complete");
     return 0;
 }
@@ -186,20 +296,44 @@ static int do_handshake(conn_t *conn, conn_mode_t mode)
 /* Forward declaration */
 int handle_request(conn_t *conn, const uint8_t *msg, size_t msg_len);
 
-static int run_session(conn_t *conn, conn_mode_t mode)
+static void session_loop(conn_t *conn)
 {
     uint8_t *msg = NULL;
     size_t msg_len;
     int ret;
 
-    /* Perform handshake */
-    if (do_handshake(conn, mode) < 0) {
-        return -1;
-    }
+    while (g_running) {
+        /* Changes to watched directories: send those that are due (watch.c) */
+        if (watch_step(conn) < 0) {
+            LOG("Connection lost while sending changes");
+            break;
+        }
 
-    LOG("Session started, cwd=%s", conn->cwd);
+        /*
+         * Pulls in progress send a frame at a time, and only while nothing
+         * from the client is waiting, so requests are answered in between
+         * (see sched.c)
+         */
+        if (sched_active(conn) && !proto_readable(conn)) {
+            /* All held back by rate limits: wait, but wake for the client */
+            int wait = sched_wait_ms(conn);
+            if (wait > 0) {
+                watch_wait(conn, wait);
+                continue;
+            }
+            if (sched_step(conn) < 0) {
+                LOG("Connection lost while streaming");
+                break;
+            }
+            continue;
+        }
+
+        /* Only watches running: sleep until there is something to do */
+        if (watch_active(conn) && !proto_readable(conn)) {
+            watch_wait(conn, -1);
+            continue;
+        }
 
-    while (g_running) {
         /* Receive a message */
         ret = proto_recv(conn, &msg, &msg_len);
         if (ret < 0) {
@@ -207,21 +341,33 @@ static int run_session(conn_t *conn, conn_mode_t mode)
             break;
         }
 
-        LOG("Received message (%zu bytes)", msg_len);
+        LOG("Received message (%zu bytes, heap %zu/%zu)", msg_len, mem_used(), mem_budget());
 
         /* Handle the request */
         if (handle_request(conn, msg, msg_len) < 0) {
             LOG("Failed to handle request");
         }
 
-        free(msg);
+        edb_free(msg);
         msg = NULL;
     }
 
     if (msg) {
-        free(msg);
+        edb_free(msg);
     }
+}
 
+static int run_session(conn_t *conn, conn_mode_t mode)
+{
+    conn->mode = mode;
+
+    /* Perform handshake */
+    if (do_handshake(conn, mode) < 0) {
+        return -1;
+    }
+
+    LOG("Session started, cwd=%s", conn->cwd);
+    session_loop(conn);
     return 0;
 }
 
@@ -241,7 +387,7 @@ static int init_conn(conn_t *conn)
 
     /* Allocate receive buffer */
     conn->recvbuf_size = EDB_READBUF_SIZE;
-    conn->recvbuf = malloc(conn->recvbuf_size);
+    conn->recvbuf = edb_malloc(conn->recvbuf_size);
     if (!conn->recvbuf) {
         fprintf(stderr, "Error: Out of memory\n");
         return -1;
@@ -252,11 +398,17 @@ static int init_conn(conn_t *conn)
 
 static void cleanup_conn(conn_t *conn)
 {
+    sched_close_all(conn);
+    watch_close_all(conn);
+    secure_end(conn);
     if (conn->sockfd >= 0) {
         transport_close(conn->sockfd);
     }
     if (conn->recvbuf) {
-        free(conn->recvbuf);
+        edb_free(conn->recvbuf);
+    }
+    for (size_t i = 0; i < conn->held_count; i++) {
+        edb_free(conn->held[(conn->held_head + i) % EDB_MAX_HELD].data);
     }
 }
 
@@ -291,27 +443,28 @@ static int run_reverse_mode(config_t *cfg)
  * Run in Bind Mode (agent listens, forks for each client)
  * ----------------------------------------------------------------------------- */
 
-static int run_bind_mode(config_t *cfg)
+static int accept_loop(int listenfd)
 {
-    int listenfd;
     int connfd;
     pid_t pid;
 
-    LOG("Starting bind mode on port %d", cfg->port);
-
-    listenfd = transport_listen(cfg->port);
-    if (listenfd < 0) {
-        fprintf(stderr, "Error: Failed to listen on port %d\n", cfg->port);
-        return 1;
-    }
-
     /* Accept loop - parent keeps accepting, children handle sessions */
     while (g_running) {
+        /* A session upgraded: exec its image too, keeping listenfd */
+        if (g_upgrade_pid) {
+            int from = g_upgrade_pid;
+            g_upgrade_pid = 0;
+            upgrade_listener(listenfd, from);
+        }
+
         connfd = transport_accept(listenfd);
         if (connfd < 0) {
             if (!g_running) {
                 break;  /* Clean shutdown */
             }
+            if (g_upgrade_pid) {
+                continue;  /* Interrupted by an upgrade signal */
+            }
             LOG("Accept failed, continuing...");
             continue;
         }
@@ -350,6 +503,88 @@ static int run_bind_mode(config_t *cfg)
     return 0;
 }
 
+static int run_bind_mode(config_t *cfg)
+{
+    LOG("Starting bind mode on port %d", cfg->port);
+
+    int listenfd = transport_listen(cfg->port);
+    if (listenfd < 0) {
+        fprintf(stderr, "Error: Failed to listen on port %d\n", cfg->port);
+        return 1;
+    }
+
+    return accept_loop(listenfd);
+}
+
+/* -----------------------------------------------------------------------------
+ * Run in Serial Mode (agent waits for clients on a tty, see serial.c)
+ * ----------------------------------------------------------------------------- */
+
+#if EDB_FEATURE_SERIAL
+static int run_serial_mode(config_t *cfg)
+{
+    LOG("Starting serial mode on %s", cfg->tty);
+
+    serial_link_t *link = serial_open(cfg->tty, cfg->baud);
+    if (!link) {
+        return 1;
+    }
+
+    /*
+     * One session at a time, in this process: the tty is shared, and a
+     * client that opens the link again ends the session before
+     */
+    while (g_running) {
+        conn_t conn;
+        int fd = serial_accept(link);
+        if (fd < 0) {
+            break;  /* Signal, or the tty failed */
+        }
+
+        if (init_conn(&conn) < 0) {
+            transport_close(fd);
+            break;
+        }
+        conn.sockfd = fd;
+
+        run_session(&conn, MODE_SERIAL);
+
+        cleanup_conn(&conn);
+    }
+
+    serial_close(link);
+    return 0;
+}
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Run After an Upgrade (the old image exec'd this one, see upgrade.c)
+ * ----------------------------------------------------------------------------- */
+
+static int run_resumed(config_t *cfg)
+{
+    conn_t conn;
+
+    /* A bind mode listener that followed a session */
+    if (cfg->listenfd >= 0) {
+        LOG("Listener upgraded");
+        return accept_loop(cfg->listenfd);
+    }
+
+    if (init_conn(&conn) < 0) {
+        return 1;
+    }
+    if (upgrade_resume(&conn) < 0) {
+        cleanup_conn(&conn);
+        return 1;
+    }
+
+    session_loop(&conn);
+
+    cleanup_conn(&conn);
+    return 0;
+}
+
 /* -----------------------------------------------------------------------------
  * Main
  * ----------------------------------------------------------------------------- */
@@ -364,12 +599,42 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    /* Upgraded: mode, budget and secret come from the old image */
+    if (cfg.resume_fd >= 0 && upgrade_load(cfg.resume_fd, &cfg) < 0) {
+        return 1;
+    }
+
+#if EDB_FEATURE_CRYPTO
+    /* Keep the secret, then blank it out of argv so ps does not show it */
+    if (cfg.secret) {
+        if (secure_init(cfg.secret) < 0) {
+            fprintf(stderr, "Error: Invalid secret\n");
+            return 1;
+        }
+        memset((char *)cfg.secret, 'x', strlen(cfg.secret));
+    }
+#endif
+
     /* Setup signal handlers */
     setup_signals();
 
+    /* Memory budget (the fingerprint reports it, so set it first) */
+    mem_init(cfg.mem_budget);
+
+    /* Gather device info once for every handshake */
+    if (fingerprint_init() < 0) {
+        LOG("Fingerprint unavailable, continuing without it");
+    }
+
     /* Run in appropriate mode */
-    if (cfg.mode == MODE_CONNECT) {
+    if (cfg.resume_fd >= 0) {
+        return run_resumed(&cfg);
+    } else if (cfg.mode == MODE_CONNECT) {
         return run_reverse_mode(&cfg);
+#if EDB_FEATURE_SERIAL
+    } else if (cfg.mode == MODE_SERIAL) {
+        return run_serial_mode(&cfg);
+#endif
     } else {
         return run_bind_mode(&cfg);
     }
@@ -0,0 +1,218 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Memory budget: tracking allocator
+ *
+ * All agent allocations go through edb_malloc() and friends, which keep a
+ * running total of live heap bytes and refuse allocations that would take
+ * the process over its budget. Handlers see a NULL return (as on a real
+ * out-of-memory) and degrade: cat asks for a ranged read, exec and strings
+ * truncate their output. On small routers this keeps the agent out of the
+ * OOM killer's way instead of being killed mid-session.
+ *
+ * Each block carries a small header holding its size so free() can be
+ * accounted. The counters are updated atomically because verify hashes on
+ * several threads. In bind mode every forked session inherits the parent's
+ * counters and has a budget of its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "edb.h"
+
+/* Block header, sized and aligned for any fundamental type */
+typedef union {
+    size_t      size;
+    long double ld;
+    void       *ptr;
+    uint64_t    u64;
+} mem_hdr_t;
+
+static size_t g_budget = 0;     /* 0 = unlimited */
+static size_t g_used = 0;
+static size_t g_peak = 0;
+
+/* =============================================================================
+ * Budget
+ * ============================================================================= */
+
+uint32_t mem_total_kb(void)
+{
+    unsigned long kb = 0;
+
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (!f) return 0;
+
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "MemTotal: %lu kB", &kb) == 1) break;
+    }
+
+    fclose(f);
+    return (uint32_t)kb;
+}
+
+void mem_init(size_t budget)
+{
+    if (budget == 0) {
+        budget = EDB_MEM_BUDGET;
+    }
+
+    if (budget == 0) {
+        /* Auto: a quarter of physical memory, within sane bounds */
+        size_t total = (size_t)mem_total_kb() * 1024;
+        budget = total / 4;
+        if (budget < EDB_MEM_BUDGET_MIN) budget = EDB_MEM_BUDGET_MIN;
+        if (budget > EDB_MEM_BUDGET_MAX) budget = EDB_MEM_BUDGET_MAX;
+    }
+
+    g_budget = budget;
+    LOG("Memory budget: %zu KB", g_budget / 1024);
+}
+
+size_t mem_budget(void)
+{
+    return g_budget;
+}
+
+size_t mem_used(void)
+{
+    return __sync_add_and_fetch(&g_used, 0);
+}
+
+size_t mem_peak(void)
+{
+    return __sync_add_and_fetch(&g_peak, 0);
+}
+
+size_t mem_available(void)
+{
+    if (g_budget == 0) return SIZE_MAX;
+
+    size_t used = mem_used();
+    return used < g_budget ? g_budget - used : 0;
+}
+
+bool mem_fits(size_t bytes)
+{
+    return bytes <= mem_available();
+}
+
+/* =============================================================================
+ * Accounting
+ * ============================================================================= */
+
+static bool mem_charge(size_t bytes)
+{
+    size_t used = __sync_add_and_fetch(&g_used, bytes);
+
+    if (g_budget && used > g_budget) {
+        __sync_sub_and_fetch(&g_used, bytes);
+        return false;
+    }
+
+    size_t peak = g_peak;
+    while (used > peak) {
+        size_t seen = __sync_val_compare_and_swap(&g_peak, peak, used);
+        if (seen == peak) break;
+        peak = seen;
+    }
+    return true;
+}
+
+static void mem_uncharge(size_t bytes)
+{
+    __sync_sub_and_fetch(&g_used, bytes);
+}
+
+/* =============================================================================
+ * Allocator
+ * ============================================================================= */
+
+void *edb_malloc(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(mem_hdr_t)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (!mem_charge(size)) {
+        LOG("Allocation of %zu bytes over budget (%zu/%zu used)",
+            size, mem_used(), g_budget);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem_hdr_t *h = malloc(sizeof(mem_hdr_t) + size);
+    if (!h) {
+        mem_uncharge(size);
+        return NULL;
+    }
+
+    h->size = size;
+    return h + 1;
+}
+
+void *edb_calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void *p = edb_malloc(n * size);
+    if (p) memset(p, 0, n * size);
+    return p;
+}
+
+void *edb_realloc(void *ptr, size_t size)
+{
+    if (!ptr) return edb_malloc(size);
+
+    if (size > SIZE_MAX - sizeof(mem_hdr_t)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    size_t old = h->size;
+
+    /* Only growth is charged up front; the old block stays valid on failure */
+    if (size > old && !mem_charge(size - old)) {
+        LOG("Reallocation to %zu bytes over budget (%zu/%zu used)",
+            size, mem_used(), g_budget);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem_hdr_t *nh = realloc(h, sizeof(mem_hdr_t) + size);
+    if (!nh) {
+        if (size > old) mem_uncharge(size - old);
+        return NULL;
+    }
+
+    if (size < old) mem_uncharge(old - size);
+    nh->size = size;
+    return nh + 1;
+}
+
+void edb_free(void *ptr)
+{
+    if (!ptr) return;
+
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    mem_uncharge(h->size);
+    free(h);
+}
+
+char *edb_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p = edb_malloc(len);
+    if (p) memcpy(p, s, len);
+    return p;
+}
@@ -0,0 +1,288 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * MessagePack encoder (see msgpack.h)
+ *
+ * The protocol layer used to carry a second writer of its own for message
+ * envelopes; both now share this one. Decoding stays with its users: the
+ * message reader in protocol.c and the argument parsers in helpers.c.
+ */
+
+#include <string.h>
+
+#include "edb.h"
+#include "msgpack.h"
+
+/* =============================================================================
+ * Buffer
+ * ============================================================================= */
+
+static int rb_ensure(resp_builder_t *rb, size_t need)
+{
+    if (rb->len + need <= rb->cap) return 0;
+    size_t new_cap = rb->cap ? rb->cap * 2 : 64;
+    while (new_cap < rb->len + need) new_cap *= 2;
+
+    uint8_t *new_buf;
+    if (rb->heap) {
+        new_buf = edb_realloc(rb->buf, new_cap);
+        if (!new_buf) return -1;
+    } else {
+        /* Leave the caller's buffer */
+        new_buf = edb_malloc(new_cap);
+        if (!new_buf) return -1;
+        memcpy(new_buf, rb->buf, rb->len);
+        rb->heap = true;
+    }
+    rb->buf = new_buf;
+    rb->cap = new_cap;
+    return 0;
+}
+
+int rb_init(resp_builder_t *rb, size_t cap)
+{
+    rb->buf = edb_malloc(cap);
+    if (!rb->buf) return -1;
+    rb->cap = cap;
+    rb->len = 0;
+    rb->heap = true;
+    return 0;
+}
+
+void rb_init_buf(resp_builder_t *rb, uint8_t *buf, size_t cap)
+{
+    rb->buf = buf;
+    rb->cap = cap;
+    rb->len = 0;
+    rb->heap = false;
+}
+
+void rb_free(resp_builder_t *rb)
+{
+    if (rb->heap) edb_free(rb->buf);
+    rb->buf = NULL;
+}
+
+/* Unchecked stores, for callers that made room with rb_ensure */
+static void put_u16be(uint8_t *p, uint16_t v)
+{
+    p[0] = (v >> 8) & 0xff;
+    p[1] = v & 0xff;
+}
+
+static void put_u32be(uint8_t *p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+}
+
+int rb_u8(resp_builder_t *rb, uint8_t v)
+{
+    if (rb_ensure(rb, 1) < 0) return -1;
+    rb->buf[rb->len++] = v;
+    return 0;
+}
+
+int rb_u16be(resp_builder_t *rb, uint16_t v)
+{
+    if (rb_ensure(rb, 2) < 0) return -1;
+    put_u16be(rb->buf + rb->len, v);
+    rb->len += 2;
+    return 0;
+}
+
+int rb_u32be(resp_builder_t *rb, uint32_t v)
+{
+    if (rb_ensure(rb, 4) < 0) return -1;
+    put_u32be(rb->buf + rb->len, v);
+    rb->len += 4;
+    return 0;
+}
+
+int rb_raw(resp_builder_t *rb, const void *data, size_t len)
+{
+    if (rb_ensure(rb, len) < 0) return -1;
+    memcpy(rb->buf + rb->len, data, len);
+    rb->len += len;
+    return 0;
+}
+
+/*
+ * Write a marker byte followed by a big-endian length or value of width 0,
+ * 1, 2, 4 or 8 bytes, with one capacity check for the lot.
+ */
+static int rb_head(resp_builder_t *rb, uint8_t marker, size_t width, uint64_t v)
+{
+    if (rb_ensure(rb, 1 + width) < 0) return -1;
+
+    uint8_t *p = rb->buf + rb->len;
+    *p++ = marker;
+    switch (width) {
+        case 1: *p = (uint8_t)v; break;
+        case 2: put_u16be(p, (uint16_t)v); break;
+        case 4: put_u32be(p, (uint32_t)v); break;
+        case 8: put_u32be(p, (uint32_t)(v >> 32)); put_u32be(p + 4, (uint32_t)v); break;
+    }
+    rb->len += 1 + width;
+    return 0;
+}
+
+/* =============================================================================
+ * Values
+ * ============================================================================= */
+
+int rb_nil(resp_builder_t *rb)
+{
+    return rb_u8(rb, MP_NIL);
+}
+
+int rb_bool(resp_builder_t *rb, bool v)
+{
+    return rb_u8(rb, v ? MP_TRUE : MP_FALSE);
+}
+
+int rb_uint(resp_builder_t *rb, uint64_t v)
+{
+    if (v <= 0x7f) {
+        return rb_u8(rb, (uint8_t)v);
+    } else if (v <= 0xff) {
+        return rb_head(rb, MP_UINT8, 1, v);
+    } else if (v <= 0xffff) {
+        return rb_head(rb, MP_UINT16, 2, v);
+    } else if (v <= 0xffffffffu) {
+        return rb_head(rb, MP_UINT32, 4, v);
+    }
+    return rb_head(rb, MP_UINT64, 8, v);
+}
+
+int rb_int(resp_builder_t *rb, int64_t v)
+{
+    if (v >= 0) {
+        return rb_uint(rb, (uint64_t)v);
+    } else if (v >= -32) {
+        return rb_u8(rb, (uint8_t)(int8_t)v);       /* negative fixint */
+    } else if (v >= INT8_MIN) {
+        return rb_head(rb, MP_INT8, 1, (uint64_t)v);
+    } else if (v >= INT16_MIN) {
+        return rb_head(rb, MP_INT16, 2, (uint64_t)v);
+    } else if (v >= INT32_MIN) {
+        return rb_head(rb, MP_INT32, 4, (uint64_t)v);
+    }
+    return rb_head(rb, MP_INT64, 8, (uint64_t)v);
+}
+
+int rb_str_n(resp_builder_t *rb, const char *s, size_t len)
+{
+    int ret;
+    if (len <= 31) {
+        ret = rb_u8(rb, MP_FIXSTR | (uint8_t)len);
+    } else if (len <= 0xff) {
+        ret = rb_head(rb, MP_STR8, 1, len);
+    } else if (len <= 0xffff) {
+        ret = rb_head(rb, MP_STR16, 2, len);
+    } else {
+        ret = rb_head(rb, MP_STR32, 4, len);
+    }
+    if (ret < 0) return -1;
+    return rb_raw(rb, s, len);
+}
+
+int rb_str(resp_builder_t *rb, const char *s)
+{
+    return rb_str_n(rb, s, strlen(s));
+}
+
+int rb_bin_header(resp_builder_t *rb, size_t len)
+{
+    if (len <= 0xff) {
+        return rb_head(rb, MP_BIN8, 1, len);
+    } else if (len <= 0xffff) {
+        return rb_head(rb, MP_BIN16, 2, len);
+    }
+    return rb_head(rb, MP_BIN32, 4, len);
+}
+
+int rb_bin(resp_builder_t *rb, const uint8_t *data, size_t len)
+{
+    if (rb_bin_header(rb, len) < 0) return -1;
+    return rb_raw(rb, data, len);
+}
+
+int rb_map(resp_builder_t *rb, size_t count)
+{
+    if (count <= 15) {
+        return rb_u8(rb, MP_FIXMAP | (uint8_t)count);
+    } else if (count <= 0xffff) {
+        return rb_head(rb, MP_MAP16, 2, count);
+    }
+    return rb_head(rb, MP_MAP32, 4, count);
+}
+
+int rb_array(resp_builder_t *rb, size_t count)
+{
+    if (count <= 15) {
+        return rb_u8(rb, MP_FIXARRAY | (uint8_t)count);
+    } else if (count <= 0xffff) {
+        return rb_head(rb, MP_ARRAY16, 2, count);
+    }
+    return rb_head(rb, MP_ARRAY32, 4, count);
+}
+
+/* =============================================================================
+ * Reserved Headers
+ * ============================================================================= */
+
+static size_t rb_begin(resp_builder_t *rb, uint8_t marker)
+{
+    size_t at = rb->len;
+    if (rb_head(rb, marker, 4, 0) < 0) return (size_t)-1;
+    return at;
+}
+
+static void rb_end(resp_builder_t *rb, size_t at, size_t count)
+{
+    if (at == (size_t)-1) return;
+    put_u32be(rb->buf + at + 1, (uint32_t)count);
+}
+
+size_t rb_map_begin(resp_builder_t *rb)
+{
+    return rb_begin(rb, MP_MAP32);
+}
+
+size_t rb_array_begin(resp_builder_t *rb)
+{
+    return rb_begin(rb, MP_ARRAY32);
+}
+
+void rb_map_end(resp_builder_t *rb, size_t at, size_t count)
+{
+    rb_end(rb, at, count);
+}
+
+void rb_array_end(resp_builder_t *rb, size_t at, size_t count)
+{
+    rb_end(rb, at, count);
+}
+
+uint8_t *rb_bin_reserve(resp_builder_t *rb, size_t len)
+{
+    if (len > 0xffffffffu) return NULL;
+    if (rb_ensure(rb, 5 + len) < 0) return NULL;
+    if (rb_head(rb, MP_BIN32, 4, len) < 0) return NULL;
+
+    uint8_t *data = rb->buf + rb->len;
+    rb->len += len;
+    return data;
+}
+
+void rb_bin_shrink(resp_builder_t *rb, uint8_t *data, size_t reserved, size_t actual)
+{
+    if (actual >= reserved) return;
+
+    put_u32be(data - 4, (uint32_t)actual);
+    rb->len -= reserved - actual;
+}
@@ -9,6 +9,8 @@
  *
  * Wire Protocol:
  *   All messages are length-prefixed: [4 bytes BE length][MessagePack payload]
+ *   After the handshake of an encrypted session the payload is sealed
+ *   (see secure.c).
  *
  * Message Types:
  *   - hello:     Agent -> Client handshake initiation
@@ -16,203 +18,53 @@
  *   - req:       Client -> Agent command request
  *   - resp:      Agent -> Client command response
  *   - data:      Chunked file transfer (both directions)
+ *   - cancel:    Client -> Agent, abort the request with the given id
  *
  * This file provides:
- *   - MessagePack writer (mp_writer_t) for encoding responses
  *   - MessagePack reader (mp_reader_t) for decoding requests
+ *     (encoding is done with the response builder in msgpack.c)
  *   - Wire protocol send/receive with length framing
  *   - High-level message builders (proto_send_hello, proto_send_response, etc)
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #include "edb.h"
+#include "msgpack.h"
 
-/* =============================================================================
- * MessagePack Format Constants
- * ============================================================================= */
-
-/* Format markers (only those we actually use) */
-#define MP_FIXMAP       0x80
-#define MP_FIXSTR       0xa0
-#define MP_FALSE        0xc2
-#define MP_TRUE         0xc3
-#define MP_BIN8         0xc4
-#define MP_BIN16        0xc5
-#define MP_BIN32        0xc6
-#define MP_UINT8        0xcc
-#define MP_UINT16       0xcd
-#define MP_UINT32       0xce
-#define MP_UINT64       0xcf
-#define MP_STR8         0xd9
-#define MP_STR16        0xda
-#define MP_STR32        0xdb
-#define MP_MAP16        0xde
-#define MP_MAP32        0xdf
+/* Nesting limit when skipping values from the peer */
+#define MP_MAX_DEPTH    32
 
 /* =============================================================================
- * MessagePack Writer
- *
- * A simple growable buffer for building MessagePack-encoded messages.
- * Used by proto_send_* functions to construct outgoing messages.
+ * Envelope Prefixes
  *
- * Usage:
- *   mp_writer_t w;
- *   mp_writer_init(&w, 64);
- *   mp_write_map(&w, 2);
- *   mp_write_str(&w, "key1");
- *   mp_write_str(&w, "value1");
- *   mp_write_str(&w, "key2");
- *   mp_write_uint(&w, 42);
- *   proto_send(conn, w.buf, w.len);
- *   mp_writer_free(&w);
+ * Keys and fixed values of the message envelopes, encoded at compile time
+ * so sending a response copies them instead of encoding them each time.
+ * Split literals keep hex escapes from swallowing the letters after them.
  * ============================================================================= */
 
-typedef struct {
-    uint8_t *buf;   /* Buffer holding encoded data */
-    size_t   cap;   /* Allocated capacity */
-    size_t   len;   /* Current length of data */
-} mp_writer_t;
-
-static int mp_writer_init(mp_writer_t *w, size_t initial_cap)
-{
-    w->buf = malloc(initial_cap);
-    if (!w->buf) return -1;
-    w->cap = initial_cap;
-    w->len = 0;
-    return 0;
-}
-
-static void mp_writer_free(mp_writer_t *w)
-{
-    if (w->buf) free(w->buf);
-    w->buf = NULL;
-    w->cap = 0;
-    w->len = 0;
-}
-
-static int mp_writer_ensure(mp_writer_t *w, size_t need)
-{
-    if (w->len + need <= w->cap) return 0;
-
-    size_t new_cap = w->cap * 2;
-    while (new_cap < w->len + need) new_cap *= 2;
-
-    uint8_t *new_buf = realloc(w->buf, new_cap);
-    if (!new_buf) return -1;
-
-    w->buf = new_buf;
-    w->cap = new_cap;
-    return 0;
-}
-
-static int mp_write_raw(mp_writer_t *w, const void *data, size_t len)
-{
-    if (mp_writer_ensure(w, len) < 0) return -1;
-    memcpy(w->buf + w->len, data, len);
-    w->len += len;
-    return 0;
-}
-
-static int mp_write_u8(mp_writer_t *w, uint8_t val)
-{
-    return mp_write_raw(w, &val, 1);
-}
-
-static int mp_write_u16be(mp_writer_t *w, uint16_t val)
-{
-    uint16_t be = htons(val);
-    return mp_write_raw(w, &be, 2);
-}
-
-static int mp_write_u32be(mp_writer_t *w, uint32_t val)
-{
-    uint32_t be = htonl(val);
-    return mp_write_raw(w, &be, 4);
-}
-
-/* Write boolean */
-static int mp_write_bool(mp_writer_t *w, bool val)
-{
-    return mp_write_u8(w, val ? MP_TRUE : MP_FALSE);
-}
-
-/* Write unsigned integer */
-static int mp_write_uint(mp_writer_t *w, uint64_t val)
-{
-    if (val <= 0x7f) {
-        return mp_write_u8(w, (uint8_t)val);
-    } else if (val <= 0xff) {
-        if (mp_write_u8(w, MP_UINT8) < 0) return -1;
-        return mp_write_u8(w, (uint8_t)val);
-    } else if (val <= 0xffff) {
-        if (mp_write_u8(w, MP_UINT16) < 0) return -1;
-        return mp_write_u16be(w, (uint16_t)val);
-    } else if (val <= 0xffffffff) {
-        if (mp_write_u8(w, MP_UINT32) < 0) return -1;
-        return mp_write_u32be(w, (uint32_t)val);
-    } else {
-        /* 64-bit, write as two 32-bit values */
-        if (mp_write_u8(w, MP_UINT64) < 0) return -1;
-        if (mp_write_u32be(w, (uint32_t)(val >> 32)) < 0) return -1;
-        return mp_write_u32be(w, (uint32_t)val);
-    }
-}
-
-/* Write string */
-static int mp_write_str(mp_writer_t *w, const char *str)
-{
-    size_t len = strlen(str);
-
-    if (len <= 31) {
-        if (mp_write_u8(w, MP_FIXSTR | (uint8_t)len) < 0) return -1;
-    } else if (len <= 0xff) {
-        if (mp_write_u8(w, MP_STR8) < 0) return -1;
-        if (mp_write_u8(w, (uint8_t)len) < 0) return -1;
-    } else if (len <= 0xffff) {
-        if (mp_write_u8(w, MP_STR16) < 0) return -1;
-        if (mp_write_u16be(w, (uint16_t)len) < 0) return -1;
-    } else {
-        if (mp_write_u8(w, MP_STR32) < 0) return -1;
-        if (mp_write_u32be(w, (uint32_t)len) < 0) return -1;
-    }
-
-    return mp_write_raw(w, str, len);
-}
-
-/* Write binary data */
-static int mp_write_bin(mp_writer_t *w, const uint8_t *data, size_t len)
-{
-    if (len <= 0xff) {
-        if (mp_write_u8(w, MP_BIN8) < 0) return -1;
-        if (mp_write_u8(w, (uint8_t)len) < 0) return -1;
-    } else if (len <= 0xffff) {
-        if (mp_write_u8(w, MP_BIN16) < 0) return -1;
-        if (mp_write_u16be(w, (uint16_t)len) < 0) return -1;
-    } else {
-        if (mp_write_u8(w, MP_BIN32) < 0) return -1;
-        if (mp_write_u32be(w, (uint32_t)len) < 0) return -1;
-    }
+#define ENV_TYPE_RESP   "\xa4" "type" "\xa4" "resp"
+#define ENV_TYPE_DATA   "\xa4" "type" "\xa4" "data"
+#define ENV_ID          "\xa2" "id"
+#define ENV_SEQ         "\xa3" "seq"
+#define ENV_OK_TRUE     "\xa2" "ok" "\xc3"
+#define ENV_OK_FALSE    "\xa2" "ok" "\xc2"
+#define ENV_ERROR       "\xa5" "error"
+#define ENV_DATA        "\xa4" "data"
+#define ENV_DONE_TRUE   "\xa4" "done" "\xc3"
+#define ENV_DONE_FALSE  "\xa4" "done" "\xc2"
 
-    return mp_write_raw(w, data, len);
-}
+#define rb_env(rb, s)   rb_raw((rb), s, sizeof(s) - 1)
 
-/* Write map header (caller must write key-value pairs after) */
-static int mp_write_map(mp_writer_t *w, size_t count)
-{
-    if (count <= 15) {
-        return mp_write_u8(w, MP_FIXMAP | (uint8_t)count);
-    } else if (count <= 0xffff) {
-        if (mp_write_u8(w, MP_MAP16) < 0) return -1;
-        return mp_write_u16be(w, (uint16_t)count);
-    } else {
-        if (mp_write_u8(w, MP_MAP32) < 0) return -1;
-        return mp_write_u32be(w, (uint32_t)count);
-    }
-}
+/* Room for an envelope without its error string or payload */
+#define ENV_BUF_SIZE    64
 
 /* =============================================================================
  * MessagePack Reader
@@ -358,45 +210,188 @@ static int mp_read_map(mp_reader_t *r, size_t *count)
     }
 }
 
+/* Skip n bytes of payload */
+static int mp_skip_bytes(mp_reader_t *r, size_t n)
+{
+    if (n > r->len - r->pos) return -1;
+    r->pos += n;
+    return 0;
+}
+
+/* Read a big-endian length of 1, 2 or 4 bytes */
+static int mp_read_len(mp_reader_t *r, size_t width, size_t *len)
+{
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+
+    switch (width) {
+        case 1: if (mp_read_u8(r, &u8) < 0) return -1; *len = u8; return 0;
+        case 2: if (mp_read_u16be(r, &u16) < 0) return -1; *len = u16; return 0;
+        default: if (mp_read_u32be(r, &u32) < 0) return -1; *len = u32; return 0;
+    }
+}
+
+static int mp_read_bool(mp_reader_t *r, bool *val)
+{
+    uint8_t marker;
+    if (mp_read_u8(r, &marker) < 0) return -1;
+    if (marker != MP_TRUE && marker != MP_FALSE) return -1;
+    *val = (marker == MP_TRUE);
+    return 0;
+}
+
+/* Read a bin value in place: *data points into the reader's buffer */
+static int mp_read_bin(mp_reader_t *r, const uint8_t **data, size_t *len)
+{
+    uint8_t marker;
+    if (mp_read_u8(r, &marker) < 0) return -1;
+
+    size_t width;
+    switch (marker) {
+        case MP_BIN8:  width = 1; break;
+        case MP_BIN16: width = 2; break;
+        case MP_BIN32: width = 4; break;
+        default: return -1;
+    }
+    if (mp_read_len(r, width, len) < 0) return -1;
+
+    if (r->pos + *len > r->len) return -1;
+    *data = &r->buf[r->pos];
+    r->pos += *len;
+    return 0;
+}
+
+/* Skip one value of any type, including nested maps and arrays */
+static int mp_skip_depth(mp_reader_t *r, int depth)
+{
+    if (depth > MP_MAX_DEPTH) return -1;
+
+    uint8_t marker;
+    if (mp_read_u8(r, &marker) < 0) return -1;
+
+    size_t n = 0;       /* Payload bytes, or elements for maps/arrays */
+    size_t items = 0;   /* Nested values to skip */
+
+    if (marker <= 0x7f || marker >= 0xe0) {
+        return 0;                               /* fixint */
+    } else if ((marker & 0xf0) == MP_FIXMAP) {
+        items = (size_t)(marker & 0x0f) * 2;
+    } else if ((marker & 0xf0) == MP_FIXARRAY) {
+        items = marker & 0x0f;
+    } else if ((marker & 0xe0) == MP_FIXSTR) {
+        return mp_skip_bytes(r, marker & 0x1f);
+    } else {
+        switch (marker) {
+            case MP_NIL:
+            case MP_FALSE:
+            case MP_TRUE:
+                return 0;
+            case MP_UINT8:  case MP_INT8:                   return mp_skip_bytes(r, 1);
+            case MP_UINT16: case MP_INT16:                  return mp_skip_bytes(r, 2);
+            case MP_UINT32: case MP_INT32: case MP_FLOAT32: return mp_skip_bytes(r, 4);
+            case MP_UINT64: case MP_INT64: case MP_FLOAT64: return mp_skip_bytes(r, 8);
+            case MP_BIN8:  case MP_STR8:
+                if (mp_read_len(r, 1, &n) < 0) return -1;
+                return mp_skip_bytes(r, n);
+            case MP_BIN16: case MP_STR16:
+                if (mp_read_len(r, 2, &n) < 0) return -1;
+                return mp_skip_bytes(r, n);
+            case MP_BIN32: case MP_STR32:
+                if (mp_read_len(r, 4, &n) < 0) return -1;
+                return mp_skip_bytes(r, n);
+            case MP_EXT8:
+                if (mp_read_len(r, 1, &n) < 0) return -1;
+                return mp_skip_bytes(r, n + 1);     /* + type byte */
+            case MP_EXT16:
+                if (mp_read_len(r, 2, &n) < 0) return -1;
+                return mp_skip_bytes(r, n + 1);
+            case MP_EXT32:
+                if (mp_read_len(r, 4, &n) < 0) return -1;
+                return mp_skip_bytes(r, n + 1);
+            case MP_ARRAY16:
+                if (mp_read_len(r, 2, &items) < 0) return -1;
+                break;
+            case MP_ARRAY32:
+                if (mp_read_len(r, 4, &items) < 0) return -1;
+                break;
+            case MP_MAP16:
+                if (mp_read_len(r, 2, &items) < 0) return -1;
+                items *= 2;
+                break;
+            case MP_MAP32:
+                if (mp_read_len(r, 4, &items) < 0) return -1;
+                items *= 2;
+                break;
+            default:
+                if (marker >= MP_FIXEXT1 && marker <= MP_FIXEXT16) {
+                    return mp_skip_bytes(r, ((size_t)1 << (marker - MP_FIXEXT1)) + 1);
+                }
+                return -1;  /* 0xc1 is never used */
+        }
+    }
+
+    for (size_t i = 0; i < items; i++) {
+        if (mp_skip_depth(r, depth + 1) < 0) return -1;
+    }
+    return 0;
+}
+
+static int mp_skip(mp_reader_t *r)
+{
+    return mp_skip_depth(r, 0);
+}
+
 /* =============================================================================
  * Wire Protocol Functions
  * ============================================================================= */
 
 /*
- * Send a message with length prefix.
- * Format: [4 bytes length BE][payload]
+ * Send a message whose payload is head followed by body, without first
+ * joining them into one buffer. Lets large responses go out without a
+ * second copy of their data; prefix, head and body leave in one writev.
  */
-int proto_send(conn_t *conn, const uint8_t *data, size_t len)
+static int proto_send_parts(conn_t *conn, const uint8_t *head, size_t head_len,
+                            const uint8_t *body, size_t body_len)
 {
+    size_t len = head_len + body_len;
     if (len > EDB_MAX_MSG_SIZE) {
         LOG("Message too large: %zu", len);
         return -1;
     }
 
-    /* Send length prefix */
     uint32_t len_be = htonl((uint32_t)len);
-    if (transport_send(conn->sockfd, (uint8_t *)&len_be, 4) < 0) {
-        return -1;
-    }
-
-    /* Send payload */
-    if (len > 0) {
-        if (transport_send(conn->sockfd, data, len) < 0) {
-            return -1;
-        }
+    struct iovec iov[3] = {
+        { &len_be, 4 },
+        { (void *)head, head_len },
+        { (void *)body, body_len },
+    };
+    if (conn->encrypted) {
+        return secure_sendv(conn, iov + 1, 2);
     }
+    return transport_sendv(conn->sockfd, iov, 3);
+}
 
-    return 0;
+/*
+ * Send a message with length prefix.
+ * Format: [4 bytes length BE][payload]
+ */
+int proto_send(conn_t *conn, const uint8_t *data, size_t len)
+{
+    return proto_send_parts(conn, data, len, NULL, 0);
 }
 
 /*
- * Receive a message with length prefix.
- * Allocates buffer, caller must free.
+ * Read one message off the connection, skipping the held-back queue.
  */
-int proto_recv(conn_t *conn, uint8_t **data, size_t *len)
+static int recv_wire(conn_t *conn, uint8_t **data, size_t *len)
 {
     uint32_t len_be;
 
+    if (conn->encrypted) {
+        return secure_recv(conn, data, len);
+    }
+
     /* Read length prefix */
     if (transport_recv(conn->sockfd, (uint8_t *)&len_be, 4) < 0) {
         return -1;
@@ -415,14 +410,14 @@ int proto_recv(conn_t *conn, uint8_t **data, size_t *len)
     }
 
     /* Allocate and read payload */
-    *data = malloc(*len);
+    *data = edb_malloc(*len);
     if (!*data) {
         LOG("Out of memory");
         return -1;
     }
 
     if (transport_recv(conn->sockfd, *data, *len) < 0) {
-        free(*data);
+        edb_free(*data);
         *data = NULL;
         return -1;
     }
@@ -431,87 +426,279 @@ int proto_recv(conn_t *conn, uint8_t **data, size_t *len)
 }
 
 /*
- * Send hello message.
- * { "type": "hello", "version": 1, "agent": true }
+ * Receive a message with length prefix.
+ * Allocates buffer, caller must edb_free().
  */
-int proto_send_hello(conn_t *conn)
+int proto_recv(conn_t *conn, uint8_t **data, size_t *len)
 {
-    mp_writer_t w;
-    if (mp_writer_init(&w, 64) < 0) return -1;
+    /* Messages read early by proto_cancelled() go first, oldest first */
+    if (conn->held_count > 0) {
+        held_msg_t *h = &conn->held[conn->held_head];
+        *data = h->data;
+        *len = h->len;
+        conn->held_head = (conn->held_head + 1) % EDB_MAX_HELD;
+        conn->held_count--;
+        return 0;
+    }
 
-    /* Write map with 3 entries */
-    mp_write_map(&w, 3);
+    return recv_wire(conn, data, len);
+}
 
-    mp_write_str(&w, "type");
-    mp_write_str(&w, "hello");
+/*
+ * Check whether msg is { "type": "cancel", "id": <id> } and get the id.
+ */
+static bool parse_cancel(const uint8_t *msg, size_t msg_len, uint32_t *id)
+{
+    mp_reader_t r;
+    mp_reader_init(&r, msg, msg_len);
 
-    mp_write_str(&w, "version");
-    mp_write_uint(&w, EDB_VERSION);
+    size_t map_count;
+    if (mp_read_map(&r, &map_count) < 0) return false;
 
-    mp_write_str(&w, "agent");
-    mp_write_bool(&w, true);
+    bool is_cancel = false;
+    bool have_id = false;
 
-    int ret = proto_send(conn, w.buf, w.len);
-    mp_writer_free(&w);
-    return ret;
+    for (size_t i = 0; i < map_count; i++) {
+        const char *key;
+        size_t key_len;
+        if (mp_read_str(&r, &key, &key_len) < 0) return false;
+
+        if (key_len == 4 && memcmp(key, "type", 4) == 0) {
+            const char *type;
+            size_t type_len;
+            if (mp_read_str(&r, &type, &type_len) < 0) return false;
+            is_cancel = (type_len == 6 && memcmp(type, "cancel", 6) == 0);
+        } else if (key_len == 2 && memcmp(key, "id", 2) == 0) {
+            uint64_t v;
+            if (mp_read_uint(&r, &v) < 0) return false;
+            *id = (uint32_t)v;
+            have_id = true;
+        } else {
+            return false;   /* Requests carry values we don't skip here */
+        }
+    }
+
+    return is_cancel && have_id;
 }
 
 /*
- * Send hello_ack message.
- * { "type": "hello_ack", "version": 1, "agent": true }
+ * Drop a held-back cancel for request id, if one is queued. Returns true if
+ * there was one.
  */
-int proto_send_hello_ack(conn_t *conn)
+static bool take_held_cancel(conn_t *conn, uint32_t id)
 {
-    mp_writer_t w;
-    if (mp_writer_init(&w, 64) < 0) return -1;
+    for (size_t i = 0; i < conn->held_count; i++) {
+        held_msg_t *h = &conn->held[(conn->held_head + i) % EDB_MAX_HELD];
+        if (!h->cancel || h->cancel_id != id) continue;
 
-    mp_write_map(&w, 3);
+        edb_free(h->data);
 
-    mp_write_str(&w, "type");
-    mp_write_str(&w, "hello_ack");
+        /* Close the gap, keeping the rest in order */
+        for (size_t j = i + 1; j < conn->held_count; j++) {
+            conn->held[(conn->held_head + j - 1) % EDB_MAX_HELD] =
+                conn->held[(conn->held_head + j) % EDB_MAX_HELD];
+        }
+        conn->held_count--;
+        return true;
+    }
+    return false;
+}
+
+bool proto_cancelled(conn_t *conn, uint32_t id)
+{
+    if (take_held_cancel(conn, id)) {
+        LOG("Request %u cancelled", id);
+        return true;
+    }
 
-    mp_write_str(&w, "version");
-    mp_write_uint(&w, EDB_VERSION);
+    /* Read everything waiting, so a cancel behind other requests is seen */
+    while (conn->held_count < EDB_MAX_HELD && transport_readable(conn->sockfd)) {
+        uint8_t *msg = NULL;
+        size_t msg_len;
+        if (recv_wire(conn, &msg, &msg_len) < 0) {
+            LOG("Connection lost while request %u was running", id);
+            return true;
+        }
 
-    mp_write_str(&w, "agent");
-    mp_write_bool(&w, true);
+        uint32_t cancel_id = 0;
+        bool cancel = msg && parse_cancel(msg, msg_len, &cancel_id);
+        if (cancel && cancel_id == id) {
+            edb_free(msg);
+            LOG("Request %u cancelled", id);
+            return true;
+        }
 
-    int ret = proto_send(conn, w.buf, w.len);
-    mp_writer_free(&w);
-    return ret;
+        /* Anything else, including a cancel for a paused pull, waits its turn */
+        held_msg_t *h = &conn->held[(conn->held_head + conn->held_count) % EDB_MAX_HELD];
+        h->data = msg;
+        h->len = msg_len;
+        h->cancel = cancel;
+        h->cancel_id = cancel_id;
+        conn->held_count++;
+    }
+    return false;
+}
+
+int proto_cancel_stream(conn_t *conn, uint32_t id)
+{
+    if (sched_cancel(conn, id) || watch_cancel(conn, id)) {
+        return proto_send_error(conn, id, "cancelled");
+    }
+    LOG("Late cancel for request %u", id);
+    return 0;
+}
+
+bool proto_readable(conn_t *conn)
+{
+    return conn->held_count > 0 || transport_readable(conn->sockfd);
+}
+
+int proto_cancel_fd(conn_t *conn)
+{
+    return conn->held_count < EDB_MAX_HELD ? conn->sockfd : -1;
+}
+
+/* Monotonic clock in milliseconds, for request deadlines */
+static uint64_t mono_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int proto_time_left(const conn_t *conn)
+{
+    if (!conn || conn->deadline == 0) return -1;
+
+    uint64_t now = mono_ms();
+    if (now >= conn->deadline) return 0;
+
+    uint64_t left = conn->deadline - now;
+    return left > 0x7fffffff ? 0x7fffffff : (int)left;
+}
+
+bool proto_expired(const conn_t *conn)
+{
+    return proto_time_left(conn) == 0;
 }
 
 /*
- * Send an error response.
- * { "type": "resp", "id": <id>, "ok": false, "error": "<msg>" }
+ * Send hello or hello_ack.
+ * { "type": <type>, "version": 1, "agent": true, "frames": 2, "key": <bin>,
+ *   "device": {...} }
+ *
+ * "frames" offers binary data frames (see EDB_FRAMES_VERSION). "key" offers
+ * encryption (see secure.c) and is left out without it. "device" is the
+ * startup fingerprint (see fingerprint.c) and is left out if it could not
+ * be gathered.
  */
-int proto_send_error(conn_t *conn, uint32_t id, const char *error)
+static int send_hello(conn_t *conn, const char *type)
 {
-    mp_writer_t w;
-    if (mp_writer_init(&w, 128) < 0) return -1;
+    size_t fp_len;
+    const uint8_t *fp = fingerprint_get(&fp_len);
+    const uint8_t *key = secure_offer(conn);
+
+    uint8_t buf[2 * ENV_BUF_SIZE];
+    resp_builder_t rb;
+    rb_init_buf(&rb, buf, sizeof(buf));
+
+    rb_map(&rb, 4 + (key ? 1 : 0) + (fp ? 1 : 0));
+
+    rb_lit(&rb, "type");
+    rb_str(&rb, type);
 
-    mp_write_map(&w, 4);
+    rb_lit(&rb, "version");
+    rb_uint(&rb, EDB_VERSION);
 
-    mp_write_str(&w, "type");
-    mp_write_str(&w, "resp");
+    rb_lit(&rb, "agent");
+    rb_bool(&rb, true);
 
-    mp_write_str(&w, "id");
-    mp_write_uint(&w, id);
+    rb_lit(&rb, "frames");
+    rb_uint(&rb, EDB_FRAMES_VERSION);
 
-    mp_write_str(&w, "ok");
-    mp_write_bool(&w, false);
+    if (key) {
+        rb_lit(&rb, "key");
+        rb_bin(&rb, key, SECURE_KEY_SIZE);
+    }
 
-    mp_write_str(&w, "error");
-    mp_write_str(&w, error);
+    int ret;
+    if (fp) {
+        rb_lit(&rb, "device");
+        ret = proto_send_parts(conn, rb.buf, rb.len, fp, fp_len);
+    } else {
+        ret = proto_send(conn, rb.buf, rb.len);
+    }
 
-    int ret = proto_send(conn, w.buf, w.len);
-    mp_writer_free(&w);
+    rb_free(&rb);
     return ret;
 }
 
+int proto_send_hello(conn_t *conn)
+{
+    return send_hello(conn, "hello");
+}
+
+int proto_send_hello_ack(conn_t *conn)
+{
+    return send_hello(conn, "hello_ack");
+}
+
+/*
+ * Receive hello or hello_ack. Peers that predate binary frames leave out
+ * "frames" and keep getting MessagePack data messages; those that do not
+ * encrypt leave out "key".
+ */
+int proto_recv_hello(conn_t *conn)
+{
+    uint8_t *msg = NULL;
+    size_t msg_len;
+    if (proto_recv(conn, &msg, &msg_len) < 0) {
+        return -1;
+    }
+
+    uint64_t frames = 1;
+    mp_reader_t r;
+    mp_reader_init(&r, msg, msg_len);
+
+    size_t map_count;
+    if (msg && mp_read_map(&r, &map_count) == 0) {
+        for (size_t i = 0; i < map_count; i++) {
+            const char *key;
+            size_t key_len;
+            if (mp_read_str(&r, &key, &key_len) < 0) break;
+
+            if (key_len == 6 && memcmp(key, "frames", 6) == 0) {
+                if (mp_read_uint(&r, &frames) < 0) break;
+            } else if (key_len == 3 && memcmp(key, "key", 3) == 0) {
+                const uint8_t *pub;
+                size_t pub_len;
+                if (mp_read_bin(&r, &pub, &pub_len) < 0) break;
+                secure_peer(conn, pub, pub_len);
+            } else if (mp_skip(&r) < 0) {
+                break;
+            }
+        }
+    }
+    edb_free(msg);
+
+    conn->frames = frames >= EDB_FRAMES_VERSION ? EDB_FRAMES_VERSION : 1;
+    LOG("Peer data frames: version %u", conn->frames);
+    return 0;
+}
+
 /*
- * Send a success response with data.
+ * Send an error response.
+ * { "type": "resp", "id": <id>, "ok": false, "error": "<msg>" }
+ */
+int proto_send_error(conn_t *conn, uint32_t id, const char *error)
+{
+    return proto_send_response(conn, id, false, NULL, 0, error);
+}
+
+/*
+ * Send a response.
  * { "type": "resp", "id": <id>, "ok": true, "data": <raw msgpack> }
+ * { "type": "resp", "id": <id>, "ok": false, "error": "<msg>" }
  *
  * The data parameter should be pre-encoded MessagePack.
  */
@@ -519,70 +706,163 @@ int proto_send_response(conn_t *conn, uint32_t id, bool ok,
                         const uint8_t *data, size_t data_len,
                         const char *error)
 {
-    mp_writer_t w;
-    if (mp_writer_init(&w, 128 + data_len) < 0) return -1;
+    uint8_t buf[ENV_BUF_SIZE];
+    resp_builder_t rb;
+    rb_init_buf(&rb, buf, sizeof(buf));
 
     int num_fields = 3;  /* type, id, ok */
     if (ok && data) num_fields++;
     if (!ok && error) num_fields++;
 
-    mp_write_map(&w, num_fields);
+    rb_map(&rb, num_fields);
+    rb_env(&rb, ENV_TYPE_RESP);
+    rb_env(&rb, ENV_ID);
+    rb_uint(&rb, id);
 
-    mp_write_str(&w, "type");
-    mp_write_str(&w, "resp");
-
-    mp_write_str(&w, "id");
-    mp_write_uint(&w, id);
-
-    mp_write_str(&w, "ok");
-    mp_write_bool(&w, ok);
-
-    if (ok && data) {
-        mp_write_str(&w, "data");
-        /* Write raw msgpack data directly */
-        mp_write_raw(&w, data, data_len);
+    if (ok) {
+        rb_env(&rb, ENV_OK_TRUE);
+    } else {
+        rb_env(&rb, ENV_OK_FALSE);
     }
 
     if (!ok && error) {
-        mp_write_str(&w, "error");
-        mp_write_str(&w, error);
+        rb_env(&rb, ENV_ERROR);
+        rb_str(&rb, error);
+    }
+
+    int ret;
+    if (ok && data) {
+        /* "data" goes last so the encoded value can follow the envelope as is */
+        rb_env(&rb, ENV_DATA);
+        ret = proto_send_parts(conn, rb.buf, rb.len, data, data_len);
+    } else {
+        ret = proto_send(conn, rb.buf, rb.len);
     }
 
-    int ret = proto_send(conn, w.buf, w.len);
-    mp_writer_free(&w);
+    rb_free(&rb);
     return ret;
 }
 
 /*
  * Send a data chunk for file transfer.
- * { "type": "data", "id": <id>, "seq": <seq>, "data": <binary>, "done": <bool> }
+ * { "type": "data", "id": <id>, "seq": <seq>, "done": <bool>, "data": <binary> }
+ *
+ * Like a response's data, the chunk goes last and is sent from where it is.
+ * With binary frames negotiated the envelope is a fixed 12-byte header.
  */
 int proto_send_data(conn_t *conn, uint32_t id, uint32_t seq,
                     const uint8_t *data, size_t len, bool done)
 {
-    mp_writer_t w;
-    if (mp_writer_init(&w, 128 + len) < 0) return -1;
+    if (conn->frames >= EDB_FRAMES_VERSION) {
+        if (len > EDB_MAX_MSG_SIZE - FRAME_HDR_SIZE) return -1;
+
+        uint8_t hdr[4 + FRAME_HDR_SIZE];
+        uint32_t v = htonl((uint32_t)(FRAME_HDR_SIZE + len));
+        memcpy(hdr, &v, 4);
+        hdr[4] = FRAME_KIND_DATA;
+        hdr[5] = done ? FRAME_FLAG_DONE : 0;
+        hdr[6] = 0;
+        hdr[7] = 0;
+        v = htonl(id);
+        memcpy(hdr + 8, &v, 4);
+        v = htonl(seq);
+        memcpy(hdr + 12, &v, 4);
+
+        struct iovec iov[2] = {
+            { hdr, sizeof(hdr) },
+            { (void *)data, len },
+        };
+        if (conn->encrypted) {
+            iov[0].iov_base = hdr + 4;
+            iov[0].iov_len = FRAME_HDR_SIZE;
+            return secure_sendv(conn, iov, 2);
+        }
+        return transport_sendv(conn->sockfd, iov, 2);
+    }
 
-    mp_write_map(&w, 5);
+    uint8_t buf[ENV_BUF_SIZE];
+    resp_builder_t rb;
+    rb_init_buf(&rb, buf, sizeof(buf));
 
-    mp_write_str(&w, "type");
-    mp_write_str(&w, "data");
+    rb_map(&rb, 5);
+    rb_env(&rb, ENV_TYPE_DATA);
+    rb_env(&rb, ENV_ID);
+    rb_uint(&rb, id);
+    rb_env(&rb, ENV_SEQ);
+    rb_uint(&rb, seq);
 
-    mp_write_str(&w, "id");
-    mp_write_uint(&w, id);
+    if (done) {
+        rb_env(&rb, ENV_DONE_TRUE);
+    } else {
+        rb_env(&rb, ENV_DONE_FALSE);
+    }
 
-    mp_write_str(&w, "seq");
-    mp_write_uint(&w, seq);
+    rb_env(&rb, ENV_DATA);
+    rb_bin_header(&rb, len);
 
-    mp_write_str(&w, "data");
-    mp_write_bin(&w, data, len);
+    int ret = proto_send_parts(conn, rb.buf, rb.len, data, len);
+    rb_free(&rb);
+    return ret;
+}
 
-    mp_write_str(&w, "done");
-    mp_write_bool(&w, done);
+static uint32_t get_u32be(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
 
-    int ret = proto_send(conn, w.buf, w.len);
-    mp_writer_free(&w);
-    return ret;
+int proto_parse_data(const uint8_t *msg, size_t msg_len, data_msg_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    if (!msg || msg_len == 0) return -1;
+
+    /* Binary frame */
+    if (msg[0] == FRAME_KIND_DATA) {
+        if (msg_len < FRAME_HDR_SIZE) return -1;
+        out->done = (msg[1] & FRAME_FLAG_DONE) != 0;
+        out->id = get_u32be(msg + 4);
+        out->seq = get_u32be(msg + 8);
+        out->data = msg + FRAME_HDR_SIZE;
+        out->len = msg_len - FRAME_HDR_SIZE;
+        return 0;
+    }
+
+    /* { "type": "data" | "cancel", "id", "seq", "data", "done" } in any order */
+    mp_reader_t r;
+    mp_reader_init(&r, msg, msg_len);
+
+    size_t map_count;
+    if (mp_read_map(&r, &map_count) < 0) return -1;
+
+    bool is_data = false;
+    for (size_t i = 0; i < map_count; i++) {
+        const char *key;
+        size_t key_len;
+        if (mp_read_str(&r, &key, &key_len) < 0) return -1;
+
+        uint64_t v;
+        if (key_len == 4 && memcmp(key, "type", 4) == 0) {
+            const char *type;
+            size_t type_len;
+            if (mp_read_str(&r, &type, &type_len) < 0) return -1;
+            is_data = (type_len == 4 && memcmp(type, "data", 4) == 0);
+            out->cancel = (type_len == 6 && memcmp(type, "cancel", 6) == 0);
+        } else if (key_len == 2 && memcmp(key, "id", 2) == 0) {
+            if (mp_read_uint(&r, &v) < 0) return -1;
+            out->id = (uint32_t)v;
+        } else if (key_len == 3 && memcmp(key, "seq", 3) == 0) {
+            if (mp_read_uint(&r, &v) < 0) return -1;
+            out->seq = (uint32_t)v;
+        } else if (key_len == 4 && memcmp(key, "data", 4) == 0) {
+            if (mp_read_bin(&r, &out->data, &out->len) < 0) return -1;
+        } else if (key_len == 4 && memcmp(key, "done", 4) == 0) {
+            if (mp_read_bool(&r, &out->done) < 0) return -1;
+        } else if (mp_skip(&r) < 0) {
+            return -1;
+        }
+    }
+
+    return (is_data || out->cancel) ? 0 : -1;
 }
 
 /* =============================================================================
@@ -593,10 +873,20 @@ int proto_send_data(conn_t *conn, uint32_t id, uint32_t seq,
  * Parse an incoming request and dispatch to command handlers.
  *
  * Expected format:
- * { "type": "req", "id": <uint>, "cmd": "<string>", "args": { ... } }
+ * { "type": "req", "id": <uint>, "cmd": "<string>", "args": { ... },
+ *   "deadline_ms": <uint> }
+ *
+ * deadline_ms is optional; handlers that scan or wait bound their work by
+ * it and return partial results. Unknown fields are skipped.
  */
 int handle_request(conn_t *conn, const uint8_t *msg, size_t msg_len)
 {
+    /* A data frame with no push to take it (e.g. sent after a cancel) */
+    if (msg_len > 0 && msg[0] == FRAME_KIND_DATA) {
+        LOG("Dropping stray data frame");
+        return 0;
+    }
+
     mp_reader_t r;
     mp_reader_init(&r, msg, msg_len);
 
@@ -615,6 +905,7 @@ int handle_request(conn_t *conn, const uint8_t *msg, size_t msg_len)
     size_t cmd_len = 0;
     size_t args_start = 0;
     size_t args_len = 0;
+    uint64_t deadline_ms = 0;
 
     for (size_t i = 0; i < map_count; i++) {
         /* Read key */
@@ -641,17 +932,28 @@ int handle_request(conn_t *conn, const uint8_t *msg, size_t msg_len)
         } else if (key_len == 4 && memcmp(key, "args", 4) == 0) {
             /* Save position of args for later parsing by command handler */
             args_start = r.pos;
-            /* Skip over the args value - we need to skip whatever type it is */
-            /* For simplicity, just pass the rest of the buffer */
-            args_len = msg_len - r.pos;
-            r.pos = msg_len;  /* Move to end */
+            if (mp_skip(&r) < 0) {
+                return proto_send_error(conn, (uint32_t)id, "invalid args field");
+            }
+            args_len = r.pos - args_start;
+        } else if (key_len == 11 && memcmp(key, "deadline_ms", 11) == 0) {
+            if (mp_read_uint(&r, &deadline_ms) < 0) {
+                return proto_send_error(conn, (uint32_t)id, "invalid deadline_ms field");
+            }
         } else {
-            /* Skip unknown field - for now just fail */
-            LOG("Unknown field in request");
-            return proto_send_error(conn, (uint32_t)id, "unknown field");
+            /* Unknown field (from a newer client): ignore it */
+            LOG("Skipping unknown field in request");
+            if (mp_skip(&r) < 0) {
+                return proto_send_error(conn, (uint32_t)id, "invalid message format");
+            }
         }
     }
 
+    /* A cancel for a pull still streaming or a watch, or one that already finished */
+    if (type_str != NULL && type_len == 6 && memcmp(type_str, "cancel", 6) == 0) {
+        return proto_cancel_stream(conn, (uint32_t)id);
+    }
+
     /* Validate we got a request */
     if (type_str == NULL || type_len != 3 || memcmp(type_str, "req", 3) != 0) {
         LOG("Not a request message");
@@ -673,6 +975,15 @@ int handle_request(conn_t *conn, const uint8_t *msg, size_t msg_len)
 
     LOG("Request id=%lu cmd=%s", (unsigned long)id, cmd_buf);
 
+    /* Cancelled while it waited behind earlier requests */
+    if (take_held_cancel(conn, (uint32_t)id)) {
+        LOG("Request %lu cancelled before it ran", (unsigned long)id);
+        return proto_send_error(conn, (uint32_t)id, "cancelled");
+    }
+
+    /* The deadline runs from when the request arrived */
+    conn->deadline = deadline_ms ? mono_ms() + deadline_ms : 0;
+
     /* Dispatch to command handler */
     cmd_type_t cmd = cmd_parse(cmd_buf);
     return cmd_handle(conn, (uint32_t)id, cmd, msg + args_start, args_len);
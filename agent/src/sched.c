@@ -0,0 +1,221 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Bulk stream scheduling
+ *
+ * A pull used to write its whole file in one loop, so a pwd sent during a
+ * large download waited behind megabytes of data. Now cmd_pull only sends
+ * its first response and registers a stream; the session loop (main.c)
+ * sends one frame at a time, and only while no message from the client is
+ * waiting:
+ *
+ *   1. Control and requests: cancel, pwd, ls, ... are read and answered
+ *      as soon as they arrive, between two frames
+ *   2. Bulk data: one frame (at most EDB_FRAME_SIZE) from the next stream,
+ *      round-robin, so parallel pulls share the link evenly
+ *
+ * Frames are produced on demand rather than queued, so a stream holds a
+ * fixed amount of memory however far the socket lags behind (for a pull,
+ * its EDB_READAHEAD read-ahead blocks).
+ *
+ * Transfers can be rate limited, each on its own ("rate" argument of pull
+ * and push) and all together (throttle command), so dumping flash does not
+ * starve a device that is still routing traffic. A stream is skipped while
+ * either of its buckets is empty; when every stream is held back the
+ * session loop waits for the client instead of spinning.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "edb.h"
+
+/* =============================================================================
+ * Token Bucket
+ *
+ * Kept as the time at which the bucket would be full again (tat), which
+ * needs no timer: sending n bytes pushes tat n/rate seconds further, and
+ * a sender may go as long as tat is at most TB_BURST_US ahead of now.
+ * ============================================================================= */
+
+#define TB_BURST_US     100000  /* Credit an idle transfer may save up: 100 ms */
+#define TB_MIN_FRAME    512     /* Smallest frame at low rates */
+
+static uint64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void tb_init(tbucket_t *tb, uint64_t rate)
+{
+    tb->rate = rate;
+    tb->tat = 0;
+}
+
+/* Microseconds until the bucket lets the next frame through */
+static uint64_t tb_wait_us(const tbucket_t *tb, uint64_t now)
+{
+    if (tb->rate == 0 || tb->tat <= now + TB_BURST_US) return 0;
+    return tb->tat - now - TB_BURST_US;
+}
+
+static void tb_charge(tbucket_t *tb, size_t bytes, uint64_t now)
+{
+    if (tb->rate == 0) return;
+    if (tb->tat < now) tb->tat = now;
+    tb->tat += (uint64_t)bytes * 1000000 / tb->rate;
+}
+
+/* Cap a frame at a tenth of a second's worth, so slow limits stay smooth */
+static size_t tb_frame(const tbucket_t *tb, size_t max)
+{
+    if (tb->rate == 0) return max;
+
+    uint64_t frame = tb->rate / 10;
+    if (frame < TB_MIN_FRAME) frame = TB_MIN_FRAME;
+    return frame < max ? (size_t)frame : max;
+}
+
+/* Microseconds until a stream may send, given its own and the session's limit */
+static uint64_t stream_wait_us(const conn_t *conn, const stream_t *s, uint64_t now)
+{
+    uint64_t own = tb_wait_us(&s->bucket, now);
+    uint64_t shared = tb_wait_us(&conn->bucket, now);
+    return own > shared ? own : shared;
+}
+
+void sched_throttle(conn_t *conn, tbucket_t *tb, size_t bytes)
+{
+    uint64_t now = mono_us();
+
+    for (;;) {
+        uint64_t wait = tb_wait_us(&conn->bucket, now);
+        if (tb) {
+            uint64_t own = tb_wait_us(tb, now);
+            if (own > wait) wait = own;
+        }
+        if (wait == 0) break;
+
+        struct timespec ts = { (time_t)(wait / 1000000), (long)(wait % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+        now = mono_us();
+    }
+
+    tb_charge(&conn->bucket, bytes, now);
+    if (tb) tb_charge(tb, bytes, now);
+}
+
+/* =============================================================================
+ * Streams
+ * ============================================================================= */
+
+/* Release a stream's state and free its slot */
+static void stream_close(stream_t *s)
+{
+    if (s->close) s->close(s->ctx);
+    memset(s, 0, sizeof(*s));
+}
+
+int sched_add(conn_t *conn, uint32_t id, uint64_t rate,
+              int (*send_next)(conn_t *, void *, size_t, size_t *),
+              void (*close_fn)(void *), void *ctx)
+{
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        stream_t *s = &conn->streams[i];
+        if (s->send_next) continue;
+
+        s->id = id;
+        s->send_next = send_next;
+        s->close = close_fn;
+        s->ctx = ctx;
+        tb_init(&s->bucket, rate);
+        LOG("Stream %u started in slot %zu", id, i);
+        return 0;
+    }
+    return -1;
+}
+
+bool sched_has_room(const conn_t *conn)
+{
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        if (!conn->streams[i].send_next) return true;
+    }
+    return false;
+}
+
+bool sched_active(const conn_t *conn)
+{
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        if (conn->streams[i].send_next) return true;
+    }
+    return false;
+}
+
+int sched_step(conn_t *conn)
+{
+    uint64_t now = mono_us();
+
+    for (size_t n = 0; n < EDB_MAX_STREAMS; n++) {
+        stream_t *s = &conn->streams[conn->stream_next];
+        conn->stream_next = (conn->stream_next + 1) % EDB_MAX_STREAMS;
+        if (!s->send_next || stream_wait_us(conn, s, now) > 0) continue;
+
+        size_t max = tb_frame(&conn->bucket, tb_frame(&s->bucket, EDB_FRAME_SIZE));
+        size_t sent = 0;
+        int ret = s->send_next(conn, s->ctx, max, &sent);
+
+        tb_charge(&s->bucket, sent, now);
+        tb_charge(&conn->bucket, sent, now);
+
+        if (ret <= 0) {
+            LOG("Stream %u %s", s->id, ret == 0 ? "finished" : "failed");
+            stream_close(s);
+        }
+        return ret < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+int sched_wait_ms(const conn_t *conn)
+{
+    uint64_t now = mono_us();
+    uint64_t wait = UINT64_MAX;
+
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        const stream_t *s = &conn->streams[i];
+        if (!s->send_next) continue;
+
+        uint64_t w = stream_wait_us(conn, s, now);
+        if (w < wait) wait = w;
+    }
+
+    if (wait == UINT64_MAX) return 0;
+    wait = (wait + 999) / 1000;
+    return wait > 0x7fffffff ? 0x7fffffff : (int)wait;
+}
+
+bool sched_cancel(conn_t *conn, uint32_t id)
+{
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        stream_t *s = &conn->streams[i];
+        if (!s->send_next || s->id != id) continue;
+
+        LOG("Stream %u cancelled", id);
+        stream_close(s);
+        return true;
+    }
+    return false;
+}
+
+void sched_close_all(conn_t *conn)
+{
+    for (size_t i = 0; i < EDB_MAX_STREAMS; i++) {
+        if (conn->streams[i].send_next) stream_close(&conn->streams[i]);
+    }
+}
@@ -0,0 +1,354 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Session encryption
+ *
+ * Each side puts a fresh X25519 public key in its hello or hello_ack
+ * ("key", 32 bytes). When both did, every message after the hello_ack is
+ * sealed with ChaCha20-Poly1305 in both directions:
+ *
+ *   [4 bytes length BE][ciphertext][16 bytes tag]
+ *
+ * The length counts ciphertext and tag, and is authenticated as the
+ * associated data. Nonces are a per-direction message counter (4 zero
+ * bytes, then the count as 64-bit little-endian), so a message dropped,
+ * replayed or reordered fails authentication and ends the session. The
+ * plaintext is exactly what would otherwise have followed the length
+ * prefix, binary data frames included.
+ *
+ * Keys come from HKDF-SHA256 over the shared secret:
+ *
+ *   prk     = HMAC(secret, X25519(own, peer))
+ *   info    = "edb session v1" || client key || agent key
+ *   client  = HMAC(prk, info || 0x01)            client -> agent
+ *   agent   = HMAC(prk, client || info || 0x02)  agent -> client
+ *
+ * secret is the pre-shared secret given with -k, empty without one. A
+ * passive listener learns nothing either way; only with a secret does a
+ * man in the middle fail, since the keys he derives do not match. An
+ * agent with a secret refuses clients that do not encrypt.
+ *
+ * Sealing is one pass over the data into a per-session buffer that holds
+ * a whole data frame, so a frame still leaves in one write.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+
+#include "edb.h"
+#include "crypto.h"
+
+#define SECURE_INFO         "edb session v1"
+#define SECURE_SECRET_MAX   256
+
+/* Largest data frame plus its header and tag, and the length prefix */
+#define SECURE_BUF_SIZE     (4 + EDB_FRAME_SIZE + 64 + AEAD_TAG_SIZE)
+
+struct secure_state {
+    bool        have_key;
+    bool        have_peer;
+    uint8_t     priv[X25519_SIZE];
+    uint8_t     pub[X25519_SIZE];
+    uint8_t     peer[X25519_SIZE];
+    uint8_t     tx_key[AEAD_KEY_SIZE];
+    uint8_t     rx_key[AEAD_KEY_SIZE];
+    uint64_t    tx_seq;
+    uint64_t    rx_seq;
+    uint8_t     buf[SECURE_BUF_SIZE];
+};
+
+static uint8_t g_secret[SECURE_SECRET_MAX];
+static size_t g_secret_len;
+
+int secure_init(const char *secret)
+{
+    size_t len = strlen(secret);
+    if (len == 0 || len > sizeof(g_secret)) {
+        return -1;
+    }
+    memcpy(g_secret, secret, len);
+    g_secret_len = len;
+    return 0;
+}
+
+static struct secure_state *secure_state(conn_t *conn)
+{
+    if (!conn->secure) {
+        conn->secure = edb_calloc(1, sizeof(struct secure_state));
+    }
+    return conn->secure;
+}
+
+static int read_random(uint8_t *buf, size_t len)
+{
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(fd, buf + got, len - got);
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        got += (size_t)n;
+    }
+
+    close(fd);
+    return 0;
+}
+
+const uint8_t *secure_offer(conn_t *conn)
+{
+    struct secure_state *s = secure_state(conn);
+    if (!s) {
+        return NULL;
+    }
+
+    if (!s->have_key) {
+        if (read_random(s->priv, sizeof(s->priv)) < 0) {
+            LOG("No random bytes, session will not be encrypted");
+            return NULL;
+        }
+        x25519_public(s->pub, s->priv);
+        s->have_key = true;
+    }
+    return s->pub;
+}
+
+void secure_peer(conn_t *conn, const uint8_t *key, size_t len)
+{
+    struct secure_state *s = secure_state(conn);
+    if (!s || len != X25519_SIZE) {
+        return;
+    }
+    memcpy(s->peer, key, X25519_SIZE);
+    s->have_peer = true;
+}
+
+int secure_start(conn_t *conn)
+{
+    struct secure_state *s = conn->secure;
+
+    if (!s || !s->have_key || !s->have_peer) {
+        secure_end(conn);
+        if (g_secret_len > 0) {
+            LOG("Refusing unencrypted session (secret set)");
+            return -1;
+        }
+        LOG("Session not encrypted");
+        return 0;
+    }
+
+    uint8_t shared[X25519_SIZE];
+    x25519(shared, s->priv, s->peer);
+    crypto_wipe(s->priv, sizeof(s->priv));
+
+    /* A low-order peer key gives an all-zero secret anyone can compute */
+    static const uint8_t zero[X25519_SIZE];
+    if (crypto_verify(shared, zero, sizeof(shared)) == 0) {
+        LOG("Peer key is not usable");
+        return -1;
+    }
+
+    hmac_sha256_ctx_t h;
+    uint8_t prk[SHA256_DIGEST_SIZE];
+    hmac_sha256_init(&h, g_secret, g_secret_len);
+    hmac_sha256_update(&h, shared, sizeof(shared));
+    hmac_sha256_final(&h, prk);
+    crypto_wipe(shared, sizeof(shared));
+
+    /* The agent's peer is always the client */
+    hmac_sha256_init(&h, prk, sizeof(prk));
+    hmac_sha256_update(&h, SECURE_INFO, sizeof(SECURE_INFO) - 1);
+    hmac_sha256_update(&h, s->peer, X25519_SIZE);
+    hmac_sha256_update(&h, s->pub, X25519_SIZE);
+    hmac_sha256_update(&h, "\x01", 1);
+    hmac_sha256_final(&h, s->rx_key);
+
+    hmac_sha256_init(&h, prk, sizeof(prk));
+    hmac_sha256_update(&h, s->rx_key, sizeof(s->rx_key));
+    hmac_sha256_update(&h, SECURE_INFO, sizeof(SECURE_INFO) - 1);
+    hmac_sha256_update(&h, s->peer, X25519_SIZE);
+    hmac_sha256_update(&h, s->pub, X25519_SIZE);
+    hmac_sha256_update(&h, "\x02", 1);
+    hmac_sha256_final(&h, s->tx_key);
+    crypto_wipe(prk, sizeof(prk));
+
+    conn->encrypted = true;
+    LOG("Session encrypted");
+    return 0;
+}
+
+static void make_nonce(uint8_t nonce[AEAD_NONCE_SIZE], uint64_t seq)
+{
+    memset(nonce, 0, 4);
+    for (int i = 0; i < 8; i++) {
+        nonce[4 + i] = (uint8_t)(seq >> (8 * i));
+    }
+}
+
+int secure_sendv(conn_t *conn, const struct iovec *iov, int iovcnt)
+{
+    struct secure_state *s = conn->secure;
+
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+    if (len > EDB_MAX_MSG_SIZE) {
+        LOG("Message too large: %zu", len);
+        return -1;
+    }
+
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    make_nonce(nonce, s->tx_seq++);
+
+    uint32_t len_be = htonl((uint32_t)(len + AEAD_TAG_SIZE));
+    memcpy(s->buf, &len_be, 4);
+
+    aead_ctx_t aead;
+    aead_init(&aead, s->tx_key, nonce, s->buf, 4);
+
+    /* Seal into buf, writing it out whenever it fills up */
+    size_t fill = 4;
+    for (int i = 0; i < iovcnt; i++) {
+        const uint8_t *p = iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+
+        while (left > 0) {
+            size_t n = sizeof(s->buf) - fill;
+            if (n > left) n = left;
+            aead_encrypt(&aead, s->buf + fill, p, n);
+            fill += n;
+            p += n;
+            left -= n;
+
+            if (fill == sizeof(s->buf)) {
+                if (transport_send(conn->sockfd, s->buf, fill) < 0) return -1;
+                fill = 0;
+            }
+        }
+    }
+
+    if (fill + AEAD_TAG_SIZE > sizeof(s->buf)) {
+        if (transport_send(conn->sockfd, s->buf, fill) < 0) return -1;
+        fill = 0;
+    }
+    aead_tag(&aead, s->buf + fill);
+    return transport_send(conn->sockfd, s->buf, fill + AEAD_TAG_SIZE);
+}
+
+int secure_recv(conn_t *conn, uint8_t **data, size_t *len)
+{
+    struct secure_state *s = conn->secure;
+    uint32_t len_be;
+
+    *data = NULL;
+    *len = 0;
+
+    if (transport_recv(conn->sockfd, (uint8_t *)&len_be, 4) < 0) {
+        return -1;
+    }
+
+    size_t n = ntohl(len_be);
+    if (n < AEAD_TAG_SIZE || n - AEAD_TAG_SIZE > EDB_MAX_MSG_SIZE) {
+        LOG("Bad sealed message length: %zu", n);
+        return -1;
+    }
+
+    uint8_t *buf = edb_malloc(n);
+    if (!buf) {
+        LOG("Out of memory");
+        return -1;
+    }
+    if (transport_recv(conn->sockfd, buf, n) < 0) {
+        edb_free(buf);
+        return -1;
+    }
+
+    uint8_t nonce[AEAD_NONCE_SIZE];
+    make_nonce(nonce, s->rx_seq++);
+
+    size_t body = n - AEAD_TAG_SIZE;
+    uint8_t tag[AEAD_TAG_SIZE];
+    aead_ctx_t aead;
+    aead_init(&aead, s->rx_key, nonce, (const uint8_t *)&len_be, 4);
+    aead_decrypt(&aead, buf, buf, body);
+    aead_tag(&aead, tag);
+
+    if (crypto_verify(tag, buf + body, AEAD_TAG_SIZE) != 0) {
+        LOG("Message failed authentication");
+        edb_free(buf);
+        return -1;
+    }
+
+    if (body == 0) {
+        edb_free(buf);
+        return 0;
+    }
+    *data = buf;
+    *len = body;
+    return 0;
+}
+
+size_t secure_secret(const char **secret)
+{
+    *secret = (const char *)g_secret;
+    return g_secret_len;
+}
+
+/* Saved session: tx key, rx key, tx count, rx count (64-bit LE each) */
+int secure_save(const conn_t *conn, uint8_t out[SECURE_SAVE_SIZE])
+{
+    const struct secure_state *s = conn->secure;
+    if (!conn->encrypted || !s) {
+        return -1;
+    }
+
+    memcpy(out, s->tx_key, AEAD_KEY_SIZE);
+    memcpy(out + AEAD_KEY_SIZE, s->rx_key, AEAD_KEY_SIZE);
+    for (int i = 0; i < 8; i++) {
+        out[2 * AEAD_KEY_SIZE + i] = (uint8_t)(s->tx_seq >> (8 * i));
+        out[2 * AEAD_KEY_SIZE + 8 + i] = (uint8_t)(s->rx_seq >> (8 * i));
+    }
+    return 0;
+}
+
+int secure_restore(conn_t *conn, const uint8_t *in, size_t len)
+{
+    struct secure_state *s = secure_state(conn);
+    if (!s || len != SECURE_SAVE_SIZE) {
+        return -1;
+    }
+
+    memcpy(s->tx_key, in, AEAD_KEY_SIZE);
+    memcpy(s->rx_key, in + AEAD_KEY_SIZE, AEAD_KEY_SIZE);
+    s->tx_seq = 0;
+    s->rx_seq = 0;
+    for (int i = 7; i >= 0; i--) {
+        s->tx_seq = (s->tx_seq << 8) | in[2 * AEAD_KEY_SIZE + i];
+        s->rx_seq = (s->rx_seq << 8) | in[2 * AEAD_KEY_SIZE + 8 + i];
+    }
+    conn->encrypted = true;
+    return 0;
+}
+
+void secure_end(conn_t *conn)
+{
+    if (conn->secure) {
+        crypto_wipe(conn->secure, sizeof(struct secure_state));
+        edb_free(conn->secure);
+        conn->secure = NULL;
+    }
+    conn->encrypted = false;
+}
@@ -0,0 +1,797 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Serial transport - the protocol over a UART (agent -s)
+ *
+ * Many targets only expose a console UART until networking is up. The
+ * session loop and the commands only know sockets, so the link runs in a
+ * thread of its own and bridges the tty to one end of a socketpair; the
+ * session gets the other end and runs exactly as in bind mode.
+ *
+ * On the line, every frame is COBS-encoded and ends with a 0x00 byte, so
+ * a receiver finds the next frame after any noise (kernel messages, a
+ * getty's prompt) by waiting for a zero. Before encoding a frame is:
+ *
+ *   u8 type, u8 seq, u8 ack, u16 sack (big-endian), data, u32 CRC-32
+ *
+ * with the CRC (IEEE, as zlib) over everything before it; frames that fail
+ * it are dropped. Every frame carries the receive state of its sender: ack
+ * is the next DATA seq it has not yet passed on, and bit i of sack is set
+ * when it holds seq ack+i already. Up to EDB_SERIAL_WINDOW DATA frames are
+ * in flight, so the line never idles waiting for acknowledgements. A frame
+ * counts as lost once a frame sent after it has arrived, and only lost
+ * frames are sent again; a timeout covers the tail of a burst.
+ *
+ * A link is opened by the client: it sends SYN until the agent answers
+ * SYN_ACK, and both start at seq 0. Their data is a random nonce chosen by
+ * the client (u32), and the window (u8) and largest frame data (u16) the
+ * sender can receive; each side sends no more than the other can take.
+ * A SYN with a new nonce ends the session running before, so a client
+ * that crashed can simply reconnect. FIN ends the session from either
+ * side. DATA for a link that is not open is answered with FIN.
+ */
+
+#define _DEFAULT_SOURCE     /* B460800 and up, CRTSCTS */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/socket.h>
+
+#include "edb.h"
+
+#define LINK_DATA       0x01
+#define LINK_ACK        0x02
+#define LINK_SYN        0x03
+#define LINK_SYN_ACK    0x04
+#define LINK_FIN        0x05
+
+#define LINK_WINDOW     EDB_SERIAL_WINDOW
+#define LINK_DATA_MAX   EDB_SERIAL_FRAME
+#define LINK_HDR        5
+#define LINK_CRC        4
+#define LINK_RAW_MAX    (LINK_HDR + LINK_DATA_MAX + LINK_CRC)
+#define LINK_COBS_MAX   (LINK_RAW_MAX + LINK_RAW_MAX / 254 + 2)   /* With delimiter */
+
+/* Room for two full frames, so the next is queued while one drains */
+#define LINK_OUT_SIZE   (2 * LINK_COBS_MAX)
+
+/*
+ * Retransmit timeout: until the first round trip is measured, the time a
+ * full window takes on the line plus this much; after that, the smoothed
+ * round trip as in TCP (RFC 6298) but with no backoff, since a UART has no
+ * one else to make room for.
+ */
+#define LINK_RTO_SLACK_MS   200
+
+/* How long a closed session waits for its last frames to be acknowledged */
+#define LINK_LINGER_MS      5000
+
+#if LINK_WINDOW > 16 || (LINK_WINDOW & (LINK_WINDOW - 1))
+#error "EDB_SERIAL_WINDOW must be a power of two, at most 16 (the sack bitmap)"
+#endif
+
+typedef struct {
+    uint64_t    sent_ms;            /* When last sent */
+    uint32_t    tx;                 /* Transmission number when last sent */
+    uint16_t    len;
+    bool        resent;             /* No round trip sample from it */
+    bool        sacked;             /* Peer holds it already */
+    uint8_t     data[LINK_DATA_MAX];
+} link_txslot_t;
+
+typedef struct {
+    uint16_t    len;
+    uint16_t    off;                /* Bytes already passed to the session */
+    bool        have;
+    uint8_t     data[LINK_DATA_MAX];
+} link_rxslot_t;
+
+struct serial_link {
+    int             tty;
+    struct termios  saved;          /* Restored by serial_close() */
+    int             notify[2];      /* Session fds for serial_accept() */
+    pthread_t       thread;
+
+    /* Open link, sock < 0 when there is none */
+    int             sock;           /* Our end of the session socketpair */
+    uint32_t        nonce;
+    unsigned        window;         /* Frames the client takes in flight */
+    size_t          frame;          /* Data the client takes per frame */
+    bool            closing;        /* Session ended, FIN once all is acked */
+    uint64_t        progress_ms;    /* Last time the peer acked something */
+
+    /* Sending */
+    uint8_t         tx_base;        /* Oldest unacknowledged seq */
+    uint8_t         tx_next;        /* Next new seq */
+    uint32_t        tx_count;       /* Frames sent so far, numbers them */
+    uint32_t        tx_hi;          /* Latest transmission the peer has */
+    unsigned        rto;            /* Retransmit timeout, ms */
+    unsigned        rto_init;       /* Before the first sample */
+    unsigned        rto_min;        /* Two frames on the line and some */
+    unsigned        srtt;           /* Smoothed round trip, 0 = no sample */
+    unsigned        rttvar;
+    link_txslot_t   txq[LINK_WINDOW];
+
+    /* Receiving */
+    uint8_t         rx_next;        /* Next seq for the session */
+    bool            ack_owed;
+    link_rxslot_t   rxq[LINK_WINDOW];
+
+    /* Line */
+    uint8_t         out[LINK_OUT_SIZE];
+    size_t          out_len;
+    uint8_t         in[LINK_COBS_MAX];
+    size_t          in_len;
+    bool            in_skip;        /* Overlong frame: drop up to the next 0x00 */
+};
+
+/* -----------------------------------------------------------------------------
+ * Helpers
+ * ----------------------------------------------------------------------------- */
+
+static uint64_t mono_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint32_t crc_table[256];
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const uint8_t *p, size_t n)
+{
+    uint32_t c = 0xffffffffu;
+    while (n--) {
+        c = crc_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+/* COBS: replace every 0x00 by the distance to the next one. Returns length. */
+static size_t cobs_encode(const uint8_t *src, size_t n, uint8_t *dst)
+{
+    size_t code_at = 0, o = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (src[i] == 0) {
+            dst[code_at] = code;
+            code_at = o++;
+            code = 1;
+        } else {
+            dst[o++] = src[i];
+            if (++code == 0xff) {
+                dst[code_at] = code;
+                code_at = o++;
+                code = 1;
+            }
+        }
+    }
+    dst[code_at] = code;
+    return o;
+}
+
+/* Returns the decoded length, or -1 if src is not valid COBS or too long */
+static int cobs_decode(const uint8_t *src, size_t n, uint8_t *dst, size_t max)
+{
+    size_t i = 0, o = 0;
+
+    while (i < n) {
+        uint8_t code = src[i++];
+        if (code == 0) return -1;
+        for (uint8_t k = 1; k < code; k++) {
+            if (i >= n || o >= max) return -1;
+            dst[o++] = src[i++];
+        }
+        if (code != 0xff && i < n) {
+            if (o >= max) return -1;
+            dst[o++] = 0;
+        }
+    }
+    return (int)o;
+}
+
+/* -----------------------------------------------------------------------------
+ * Open the tty
+ * ----------------------------------------------------------------------------- */
+
+static const struct { unsigned baud; speed_t speed; } bauds[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 },
+    { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B500000
+    { 500000, B500000 },
+#endif
+#ifdef B576000
+    { 576000, B576000 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B1500000
+    { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+    { 2000000, B2000000 },
+#endif
+#ifdef B3000000
+    { 3000000, B3000000 },
+#endif
+#ifdef B4000000
+    { 4000000, B4000000 },
+#endif
+};
+
+static int tty_open(const char *path, unsigned baud, struct termios *saved)
+{
+    speed_t speed = 0;
+    for (size_t i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+        if (bauds[i].baud == baud) speed = bauds[i].speed;
+    }
+    if (!speed) {
+        fprintf(stderr, "Error: Unsupported baud rate %u\n", baud);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct termios t;
+    if (tcgetattr(fd, &t) < 0) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    *saved = t;
+
+    /* Raw 8N1: no echo, no line editing, no XON/XOFF, no CR/LF mapping */
+    t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR |
+                   ICRNL | IXON | IXOFF | IXANY);
+    t.c_oflag &= ~OPOST;
+    t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    t.c_cflag &= ~(CSIZE | PARENB | CSTOPB);
+    t.c_cflag |= CS8 | CREAD | CLOCAL;
+#ifdef CRTSCTS
+    t.c_cflag &= ~CRTSCTS;
+#endif
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    cfsetispeed(&t, speed);
+    cfsetospeed(&t, speed);
+
+    if (tcsetattr(fd, TCSANOW, &t) < 0) {
+        fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+/* -----------------------------------------------------------------------------
+ * Sending
+ * ----------------------------------------------------------------------------- */
+
+/* Receive state for the header: next seq wanted, and which after it we hold */
+static uint16_t link_sack(const serial_link_t *l)
+{
+    uint16_t sack = 0;
+    for (unsigned i = 0; i < LINK_WINDOW; i++) {
+        if (l->rxq[(uint8_t)(l->rx_next + i) % LINK_WINDOW].have) {
+            sack |= (uint16_t)(1u << i);
+        }
+    }
+    return sack;
+}
+
+static bool link_room(const serial_link_t *l)
+{
+    return LINK_OUT_SIZE - l->out_len >= LINK_COBS_MAX;
+}
+
+/* Encode a frame onto the output buffer; the caller checks link_room() */
+static void link_queue(serial_link_t *l, uint8_t type, uint8_t seq,
+                       const uint8_t *data, size_t len)
+{
+    uint8_t raw[LINK_RAW_MAX];
+    uint16_t sack = link_sack(l);
+
+    raw[0] = type;
+    raw[1] = seq;
+    raw[2] = l->rx_next;
+    raw[3] = (uint8_t)(sack >> 8);
+    raw[4] = (uint8_t)sack;
+    if (len) memcpy(raw + LINK_HDR, data, len);
+
+    size_t n = LINK_HDR + len;
+    uint32_t crc = crc32(raw, n);
+    raw[n++] = (uint8_t)(crc >> 24);
+    raw[n++] = (uint8_t)(crc >> 16);
+    raw[n++] = (uint8_t)(crc >> 8);
+    raw[n++] = (uint8_t)crc;
+
+    l->out_len += cobs_encode(raw, n, l->out + l->out_len);
+    l->out[l->out_len++] = 0;
+    l->ack_owed = false;
+}
+
+static void link_send_data(serial_link_t *l, uint8_t seq, bool resend)
+{
+    link_txslot_t *s = &l->txq[seq % LINK_WINDOW];
+    s->sent_ms = mono_ms();
+    s->tx = ++l->tx_count;
+    s->resent = resend;
+    link_queue(l, LINK_DATA, seq, s->data, s->len);
+}
+
+/* When the frame sent first of those not yet acknowledged times out */
+static uint64_t link_due(const serial_link_t *l)
+{
+    uint64_t due = UINT64_MAX;
+    for (uint8_t seq = l->tx_base; seq != l->tx_next; seq++) {
+        const link_txslot_t *s = &l->txq[seq % LINK_WINDOW];
+        if ((!s->sacked || seq == l->tx_base) && s->sent_ms + l->rto < due) {
+            due = s->sent_ms + l->rto;
+        }
+    }
+    return due;
+}
+
+/* Round trip of a frame sent once (RFC 6298, in ms) */
+static void link_rtt(serial_link_t *l, unsigned rtt)
+{
+    if (l->srtt == 0) {
+        l->srtt = rtt ? rtt : 1;
+        l->rttvar = rtt / 2;
+    } else {
+        unsigned diff = rtt > l->srtt ? rtt - l->srtt : l->srtt - rtt;
+        l->rttvar = (3 * l->rttvar + diff) / 4;
+        l->srtt = (7 * l->srtt + rtt) / 8;
+    }
+    l->rto = l->srtt + (4 * l->rttvar > l->rto_min ? 4 * l->rttvar : l->rto_min);
+}
+
+/* SYN_ACK and FIN: nonce, our window and frame size */
+static void link_send_ctl(serial_link_t *l, uint8_t type)
+{
+    uint8_t n[7] = {
+        (uint8_t)(l->nonce >> 24), (uint8_t)(l->nonce >> 16),
+        (uint8_t)(l->nonce >> 8), (uint8_t)l->nonce,
+        LINK_WINDOW, (uint8_t)(LINK_DATA_MAX >> 8), (uint8_t)LINK_DATA_MAX,
+    };
+    if (link_room(l)) link_queue(l, type, 0, n, sizeof(n));
+}
+
+/* Write what the tty takes without blocking */
+static int link_flush(serial_link_t *l)
+{
+    if (l->out_len == 0) return 0;
+
+    ssize_t n = write(l->tty, l->out, l->out_len);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        LOG("serial: write failed: %s", strerror(errno));
+        return -1;
+    }
+    memmove(l->out, l->out + n, l->out_len - (size_t)n);
+    l->out_len -= (size_t)n;
+    return 0;
+}
+
+/* -----------------------------------------------------------------------------
+ * Link State
+ * ----------------------------------------------------------------------------- */
+
+static void link_reset(serial_link_t *l)
+{
+    l->closing = false;
+    l->tx_base = l->tx_next = 0;
+    l->tx_count = l->tx_hi = 0;
+    l->rto = l->rto_init;
+    l->srtt = l->rttvar = 0;
+    l->rx_next = 0;
+    l->ack_owed = false;
+    for (unsigned i = 0; i < LINK_WINDOW; i++) {
+        l->txq[i].sacked = false;
+        l->rxq[i].have = false;
+    }
+    l->progress_ms = mono_ms();
+}
+
+/* End the running session: it reads end of file and finishes */
+static void link_drop(serial_link_t *l)
+{
+    if (l->sock >= 0) {
+        shutdown(l->sock, SHUT_RDWR);
+        close(l->sock);
+        l->sock = -1;
+    }
+    l->nonce = 0;
+}
+
+/* Client SYN: start a new session unless this one is already running */
+static void link_syn(serial_link_t *l, const uint8_t *data, size_t len)
+{
+    if (len < 7) return;
+
+    uint32_t nonce = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                     ((uint32_t)data[2] << 8) | data[3];
+    unsigned window = data[4];
+    size_t frame = ((size_t)data[5] << 8) | data[6];
+
+    if (nonce != 0 && nonce == l->nonce) {
+        link_send_ctl(l, LINK_SYN_ACK);         /* Our answer was lost */
+        return;
+    }
+    if (window == 0 || frame == 0) return;
+
+    if (l->sock >= 0) {
+        LOG("serial: client reconnected, ending the previous session");
+    }
+    link_drop(l);
+    link_reset(l);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        LOG("serial: socketpair failed: %s", strerror(errno));
+        return;
+    }
+    fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[1], F_SETFD, FD_CLOEXEC);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+
+    if (write(l->notify[1], &sv[1], sizeof(sv[1])) != sizeof(sv[1])) {
+        close(sv[0]);
+        close(sv[1]);
+        return;
+    }
+
+    l->sock = sv[0];
+    l->nonce = nonce;
+    l->window = window < LINK_WINDOW ? window : LINK_WINDOW;
+    l->frame = frame < LINK_DATA_MAX ? frame : LINK_DATA_MAX;
+    link_send_ctl(l, LINK_SYN_ACK);
+    LOG("serial: link open");
+}
+
+/* Apply the peer's receive state to what we have in flight */
+static void link_acked(serial_link_t *l, uint8_t ack, uint16_t sack)
+{
+    uint8_t inflight = (uint8_t)(l->tx_next - l->tx_base);
+
+    /* An ack outside what we sent is stale (or from before a reset) */
+    if ((uint8_t)(ack - l->tx_base) > inflight) return;
+
+    uint64_t now = mono_ms();
+    while (l->tx_base != ack) {
+        link_txslot_t *s = &l->txq[l->tx_base % LINK_WINDOW];
+        if (s->tx > l->tx_hi) l->tx_hi = s->tx;
+        /* Timed from the first news of it, not from the gap before it closing */
+        if (!s->resent && !s->sacked) link_rtt(l, (unsigned)(now - s->sent_ms));
+        s->sacked = false;
+        l->tx_base++;
+        l->progress_ms = now;
+    }
+
+    inflight = (uint8_t)(l->tx_next - l->tx_base);
+    for (unsigned i = 0; i < LINK_WINDOW && i < inflight; i++) {
+        link_txslot_t *s = &l->txq[(uint8_t)(ack + i) % LINK_WINDOW];
+        if ((sack & (1u << i)) && !s->sacked) {
+            s->sacked = true;
+            if (s->tx > l->tx_hi) l->tx_hi = s->tx;
+            if (!s->resent) link_rtt(l, (unsigned)(now - s->sent_ms));
+        }
+    }
+}
+
+/* One frame off the line, still COBS-encoded */
+static void link_input(serial_link_t *l, const uint8_t *enc, size_t enc_len)
+{
+    uint8_t raw[LINK_RAW_MAX];
+    int n = cobs_decode(enc, enc_len, raw, sizeof(raw));
+    if (n < LINK_HDR + LINK_CRC) return;
+
+    size_t len = (size_t)n - LINK_CRC;
+    uint32_t crc = ((uint32_t)raw[len] << 24) | ((uint32_t)raw[len + 1] << 16) |
+                   ((uint32_t)raw[len + 2] << 8) | raw[len + 3];
+    if (crc32(raw, len) != crc) return;
+
+    uint8_t type = raw[0], seq = raw[1], ack = raw[2];
+    uint16_t sack = (uint16_t)((raw[3] << 8) | raw[4]);
+    const uint8_t *data = raw + LINK_HDR;
+    len -= LINK_HDR;
+
+    if (type == LINK_SYN) {
+        link_syn(l, data, len);
+        return;
+    }
+
+    if (l->sock < 0) {
+        /* A client that thinks it is connected: tell it otherwise */
+        if (type == LINK_DATA) link_send_ctl(l, LINK_FIN);
+        return;
+    }
+
+    if (type == LINK_FIN) {
+        LOG("serial: link closed by client");
+        link_drop(l);
+        return;
+    }
+
+    link_acked(l, ack, sack);
+
+    if (type == LINK_DATA) {
+        /* Answer duplicates too: our last ack may be what was lost */
+        l->ack_owed = true;
+        if ((uint8_t)(seq - l->rx_next) < LINK_WINDOW && len > 0) {
+            link_rxslot_t *s = &l->rxq[seq % LINK_WINDOW];
+            if (!s->have) {
+                memcpy(s->data, data, len);
+                s->len = (uint16_t)len;
+                s->off = 0;
+                s->have = true;
+            }
+        }
+    }
+}
+
+/* Split what the tty has into frames */
+static int link_read(serial_link_t *l)
+{
+    uint8_t buf[1024];
+
+    for (;;) {
+        ssize_t n = read(l->tty, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) return 0;
+            LOG("serial: read failed: %s", strerror(errno));
+            return -1;
+        }
+        if (n == 0) return 0;
+
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] == 0) {
+                if (!l->in_skip && l->in_len) link_input(l, l->in, l->in_len);
+                l->in_len = 0;
+                l->in_skip = false;
+            } else if (l->in_len < sizeof(l->in)) {
+                l->in[l->in_len++] = buf[i];
+            } else {
+                l->in_skip = true;
+            }
+        }
+    }
+}
+
+/* Pass in-order data to the session as far as it takes it */
+static void link_deliver(serial_link_t *l)
+{
+    for (;;) {
+        link_rxslot_t *s = &l->rxq[l->rx_next % LINK_WINDOW];
+        if (!s->have) return;
+
+        if (l->sock >= 0 && !l->closing) {
+            ssize_t n = send(l->sock, s->data + s->off, s->len - s->off, MSG_DONTWAIT);
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                return;
+            }
+            if (n > 0 && s->off + n < s->len) {
+                s->off += (uint16_t)n;
+                return;
+            }
+            /* Sent, or the session is gone and it is dropped */
+        }
+        s->have = false;
+        l->rx_next++;
+        l->ack_owed = true;
+    }
+}
+
+/* Send what the peer lost, then new data from the session while the window allows */
+static void link_transmit(serial_link_t *l)
+{
+    if (l->sock < 0) return;
+
+    uint64_t now = mono_ms();
+
+    /*
+     * Lost: a frame sent after it arrived, or nothing heard of it for too
+     * long. The oldest also goes again when held, to have its ack resent.
+     */
+    for (uint8_t seq = l->tx_base; seq != l->tx_next && link_room(l); seq++) {
+        link_txslot_t *s = &l->txq[seq % LINK_WINDOW];
+        bool lost = !s->sacked && s->tx < l->tx_hi;
+        bool expired = (!s->sacked || seq == l->tx_base) && now - s->sent_ms >= l->rto;
+        if (lost || expired) link_send_data(l, seq, true);
+    }
+
+    while (!l->closing && link_room(l) &&
+           (uint8_t)(l->tx_next - l->tx_base) < l->window) {
+        link_txslot_t *s = &l->txq[l->tx_next % LINK_WINDOW];
+        ssize_t n = recv(l->sock, s->data, l->frame, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                l->closing = true;
+            }
+            break;
+        }
+        if (n == 0) {
+            l->closing = true;          /* Session ended */
+            l->progress_ms = now;
+            break;
+        }
+        s->len = (uint16_t)n;
+        s->sacked = false;
+        link_send_data(l, l->tx_next++, false);
+    }
+
+    /* Session ended: close the link once the client has everything */
+    if (l->closing &&
+        (l->tx_base == l->tx_next || now - l->progress_ms >= LINK_LINGER_MS) &&
+        link_room(l)) {
+        link_send_ctl(l, LINK_FIN);
+        link_drop(l);
+        LOG("serial: link closed");
+        return;
+    }
+
+    if (l->ack_owed && link_room(l)) {
+        link_queue(l, LINK_ACK, 0, NULL, 0);
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * Link Thread
+ * ----------------------------------------------------------------------------- */
+
+static void *link_thread(void *arg)
+{
+    serial_link_t *l = arg;
+
+    for (;;) {
+        struct pollfd pfd[2];
+        int nfds = 1;
+
+        pfd[0].fd = l->tty;
+        pfd[0].events = POLLIN | (l->out_len ? POLLOUT : 0);
+
+        if (l->sock >= 0) {
+            pfd[1].fd = l->sock;
+            pfd[1].events = 0;
+            if (!l->closing && (uint8_t)(l->tx_next - l->tx_base) < l->window &&
+                link_room(l)) {
+                pfd[1].events |= POLLIN;
+            }
+            if (l->rxq[l->rx_next % LINK_WINDOW].have) {
+                pfd[1].events |= POLLOUT;
+            }
+            nfds = 2;
+        }
+
+        /* Wake for the retransmit timer and the linger limit */
+        int timeout = -1;
+        if (l->sock >= 0 && l->tx_base != l->tx_next) {
+            uint64_t now = mono_ms();
+            uint64_t due = link_due(l);
+            timeout = due > now ? (int)(due - now) : 0;
+        } else if (l->sock >= 0 && l->closing) {
+            timeout = LINK_RTO_SLACK_MS;
+        }
+
+        if (poll(pfd, nfds, timeout) < 0 && errno != EINTR) {
+            LOG("serial: poll failed: %s", strerror(errno));
+            break;
+        }
+
+        if (link_read(l) < 0) break;
+        link_deliver(l);
+        link_transmit(l);
+        if (link_flush(l) < 0) break;
+    }
+
+    link_drop(l);
+    close(l->notify[1]);            /* serial_accept() fails from now on */
+    return NULL;
+}
+
+/* -----------------------------------------------------------------------------
+ * Public Interface
+ * ----------------------------------------------------------------------------- */
+
+serial_link_t *serial_open(const char *path, unsigned baud)
+{
+    serial_link_t *l = edb_malloc(sizeof(*l));
+    if (!l) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return NULL;
+    }
+    memset(l, 0, sizeof(*l));
+    l->sock = -1;
+
+    l->tty = tty_open(path, baud, &l->saved);
+    if (l->tty < 0) {
+        edb_free(l);
+        return NULL;
+    }
+
+    if (pipe(l->notify) < 0) {
+        fprintf(stderr, "Error: pipe: %s\n", strerror(errno));
+        tcsetattr(l->tty, TCSANOW, &l->saved);
+        close(l->tty);
+        edb_free(l);
+        return NULL;
+    }
+    fcntl(l->notify[0], F_SETFD, FD_CLOEXEC);
+    fcntl(l->notify[1], F_SETFD, FD_CLOEXEC);
+
+    /*
+     * A full window on the line (10 bits a byte), plus the kernel's output
+     * buffer ahead of it and the peer's frame ahead of its ack
+     */
+    unsigned frame_ms = (unsigned)((uint64_t)LINK_COBS_MAX * 10 * 1000 / baud) + 1;
+    l->rto_init = LINK_RTO_SLACK_MS + (LINK_WINDOW + 4) * frame_ms;
+    l->rto_min = 2 * frame_ms + 20;
+    link_reset(l);
+
+    crc_init();
+
+    if (pthread_create(&l->thread, NULL, link_thread, l) != 0) {
+        fprintf(stderr, "Error: Failed to start the serial link\n");
+        close(l->notify[0]);
+        close(l->notify[1]);
+        tcsetattr(l->tty, TCSANOW, &l->saved);
+        close(l->tty);
+        edb_free(l);
+        return NULL;
+    }
+    pthread_detach(l->thread);
+
+    LOG("serial: %s at %u baud, window %d x %d bytes, rto %u ms",
+        path, baud, LINK_WINDOW, LINK_DATA_MAX, l->rto);
+    return l;
+}
+
+int serial_accept(serial_link_t *l)
+{
+    int fd;
+    ssize_t n = read(l->notify[0], &fd, sizeof(fd));
+    if (n != sizeof(fd)) {
+        return -1;
+    }
+    LOG("Client connected");
+    return fd;
+}
+
+void serial_close(serial_link_t *l)
+{
+    /* The link thread still runs; the process exits right after this */
+    tcsetattr(l->tty, TCSANOW, &l->saved);
+}
@@ -19,6 +19,8 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 #include "edb.h"
 
@@ -201,6 +203,43 @@ int transport_send(int sockfd, const uint8_t *data, size_t len)
     return 0;
 }
 
+int transport_sendv(int sockfd, struct iovec *iov, int iovcnt)
+{
+    for (;;) {
+        while (iovcnt > 0 && iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt == 0) break;
+
+        ssize_t n = writev(sockfd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG("send failed: %s", strerror(errno));
+            return -1;
+        }
+        if (n == 0) {
+            LOG("connection closed");
+            return -1;
+        }
+
+        /* Drop what went out, resume partway into a buffer if need be */
+        size_t done = (size_t)n;
+        while (done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            iovcnt--;
+            if (iovcnt == 0) return 0;
+        }
+        iov->iov_base = (uint8_t *)iov->iov_base + done;
+        iov->iov_len -= done;
+    }
+
+    return 0;
+}
+
 /* -----------------------------------------------------------------------------
  * Receive Raw Bytes
  * ----------------------------------------------------------------------------- */
@@ -227,3 +266,24 @@ int transport_recv(int sockfd, uint8_t *data, size_t len)
 
     return 0;
 }
+
+/* -----------------------------------------------------------------------------
+ * Check for Pending Input
+ * ----------------------------------------------------------------------------- */
+
+bool transport_readable(int sockfd)
+{
+    return transport_wait_readable(sockfd, 0);
+}
+
+bool transport_wait_readable(int sockfd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = sockfd, .events = POLLIN };
+
+    int n;
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+
+    return n > 0 && (pfd.revents & (POLLIN | POLLHUP | POLLERR));
+}
@@ -0,0 +1,607 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Hot upgrade
+ *
+ * Command: upgrade - Replace the agent binary without dropping the session
+ *
+ * Getting a new agent onto a device meant push, kill-agent and starting
+ * it again, often by re-running whatever got the first one there. upgrade
+ * takes the new binary like push, checks it, and execve()s it in the
+ * session's own process. The socket stays open across the exec; the rest
+ * of the session (cwd, data framing, throttle rate, memory budget, secret,
+ * session keys and message counts) goes through a pipe whose read end is
+ * passed as -u <fd>, keeping keys out of argv and the environment. The new
+ * image answers the upgrade request and carries on with the session where
+ * the old one stopped, so the client never reconnects.
+ *
+ * In bind mode the listener follows: the new image signals its parent
+ * (SIGUSR1), which execs /proc/<child>/exe keeping its listening socket, so
+ * later connections get the new agent as well. Other sessions keep the
+ * image they started with until they end.
+ *
+ * The binary is held in a memfd unless a path is given, so nothing has to
+ * be written to flash. Over a serial line the link runs on a thread of the
+ * session's process, which the exec would end, so upgrade is refused there.
+ *
+ * Args:
+ *   size    length of the binary
+ *   sha256  its SHA-256 (32 bytes); nothing is run unless it matches
+ *   path    also keep the binary at this path (optional), e.g. over the
+ *           agent on disk so the next start gets it too
+ *   rate    bytes/s limit for the transfer, as push (optional)
+ *
+ * Responds with {}, then takes the binary as data chunks like push. The
+ * final response comes from the new image and carries its device
+ * fingerprint (as in the handshake). An error response means the old image
+ * is still running the session.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "edb.h"
+#include "commands.h"
+#include "sha256.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC         0x0001U
+#endif
+
+/* Largest binary taken; without a path it is held in RAM until the exec */
+#define UPGRADE_MAX_SIZE    (64 * 1024 * 1024)
+
+/* Handed-over state: a cwd and some numbers, well within a pipe's capacity */
+#define UPGRADE_STATE_MAX   (EDB_PATH_MAX + 1024)
+
+/* State read by upgrade_load(), for upgrade_resume() */
+static uint8_t *g_state;
+static size_t g_state_len;
+
+static int write_all(int fd, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Parent pid of pid from /proc/<pid>/stat, -1 if it cannot be read */
+static int parent_of(int pid)
+{
+    char path[32], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    /* "pid (comm) state ppid ...", comm may contain anything */
+    char *p = strrchr(buf, ')');
+    int ppid;
+    if (!p || sscanf(p + 1, " %*c %d", &ppid) != 1) {
+        return -1;
+    }
+    return ppid;
+}
+
+/* Check whether two processes run the same binary */
+static bool same_exe(int a, int b)
+{
+    char path[32];
+    struct stat sa, sb;
+
+    snprintf(path, sizeof(path), "/proc/%d/exe", a);
+    if (stat(path, &sa) < 0) return false;
+    snprintf(path, sizeof(path), "/proc/%d/exe", b);
+    if (stat(path, &sb) < 0) return false;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+/*
+ * Check that the binary in fd is an ELF executable for the machine this
+ * agent runs on. Returns NULL if so, or what is wrong.
+ */
+static const char *check_elf(int fd)
+{
+    uint8_t hdr[20], own[20];
+
+    if (pread(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr, "\x7f" "ELF", 4) != 0) {
+        return "not an ELF binary";
+    }
+
+    int self = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    if (self < 0) {
+        return "cannot read own binary";
+    }
+    ssize_t n = pread(self, own, sizeof(own), 0);
+    close(self);
+    if (n != (ssize_t)sizeof(own)) {
+        return "cannot read own binary";
+    }
+
+    /* Class, byte order and e_machine must match this agent's */
+    if (hdr[4] != own[4] || hdr[5] != own[5] || memcmp(hdr + 18, own + 18, 2) != 0) {
+        return "binary is for another architecture";
+    }
+
+    /* e_type: ET_EXEC or ET_DYN (static PIE) */
+    unsigned type = hdr[5] == 1 ? (unsigned)(hdr[16] | hdr[17] << 8)
+                                : (unsigned)(hdr[17] | hdr[16] << 8);
+    if (type != 2 && type != 3) {
+        return "not an executable";
+    }
+    return NULL;
+}
+
+/*
+ * Write state to a pipe and exec exe with -u and the pipe's read end.
+ * Returns only if that fails, with errno set.
+ */
+static void exec_with_state(const char *exe, const resp_builder_t *state)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return;
+    }
+
+    /* The new image reads to EOF, so it must not inherit the write end */
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    int ret = write_all(fds[1], state->buf, state->len);
+    close(fds[1]);
+
+    if (ret == 0) {
+        char fdarg[16];
+        char *argv[] = { (char *)"edb-agent", (char *)"-u", fdarg, NULL };
+        snprintf(fdarg, sizeof(fdarg), "%d", fds[0]);
+        execve(exe, argv, environ);
+    }
+
+    int err = errno;
+    close(fds[0]);
+    errno = err;
+}
+
+static bool has_secret(void)
+{
+    const char *secret;
+    return secure_secret(&secret) > 0;
+}
+
+/* Add the secret (-k), if any, to a state map */
+static void add_secret(resp_builder_t *rb)
+{
+    const char *secret;
+    size_t len = secure_secret(&secret);
+    if (len > 0) {
+        rb_lit(rb, "secret");
+        rb_str_n(rb, secret, len);
+    }
+}
+
+static void state_free(resp_builder_t *rb)
+{
+    memset(rb->buf, 0, rb->cap);
+    rb_free(rb);
+}
+
+/*
+ * Hand the session over to the binary at exe. Returns only if the exec
+ * failed, with errno set.
+ */
+static void hand_over(conn_t *conn, uint32_t id, const char *exe)
+{
+    resp_builder_t rb;
+    if (rb_init(&rb, 512) < 0) {
+        errno = ENOMEM;
+        return;
+    }
+
+    /*
+     * The argument parsers only take fixmap/map16 headers, so count the
+     * optional entries up front instead of patching a map32 afterwards.
+     */
+    uint8_t keys[SECURE_SAVE_SIZE];
+    bool have_keys = secure_save(conn, keys) == 0;
+
+    /* Bind mode: the listener follows if it runs this same agent */
+    int ppid = getppid();
+    bool listener = conn->mode == MODE_LISTEN && ppid > 1 &&
+                    same_exe(ppid, getpid());
+
+    rb_map(&rb, 7 + (has_secret() ? 1 : 0) + have_keys + listener);
+    rb_lit(&rb, "id");
+    rb_uint(&rb, id);
+    rb_lit(&rb, "mode");
+    rb_uint(&rb, (uint64_t)conn->mode);
+    rb_lit(&rb, "sock");
+    rb_uint(&rb, (uint64_t)conn->sockfd);
+    rb_lit(&rb, "cwd");
+    rb_str(&rb, conn->cwd);
+    rb_lit(&rb, "frames");
+    rb_uint(&rb, conn->frames);
+    rb_lit(&rb, "rate");
+    rb_uint(&rb, conn->bucket.rate);
+    rb_lit(&rb, "budget");
+    rb_uint(&rb, mem_budget());
+    add_secret(&rb);
+    if (have_keys) {
+        rb_lit(&rb, "keys");
+        rb_bin(&rb, keys, sizeof(keys));
+        memset(keys, 0, sizeof(keys));
+    }
+    if (listener) {
+        rb_lit(&rb, "listener");
+        rb_uint(&rb, (uint64_t)ppid);
+    }
+
+    if (rb.len > UPGRADE_STATE_MAX) {
+        state_free(&rb);
+        errno = E2BIG;
+        return;
+    }
+
+    exec_with_state(exe, &rb);
+
+    int err = errno;
+    state_free(&rb);
+    errno = err;
+}
+
+/*
+ * Take the binary as the data chunks of request id into fd, hashing it on
+ * the way. Returns NULL when all of it came, else the error for the client;
+ * *lost is set if the connection failed.
+ */
+static const char *receive_binary(conn_t *conn, uint32_t id, int fd, uint64_t size,
+                                  tbucket_t *bucket, uint8_t digest[SHA256_DIGEST_SIZE],
+                                  bool *lost)
+{
+    sha256_ctx_t sha;
+    uint64_t total = 0;
+
+    sha256_init(&sha);
+    *lost = false;
+
+    while (1) {
+        uint8_t *msg = NULL;
+        size_t msg_len;
+
+        if (proto_recv(conn, &msg, &msg_len) < 0) {
+            *lost = true;
+            return "connection lost";
+        }
+
+        data_msg_t chunk;
+        if (proto_parse_data(msg, msg_len, &chunk) < 0) {
+            edb_free(msg);
+            return "invalid data chunk";
+        }
+        if (chunk.cancel && chunk.id != id) {
+            edb_free(msg);
+            if (proto_cancel_stream(conn, chunk.id) < 0) {
+                *lost = true;
+                return "connection lost";
+            }
+            continue;
+        }
+        if (chunk.cancel) {
+            edb_free(msg);
+            return "cancelled";
+        }
+
+        if (chunk.len > 0) {
+            total += chunk.len;
+            if (total > size) {
+                edb_free(msg);
+                return "more data than announced";
+            }
+            sched_throttle(conn, bucket, chunk.len);
+            if (write_all(fd, chunk.data, chunk.len) < 0) {
+                edb_free(msg);
+                return "write error";
+            }
+            sha256_update(&sha, chunk.data, chunk.len);
+        }
+
+        bool done = chunk.done;
+        edb_free(msg);
+        if (done) break;
+    }
+
+    if (total != size) {
+        return "less data than announced";
+    }
+    sha256_final(&sha, digest);
+    return NULL;
+}
+
+int cmd_upgrade(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    if (conn->mode == MODE_SERIAL) {
+        return proto_send_error(conn, id, "not supported over a serial line");
+    }
+    if (sched_active(conn) || watch_active(conn)) {
+        return proto_send_error(conn, id, "transfers or watches running, cancel them first");
+    }
+
+    uint64_t size = 0;
+    if (parse_uint_arg(args, args_len, "size", &size) < 0 ||
+        size == 0 || size > UPGRADE_MAX_SIZE) {
+        return proto_send_error(conn, id, "missing or bad size argument");
+    }
+
+    size_t sum_len = 0;
+    const uint8_t *sum = parse_bin_arg(args, args_len, "sha256", &sum_len);
+    if (!sum || sum_len != SHA256_DIGEST_SIZE) {
+        return proto_send_error(conn, id, "missing sha256 argument");
+    }
+    uint8_t want[SHA256_DIGEST_SIZE];
+    memcpy(want, sum, sizeof(want));
+
+    uint64_t rate = 0;
+    parse_uint_arg(args, args_len, "rate", &rate);
+    tbucket_t bucket;
+    tb_init(&bucket, rate);
+
+    /* With a path, write next to it and rename once checked */
+    char *path = NULL, *tmp = NULL;
+    char *arg_path = parse_string_arg(args, args_len, "path");
+    if (arg_path) {
+        path = path_resolve(conn->cwd, arg_path);
+        edb_free(arg_path);
+        tmp = path ? edb_malloc(strlen(path) + 5) : NULL;
+        if (!tmp) {
+            edb_free(path);
+            return proto_send_error(conn, id, "out of memory");
+        }
+        sprintf(tmp, "%s.new", path);
+    }
+
+    int fd;
+    if (tmp) {
+        fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    } else {
+#ifdef SYS_memfd_create
+        fd = (int)syscall(SYS_memfd_create, "edb-agent", MFD_CLOEXEC);
+#else
+        fd = -1;
+        errno = ENOSYS;
+#endif
+    }
+    if (fd < 0) {
+        int err = errno;
+        edb_free(path);
+        edb_free(tmp);
+        return proto_send_error(conn, id, err == ENOSYS ?
+                                "kernel has no memfd_create, give a path" : strerror(err));
+    }
+
+    LOG("upgrade: receiving %lu bytes into %s", (unsigned long)size, tmp ? tmp : "memfd");
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 16) < 0) {
+        close(fd);
+        if (tmp) unlink(tmp);
+        edb_free(path);
+        edb_free(tmp);
+        return proto_send_error(conn, id, "out of memory");
+    }
+    rb_map(&rb, 0);
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    if (ret < 0) {
+        close(fd);
+        if (tmp) unlink(tmp);
+        edb_free(path);
+        edb_free(tmp);
+        return -1;
+    }
+
+    bool lost;
+    uint8_t got[SHA256_DIGEST_SIZE];
+    const char *err = receive_binary(conn, id, fd, size, &bucket, got, &lost);
+    if (!err && memcmp(got, want, sizeof(got)) != 0) {
+        err = "sha256 mismatch";
+    }
+    if (!err) {
+        err = check_elf(fd);
+    }
+
+    /* A file is exec'd by path, and only once no one has it open to write */
+    char exe[32];
+    if (!err && tmp) {
+        close(fd);
+        fd = -1;
+        if (rename(tmp, path) < 0) {
+            err = strerror(errno);
+        }
+    } else {
+        snprintf(exe, sizeof(exe), "/proc/self/fd/%d", fd);
+    }
+
+    if (!err) {
+        LOG("upgrade: verified, handing the session over");
+        hand_over(conn, id, tmp ? path : exe);
+        err = strerror(errno);
+        LOG("upgrade: exec failed: %s", err);
+    } else if (tmp) {
+        unlink(tmp);
+    }
+
+    if (fd >= 0) close(fd);
+    edb_free(path);
+    edb_free(tmp);
+
+    if (lost) {
+        return -1;
+    }
+    return proto_send_error(conn, id, err);
+}
+
+/* -----------------------------------------------------------------------------
+ * The New Image
+ * ----------------------------------------------------------------------------- */
+
+int upgrade_load(int fd, config_t *cfg)
+{
+    g_state = edb_malloc(UPGRADE_STATE_MAX);
+    if (!g_state) {
+        close(fd);
+        return -1;
+    }
+
+    g_state_len = 0;
+    while (g_state_len < UPGRADE_STATE_MAX) {
+        ssize_t n = read(fd, g_state + g_state_len, UPGRADE_STATE_MAX - g_state_len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        g_state_len += (size_t)n;
+    }
+    close(fd);
+
+    uint64_t v;
+    if (parse_uint_arg(g_state, g_state_len, "mode", &v) < 0) {
+        fprintf(stderr, "Error: No upgrade state on fd %d\n", fd);
+        return -1;
+    }
+    cfg->mode = (conn_mode_t)v;
+
+    if (parse_uint_arg(g_state, g_state_len, "budget", &v) == 0) {
+        cfg->mem_budget = (size_t)v;
+    }
+    if (parse_uint_arg(g_state, g_state_len, "listen", &v) == 0) {
+        cfg->listenfd = (int)v;
+    }
+
+    char *secret = parse_string_arg(g_state, g_state_len, "secret");
+    if (secret) {
+        int ret = secure_init(secret);
+        memset(secret, 0, strlen(secret));
+        edb_free(secret);
+        if (ret < 0) {
+            fprintf(stderr, "Error: Cannot take over the secret\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int upgrade_resume(conn_t *conn)
+{
+    const uint8_t *st = g_state;
+    size_t len = g_state_len;
+    uint64_t id, sock, v;
+
+    if (!st || parse_uint_arg(st, len, "id", &id) < 0 ||
+        parse_uint_arg(st, len, "sock", &sock) < 0) {
+        return -1;
+    }
+    conn->sockfd = (int)sock;
+
+    if (parse_uint_arg(st, len, "mode", &v) == 0) {
+        conn->mode = (conn_mode_t)v;
+    }
+    char *cwd = parse_string_arg(st, len, "cwd");
+    if (cwd) {
+        safe_strcpy(conn->cwd, cwd, sizeof(conn->cwd));
+        edb_free(cwd);
+    }
+    if (parse_uint_arg(st, len, "frames", &v) == 0) {
+        conn->frames = (uint8_t)v;
+    }
+    if (parse_uint_arg(st, len, "rate", &v) == 0) {
+        tb_init(&conn->bucket, v);
+    }
+
+    int listener = 0;
+    if (parse_uint_arg(st, len, "listener", &v) == 0) {
+        listener = (int)v;
+    }
+
+    size_t keys_len = 0;
+    const uint8_t *keys = parse_bin_arg(st, len, "keys", &keys_len);
+    int ret = keys ? secure_restore(conn, keys, keys_len) : 0;
+
+    memset(g_state, 0, UPGRADE_STATE_MAX);
+    edb_free(g_state);
+    g_state = NULL;
+
+    if (ret < 0) {
+        LOG("upgrade: cannot restore the session keys");
+        return -1;
+    }
+
+    LOG("upgrade: resumed session, cwd=%s", conn->cwd);
+
+    /*
+     * The device info a new connection would get from this image, but with
+     * the session's cwd: the startup fingerprint has this process's own.
+     */
+    size_t fp_len = 0;
+    uint8_t *fp = fingerprint_build(conn->cwd, &fp_len);
+    if (fp) {
+        ret = proto_send_response(conn, (uint32_t)id, true, fp, fp_len, NULL);
+        edb_free(fp);
+    } else {
+        uint8_t empty = 0x80;
+        ret = proto_send_response(conn, (uint32_t)id, true, &empty, 1, NULL);
+    }
+
+    /* Have the bind mode listener exec this image too (upgrade_listener) */
+    if (listener > 0 && getppid() == listener) {
+        kill(listener, SIGUSR1);
+    }
+    return ret;
+}
+
+void upgrade_listener(int listenfd, int pid)
+{
+    /* Only follow our own sessions */
+    if (parent_of(pid) != getpid()) {
+        LOG("upgrade: ignoring signal from %d, not a session of ours", pid);
+        return;
+    }
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 256) < 0) {
+        return;
+    }
+    rb_map(&rb, 3 + (has_secret() ? 1 : 0));
+    rb_lit(&rb, "mode");
+    rb_uint(&rb, MODE_LISTEN);
+    rb_lit(&rb, "listen");
+    rb_uint(&rb, (uint64_t)listenfd);
+    rb_lit(&rb, "budget");
+    rb_uint(&rb, mem_budget());
+    add_secret(&rb);
+
+    char exe[32];
+    snprintf(exe, sizeof(exe), "/proc/%d/exe", pid);
+    LOG("upgrade: listener follows session %d", pid);
+    exec_with_state(exe, &rb);
+
+    LOG("upgrade: listener exec failed: %s", strerror(errno));
+    state_free(&rb);
+}
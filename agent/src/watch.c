@@ -0,0 +1,477 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Directory watches (inotify)
+ *
+ * Command: watch_dir - Report changes to a directory as they happen
+ *
+ * A client that caches listings (the TUI's path completion) had to list a
+ * directory again every time it needed it, since it could not know whether
+ * anything changed. watch_dir subscribes to a directory instead: the
+ * session's inotify descriptor is polled by the session loop (main.c)
+ * alongside the socket, and changes are sent as data messages on the watch
+ * request's id.
+ *
+ * Changes are coalesced per name for interval_ms after the first one, so a
+ * file being written sends one "modify" rather than one per write(), and a
+ * file created and removed again in between sends nothing. The net effect
+ * is what is reported: a name that did not exist before the batch and does
+ * now is a "create", and so on, so a cached listing stays exact.
+ *
+ * Args:
+ *   path         directory to watch
+ *   interval_ms  how long to gather changes before sending (default 200)
+ *
+ * Responds with { path, interval_ms }, then sends data messages whose
+ * payload is { events: [{ op, name, to?, dir? }, ...], overflow }. op is
+ * create, delete, modify or move (name renamed to "to", both in this
+ * directory). overflow means changes were lost and the directory should be
+ * listed again. When the directory itself is removed or moved the last
+ * message has done set. A cancel with the watch's id ends it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/inotify.h>
+
+#include "edb.h"
+#include "commands.h"
+
+#define WATCH_MASK  (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+                     IN_MOVE_SELF | IN_ONLYDIR)
+
+#define WATCH_INTERVAL_DEFAULT  200
+#define WATCH_INTERVAL_MIN      10
+#define WATCH_INTERVAL_MAX      60000
+
+/* Names one batch tracks; past that it reports overflow instead */
+#define WATCH_MAX_CHANGES       256
+
+/* Reads of the inotify descriptor per session loop pass */
+#define WATCH_MAX_READS         16
+
+/* Net change to one name within a batch */
+typedef struct {
+    char     *name;
+    bool      before;           /* Existed when the batch started */
+    bool      now;              /* Exists after the last event */
+    bool      dir;
+    bool      paired;           /* Reported as the target of a move */
+    uint32_t  cookie;           /* Moved away (before) or here (!before) */
+} watch_change_t;
+
+typedef struct {
+    uint32_t  id;               /* Request id; 0 = free slot */
+    int       wd;
+    uint32_t  seq;
+    uint32_t  interval_ms;
+    uint64_t  due;              /* When the batch goes out (0 = nothing pending) */
+    bool      overflow;
+    bool      ended;            /* Directory gone: last batch, then close */
+    watch_change_t *changes;
+    size_t    nchanges;
+} watch_t;
+
+struct watch_state {
+    int       fd;
+    size_t    count;
+    watch_t   watches[EDB_MAX_WATCHES];
+};
+
+static uint64_t mono_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* =============================================================================
+ * Batches
+ * ============================================================================= */
+
+static void watch_reset(watch_t *w)
+{
+    for (size_t i = 0; i < w->nchanges; i++) {
+        edb_free(w->changes[i].name);
+    }
+    w->nchanges = 0;
+    w->overflow = false;
+    w->due = 0;
+}
+
+static void watch_mark_due(watch_t *w, uint64_t now)
+{
+    if (w->due == 0) w->due = now + w->interval_ms;
+}
+
+/* Find the change for name, adding one that starts out as given */
+static watch_change_t *watch_change(watch_t *w, const char *name, bool before)
+{
+    for (size_t i = 0; i < w->nchanges; i++) {
+        if (strcmp(w->changes[i].name, name) == 0) return &w->changes[i];
+    }
+
+    if (w->nchanges == WATCH_MAX_CHANGES) return NULL;
+    if (!w->changes) {
+        w->changes = edb_calloc(WATCH_MAX_CHANGES, sizeof(watch_change_t));
+        if (!w->changes) return NULL;
+    }
+
+    char *copy = edb_strdup(name);
+    if (!copy) return NULL;
+
+    watch_change_t *c = &w->changes[w->nchanges++];
+    memset(c, 0, sizeof(*c));
+    c->name = copy;
+    c->before = before;
+    c->now = before;
+    return c;
+}
+
+static void watch_event(watch_t *w, const struct inotify_event *ev, uint64_t now)
+{
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        w->ended = true;
+        w->due = now;
+        return;
+    }
+    if (ev->len == 0 || w->overflow) return;
+
+    bool appears = (ev->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+    bool goes = (ev->mask & (IN_DELETE | IN_MOVED_FROM)) != 0;
+
+    /* The first event for a name tells whether it was there before */
+    watch_change_t *c = watch_change(w, ev->name, !appears);
+    if (!c) {
+        watch_reset(w);
+        w->overflow = true;
+        watch_mark_due(w, now);
+        return;
+    }
+
+    if (appears) {
+        c->now = true;
+    } else if (goes) {
+        c->now = false;
+    }
+    c->dir = (ev->mask & IN_ISDIR) != 0;
+
+    /* Only a move with nothing else happening to either name is a move */
+    c->cookie = (ev->mask & (IN_MOVED_FROM | IN_MOVED_TO)) ? ev->cookie : 0;
+
+    watch_mark_due(w, now);
+}
+
+static void watch_encode_change(resp_builder_t *rb, const watch_change_t *c,
+                                const watch_change_t *to)
+{
+    const char *op;
+    if (to) {
+        op = "move";
+    } else if (!c->before) {
+        op = "create";
+    } else if (!c->now) {
+        op = "delete";
+    } else {
+        op = "modify";
+    }
+
+    /* Only new names need their type; the client has it for the rest */
+    bool dir = (to || !c->before) && c->dir;
+    rb_map(rb, 2 + (to ? 1 : 0) + (dir ? 1 : 0));
+    rb_lit(rb, "op");
+    rb_str(rb, op);
+    rb_lit(rb, "name");
+    rb_str(rb, c->name);
+    if (to) {
+        rb_lit(rb, "to");
+        rb_str(rb, to->name);
+    }
+    if (dir) {
+        rb_lit(rb, "dir");
+        rb_bool(rb, true);
+    }
+}
+
+/* Send a watch's pending batch. Returns 0 on success, -1 if sending failed. */
+static int watch_flush(conn_t *conn, watch_t *w)
+{
+    resp_builder_t rb;
+    if (rb_init(&rb, 256) < 0) {
+        /* Try again later; the changes are lost, which overflow says */
+        watch_reset(w);
+        w->overflow = true;
+        w->due = mono_ms() + w->interval_ms;
+        return 0;
+    }
+
+    rb_map(&rb, 2);
+    rb_lit(&rb, "events");
+    size_t at = rb_array_begin(&rb);
+    size_t count = 0;
+
+    /* Pair the names moved away with those moved in by the same rename */
+    for (size_t i = 0; i < w->nchanges; i++) {
+        watch_change_t *c = &w->changes[i];
+        if (!c->before && c->now && c->cookie) {
+            for (size_t j = 0; j < w->nchanges; j++) {
+                watch_change_t *from = &w->changes[j];
+                if (from->before && !from->now && from->cookie == c->cookie) {
+                    c->paired = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < w->nchanges; i++) {
+        const watch_change_t *c = &w->changes[i];
+        if (c->paired) continue;
+        if (!c->before && !c->now) continue;    /* Came and went */
+
+        const watch_change_t *to = NULL;
+        if (c->before && !c->now && c->cookie) {
+            for (size_t j = 0; j < w->nchanges; j++) {
+                if (w->changes[j].paired && w->changes[j].cookie == c->cookie) {
+                    to = &w->changes[j];
+                    break;
+                }
+            }
+        }
+        watch_encode_change(&rb, c, to);
+        count++;
+    }
+    rb_array_end(&rb, at, count);
+
+    rb_lit(&rb, "overflow");
+    rb_bool(&rb, w->overflow);
+
+    int ret = 0;
+    if (count > 0 || w->overflow || w->ended) {
+        if (at == (size_t)-1) {
+            ret = proto_send_error(conn, w->id, "out of memory");
+            w->ended = true;
+        } else {
+            ret = proto_send_data(conn, w->id, w->seq++, rb.buf, rb.len, w->ended);
+        }
+    }
+    rb_free(&rb);
+    watch_reset(w);
+    return ret < 0 ? -1 : 0;
+}
+
+/* =============================================================================
+ * Session Hooks
+ * ============================================================================= */
+
+static void watch_close(struct watch_state *ws, watch_t *w)
+{
+    LOG("Watch %u closed", w->id);
+    inotify_rm_watch(ws->fd, w->wd);     /* Already gone if the directory was */
+    watch_reset(w);
+    edb_free(w->changes);
+    memset(w, 0, sizeof(*w));
+    ws->count--;
+}
+
+bool watch_active(const conn_t *conn)
+{
+    return conn->watch && conn->watch->count > 0;
+}
+
+int watch_step(conn_t *conn)
+{
+    struct watch_state *ws = conn->watch;
+    if (!ws || ws->count == 0) return 0;
+
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    uint64_t now = mono_ms();
+
+    for (int n = 0; n < WATCH_MAX_READS; n++) {
+        ssize_t len = read(ws->fd, u.buf, sizeof(u.buf));
+        if (len <= 0) break;
+
+        for (ssize_t off = 0; off < len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)(u.buf + off);
+            off += (ssize_t)(sizeof(*ev) + ev->len);
+
+            for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+                watch_t *w = &ws->watches[i];
+                if (!w->id) continue;
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    watch_reset(w);
+                    w->overflow = true;
+                    watch_mark_due(w, now);
+                } else if (w->wd == ev->wd) {
+                    watch_event(w, ev, now);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+        watch_t *w = &ws->watches[i];
+        if (!w->id || w->due == 0 || w->due > now) continue;
+
+        if (watch_flush(conn, w) < 0) return -1;
+        if (w->ended) watch_close(ws, w);
+    }
+    return 0;
+}
+
+void watch_wait(conn_t *conn, int timeout_ms)
+{
+    struct watch_state *ws = conn->watch;
+    if (!ws || ws->count == 0) {
+        transport_wait_readable(conn->sockfd, timeout_ms);
+        return;
+    }
+
+    /* Wake up for the earliest batch too */
+    uint64_t now = mono_ms();
+    for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+        const watch_t *w = &ws->watches[i];
+        if (!w->id || w->due == 0) continue;
+
+        int left = w->due > now ? (int)(w->due - now) : 0;
+        if (timeout_ms < 0 || left < timeout_ms) timeout_ms = left;
+    }
+
+    struct pollfd pfd[2] = {
+        { .fd = conn->sockfd, .events = POLLIN },
+        { .fd = ws->fd,       .events = POLLIN },
+    };
+    while (poll(pfd, 2, timeout_ms) < 0 && errno == EINTR) {
+    }
+}
+
+bool watch_cancel(conn_t *conn, uint32_t id)
+{
+    struct watch_state *ws = conn->watch;
+    if (!ws) return false;
+
+    for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+        if (ws->watches[i].id == id) {
+            watch_close(ws, &ws->watches[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void watch_close_all(conn_t *conn)
+{
+    struct watch_state *ws = conn->watch;
+    if (!ws) return;
+
+    for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+        if (ws->watches[i].id) watch_close(ws, &ws->watches[i]);
+    }
+    close(ws->fd);
+    edb_free(ws);
+    conn->watch = NULL;
+}
+
+/* =============================================================================
+ * Command: watch_dir
+ * ============================================================================= */
+
+int cmd_watch_dir(conn_t *conn, uint32_t id, const uint8_t *args, size_t args_len)
+{
+    char *arg_path = parse_string_arg(args, args_len, "path");
+    if (!arg_path) {
+        return proto_send_error(conn, id, "missing path argument");
+    }
+
+    uint64_t interval = WATCH_INTERVAL_DEFAULT;
+    parse_uint_arg(args, args_len, "interval_ms", &interval);
+    if (interval < WATCH_INTERVAL_MIN) interval = WATCH_INTERVAL_MIN;
+    if (interval > WATCH_INTERVAL_MAX) interval = WATCH_INTERVAL_MAX;
+
+    char *resolved = path_resolve(conn->cwd, arg_path);
+    edb_free(arg_path);
+    if (!resolved) {
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    /* One inotify descriptor per session, made on first use */
+    struct watch_state *ws = conn->watch;
+    if (!ws) {
+        ws = edb_calloc(1, sizeof(*ws));
+        if (!ws) {
+            edb_free(resolved);
+            return proto_send_error(conn, id, "out of memory");
+        }
+        ws->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (ws->fd < 0) {
+            int err = errno;
+            edb_free(ws);
+            edb_free(resolved);
+            return proto_send_error(conn, id, strerror(err));
+        }
+        conn->watch = ws;
+    }
+
+    if (ws->count == EDB_MAX_WATCHES) {
+        edb_free(resolved);
+        return proto_send_error(conn, id, "too many watches");
+    }
+
+    int wd = inotify_add_watch(ws->fd, resolved, WATCH_MASK);
+    if (wd < 0) {
+        int err = errno;
+        edb_free(resolved);
+        return proto_send_error(conn, id, strerror(err));
+    }
+
+    /* The same directory gives the same wd, which both would then own */
+    for (size_t i = 0; i < EDB_MAX_WATCHES; i++) {
+        if (ws->watches[i].id && ws->watches[i].wd == wd) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "already watched by request %u", ws->watches[i].id);
+            edb_free(resolved);
+            return proto_send_error(conn, id, msg);
+        }
+    }
+
+    watch_t *w = NULL;
+    for (size_t i = 0; i < EDB_MAX_WATCHES && !w; i++) {
+        if (!ws->watches[i].id) w = &ws->watches[i];
+    }
+    w->id = id;
+    w->wd = wd;
+    w->interval_ms = (uint32_t)interval;
+    ws->count++;
+
+    LOG("Watch %u on %s, interval %u ms", id, resolved, w->interval_ms);
+
+    resp_builder_t rb;
+    if (rb_init(&rb, 64) < 0) {
+        watch_close(ws, w);
+        edb_free(resolved);
+        return proto_send_error(conn, id, "out of memory");
+    }
+
+    rb_map(&rb, 2);
+    rb_lit(&rb, "path");
+    rb_str(&rb, resolved);
+    rb_lit(&rb, "interval_ms");
+    rb_uint(&rb, w->interval_ms);
+    edb_free(resolved);
+
+    int ret = proto_send_response(conn, id, true, rb.buf, rb.len, NULL);
+    rb_free(&rb);
+    return ret;
+}
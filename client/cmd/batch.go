@@ -0,0 +1,257 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Batch command - run a script of commands without the interactive shell
+ */
+
+package cmd
+
+import (
+	"bufio"
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"strconv"
+	"strings"
+
+	"github.com/spf13/cobra"
+	"github.com/vmihailenco/msgpack/v5"
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
+)
+
+var batchCmd = &cobra.Command{
+	Use:   "batch <host:port|device> [script]",
+	Short: "Run commands from a script or stdin, printing results as JSON lines",
+	Long: `Connect to an agent in bind mode and run the commands of a script (or
+stdin) without the interactive shell, for CI jobs and forensics pipelines.
+
+Each line is an agent command, optionally followed by its arguments as a
+JSON object. Blank lines and lines starting with # are skipped:
+
+  uname
+  ls {"path": "/etc"}
+  strings {"path": "/bin/busybox", "min_len": 8}
+
+Requests are sent without waiting for the responses before them (up to
+--window in flight), so a thousand queries take a few round trips rather
+than a thousand. The agent still runs them in order, so a cd applies to
+the lines after it. One result per line is written to stdout, in script
+order:
+
+  {"line":2,"cmd":"ls","ok":true,"data":{...}}
+
+Commands that stream data (pull, push, ...) are not available in batch
+mode. The exit status is non-zero if any command failed.
+
+Examples:
+  edb batch 192.168.1.50 queries.txt > results.jsonl
+  echo uname | edb batch 192.168.1.50 --format msgpack > results.msgpack`,
+	Args:         cobra.RangeArgs(1, 2),
+	SilenceUsage: true,
+	RunE:         runBatch,
+}
+
+var (
+	batchFormat string
+	batchWindow int
+)
+
+// batchStreaming are the commands whose data does not fit in one response
+var batchStreaming = map[string]bool{
+	"pull":        true,
+	"pull_many":   true,
+	"push":        true,
+	"profile":     true,
+	"systrace":    true,
+	"watch_dir":   true,
+	"hash_chunks": true,
+}
+
+// batchResult is one line of batch output
+type batchResult struct {
+	Line  int                    `json:"line" msgpack:"line"`
+	Cmd   string                 `json:"cmd" msgpack:"cmd"`
+	OK    bool                   `json:"ok" msgpack:"ok"`
+	Data  map[string]interface{} `json:"data,omitempty" msgpack:"data,omitempty"`
+	Error string                 `json:"error,omitempty" msgpack:"error,omitempty"`
+
+	id uint32 // Request ID, 0 if the line was not sent
+}
+
+func init() {
+	batchCmd.Flags().StringVar(&batchFormat, "format", "json", "Output format: json (one object per line) or msgpack (a stream of maps)")
+	batchCmd.Flags().IntVar(&batchWindow, "window", 256, "Requests in flight at once")
+	rootCmd.AddCommand(batchCmd)
+}
+
+func runBatch(cmd *cobra.Command, args []string) error {
+	var encode func(*batchResult) error
+	out := bufio.NewWriter(os.Stdout)
+	defer out.Flush()
+
+	switch batchFormat {
+	case "json":
+		enc := json.NewEncoder(out)
+		encode = func(r *batchResult) error { return enc.Encode(r) }
+	case "msgpack":
+		enc := msgpack.NewEncoder(out)
+		encode = func(r *batchResult) error { return enc.Encode(r) }
+	default:
+		return fmt.Errorf("unknown format %q (json or msgpack)", batchFormat)
+	}
+	if batchWindow < 1 {
+		batchWindow = 1
+	}
+
+	var script io.Reader = os.Stdin
+	if len(args) > 1 && args[1] != "-" {
+		f, err := os.Open(args[1])
+		if err != nil {
+			return err
+		}
+		defer f.Close()
+		script = f
+	}
+
+	conn, err := dialAgent(args[0])
+	if err != nil {
+		return err
+	}
+	defer conn.Close()
+
+	// Create protocol handler
+	proto := newProtocol(conn)
+
+	// In bind mode, client sends hello first
+	if err := proto.SendHello(); err != nil {
+		return fmt.Errorf("failed to send hello: %w", err)
+	}
+	if _, err := proto.RecvHelloAck(); err != nil {
+		return fmt.Errorf("handshake failed: %w", err)
+	}
+
+	proto.SetDeadline(requestDeadline)
+
+	// The sender runs ahead of the responses by up to batchWindow requests.
+	// Results queue up in script order; the agent answers in that order too.
+	slots := make(chan struct{}, batchWindow)
+	results := make(chan *batchResult, batchWindow)
+	sendErr := make(chan error, 1)
+
+	go func() {
+		defer close(results)
+		scanner := bufio.NewScanner(script)
+		scanner.Buffer(make([]byte, 64*1024), protocol.MaxMsgSize)
+		line := 0
+		for scanner.Scan() {
+			line++
+			r, args := parseBatchLine(line, scanner.Text())
+			if r == nil {
+				continue
+			}
+			if r.Error == "" {
+				slots <- struct{}{}
+				id, err := proto.SendRequest(r.Cmd, args)
+				if err != nil {
+					sendErr <- err
+					return
+				}
+				r.id = id
+			}
+			results <- r
+		}
+		sendErr <- scanner.Err()
+	}()
+
+	total, failed := 0, 0
+	for r := range results {
+		if r.id != 0 {
+			resp, err := proto.RecvResponse()
+			<-slots
+			if err != nil {
+				return err
+			}
+			if resp.ID != r.id {
+				return fmt.Errorf("line %d: response for request %d, expected %d", r.Line, resp.ID, r.id)
+			}
+			r.OK, r.Data, r.Error = resp.OK, resp.Data, resp.Error
+		}
+
+		total++
+		if !r.OK {
+			failed++
+		}
+		if err := encode(r); err != nil {
+			return err
+		}
+		// Keep output moving when the script comes from a slow pipe
+		if len(results) == 0 {
+			out.Flush()
+		}
+	}
+
+	if err := <-sendErr; err != nil {
+		return err
+	}
+	if failed > 0 {
+		return fmt.Errorf("%d of %d commands failed", failed, total)
+	}
+	return nil
+}
+
+// parseBatchLine splits a script line into a command and its JSON
+// arguments. Returns nil for blank lines and comments, and a result with
+// Error set for lines that cannot be sent.
+func parseBatchLine(line int, text string) (*batchResult, map[string]interface{}) {
+	text = strings.TrimSpace(text)
+	if text == "" || strings.HasPrefix(text, "#") {
+		return nil, nil
+	}
+
+	name, rest, _ := strings.Cut(text, " ")
+	r := &batchResult{Line: line, Cmd: name}
+	if batchStreaming[name] {
+		r.Error = "streaming command, not available in batch mode"
+		return r, nil
+	}
+
+	var args map[string]interface{}
+	if rest = strings.TrimSpace(rest); rest != "" {
+		dec := json.NewDecoder(strings.NewReader(rest))
+		dec.UseNumber()
+		if err := dec.Decode(&args); err != nil {
+			r.Error = fmt.Sprintf("bad arguments: %v", err)
+			return r, nil
+		}
+		batchNumbers(args)
+	}
+	return r, args
+}
+
+// batchNumbers turns JSON numbers back into integers where they are whole,
+// since the agent reads sizes, modes and PIDs as MessagePack integers. They
+// must be unsigned: the agent skips signed ones as if they were missing.
+func batchNumbers(v interface{}) interface{} {
+	switch v := v.(type) {
+	case json.Number:
+		if n, err := strconv.ParseUint(v.String(), 10, 64); err == nil {
+			return n
+		}
+		if n, err := v.Int64(); err == nil {
+			return n
+		}
+		f, _ := v.Float64()
+		return f
+	case map[string]interface{}:
+		for k, x := range v {
+			v[k] = batchNumbers(x)
+		}
+	case []interface{}:
+		for i, x := range v {
+			v[i] = batchNumbers(x)
+		}
+	}
+	return v
+}
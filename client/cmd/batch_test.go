@@ -0,0 +1,46 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Batch script parsing tests
+ */
+
+package cmd
+
+import (
+	"testing"
+
+	"github.com/vmihailenco/msgpack/v5"
+)
+
+// The agent reads numeric arguments with parse_uint_arg, which only takes
+// positive fixint and uint8-uint64 (0xcc-0xcf)
+func TestBatchNumbersUnsigned(t *testing.T) {
+	r, args := parseBatchLine(1, `strings {"path": "/bin/busybox", "min_len": 8, "offset": 5000000000}`)
+	if r == nil || r.Error != "" {
+		t.Fatalf("line rejected: %+v", r)
+	}
+
+	for _, key := range []string{"min_len", "offset"} {
+		if _, ok := args[key].(uint64); !ok {
+			t.Errorf("%s is %T, want uint64", key, args[key])
+		}
+
+		enc, err := msgpack.Marshal(args[key])
+		if err != nil {
+			t.Fatal(err)
+		}
+		if m := enc[0]; m > 0x7f && (m < 0xcc || m > 0xcf) {
+			t.Errorf("%s encoded with marker 0x%02x, want fixint or 0xcc-0xcf", key, m)
+		}
+	}
+
+	// Negative and fractional numbers keep their JSON meaning
+	_, args = parseBatchLine(2, `exec {"n": -1, "f": 1.5}`)
+	if _, ok := args["n"].(int64); !ok {
+		t.Errorf("n is %T, want int64", args["n"])
+	}
+	if _, ok := args["f"].(float64); !ok {
+		t.Errorf("f is %T, want float64", args["f"])
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Connecting to an agent in bind mode, over TCP or a serial line
+ */
+
+package cmd
+
+import (
+	"fmt"
+	"net"
+	"strings"
+
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
+	"github.com/Necromancer-Labs/embbridge/client/serial"
+)
+
+// dialAgent connects to host[:port], or to an agent on a serial device
+// (edb-agent -s) when the target is a path such as /dev/ttyUSB0
+func dialAgent(target string) (net.Conn, error) {
+	if strings.HasPrefix(target, "/") {
+		conn, err := serial.Dial(target, serialBaud)
+		if err != nil {
+			return nil, fmt.Errorf("failed to connect: %w", err)
+		}
+		return conn, nil
+	}
+
+	// Add default port if not specified
+	if !strings.Contains(target, ":") {
+		target = fmt.Sprintf("%s:%d", target, DefaultPort)
+	}
+
+	conn, err := net.Dial("tcp", target)
+	if err != nil {
+		return nil, fmt.Errorf("failed to connect: %w", err)
+	}
+	return conn, nil
+}
+
+// newProtocol wraps conn for the handshake, with the session encryption
+// settings from --secret and --plaintext
+func newProtocol(conn net.Conn) *protocol.Protocol {
+	proto := protocol.New(conn)
+	proto.SetSecret(sessionSecret)
+	proto.SetPlaintext(plaintext)
+	return proto
+}
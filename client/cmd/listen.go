@@ -15,7 +15,6 @@ import (
 	"syscall"
 
 	"github.com/spf13/cobra"
-	"github.com/Necromancer-Labs/embbridge/client/protocol"
 	"github.com/Necromancer-Labs/embbridge/client/shell"
 )
 
@@ -85,7 +84,7 @@ func handleConnection(conn net.Conn) error {
 	defer conn.Close()
 
 	// Create protocol handler
-	proto := protocol.New(conn)
+	proto := newProtocol(conn)
 
 	// Perform handshake - expect hello from agent
 	hello, err := proto.RecvHello()
@@ -98,12 +97,20 @@ func handleConnection(conn net.Conn) error {
 	}
 
 	fmt.Printf("Agent version: %d\n", hello.Version)
+	if d := hello.Device; d != nil {
+		fmt.Printf("Device: %s (%s %s, %s)\n", d.Nodename, d.Sysname, d.Release, d.Machine)
+	}
 
 	// Send hello_ack
 	if err := proto.SendHelloAck(); err != nil {
 		return fmt.Errorf("failed to send hello_ack: %w", err)
 	}
+	if proto.Encrypted() {
+		fmt.Println("Session encrypted")
+	}
+
+	proto.SetDeadline(requestDeadline)
 
 	// Start interactive shell
-	return shell.RunShell(proto)
+	return shell.RunShell(proto, hello.Device, storeDir)
 }
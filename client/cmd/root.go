@@ -8,6 +8,10 @@
 package cmd
 
 import (
+	"os"
+	"time"
+
+	"github.com/Necromancer-Labs/embbridge/client/store"
 	"github.com/spf13/cobra"
 )
 
@@ -26,10 +30,27 @@ investigation, and research.
 
 Usage:
   edb listen              Listen for agent connections (reverse mode)
-  edb shell <host:port>   Connect to agent (bind mode)`,
+  edb shell <host:port>   Connect to agent (bind mode)
+  edb shell <device>      Connect to agent on a serial line
+  edb batch <host:port>   Run a script of commands, results as JSON lines`,
 	Version: Version,
 }
 
+// requestDeadline is sent with every request (--deadline)
+var requestDeadline time.Duration
+
+// storeDir holds the chunks and manifests of dumps (--store)
+var storeDir string
+
+// serialBaud is the line speed for targets that are serial devices (--baud)
+var serialBaud int
+
+// sessionSecret is mixed into the session keys (--secret, $EDB_SECRET)
+var sessionSecret string
+
+// plaintext turns off session encryption (--plaintext)
+var plaintext bool
+
 // Execute runs the root command
 func Execute() error {
 	return rootCmd.Execute()
@@ -39,4 +60,15 @@ func init() {
 	// Add subcommands
 	rootCmd.AddCommand(listenCmd)
 	rootCmd.AddCommand(shellCmd)
+
+	rootCmd.PersistentFlags().DurationVar(&requestDeadline, "deadline", 0,
+		"Limit slow agent scans (ps, ss, strings, exec) to this long, returning partial output (e.g. 2s)")
+	rootCmd.PersistentFlags().StringVar(&storeDir, "store", store.DefaultDir(),
+		"Dump store directory, shared by all devices so identical data is kept and transferred once")
+	rootCmd.PersistentFlags().IntVar(&serialBaud, "baud", 115200,
+		"Line speed when connecting to an agent on a serial device (edb-agent -s)")
+	rootCmd.PersistentFlags().StringVar(&sessionSecret, "secret", os.Getenv("EDB_SECRET"),
+		"Pre-shared secret of agents started with -k; also read from $EDB_SECRET")
+	rootCmd.PersistentFlags().BoolVar(&plaintext, "plaintext", false,
+		"Do not encrypt the session, e.g. to read it in a packet capture")
 }
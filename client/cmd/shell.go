@@ -9,46 +9,39 @@ package cmd
 
 import (
 	"fmt"
-	"net"
-	"strings"
 
 	"github.com/spf13/cobra"
-	"github.com/Necromancer-Labs/embbridge/client/protocol"
 	"github.com/Necromancer-Labs/embbridge/client/shell"
 )
 
 var shellCmd = &cobra.Command{
-	Use:   "shell <host:port>",
+	Use:   "shell <host:port|device>",
 	Short: "Connect to agent and start interactive shell",
 	Long: `Connect to an agent running in bind mode and start an interactive shell.
+The target may also be a serial device, for an agent started with -s on
+the other end of the line.
 
 Examples:
   edb shell 192.168.1.50:1337
-  edb shell 192.168.1.50        # Uses default port 1337`,
+  edb shell 192.168.1.50        # Uses default port 1337
+  edb shell /dev/ttyUSB0 --baud 921600`,
 	Args: cobra.ExactArgs(1),
 	RunE: runShell,
 }
 
 func runShell(cmd *cobra.Command, args []string) error {
-	target := args[0]
+	fmt.Printf("Connecting to %s...\n", args[0])
 
-	// Add default port if not specified
-	if !strings.Contains(target, ":") {
-		target = fmt.Sprintf("%s:%d", target, DefaultPort)
-	}
-
-	fmt.Printf("Connecting to %s...\n", target)
-
-	conn, err := net.Dial("tcp", target)
+	conn, err := dialAgent(args[0])
 	if err != nil {
-		return fmt.Errorf("failed to connect: %w", err)
+		return err
 	}
 	defer conn.Close()
 
 	fmt.Println("Connected")
 
 	// Create protocol handler
-	proto := protocol.New(conn)
+	proto := newProtocol(conn)
 
 	// In bind mode, client sends hello first
 	if err := proto.SendHello(); err != nil {
@@ -62,7 +55,15 @@ func runShell(cmd *cobra.Command, args []string) error {
 	}
 
 	fmt.Printf("Agent version: %d\n", ack.Version)
+	if proto.Encrypted() {
+		fmt.Println("Session encrypted")
+	}
+	if d := ack.Device; d != nil {
+		fmt.Printf("Device: %s (%s %s, %s)\n", d.Nodename, d.Sysname, d.Release, d.Machine)
+	}
+
+	proto.SetDeadline(requestDeadline)
 
 	// Start interactive shell
-	return shell.RunShell(proto)
+	return shell.RunShell(proto, ack.Device, storeDir)
 }
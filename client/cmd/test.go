@@ -49,7 +49,7 @@ func runTest(cmd *cobra.Command, args []string) error {
 	fmt.Println("Connected")
 
 	// Create protocol handler
-	proto := protocol.New(conn)
+	proto := newProtocol(conn)
 
 	// In bind mode, client sends hello first
 	fmt.Println("Sending hello...")
@@ -0,0 +1,133 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Loopback tests against a real agent
+ *
+ * Uses the same agent as the benchmarks (see bench_test.go) and is skipped
+ * if it is not there.
+ */
+
+package protocol
+
+import (
+	"bytes"
+	"crypto/rand"
+	"os"
+	"path/filepath"
+	"testing"
+	"time"
+)
+
+// A cancel for a watch that arrives in the middle of a push stops the
+// watch only: the push still completes
+func TestPushIgnoresOtherCancel(t *testing.T) {
+	p := dialAgent(t, startAgent(t))
+
+	wid, err := p.WatchDir(t.TempDir(), 0, func(WatchBatch) {})
+	if err != nil {
+		t.Fatal(err)
+	}
+
+	data := make([]byte, 256<<10)
+	rand.Read(data)
+	dst := filepath.Join(t.TempDir(), "pushed")
+
+	id, err := p.SendRequest("push", map[string]interface{}{
+		"path": dst,
+		"size": uint64(len(data)),
+		"mode": uint64(0644),
+	})
+	if err != nil {
+		t.Fatal(err)
+	}
+	if resp, err := p.RecvResponse(); err != nil || !resp.OK {
+		t.Fatalf("push refused: %v %+v", err, resp)
+	}
+
+	// In place of the first chunk, where the agent is reading push data
+	if err := p.Send(CancelMsg{Type: "cancel", ID: wid}); err != nil {
+		t.Fatal(err)
+	}
+	if err := p.sendChunks(id, data, nil); err != nil {
+		t.Fatal(err)
+	}
+
+	// The watch's "cancelled" response is picked up on the way
+	if _, err := p.Pwd(); err != nil {
+		t.Fatalf("session after push: %v", err)
+	}
+	if _, ok := p.watches[wid]; ok {
+		t.Error("watch still active after its cancel")
+	}
+
+	got, err := os.ReadFile(dst)
+	if err != nil {
+		t.Fatalf("push did not complete: %v", err)
+	}
+	if !bytes.Equal(got, data) {
+		t.Fatalf("pushed %d bytes, file has %d", len(data), len(got))
+	}
+}
+
+// A cancel sent behind another pipelined request still reaches the running
+// one: the agent reads past the queued request to find it
+func TestCancelBehindQueuedRequest(t *testing.T) {
+	p := dialAgent(t, startAgent(t))
+
+	start := time.Now()
+	id, err := p.SendRequest("exec", map[string]interface{}{"command": "/bin/sleep 5"})
+	if err != nil {
+		t.Fatal(err)
+	}
+	next, err := p.SendRequest("pwd", nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := p.Send(CancelMsg{Type: "cancel", ID: id}); err != nil {
+		t.Fatal(err)
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if resp.ID != id || resp.OK || resp.Error != ErrCancelled.Error() {
+		t.Fatalf("first response %+v, want request %d cancelled", resp, id)
+	}
+	if elapsed := time.Since(start); elapsed > 3*time.Second {
+		t.Errorf("exec ran %v after its cancel", elapsed)
+	}
+
+	resp, err = p.RecvResponse()
+	if err != nil {
+		t.Fatal(err)
+	}
+	if resp.ID != next || !resp.OK {
+		t.Fatalf("queued request answered with %+v", resp)
+	}
+}
+
+// The device info from an upgrade carries the session's cwd, not the
+// directory the new image started in
+func TestUpgradeKeepsCwd(t *testing.T) {
+	addr := startAgent(t)
+	bin, err := os.ReadFile(agentBinary())
+	if err != nil {
+		t.Fatal(err)
+	}
+	p := dialAgent(t, addr)
+
+	dir := t.TempDir()
+	if resp, err := p.Cd(dir); err != nil || !resp.OK {
+		t.Fatalf("cd: %v %+v", err, resp)
+	}
+
+	device, err := p.Upgrade(bin, "", nil)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if device == nil || device.Cwd != dir {
+		t.Fatalf("upgrade reported %+v, want cwd %s", device, dir)
+	}
+}
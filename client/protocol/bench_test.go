@@ -0,0 +1,328 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Loopback end-to-end benchmarks against a real agent
+ *
+ * The agent binary is taken from $EDB_AGENT (default ../../agent/edb-agent)
+ * and started in bind mode on a free loopback port. Benchmarks are skipped
+ * if it is not there. Run with `make bench` in agent/, or:
+ *
+ *   EDB_AGENT=/path/to/edb-agent go test -run '^$' -bench . -benchmem ./protocol/
+ *
+ * Results use the standard Go benchmark format (compare runs with benchstat).
+ * Latency benchmarks also report p50/p90/p99 per operation.
+ */
+
+package protocol
+
+import (
+	"crypto/rand"
+	"fmt"
+	"net"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"sort"
+	"strconv"
+	"testing"
+	"time"
+)
+
+// benchSizes are the file sizes used for pull/push throughput
+var benchSizes = []int{4 << 10, 64 << 10, 1 << 20, 16 << 20}
+
+// agentBinary returns the path of the agent under test, as startAgent
+func agentBinary() string {
+	if bin := os.Getenv("EDB_AGENT"); bin != "" {
+		return bin
+	}
+	return filepath.Join("..", "..", "agent", "edb-agent")
+}
+
+// startAgent launches the agent in bind mode and returns its address. The
+// agent is killed when the test or benchmark finishes.
+func startAgent(b testing.TB) string {
+	b.Helper()
+
+	bin := agentBinary()
+	if _, err := os.Stat(bin); err != nil {
+		b.Skipf("agent binary not found (%s), set EDB_AGENT", bin)
+	}
+
+	// Grab a free port, then hand it to the agent
+	l, err := net.Listen("tcp", "127.0.0.1:0")
+	if err != nil {
+		b.Fatal(err)
+	}
+	port := l.Addr().(*net.TCPAddr).Port
+	l.Close()
+
+	cmd := exec.Command(bin, "-l", strconv.Itoa(port))
+	if err := cmd.Start(); err != nil {
+		b.Fatalf("start agent: %v", err)
+	}
+	b.Cleanup(func() {
+		cmd.Process.Kill()
+		cmd.Wait()
+	})
+
+	addr := fmt.Sprintf("127.0.0.1:%d", port)
+	for i := 0; i < 100; i++ {
+		conn, err := net.Dial("tcp", addr)
+		if err == nil {
+			conn.Close()
+			return addr
+		}
+		time.Sleep(20 * time.Millisecond)
+	}
+	b.Fatalf("agent did not start listening on %s", addr)
+	return ""
+}
+
+// dialAgent connects and performs the client side of the handshake
+func dialAgent(b testing.TB, addr string) *Protocol {
+	b.Helper()
+	return dialAgentPlain(b, addr, false)
+}
+
+// dialAgentPlain is dialAgent with the session left unencrypted if plain
+func dialAgentPlain(b testing.TB, addr string, plain bool) *Protocol {
+	b.Helper()
+
+	conn, err := net.Dial("tcp", addr)
+	if err != nil {
+		b.Fatal(err)
+	}
+	p := New(conn)
+	p.SetPlaintext(plain)
+	if err := p.SendHello(); err != nil {
+		b.Fatal(err)
+	}
+	if _, err := p.RecvHelloAck(); err != nil {
+		b.Fatal(err)
+	}
+	b.Cleanup(func() { p.Close() })
+	return p
+}
+
+// writeRandomFile creates a file of the given size with random content
+func writeRandomFile(b *testing.B, dir string, size int) string {
+	b.Helper()
+
+	data := make([]byte, size)
+	rand.Read(data)
+	path := filepath.Join(dir, fmt.Sprintf("bench-%d", size))
+	if err := os.WriteFile(path, data, 0644); err != nil {
+		b.Fatal(err)
+	}
+	return path
+}
+
+// reportPercentiles adds p50/p90/p99 latency metrics to the benchmark output
+func reportPercentiles(b *testing.B, samples []time.Duration) {
+	if len(samples) == 0 {
+		return
+	}
+	sort.Slice(samples, func(i, j int) bool { return samples[i] < samples[j] })
+	for _, p := range []int{50, 90, 99} {
+		idx := (len(samples)*p+99)/100 - 1
+		if idx < 0 {
+			idx = 0
+		}
+		b.ReportMetric(float64(samples[idx].Nanoseconds()), fmt.Sprintf("p%d-ns", p))
+	}
+}
+
+func sizeName(size int) string {
+	switch {
+	case size >= 1<<20:
+		return fmt.Sprintf("%dM", size>>20)
+	case size >= 1<<10:
+		return fmt.Sprintf("%dK", size>>10)
+	}
+	return strconv.Itoa(size)
+}
+
+// BenchmarkHandshake measures connect + hello/hello_ack (bind mode, which
+// includes the agent's fork per connection)
+func BenchmarkHandshake(b *testing.B) {
+	addr := startAgent(b)
+	samples := make([]time.Duration, 0, b.N)
+
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		start := time.Now()
+		conn, err := net.Dial("tcp", addr)
+		if err != nil {
+			b.Fatal(err)
+		}
+		p := New(conn)
+		if err := p.SendHello(); err != nil {
+			b.Fatal(err)
+		}
+		if _, err := p.RecvHelloAck(); err != nil {
+			b.Fatal(err)
+		}
+		samples = append(samples, time.Since(start))
+		p.Close()
+	}
+	b.StopTimer()
+	reportPercentiles(b, samples)
+}
+
+// BenchmarkPull measures download throughput across file sizes
+func BenchmarkPull(b *testing.B) {
+	addr := startAgent(b)
+	dir := b.TempDir()
+
+	for _, size := range benchSizes {
+		b.Run(sizeName(size), func(b *testing.B) {
+			path := writeRandomFile(b, dir, size)
+			p := dialAgent(b, addr)
+
+			b.SetBytes(int64(size))
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				data, _, _, err := p.Pull(path, nil)
+				if err != nil {
+					b.Fatal(err)
+				}
+				if len(data) != size {
+					b.Fatalf("pulled %d bytes, want %d", len(data), size)
+				}
+			}
+		})
+	}
+}
+
+// BenchmarkPullEncryption measures what session encryption costs on pull
+// throughput, plaintext against sealed sessions
+func BenchmarkPullEncryption(b *testing.B) {
+	addr := startAgent(b)
+	dir := b.TempDir()
+
+	for _, mode := range []string{"plain", "sealed"} {
+		for _, size := range benchSizes {
+			b.Run(mode+"/"+sizeName(size), func(b *testing.B) {
+				path := writeRandomFile(b, dir, size)
+				p := dialAgentPlain(b, addr, mode == "plain")
+				if p.Encrypted() != (mode == "sealed") {
+					b.Fatalf("session encrypted: %v", p.Encrypted())
+				}
+
+				b.SetBytes(int64(size))
+				b.ResetTimer()
+				for i := 0; i < b.N; i++ {
+					data, _, _, err := p.Pull(path, nil)
+					if err != nil {
+						b.Fatal(err)
+					}
+					if len(data) != size {
+						b.Fatalf("pulled %d bytes, want %d", len(data), size)
+					}
+				}
+			})
+		}
+	}
+}
+
+// BenchmarkPush measures upload throughput across file sizes
+func BenchmarkPush(b *testing.B) {
+	addr := startAgent(b)
+	dir := b.TempDir()
+
+	for _, size := range benchSizes {
+		b.Run(sizeName(size), func(b *testing.B) {
+			data := make([]byte, size)
+			rand.Read(data)
+			path := filepath.Join(dir, "push-"+sizeName(size))
+			p := dialAgent(b, addr)
+
+			b.SetBytes(int64(size))
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if err := p.Push(path, data, 0644, nil); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+// BenchmarkCommand measures request/response latency of common commands
+func BenchmarkCommand(b *testing.B) {
+	addr := startAgent(b)
+
+	// 100-entry directory for ls, 4 KB file for cat
+	dir := b.TempDir()
+	for i := 0; i < 100; i++ {
+		name := filepath.Join(dir, fmt.Sprintf("file%03d", i))
+		if err := os.WriteFile(name, []byte("x"), 0644); err != nil {
+			b.Fatal(err)
+		}
+	}
+	catPath := writeRandomFile(b, b.TempDir(), 4<<10)
+
+	commands := []struct {
+		name string
+		run  func(p *Protocol) (*Response, error)
+	}{
+		{"ls", func(p *Protocol) (*Response, error) { return p.Ls(dir) }},
+		{"ps", func(p *Protocol) (*Response, error) { return p.Ps() }},
+		{"ss", func(p *Protocol) (*Response, error) { return p.Ss() }},
+		{"cat", func(p *Protocol) (*Response, error) { return p.Cat(catPath) }},
+	}
+
+	for _, c := range commands {
+		b.Run(c.name, func(b *testing.B) {
+			p := dialAgent(b, addr)
+			samples := make([]time.Duration, 0, b.N)
+
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				start := time.Now()
+				resp, err := c.run(p)
+				if err != nil {
+					b.Fatal(err)
+				}
+				if !resp.OK {
+					b.Fatalf("%s: %s", c.name, resp.Error)
+				}
+				samples = append(samples, time.Since(start))
+			}
+			b.StopTimer()
+			reportPercentiles(b, samples)
+		})
+	}
+}
+
+// BenchmarkUpgrade measures an in-place upgrade: sending the agent its own
+// binary, the exec, and the first request answered by the new image
+func BenchmarkUpgrade(b *testing.B) {
+	addr := startAgent(b)
+	bin, err := os.ReadFile(agentBinary())
+	if err != nil {
+		b.Fatal(err)
+	}
+	p := dialAgent(b, addr)
+	samples := make([]time.Duration, 0, b.N)
+
+	b.SetBytes(int64(len(bin)))
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		start := time.Now()
+		if _, err := p.Upgrade(bin, "", nil); err != nil {
+			b.Fatal(err)
+		}
+		if _, err := p.Pwd(); err != nil {
+			b.Fatalf("session after upgrade: %v", err)
+		}
+		samples = append(samples, time.Since(start))
+	}
+	b.StopTimer()
+	reportPercentiles(b, samples)
+
+	// The listener followed and still takes connections
+	dialAgent(b, addr)
+}
@@ -8,12 +8,19 @@
 package protocol
 
 import (
+	"crypto/ecdh"
+	"crypto/sha256"
 	"encoding/binary"
+	"errors"
 	"fmt"
 	"io"
 	"net"
+	"os"
+	"strconv"
+	"strings"
 	"sync"
 	"sync/atomic"
+	"time"
 
 	"github.com/vmihailenco/msgpack/v5"
 )
@@ -22,13 +29,54 @@ const (
 	Version       = 1
 	MaxMsgSize    = 16 * 1024 * 1024 // 16 MB
 	DefaultChunk  = 64 * 1024        // 64 KB
+	FramesVersion = 2                // Binary data frames, offered in hello/hello_ack
 )
 
+// Binary data frame (FramesVersion 2), used for data chunks in both
+// directions once both sides offered it in the handshake:
+//
+//	[4 length BE][1 kind][1 flags][2 reserved][4 id BE][4 seq BE][payload]
+//
+// The length prefix is the usual one. A MessagePack message always starts
+// with a map marker (0x80 and up), so the kind byte tells the two apart.
+const (
+	frameKindData = 0x01
+	frameFlagDone = 0x01
+	frameHdrSize  = 12 // After the length prefix
+)
+
+// ErrCancelled is returned by transfers stopped with Cancel
+var ErrCancelled = errors.New("cancelled")
+
 // Protocol handles the wire protocol for embbridge
 type Protocol struct {
 	conn   net.Conn
 	mu     sync.Mutex
 	nextID uint32
+
+	// Cancellation state, read and written atomically
+	inflight  uint32 // ID of the last request sent
+	uploading uint32 // 1 while Push is sending chunks
+	cancelled uint32 // 1 once Cancel was called for inflight
+
+	deadlineMs uint32        // Sent with every request (0 = none), see SetDeadline
+	rate       atomic.Uint64 // Sent with every pull and push (0 = none), see SetTransferRate
+
+	// Data frame versions offered by each side during the handshake
+	ownFrames  int
+	peerFrames int
+
+	// Session encryption (secure.go): settings, the key pair offered in
+	// the handshake, and the sealers once both sides offered one
+	secret    []byte
+	plaintext bool
+	ownKey    *ecdh.PrivateKey
+	peerHello HelloMsg
+	tx, rx    *sealer
+
+	// Active directory watches by request ID, see WatchDir. Only touched
+	// by the goroutine that reads from the connection.
+	watches map[uint32]WatchFunc
 }
 
 // New creates a new Protocol handler
@@ -39,6 +87,41 @@ func New(conn net.Conn) *Protocol {
 	}
 }
 
+// SetDeadline sets a time limit sent with every following request. The
+// agent bounds slow scans (ps, ss, strings) and exec by it and returns
+// partial results flagged "truncated" instead of making the caller wait.
+// Zero removes the limit. Agents without deadline support reject requests
+// that carry one, so only set it for agents that have it.
+func (p *Protocol) SetDeadline(d time.Duration) {
+	atomic.StoreUint32(&p.deadlineMs, uint32(d/time.Millisecond))
+}
+
+// SetTransferRate limits each following pull and push to bytesPerSec
+// (0 = unlimited). The agent paces the transfer itself, on top of any
+// session-wide limit set with Throttle.
+func (p *Protocol) SetTransferRate(bytesPerSec uint64) {
+	p.rate.Store(bytesPerSec)
+}
+
+// TransferRate returns the per-transfer limit set with SetTransferRate
+func (p *Protocol) TransferRate() uint64 {
+	return p.rate.Load()
+}
+
+// transferArgs adds the per-transfer rate limit, if any, to args
+func (p *Protocol) transferArgs(args map[string]interface{}) map[string]interface{} {
+	if rate := p.rate.Load(); rate > 0 {
+		args["rate"] = rate
+	}
+	return args
+}
+
+// BinaryFrames reports whether data chunks use binary frames, i.e. both
+// sides offered FramesVersion in the handshake
+func (p *Protocol) BinaryFrames() bool {
+	return p.ownFrames >= FramesVersion && p.peerFrames >= FramesVersion
+}
+
 // Close closes the underlying connection
 func (p *Protocol) Close() error {
 	return p.conn.Close()
@@ -67,6 +150,10 @@ func (p *Protocol) Send(v interface{}) error {
 		return fmt.Errorf("message too large: %d bytes", len(data))
 	}
 
+	if p.tx != nil {
+		return p.writeSealed(data)
+	}
+
 	// Send length prefix (4 bytes, big-endian)
 	lenBuf := make([]byte, 4)
 	binary.BigEndian.PutUint32(lenBuf, uint32(len(data)))
@@ -83,33 +170,91 @@ func (p *Protocol) Send(v interface{}) error {
 	return nil
 }
 
-// Recv receives a MessagePack-encoded message with length prefix
+// Recv receives a MessagePack-encoded message with length prefix. Messages
+// for active directory watches are handed to their WatchFunc on the way.
 func (p *Protocol) Recv(v interface{}) error {
-	// Read length prefix
-	lenBuf := make([]byte, 4)
-	if _, err := io.ReadFull(p.conn, lenBuf); err != nil {
-		return fmt.Errorf("read length: %w", err)
+	for {
+		data, err := p.readMsg()
+		if err != nil {
+			return err
+		}
+		if len(data) == 0 {
+			return nil
+		}
+		if len(p.watches) > 0 && p.dispatchWatch(data) {
+			continue
+		}
+
+		if data[0] == frameKindData {
+			return decodeFrame(data, v)
+		}
+
+		if err := msgpack.Unmarshal(data, v); err != nil {
+			return fmt.Errorf("msgpack decode: %w", err)
+		}
+		return nil
 	}
+}
 
-	length := binary.BigEndian.Uint32(lenBuf)
-	if length > MaxMsgSize {
-		return fmt.Errorf("message too large: %d bytes", length)
+// readMsg reads one length-prefixed message and returns it undecoded
+func (p *Protocol) readMsg() ([]byte, error) {
+	var lenBuf [4]byte
+	if _, err := io.ReadFull(p.conn, lenBuf[:]); err != nil {
+		return nil, fmt.Errorf("read length: %w", err)
+	}
+	return p.readPayload(lenBuf)
+}
+
+// readPayload reads the message whose length prefix is in lenBuf, and
+// opens it if the session is encrypted
+func (p *Protocol) readPayload(lenBuf [4]byte) ([]byte, error) {
+	length := binary.BigEndian.Uint32(lenBuf[:])
+	limit := uint32(MaxMsgSize)
+	if p.rx != nil {
+		limit += tagSize
+	}
+	if length > limit {
+		return nil, fmt.Errorf("message too large: %d bytes", length)
 	}
 
 	if length == 0 {
-		return nil
+		return nil, nil
 	}
 
-	// Read payload
 	data := make([]byte, length)
 	if _, err := io.ReadFull(p.conn, data); err != nil {
-		return fmt.Errorf("read payload: %w", err)
+		return nil, fmt.Errorf("read payload: %w", err)
 	}
 
-	if err := msgpack.Unmarshal(data, v); err != nil {
-		return fmt.Errorf("msgpack decode: %w", err)
+	if p.rx != nil {
+		body, err := p.rx.open(lenBuf[:], data)
+		if err != nil || len(body) == 0 {
+			return nil, err
+		}
+		return body, nil
 	}
+	return data, nil
+}
 
+// decodeFrame fills a data message from a binary frame. The payload is
+// used in place, not copied.
+func decodeFrame(data []byte, v interface{}) error {
+	if len(data) < frameHdrSize {
+		return fmt.Errorf("short data frame: %d bytes", len(data))
+	}
+	id := binary.BigEndian.Uint32(data[4:8])
+	seq := binary.BigEndian.Uint32(data[8:12])
+	done := data[1]&frameFlagDone != 0
+	payload := data[frameHdrSize:]
+
+	switch m := v.(type) {
+	case *DataMsg:
+		*m = DataMsg{Type: "data", ID: id, Seq: seq, Data: payload, Done: done}
+	case *streamMsg:
+		*m = streamMsg{Type: "data", Data: payload, Done: done}
+	default:
+		return fmt.Errorf("unexpected data frame")
+	}
 	return nil
 }
 
@@ -119,24 +264,61 @@ func (p *Protocol) Recv(v interface{}) error {
 
 // HelloMsg is the initial handshake message
 type HelloMsg struct {
-	Type    string `msgpack:"type"`
-	Version int    `msgpack:"version"`
-	IsAgent bool   `msgpack:"agent"`
+	Type    string      `msgpack:"type"`
+	Version int         `msgpack:"version"`
+	IsAgent bool        `msgpack:"agent"`
+	Frames  int         `msgpack:"frames,omitempty"`
+	Key     []byte      `msgpack:"key,omitempty"` // X25519 public key, offers encryption
+	Device  *DeviceInfo `msgpack:"device,omitempty"`
 }
 
 // HelloAckMsg is the handshake response
 type HelloAckMsg struct {
-	Type    string `msgpack:"type"`
-	Version int    `msgpack:"version"`
-	IsAgent bool   `msgpack:"agent"`
+	Type    string      `msgpack:"type"`
+	Version int         `msgpack:"version"`
+	IsAgent bool        `msgpack:"agent"`
+	Frames  int         `msgpack:"frames,omitempty"`
+	Key     []byte      `msgpack:"key,omitempty"`
+	Device  *DeviceInfo `msgpack:"device,omitempty"`
+}
+
+// DeviceInfo is the fingerprint an agent gathers at startup and sends with
+// hello/hello_ack, so clients need no extra requests after the handshake.
+// Nil when the agent is too old to send it.
+type DeviceInfo struct {
+	Sysname    string   `msgpack:"sysname"`
+	Nodename   string   `msgpack:"nodename"`
+	Release    string   `msgpack:"release"`
+	Version    string   `msgpack:"version"`
+	Machine    string   `msgpack:"machine"`
+	User       string   `msgpack:"user"`
+	UID        int      `msgpack:"uid"`
+	GID        int      `msgpack:"gid"`
+	Cwd        string   `msgpack:"cwd"`
+	CPU        string   `msgpack:"cpu"`
+	MemTotalKB uint64   `msgpack:"mem_total_kb"`
+	MemBudget  uint64   `msgpack:"mem_budget_kb"`
+	MTDCount   int      `msgpack:"mtd_count"`
+	Features   []string `msgpack:"features"`
+}
+
+// HasFeature reports whether the agent was built with the named command
+func (d *DeviceInfo) HasFeature(name string) bool {
+	for _, f := range d.Features {
+		if f == name {
+			return true
+		}
+	}
+	return false
 }
 
 // Request is a command request from client to agent
 type Request struct {
-	Type string                 `msgpack:"type"`
-	ID   uint32                 `msgpack:"id"`
-	Cmd  string                 `msgpack:"cmd"`
-	Args map[string]interface{} `msgpack:"args"`
+	Type       string                 `msgpack:"type"`
+	ID         uint32                 `msgpack:"id"`
+	Cmd        string                 `msgpack:"cmd"`
+	DeadlineMs uint32                 `msgpack:"deadline_ms,omitempty"`
+	Args       map[string]interface{} `msgpack:"args"`
 }
 
 // Response is a command response from agent to client
@@ -154,22 +336,40 @@ type Response struct {
 
 // SendHello sends a hello message (client initiating)
 func (p *Protocol) SendHello() error {
+	key, err := p.offerKey()
+	if err != nil {
+		return err
+	}
 	msg := HelloMsg{
 		Type:    "hello",
 		Version: Version,
 		IsAgent: false,
+		Frames:  FramesVersion,
+		Key:     key,
 	}
+	p.ownFrames = FramesVersion
 	return p.Send(msg)
 }
 
-// SendHelloAck sends a hello_ack message
+// SendHelloAck sends a hello_ack message in reply to the hello received
+// with RecvHello. Messages after it are sealed if both offered a key.
 func (p *Protocol) SendHelloAck() error {
+	key, err := p.offerKey()
+	if err != nil {
+		return err
+	}
 	msg := HelloAckMsg{
 		Type:    "hello_ack",
 		Version: Version,
 		IsAgent: false,
+		Frames:  FramesVersion,
+		Key:     key,
 	}
-	return p.Send(msg)
+	p.ownFrames = FramesVersion
+	if err := p.Send(msg); err != nil {
+		return err
+	}
+	return p.startSecure(p.peerHello.Key, p.peerHello.IsAgent)
 }
 
 // RecvHello receives and validates a hello message
@@ -182,11 +382,14 @@ func (p *Protocol) RecvHello() (*HelloMsg, error) {
 	if msg.Type != "hello" {
 		return nil, fmt.Errorf("expected hello, got %s", msg.Type)
 	}
+	p.peerFrames = msg.Frames
+	p.peerHello = msg
 
 	return &msg, nil
 }
 
-// RecvHelloAck receives and validates a hello_ack message
+// RecvHelloAck receives and validates a hello_ack message. Messages after
+// it are sealed if both offered a key.
 func (p *Protocol) RecvHelloAck() (*HelloAckMsg, error) {
 	var msg HelloAckMsg
 	if err := p.Recv(&msg); err != nil {
@@ -196,7 +399,11 @@ func (p *Protocol) RecvHelloAck() (*HelloAckMsg, error) {
 	if msg.Type != "hello_ack" {
 		return nil, fmt.Errorf("expected hello_ack, got %s", msg.Type)
 	}
+	p.peerFrames = msg.Frames
 
+	if err := p.startSecure(msg.Key, msg.IsAgent); err != nil {
+		return nil, err
+	}
 	return &msg, nil
 }
 
@@ -208,14 +415,41 @@ func (p *Protocol) RecvHelloAck() (*HelloAckMsg, error) {
 func (p *Protocol) SendRequest(cmd string, args map[string]interface{}) (uint32, error) {
 	id := p.NextID()
 	req := Request{
-		Type: "req",
-		ID:   id,
-		Cmd:  cmd,
-		Args: args,
+		Type:       "req",
+		ID:         id,
+		Cmd:        cmd,
+		DeadlineMs: atomic.LoadUint32(&p.deadlineMs),
+		Args:       args,
 	}
+	atomic.StoreUint32(&p.cancelled, 0)
+	atomic.StoreUint32(&p.inflight, id)
 	return id, p.Send(req)
 }
 
+// CancelMsg asks the agent to abort a running request
+type CancelMsg struct {
+	Type string `msgpack:"type"`
+	ID   uint32 `msgpack:"id"`
+}
+
+// Cancel asks the agent to abort the request in flight. It is safe to call
+// from another goroutine (e.g. on Ctrl-C) while a command is waiting for
+// its response. The agent stops pull and push between chunks and kills a
+// running exec; the pending call then returns ErrCancelled or an error
+// response. Profile and systrace stop early and return what they have.
+// If the request already finished the agent ignores the cancel.
+func (p *Protocol) Cancel() error {
+	id := atomic.LoadUint32(&p.inflight)
+	if id == 0 || !atomic.CompareAndSwapUint32(&p.cancelled, 0, 1) {
+		return nil
+	}
+	// Push sends the cancel itself, between chunks
+	if atomic.LoadUint32(&p.uploading) == 1 {
+		return nil
+	}
+	return p.Send(CancelMsg{Type: "cancel", ID: id})
+}
+
 // RecvResponse receives a command response
 func (p *Protocol) RecvResponse() (*Response, error) {
 	var resp Response
@@ -278,6 +512,16 @@ func (p *Protocol) Cat(path string) (*Response, error) {
 	return p.RecvResponse()
 }
 
+// CatRange reads length bytes of a file starting at offset (length 0 reads
+// to the end). Use it for files larger than the agent's memory budget.
+func (p *Protocol) CatRange(path string, offset, length uint64) (*Response, error) {
+	args := map[string]interface{}{"path": path, "offset": offset, "length": length}
+	if _, err := p.SendRequest("cat", args); err != nil {
+		return nil, err
+	}
+	return p.RecvResponse()
+}
+
 // Uname gets system info
 func (p *Protocol) Uname() (*Response, error) {
 	if _, err := p.SendRequest("uname", nil); err != nil {
@@ -387,6 +631,19 @@ func (p *Protocol) IpRoute() (*Response, error) {
 	return p.RecvResponse()
 }
 
+// Elfinfo inspects ELF binaries on the device. With brief set, only the
+// header, needed libraries and security flags are returned for each file.
+func (p *Protocol) Elfinfo(paths []string, brief bool) (*Response, error) {
+	args := map[string]interface{}{"paths": paths}
+	if brief {
+		args["brief"] = 1
+	}
+	if _, err := p.SendRequest("elfinfo", args); err != nil {
+		return nil, err
+	}
+	return p.RecvResponse()
+}
+
 // Rm removes a file or empty directory
 func (p *Protocol) Rm(path string) (*Response, error) {
 	args := map[string]interface{}{"path": path}
@@ -445,6 +702,15 @@ type DataMsg struct {
 	Done bool   `msgpack:"done"`
 }
 
+// streamMsg is what arrives while a transfer streams: normally data, but
+// a resp if the agent ended the request early
+type streamMsg struct {
+	Type  string `msgpack:"type"`
+	Data  []byte `msgpack:"data"`
+	Done  bool   `msgpack:"done"`
+	Error string `msgpack:"error"`
+}
+
 // TransferProgress is called during file transfers with progress info
 type TransferProgress func(transferred, total int64)
 
@@ -454,7 +720,7 @@ type TransferProgress func(transferred, total int64)
 
 // Pull downloads a file from the device with progress reporting
 func (p *Protocol) Pull(remotePath string, progress TransferProgress) ([]byte, int64, uint32, error) {
-	args := map[string]interface{}{"path": remotePath}
+	args := p.transferArgs(map[string]interface{}{"path": remotePath})
 	if _, err := p.SendRequest("pull", args); err != nil {
 		return nil, 0, 0, err
 	}
@@ -473,18 +739,60 @@ func (p *Protocol) Pull(remotePath string, progress TransferProgress) ([]byte, i
 	size := toInt64(resp.Data["size"])
 	mode := toInt64(resp.Data["mode"])
 
-	// Receive data chunks
-	var data []byte
+	data, err := p.recvChunks(nil, size, progress)
+	if err != nil {
+		return nil, 0, 0, err
+	}
+	return data, size, uint32(mode), nil
+}
+
+// PullRange downloads length bytes of a file starting at offset (length 0
+// for the rest of the file). Agents that predate ranged pulls are refused
+// rather than sending the whole file.
+func (p *Protocol) PullRange(remotePath string, offset, length int64, progress TransferProgress) ([]byte, error) {
+	args := p.transferArgs(map[string]interface{}{
+		"path":   remotePath,
+		"offset": uint64(offset),
+		"length": uint64(length),
+	})
+	if _, err := p.SendRequest("pull", args); err != nil {
+		return nil, err
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return nil, err
+	}
+	if !resp.OK {
+		return nil, fmt.Errorf("%s", resp.Error)
+	}
+	if _, ok := resp.Data["length"]; !ok {
+		return nil, fmt.Errorf("agent does not support ranged pulls")
+	}
+
+	// Nothing follows an empty range
+	want := toInt64(resp.Data["length"])
+	if want == 0 {
+		return []byte{}, nil
+	}
+	return p.recvChunks(make([]byte, 0, want), want, progress)
+}
+
+// recvChunks appends the data messages of a pull to data until done
+func (p *Protocol) recvChunks(data []byte, size int64, progress TransferProgress) ([]byte, error) {
 	var transferred int64
 
 	for {
-		var chunk DataMsg
+		var chunk streamMsg
 		if err := p.Recv(&chunk); err != nil {
-			return nil, 0, 0, fmt.Errorf("receive chunk: %w", err)
+			return nil, fmt.Errorf("receive chunk: %w", err)
 		}
 
+		if chunk.Type == "resp" && chunk.Error == ErrCancelled.Error() {
+			return nil, ErrCancelled
+		}
 		if chunk.Type != "data" {
-			return nil, 0, 0, fmt.Errorf("expected data, got %s", chunk.Type)
+			return nil, fmt.Errorf("expected data, got %s", chunk.Type)
 		}
 
 		data = append(data, chunk.Data...)
@@ -495,19 +803,112 @@ func (p *Protocol) Pull(remotePath string, progress TransferProgress) ([]byte, i
 		}
 
 		if chunk.Done {
-			break
+			return data, nil
 		}
 	}
+}
 
-	return data, size, uint32(mode), nil
+// PulledFile is one file downloaded by PullMany
+type PulledFile struct {
+	Path string
+	Size int64 // As listed; Data is shorter if the file shrank meanwhile
+	Mode uint32
+	Data []byte
+}
+
+// SkippedFile is a match PullMany could not download, with the reason
+type SkippedFile struct {
+	Path  string
+	Error string
+}
+
+// PullMany downloads every file matching the given glob patterns in one
+// request. The agent expands the patterns, lists what it will send, then
+// streams the files back to back. progress reports bytes over all files.
+func (p *Protocol) PullMany(patterns []string, progress TransferProgress) ([]PulledFile, []SkippedFile, error) {
+	args := p.transferArgs(map[string]interface{}{"paths": patterns})
+	if _, err := p.SendRequest("pull_many", args); err != nil {
+		return nil, nil, err
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return nil, nil, err
+	}
+	if !resp.OK {
+		return nil, nil, fmt.Errorf("%s", resp.Error)
+	}
+
+	var files []PulledFile
+	var total int64
+	if list, ok := resp.Data["files"].([]interface{}); ok {
+		for _, item := range list {
+			entry, _ := item.(map[string]interface{})
+			path, _ := entry["path"].(string)
+			f := PulledFile{
+				Path: path,
+				Size: toInt64(entry["size"]),
+				Mode: uint32(toInt64(entry["mode"])),
+			}
+			total += f.Size
+			files = append(files, f)
+		}
+	}
+
+	var skipped []SkippedFile
+	if list, ok := resp.Data["skipped"].([]interface{}); ok {
+		for _, item := range list {
+			entry, _ := item.(map[string]interface{})
+			path, _ := entry["path"].(string)
+			reason, _ := entry["error"].(string)
+			skipped = append(skipped, SkippedFile{Path: path, Error: reason})
+		}
+	}
+
+	// Each listed file follows in order, ending with its done chunk
+	var transferred int64
+	for i := range files {
+		for {
+			var chunk streamMsg
+			if err := p.Recv(&chunk); err != nil {
+				return nil, nil, fmt.Errorf("receive chunk: %w", err)
+			}
+
+			if chunk.Type == "resp" {
+				if chunk.Error == ErrCancelled.Error() {
+					return nil, nil, ErrCancelled
+				}
+				return nil, nil, fmt.Errorf("%s: %s", files[i].Path, chunk.Error)
+			}
+			if chunk.Type != "data" {
+				return nil, nil, fmt.Errorf("expected data, got %s", chunk.Type)
+			}
+
+			files[i].Data = append(files[i].Data, chunk.Data...)
+			transferred += int64(len(chunk.Data))
+
+			if progress != nil {
+				progress(transferred, total)
+			}
+
+			if chunk.Done {
+				break
+			}
+		}
+	}
+
+	return files, skipped, nil
 }
 
 // =============================================================================
 // Push (Upload) with Progress
 // =============================================================================
 
-// SendData sends a data chunk
+// SendData sends a data chunk, as a binary frame when negotiated
 func (p *Protocol) SendData(id, seq uint32, data []byte, done bool) error {
+	if p.BinaryFrames() {
+		return p.sendFrame(id, seq, data, done)
+	}
 	msg := DataMsg{
 		Type: "data",
 		ID:   id,
@@ -518,13 +919,46 @@ func (p *Protocol) SendData(id, seq uint32, data []byte, done bool) error {
 	return p.Send(msg)
 }
 
+// sendFrame sends a binary data frame; header and payload go out in one
+// writev
+func (p *Protocol) sendFrame(id, seq uint32, data []byte, done bool) error {
+	if len(data) > MaxMsgSize-frameHdrSize {
+		return fmt.Errorf("message too large: %d bytes", len(data))
+	}
+
+	var hdr [4 + frameHdrSize]byte
+	binary.BigEndian.PutUint32(hdr[0:4], uint32(frameHdrSize+len(data)))
+	hdr[4] = frameKindData
+	if done {
+		hdr[5] = frameFlagDone
+	}
+	binary.BigEndian.PutUint32(hdr[8:12], id)
+	binary.BigEndian.PutUint32(hdr[12:16], seq)
+
+	p.mu.Lock()
+	defer p.mu.Unlock()
+
+	if p.tx != nil {
+		return p.writeSealed(hdr[4:], data)
+	}
+
+	bufs := net.Buffers{hdr[:], data}
+	if _, err := bufs.WriteTo(p.conn); err != nil {
+		return fmt.Errorf("write frame: %w", err)
+	}
+	return nil
+}
+
 // Push uploads a file to the device with progress reporting
 func (p *Protocol) Push(remotePath string, data []byte, mode uint32, progress TransferProgress) error {
-	args := map[string]interface{}{
+	args := p.transferArgs(map[string]interface{}{
 		"path": remotePath,
 		"size": uint64(len(data)),
 		"mode": uint64(mode),
-	}
+	})
+	atomic.StoreUint32(&p.uploading, 1)
+	defer atomic.StoreUint32(&p.uploading, 0)
+
 	id, err := p.SendRequest("push", args)
 	if err != nil {
 		return err
@@ -540,12 +974,28 @@ func (p *Protocol) Push(remotePath string, data []byte, mode uint32, progress Tr
 		return fmt.Errorf("%s", resp.Error)
 	}
 
-	// Send data in chunks
+	return p.sendChunks(id, data, progress)
+}
+
+// sendChunks sends data as the chunks of request id, stopping early if
+// the transfer is cancelled
+func (p *Protocol) sendChunks(id uint32, data []byte, progress TransferProgress) error {
 	total := int64(len(data))
 	var seq uint32
 	var transferred int64
 
 	for transferred < total {
+		if atomic.LoadUint32(&p.cancelled) == 1 {
+			if err := p.Send(CancelMsg{Type: "cancel", ID: id}); err != nil {
+				return err
+			}
+			// The agent removes the partial file and confirms
+			if _, err := p.RecvResponse(); err != nil {
+				return err
+			}
+			return ErrCancelled
+		}
+
 		end := transferred + DefaultChunk
 		if end > total {
 			end = total
@@ -569,6 +1019,621 @@ func (p *Protocol) Push(remotePath string, data []byte, mode uint32, progress Tr
 	return nil
 }
 
+// Upgrade replaces the agent with the binary in data without ending the
+// session: the agent checks it against its SHA-256 and execs it, and the
+// new image carries on with this connection. keepPath, if set, also stores
+// the binary on the device (e.g. over the agent's file for the next start).
+// Returns the new image's device fingerprint, nil if it sends none.
+func (p *Protocol) Upgrade(data []byte, keepPath string, progress TransferProgress) (*DeviceInfo, error) {
+	sum := sha256.Sum256(data)
+	args := map[string]interface{}{
+		"size":   uint64(len(data)),
+		"sha256": sum[:],
+	}
+	if keepPath != "" {
+		args["path"] = keepPath
+	}
+	args = p.transferArgs(args)
+	atomic.StoreUint32(&p.uploading, 1)
+	defer atomic.StoreUint32(&p.uploading, 0)
+
+	id, err := p.SendRequest("upgrade", args)
+	if err != nil {
+		return nil, err
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return nil, err
+	}
+	if !resp.OK {
+		return nil, fmt.Errorf("%s", resp.Error)
+	}
+
+	if err := p.sendChunks(id, data, progress); err != nil {
+		return nil, err
+	}
+
+	// From the new image, or an error from the old one
+	resp, err = p.RecvResponse()
+	if err != nil {
+		return nil, err
+	}
+	if !resp.OK {
+		return nil, fmt.Errorf("%s", resp.Error)
+	}
+	if len(resp.Data) == 0 {
+		return nil, nil
+	}
+
+	// The new image's fingerprint, as it would send with hello_ack
+	raw, err := msgpack.Marshal(resp.Data)
+	if err != nil {
+		return nil, err
+	}
+	var device DeviceInfo
+	if err := msgpack.Unmarshal(raw, &device); err != nil {
+		return nil, fmt.Errorf("bad fingerprint: %w", err)
+	}
+	return &device, nil
+}
+
+// =============================================================================
+// Throttle (transfer limits)
+// =============================================================================
+
+// ThrottleOptions changes how hard the session's transfers may hit the
+// device. Nil fields and a zero IOClass are left as they are.
+type ThrottleOptions struct {
+	Rate    *uint64 // Bytes/s for all transfers together, 0 = unlimited
+	Nice    *int    // CPU niceness of the agent session, 0-19
+	IOClass int     // I/O class as ionice -c: 1 realtime, 2 best-effort, 3 idle
+	IOLevel int     // Level within the class as ionice -n, 0-7
+}
+
+// Throttle sets the session's limits and returns those in effect (rate,
+// nice, ioclass, iolevel). With no options it only reports them.
+func (p *Protocol) Throttle(opts ThrottleOptions) (*Response, error) {
+	args := map[string]interface{}{}
+	if opts.Rate != nil {
+		args["rate"] = *opts.Rate
+	}
+	if opts.Nice != nil {
+		args["nice"] = *opts.Nice
+	}
+	if opts.IOClass > 0 {
+		args["ioclass"] = opts.IOClass
+		args["iolevel"] = opts.IOLevel
+	}
+	if _, err := p.SendRequest("throttle", args); err != nil {
+		return nil, err
+	}
+	return p.RecvResponse()
+}
+
+// ParseRate parses a rate in bytes/s such as 65536, 512K or 2M; "off" and
+// 0 mean unlimited
+func ParseRate(s string) (uint64, error) {
+	if s == "off" {
+		return 0, nil
+	}
+	num, mult := s, uint64(1)
+	switch {
+	case strings.HasSuffix(s, "K") || strings.HasSuffix(s, "k"):
+		num, mult = s[:len(s)-1], 1024
+	case strings.HasSuffix(s, "M") || strings.HasSuffix(s, "m"):
+		num, mult = s[:len(s)-1], 1024*1024
+	}
+	n, err := strconv.ParseUint(num, 10, 64)
+	if err != nil {
+		return 0, fmt.Errorf("invalid rate: %s (e.g. 512K, 2M or off)", s)
+	}
+	return n * mult, nil
+}
+
+// ParseIOPriority parses idle, be[:level] or rt[:level] into the ionice
+// class and level used by ThrottleOptions
+func ParseIOPriority(s string) (int, int, error) {
+	name, levelStr, hasLevel := strings.Cut(s, ":")
+	classes := map[string]int{"rt": 1, "be": 2, "idle": 3}
+	class, ok := classes[name]
+	if !ok {
+		return 0, 0, fmt.Errorf("invalid io class: %s (idle, be or rt)", name)
+	}
+	level := 4
+	if hasLevel {
+		n, err := strconv.Atoi(levelStr)
+		if err != nil || n < 0 || n > 7 || class == 3 {
+			return 0, 0, fmt.Errorf("invalid io level: %s (0-7, not for idle)", levelStr)
+		}
+		level = n
+	}
+	return class, level, nil
+}
+
+// =============================================================================
+// Profile (CPU sampling)
+// =============================================================================
+
+// ProfileOptions controls a profile run. Zero values use the agent defaults.
+type ProfileOptions struct {
+	PID      int    // Target process; 0 profiles the whole system
+	Duration int    // Sampling time in milliseconds
+	Freq     int    // Samples per second per CPU
+	Event    string // "cpu-clock" (default) or "cycles"
+	Top      int    // Number of entries in the summary lists
+}
+
+// ProfileSample is a single decoded sample streamed by the agent
+type ProfileSample struct {
+	PID   uint32
+	TID   uint32
+	IP    uint64
+	Stack []uint64
+}
+
+// Profile runs the CPU profiler on the device. The agent streams raw samples
+// while sampling, then sends an aggregated summary as a second response.
+func (p *Protocol) Profile(opts ProfileOptions) (*Response, []ProfileSample, error) {
+	args := map[string]interface{}{}
+	if opts.PID > 0 {
+		args["pid"] = opts.PID
+	}
+	if opts.Duration > 0 {
+		args["duration"] = opts.Duration
+	}
+	if opts.Freq > 0 {
+		args["freq"] = opts.Freq
+	}
+	if opts.Event != "" {
+		args["event"] = opts.Event
+	}
+	if opts.Top > 0 {
+		args["top"] = opts.Top
+	}
+	if _, err := p.SendRequest("profile", args); err != nil {
+		return nil, nil, err
+	}
+
+	// Initial response confirms sampling has started
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return nil, nil, err
+	}
+	if !resp.OK {
+		return resp, nil, nil
+	}
+
+	var samples []ProfileSample
+	for {
+		var chunk DataMsg
+		if err := p.Recv(&chunk); err != nil {
+			return nil, nil, fmt.Errorf("receive samples: %w", err)
+		}
+		if chunk.Type != "data" {
+			return nil, nil, fmt.Errorf("expected data, got %s", chunk.Type)
+		}
+
+		samples = appendProfileSamples(samples, chunk.Data)
+
+		if chunk.Done {
+			break
+		}
+	}
+
+	summary, err := p.RecvResponse()
+	if err != nil {
+		return nil, nil, err
+	}
+	return summary, samples, nil
+}
+
+// appendProfileSamples decodes packed sample records:
+// u32 pid, u32 tid, u64 ip, u8 nr, nr x u64 callchain (all big-endian)
+func appendProfileSamples(out []ProfileSample, b []byte) []ProfileSample {
+	for len(b) >= 17 {
+		nr := int(b[16])
+		if len(b) < 17+nr*8 {
+			break
+		}
+		s := ProfileSample{
+			PID: binary.BigEndian.Uint32(b[0:4]),
+			TID: binary.BigEndian.Uint32(b[4:8]),
+			IP:  binary.BigEndian.Uint64(b[8:16]),
+		}
+		for i := 0; i < nr; i++ {
+			off := 17 + i*8
+			s.Stack = append(s.Stack, binary.BigEndian.Uint64(b[off:off+8]))
+		}
+		out = append(out, s)
+		b = b[17+nr*8:]
+	}
+	return out
+}
+
+// =============================================================================
+// Systrace (syscall latency)
+// =============================================================================
+
+// SystraceOptions controls a systrace run. Zero values use the agent defaults.
+type SystraceOptions struct {
+	PID      int // Target process (required)
+	Duration int // Tracing time in milliseconds
+	Interval int // Reporting interval in milliseconds
+}
+
+// SystraceInterval is called with the per-syscall stats for each reporting
+// interval while tracing runs
+type SystraceInterval func(elapsedMs int64, syscalls []interface{})
+
+// Systrace traces syscalls of a process on the device. The agent streams
+// per-interval aggregates as data messages, then sends the totals as a
+// second response.
+func (p *Protocol) Systrace(opts SystraceOptions, onInterval SystraceInterval) (*Response, error) {
+	args := map[string]interface{}{"pid": opts.PID}
+	if opts.Duration > 0 {
+		args["duration"] = opts.Duration
+	}
+	if opts.Interval > 0 {
+		args["interval"] = opts.Interval
+	}
+	if _, err := p.SendRequest("systrace", args); err != nil {
+		return nil, err
+	}
+
+	// Initial response confirms the target was attached
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return nil, err
+	}
+	if !resp.OK {
+		return resp, nil
+	}
+
+	for {
+		var chunk DataMsg
+		if err := p.Recv(&chunk); err != nil {
+			return nil, fmt.Errorf("receive interval: %w", err)
+		}
+		if chunk.Type != "data" {
+			return nil, fmt.Errorf("expected data, got %s", chunk.Type)
+		}
+
+		if len(chunk.Data) > 0 && onInterval != nil {
+			var interval map[string]interface{}
+			if err := msgpack.Unmarshal(chunk.Data, &interval); err != nil {
+				return nil, fmt.Errorf("decode interval: %w", err)
+			}
+			syscalls, _ := interval["syscalls"].([]interface{})
+			onInterval(toInt64(interval["elapsed_ms"]), syscalls)
+		}
+
+		if chunk.Done {
+			break
+		}
+	}
+
+	return p.RecvResponse()
+}
+
+// =============================================================================
+// Directory Watches
+// =============================================================================
+
+// WatchEvent is one coalesced change to a watched directory. Op is
+// "create", "delete", "modify" or "move" (Name renamed to To).
+type WatchEvent struct {
+	Op   string `msgpack:"op"`
+	Name string `msgpack:"name"`
+	To   string `msgpack:"to,omitempty"`
+	Dir  bool   `msgpack:"dir,omitempty"`
+}
+
+// WatchBatch is what the agent gathered over one watch interval. Overflow
+// means changes were lost and the directory should be listed again. Done
+// means the watch ended: the directory was removed or moved, or the agent
+// stopped it.
+type WatchBatch struct {
+	Events   []WatchEvent `msgpack:"events"`
+	Overflow bool         `msgpack:"overflow"`
+	Done     bool         `msgpack:"-"`
+}
+
+// WatchFunc is called with each batch of changes to a watched directory
+type WatchFunc func(WatchBatch)
+
+// watchHeader is decoded first to tell watch messages from the rest
+type watchHeader struct {
+	Type string `msgpack:"type"`
+	ID   uint32 `msgpack:"id"`
+}
+
+// WatchDir subscribes to changes to a directory on the device. The agent
+// gathers them for interval (zero or negative for its default) and sends
+// each batch as a data message on the watch's ID, which Recv hands to fn
+// whenever it reads one; PollWatches picks them up between requests.
+// Returns the ID to pass to Unwatch.
+func (p *Protocol) WatchDir(path string, interval time.Duration, fn WatchFunc) (uint32, error) {
+	args := map[string]interface{}{"path": path}
+	if interval < 0 {
+		interval = 0
+	}
+	if interval > 0 {
+		args["interval_ms"] = uint64(interval.Milliseconds())
+	}
+	id, err := p.SendRequest("watch_dir", args)
+	if err != nil {
+		return 0, err
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return 0, err
+	}
+	if !resp.OK {
+		return 0, fmt.Errorf("%s", resp.Error)
+	}
+
+	// The watch outlives the request; Cancel is for the next one
+	atomic.CompareAndSwapUint32(&p.inflight, id, 0)
+
+	if p.watches == nil {
+		p.watches = make(map[uint32]WatchFunc)
+	}
+	p.watches[id] = fn
+	return id, nil
+}
+
+// Unwatch ends a directory watch. Batches the agent sent before it saw the
+// cancel are read and dropped.
+func (p *Protocol) Unwatch(id uint32) error {
+	if _, ok := p.watches[id]; !ok {
+		return nil
+	}
+	p.watches[id] = nil
+
+	if err := p.Send(CancelMsg{Type: "cancel", ID: id}); err != nil {
+		delete(p.watches, id)
+		return err
+	}
+
+	// Ends with the "cancelled" response, or with a done batch if the
+	// watch ended on its own first (the agent ignores a late cancel)
+	for {
+		if _, ok := p.watches[id]; !ok {
+			return nil
+		}
+		data, err := p.readMsg()
+		if err != nil {
+			return err
+		}
+		if !p.dispatchWatch(data) {
+			return fmt.Errorf("unexpected message while unwatching")
+		}
+	}
+}
+
+// PollWatches hands any watch batches that already arrived to their
+// WatchFunc without waiting for more. Call it between requests, when
+// nothing else is expected from the agent.
+func (p *Protocol) PollWatches() error {
+	for len(p.watches) > 0 {
+		// Only wait for the first byte; once a message started, read all of it
+		var lenBuf [4]byte
+		p.conn.SetReadDeadline(time.Now().Add(time.Millisecond))
+		n, err := p.conn.Read(lenBuf[:1])
+		p.conn.SetReadDeadline(time.Time{})
+		if n == 0 {
+			if errors.Is(err, os.ErrDeadlineExceeded) {
+				return nil
+			}
+			return fmt.Errorf("read length: %w", err)
+		}
+		if _, err := io.ReadFull(p.conn, lenBuf[1:]); err != nil {
+			return fmt.Errorf("read length: %w", err)
+		}
+
+		data, err := p.readPayload(lenBuf)
+		if err != nil {
+			return err
+		}
+		if !p.dispatchWatch(data) {
+			return fmt.Errorf("unexpected message between requests")
+		}
+	}
+	return nil
+}
+
+// dispatchWatch passes data to the watch it belongs to, if any, and
+// reports whether it did. A response on a watch's ID ends the watch: it is
+// the agent's answer to Unwatch, or an error that stopped the watch.
+func (p *Protocol) dispatchWatch(data []byte) bool {
+	if len(data) == 0 {
+		return false
+	}
+
+	var id uint32
+	var payload []byte
+	var done bool
+
+	if data[0] == frameKindData {
+		if len(data) < frameHdrSize {
+			return false
+		}
+		id = binary.BigEndian.Uint32(data[4:8])
+		if _, ok := p.watches[id]; !ok {
+			return false
+		}
+		payload = data[frameHdrSize:]
+		done = data[1]&frameFlagDone != 0
+	} else {
+		var hdr watchHeader
+		if msgpack.Unmarshal(data, &hdr) != nil {
+			return false
+		}
+		id = hdr.ID
+		fn, ok := p.watches[id]
+		if !ok {
+			return false
+		}
+		if hdr.Type != "data" {
+			delete(p.watches, id)
+			if fn != nil {
+				fn(WatchBatch{Overflow: true, Done: true})
+			}
+			return true
+		}
+		var msg DataMsg
+		if msgpack.Unmarshal(data, &msg) != nil {
+			return false
+		}
+		payload = msg.Data
+		done = msg.Done
+	}
+
+	fn := p.watches[id]
+	if done {
+		delete(p.watches, id)
+	}
+	if fn == nil {
+		return true
+	}
+
+	var batch WatchBatch
+	if len(payload) > 0 && msgpack.Unmarshal(payload, &batch) != nil {
+		// Undecodable changes are lost changes
+		batch = WatchBatch{Overflow: true}
+	}
+	batch.Done = done
+	fn(batch)
+	return true
+}
+
+// =============================================================================
+// Chunk Hashes (content-defined chunking)
+// =============================================================================
+
+// Chunk is one content-defined chunk of a file on the device
+type Chunk struct {
+	Offset int64
+	Size   uint32
+	Hash   [32]byte
+}
+
+// Packed hash_chunks record: u32 length (big-endian), SHA-256
+const chunkRecordSize = 4 + 32
+
+// HashChunks has the agent split a file (or MTD partition) into
+// content-defined chunks and hash each, without sending the data. Returns
+// the file's size and mode and its chunks in order; pull the ones a store
+// lacks with PullRange.
+func (p *Protocol) HashChunks(remotePath string) (int64, uint32, []Chunk, error) {
+	args := map[string]interface{}{"path": remotePath}
+	if _, err := p.SendRequest("hash_chunks", args); err != nil {
+		return 0, 0, nil, err
+	}
+
+	resp, err := p.RecvResponse()
+	if err != nil {
+		return 0, 0, nil, err
+	}
+	if !resp.OK {
+		return 0, 0, nil, fmt.Errorf("%s", resp.Error)
+	}
+	size := toInt64(resp.Data["size"])
+	mode := toInt64(resp.Data["mode"])
+
+	var chunks []Chunk
+	var offset int64
+	for {
+		var msg streamMsg
+		if err := p.Recv(&msg); err != nil {
+			return 0, 0, nil, fmt.Errorf("receive chunk hashes: %w", err)
+		}
+		if msg.Type == "resp" {
+			if msg.Error == ErrCancelled.Error() {
+				return 0, 0, nil, ErrCancelled
+			}
+			return 0, 0, nil, fmt.Errorf("%s", msg.Error)
+		}
+		if msg.Type != "data" {
+			return 0, 0, nil, fmt.Errorf("expected data, got %s", msg.Type)
+		}
+		if len(msg.Data)%chunkRecordSize != 0 {
+			return 0, 0, nil, fmt.Errorf("malformed chunk hashes")
+		}
+
+		for b := msg.Data; len(b) > 0; b = b[chunkRecordSize:] {
+			c := Chunk{Offset: offset, Size: binary.BigEndian.Uint32(b)}
+			copy(c.Hash[:], b[4:chunkRecordSize])
+			chunks = append(chunks, c)
+			offset += int64(c.Size)
+		}
+
+		if msg.Done {
+			break
+		}
+	}
+
+	return size, uint32(mode), chunks, nil
+}
+
+// =============================================================================
+// Verify (hash manifest)
+// =============================================================================
+
+// ManifestEntry is the expected size and SHA-256 of one file on the device
+type ManifestEntry struct {
+	Path string
+	Size uint64
+	Hash [32]byte
+}
+
+// manifestVersion is the leading byte of an encoded manifest
+const manifestVersion = 1
+
+// EncodeManifest packs entries into the wire format used by verify:
+// u8 version, then per entry u16 path_len, path, u64 size, 32-byte SHA-256
+// (all big-endian)
+func EncodeManifest(entries []ManifestEntry) ([]byte, error) {
+	size := 1
+	for _, e := range entries {
+		if len(e.Path) == 0 || len(e.Path) > 0xFFFF {
+			return nil, fmt.Errorf("invalid manifest path %q", e.Path)
+		}
+		size += 2 + len(e.Path) + 8 + 32
+	}
+
+	buf := make([]byte, 0, size)
+	buf = append(buf, manifestVersion)
+	for _, e := range entries {
+		buf = binary.BigEndian.AppendUint16(buf, uint16(len(e.Path)))
+		buf = append(buf, e.Path...)
+		buf = binary.BigEndian.AppendUint64(buf, e.Size)
+		buf = append(buf, e.Hash[:]...)
+	}
+	return buf, nil
+}
+
+// Verify checks files on the device against a manifest. Only mismatches,
+// missing files and errors are returned. threads 0 lets the agent use one
+// worker per online CPU.
+func (p *Protocol) Verify(entries []ManifestEntry, threads int) (*Response, error) {
+	manifest, err := EncodeManifest(entries)
+	if err != nil {
+		return nil, err
+	}
+
+	args := map[string]interface{}{"manifest": manifest}
+	if threads > 0 {
+		args["threads"] = uint64(threads)
+	}
+	if _, err := p.SendRequest("verify", args); err != nil {
+		return nil, err
+	}
+	return p.RecvResponse()
+}
+
 // =============================================================================
 // Helpers
 // =============================================================================
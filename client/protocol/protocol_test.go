@@ -0,0 +1,103 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Request encoding tests, no agent needed
+ *
+ * The agent's argument parsers (parse_uint_arg in helpers.c) read unsigned
+ * MessagePack integers only: positive fixint and uint8-uint64 (0xcc-0xcf).
+ * A signed int64 (0xd3) is skipped as if the argument were missing, so these
+ * tests check what actually goes on the wire.
+ */
+
+package protocol
+
+import (
+	"bytes"
+	"encoding/binary"
+	"io"
+	"net"
+	"testing"
+	"time"
+)
+
+// captureRequest runs call against a Protocol on one end of a pipe and
+// returns the first message it sends. The pipe is closed after that, so
+// call sees an error waiting for the response.
+func captureRequest(t *testing.T, call func(p *Protocol)) []byte {
+	t.Helper()
+
+	client, agent := net.Pipe()
+	done := make(chan struct{})
+	go func() {
+		defer close(done)
+		call(New(client))
+	}()
+
+	var hdr [4]byte
+	if _, err := io.ReadFull(agent, hdr[:]); err != nil {
+		t.Fatalf("read length: %v", err)
+	}
+	msg := make([]byte, binary.BigEndian.Uint32(hdr[:]))
+	if _, err := io.ReadFull(agent, msg); err != nil {
+		t.Fatalf("read payload: %v", err)
+	}
+	agent.Close()
+	<-done
+	return msg
+}
+
+// uintMarker returns the type byte of the value stored under key, which must
+// be a fixstr. Fails the test if the key is not in msg.
+func uintMarker(t *testing.T, msg []byte, key string) byte {
+	t.Helper()
+
+	enc := append([]byte{0xa0 | byte(len(key))}, key...)
+	i := bytes.Index(msg, enc)
+	if i < 0 || i+len(enc) >= len(msg) {
+		t.Fatalf("%s not in request", key)
+	}
+	return msg[i+len(enc)]
+}
+
+// checkUnsigned fails the test unless every key holds an unsigned integer
+// the agent can read
+func checkUnsigned(t *testing.T, msg []byte, keys ...string) {
+	t.Helper()
+
+	for _, key := range keys {
+		m := uintMarker(t, msg, key)
+		if m > 0x7f && (m < 0xcc || m > 0xcf) {
+			t.Errorf("%s encoded with marker 0x%02x, want fixint or 0xcc-0xcf", key, m)
+		}
+	}
+}
+
+func TestPullRangeArgsUnsigned(t *testing.T) {
+	msg := captureRequest(t, func(p *Protocol) {
+		p.PullRange("/dev/mtdblock0", 3<<20, 64<<10, nil)
+	})
+	checkUnsigned(t, msg, "offset", "length")
+}
+
+func TestWatchDirIntervalUnsigned(t *testing.T) {
+	msg := captureRequest(t, func(p *Protocol) {
+		p.WatchDir("/tmp", 500*time.Millisecond, func(WatchBatch) {})
+	})
+	checkUnsigned(t, msg, "interval_ms")
+
+	// A negative interval means the agent's default, like zero
+	msg = captureRequest(t, func(p *Protocol) {
+		p.WatchDir("/tmp", -time.Second, func(WatchBatch) {})
+	})
+	if bytes.Contains(msg, []byte("interval_ms")) {
+		t.Error("negative interval sent")
+	}
+}
+
+func TestVerifyThreadsUnsigned(t *testing.T) {
+	msg := captureRequest(t, func(p *Protocol) {
+		p.Verify([]ManifestEntry{{Path: "/bin/busybox", Size: 1}}, 2)
+	})
+	checkUnsigned(t, msg, "threads")
+}
@@ -0,0 +1,368 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Session encryption - X25519 key exchange and ChaCha20-Poly1305
+ */
+
+package protocol
+
+import (
+	"crypto/ecdh"
+	"crypto/hmac"
+	"crypto/rand"
+	"crypto/sha256"
+	"crypto/subtle"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"math/bits"
+)
+
+// Each side offers a fresh X25519 public key in hello/hello_ack. When both
+// did, every message after the hello_ack is sealed:
+//
+//	[4 length BE][ciphertext][16 tag]
+//
+// with ChaCha20-Poly1305 (RFC 8439). The length counts ciphertext and tag
+// and is the associated data; the nonce is a per-direction message
+// counter. Keys are HKDF-SHA256 over the shared secret, salted with the
+// pre-shared secret if one is set (see agent/src/secure.c):
+//
+//	prk    = HMAC(secret, X25519(own, peer))
+//	info   = "edb session v1" || client key || agent key
+//	client = HMAC(prk, info || 0x01)           client -> agent
+//	agent  = HMAC(prk, client || info || 0x02) agent -> client
+const (
+	sessionInfo = "edb session v1"
+	tagSize     = 16
+)
+
+// ErrAuth is returned when a sealed message does not authenticate, e.g.
+// because the two sides were given different secrets
+var ErrAuth = errors.New("message failed authentication (secret mismatch?)")
+
+// SetSecret sets a pre-shared secret mixed into the session keys. Call it
+// before the handshake. With a secret set the handshake fails against an
+// agent that does not encrypt, and a peer that does not know the secret
+// (a man in the middle) cannot read or forge any message.
+func (p *Protocol) SetSecret(secret string) {
+	p.secret = []byte(secret)
+}
+
+// SetPlaintext stops the handshake from offering encryption, for agents
+// or captures where the traffic has to stay readable
+func (p *Protocol) SetPlaintext(plain bool) {
+	p.plaintext = plain
+}
+
+// Encrypted reports whether messages after the handshake are sealed
+func (p *Protocol) Encrypted() bool {
+	return p.tx != nil
+}
+
+// offerKey makes the key pair for this session and returns the public key
+// to send in hello/hello_ack, or nil when not encrypting
+func (p *Protocol) offerKey() ([]byte, error) {
+	if p.plaintext {
+		return nil, nil
+	}
+	key, err := ecdh.X25519().GenerateKey(rand.Reader)
+	if err != nil {
+		return nil, fmt.Errorf("session key: %w", err)
+	}
+	p.ownKey = key
+	return key.PublicKey().Bytes(), nil
+}
+
+// startSecure derives the session keys once hello and hello_ack have
+// passed. The peer's key and role come from its hello/hello_ack.
+func (p *Protocol) startSecure(peerKey []byte, peerIsAgent bool) error {
+	own := p.ownKey
+	p.ownKey = nil
+
+	if own == nil || len(peerKey) == 0 {
+		if len(p.secret) > 0 {
+			return errors.New("session not encrypted, refusing it (secret set)")
+		}
+		return nil
+	}
+
+	peer, err := ecdh.X25519().NewPublicKey(peerKey)
+	if err != nil {
+		return fmt.Errorf("peer key: %w", err)
+	}
+	shared, err := own.ECDH(peer)
+	if err != nil {
+		return fmt.Errorf("key exchange: %w", err)
+	}
+
+	clientKey, agentKey := own.PublicKey().Bytes(), peerKey
+	if !peerIsAgent {
+		clientKey, agentKey = agentKey, clientKey
+	}
+
+	prk := hmacSum(p.secret, shared)
+	toAgent := hmacSum(prk, []byte(sessionInfo), clientKey, agentKey, []byte{1})
+	toClient := hmacSum(prk, toAgent, []byte(sessionInfo), clientKey, agentKey, []byte{2})
+
+	if peerIsAgent {
+		p.tx, p.rx = newSealer(toAgent), newSealer(toClient)
+	} else {
+		p.tx, p.rx = newSealer(toClient), newSealer(toAgent)
+	}
+	return nil
+}
+
+func hmacSum(key []byte, parts ...[]byte) []byte {
+	mac := hmac.New(sha256.New, key)
+	for _, part := range parts {
+		mac.Write(part)
+	}
+	return mac.Sum(nil)
+}
+
+// writeSealed seals a message made of parts and sends it with one write.
+// Called with p.mu held.
+func (p *Protocol) writeSealed(parts ...[]byte) error {
+	n := 0
+	for _, part := range parts {
+		n += len(part)
+	}
+	if n > MaxMsgSize {
+		return fmt.Errorf("message too large: %d bytes", n)
+	}
+
+	buf := make([]byte, 4, 4+n+tagSize)
+	binary.BigEndian.PutUint32(buf, uint32(n+tagSize))
+	for _, part := range parts {
+		buf = append(buf, part...)
+	}
+	buf = buf[:4+len(p.tx.seal(buf[:4], buf[4:]))]
+
+	if _, err := p.conn.Write(buf); err != nil {
+		return fmt.Errorf("write message: %w", err)
+	}
+	return nil
+}
+
+// =============================================================================
+// ChaCha20-Poly1305
+// =============================================================================
+
+// sealer seals or opens the messages of one direction
+type sealer struct {
+	key [8]uint32
+	seq uint64
+}
+
+func newSealer(key []byte) *sealer {
+	s := &sealer{}
+	for i := range s.key {
+		s.key[i] = binary.LittleEndian.Uint32(key[4*i:])
+	}
+	return s
+}
+
+// next returns the nonce words of the next message
+func (s *sealer) next() [3]uint32 {
+	n := [3]uint32{0, uint32(s.seq), uint32(s.seq >> 32)}
+	s.seq++
+	return n
+}
+
+// seal encrypts msg in place and appends the tag; msg needs tagSize bytes
+// of spare capacity to stay in place
+func (s *sealer) seal(ad, msg []byte) []byte {
+	nonce := s.next()
+	var polyKey [64]byte
+	chachaXOR(&s.key, &nonce, 0, polyKey[:], polyKey[:])
+	chachaXOR(&s.key, &nonce, 1, msg, msg)
+	tag := aeadTag(polyKey[:32], ad, msg)
+	return append(msg, tag[:]...)
+}
+
+// open checks the tag at the end of msg and decrypts the rest in place
+func (s *sealer) open(ad, msg []byte) ([]byte, error) {
+	if len(msg) < tagSize {
+		return nil, ErrAuth
+	}
+	nonce := s.next()
+	body, tag := msg[:len(msg)-tagSize], msg[len(msg)-tagSize:]
+
+	var polyKey [64]byte
+	chachaXOR(&s.key, &nonce, 0, polyKey[:], polyKey[:])
+	want := aeadTag(polyKey[:32], ad, body)
+	if subtle.ConstantTimeCompare(want[:], tag) != 1 {
+		return nil, ErrAuth
+	}
+	chachaXOR(&s.key, &nonce, 1, body, body)
+	return body, nil
+}
+
+func aeadTag(key, ad, ct []byte) [16]byte {
+	mac := newPoly1305(key)
+	mac.padded(ad)
+	mac.padded(ct)
+	var lens [16]byte
+	binary.LittleEndian.PutUint64(lens[0:8], uint64(len(ad)))
+	binary.LittleEndian.PutUint64(lens[8:16], uint64(len(ct)))
+	mac.blocks(lens[:])
+	return mac.sum()
+}
+
+func quarterRound(a, b, c, d uint32) (uint32, uint32, uint32, uint32) {
+	a += b
+	d = bits.RotateLeft32(d^a, 16)
+	c += d
+	b = bits.RotateLeft32(b^c, 12)
+	a += b
+	d = bits.RotateLeft32(d^a, 8)
+	c += d
+	b = bits.RotateLeft32(b^c, 7)
+	return a, b, c, d
+}
+
+// chachaXOR XORs src with the ChaCha20 key stream from block counter on
+// into dst (which may be src)
+func chachaXOR(key *[8]uint32, nonce *[3]uint32, counter uint32, dst, src []byte) {
+	s := [16]uint32{
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+		counter, nonce[0], nonce[1], nonce[2],
+	}
+
+	for len(src) > 0 {
+		x0, x1, x2, x3 := s[0], s[1], s[2], s[3]
+		x4, x5, x6, x7 := s[4], s[5], s[6], s[7]
+		x8, x9, x10, x11 := s[8], s[9], s[10], s[11]
+		x12, x13, x14, x15 := s[12], s[13], s[14], s[15]
+
+		for i := 0; i < 10; i++ {
+			x0, x4, x8, x12 = quarterRound(x0, x4, x8, x12)
+			x1, x5, x9, x13 = quarterRound(x1, x5, x9, x13)
+			x2, x6, x10, x14 = quarterRound(x2, x6, x10, x14)
+			x3, x7, x11, x15 = quarterRound(x3, x7, x11, x15)
+			x0, x5, x10, x15 = quarterRound(x0, x5, x10, x15)
+			x1, x6, x11, x12 = quarterRound(x1, x6, x11, x12)
+			x2, x7, x8, x13 = quarterRound(x2, x7, x8, x13)
+			x3, x4, x9, x14 = quarterRound(x3, x4, x9, x14)
+		}
+
+		ks := [16]uint32{
+			x0 + s[0], x1 + s[1], x2 + s[2], x3 + s[3],
+			x4 + s[4], x5 + s[5], x6 + s[6], x7 + s[7],
+			x8 + s[8], x9 + s[9], x10 + s[10], x11 + s[11],
+			x12 + s[12], x13 + s[13], x14 + s[14], x15 + s[15],
+		}
+		s[12]++
+
+		if len(src) >= 64 {
+			for i, k := range ks {
+				binary.LittleEndian.PutUint32(dst[4*i:], binary.LittleEndian.Uint32(src[4*i:])^k)
+			}
+			src, dst = src[64:], dst[64:]
+			continue
+		}
+
+		var block [64]byte
+		for i, k := range ks {
+			binary.LittleEndian.PutUint32(block[4*i:], k)
+		}
+		for i := range src {
+			dst[i] = src[i] ^ block[i]
+		}
+		return
+	}
+}
+
+// poly1305 is the MAC with h in three 64-bit limbs (130 bits)
+type poly1305 struct {
+	r0, r1     uint64
+	s0, s1     uint64
+	h0, h1, h2 uint64
+}
+
+func newPoly1305(key []byte) *poly1305 {
+	return &poly1305{
+		r0: binary.LittleEndian.Uint64(key[0:8]) & 0x0ffffffc0fffffff,
+		r1: binary.LittleEndian.Uint64(key[8:16]) & 0x0ffffffc0ffffffc,
+		s0: binary.LittleEndian.Uint64(key[16:24]),
+		s1: binary.LittleEndian.Uint64(key[24:32]),
+	}
+}
+
+// blocks adds whole 16-byte blocks: h = (h + m + 2^128) * r mod 2^130 - 5
+func (p *poly1305) blocks(m []byte) {
+	h0, h1, h2 := p.h0, p.h1, p.h2
+	r0, r1 := p.r0, p.r1
+
+	for len(m) >= 16 {
+		var c uint64
+		h0, c = bits.Add64(h0, binary.LittleEndian.Uint64(m[0:8]), 0)
+		h1, c = bits.Add64(h1, binary.LittleEndian.Uint64(m[8:16]), c)
+		h2 += c + 1
+
+		// h2 stays below 8 and r below 2^60, so no column overflows
+		h0r0hi, h0r0lo := bits.Mul64(h0, r0)
+		h1r0hi, h1r0lo := bits.Mul64(h1, r0)
+		h0r1hi, h0r1lo := bits.Mul64(h0, r1)
+		h1r1hi, h1r1lo := bits.Mul64(h1, r1)
+
+		m1lo, c := bits.Add64(h1r0lo, h0r1lo, 0)
+		m1hi := h1r0hi + h0r1hi + c
+		m2lo, c := bits.Add64(h1r1lo, h2*r0, 0)
+		m2hi := h1r1hi + c
+		m3 := h2 * r1
+
+		t0 := h0r0lo
+		t1, c := bits.Add64(m1lo, h0r0hi, 0)
+		t2, c := bits.Add64(m2lo, m1hi, c)
+		t3 := m3 + m2hi + c
+
+		// t = h * r; fold the bits above 130 back in times 5 (4x + x)
+		h0, h1, h2 = t0, t1, t2&3
+		cLo, cHi := t2&^3, t3
+		h0, c = bits.Add64(h0, cLo, 0)
+		h1, c = bits.Add64(h1, cHi, c)
+		h2 += c
+		cLo, cHi = cLo>>2|cHi<<62, cHi>>2
+		h0, c = bits.Add64(h0, cLo, 0)
+		h1, c = bits.Add64(h1, cHi, c)
+		h2 += c
+
+		m = m[16:]
+	}
+
+	p.h0, p.h1, p.h2 = h0, h1, h2
+}
+
+// padded adds m zero-padded to a whole number of blocks, as the AEAD does
+func (p *poly1305) padded(m []byte) {
+	full := len(m) &^ 15
+	p.blocks(m[:full])
+	if full < len(m) {
+		var block [16]byte
+		copy(block[:], m[full:])
+		p.blocks(block[:])
+	}
+}
+
+func (p *poly1305) sum() [16]byte {
+	// h mod p: subtract p unless that borrows
+	t0, b := bits.Sub64(p.h0, 0xfffffffffffffffb, 0)
+	t1, b := bits.Sub64(p.h1, 0xffffffffffffffff, b)
+	_, b = bits.Sub64(p.h2, 3, b)
+	keep := -b
+	h0 := p.h0&keep | t0&^keep
+	h1 := p.h1&keep | t1&^keep
+
+	var c uint64
+	h0, c = bits.Add64(h0, p.s0, 0)
+	h1, _ = bits.Add64(h1, p.s1, c)
+
+	var tag [16]byte
+	binary.LittleEndian.PutUint64(tag[0:8], h0)
+	binary.LittleEndian.PutUint64(tag[8:16], h1)
+	return tag
+}
@@ -0,0 +1,168 @@
+//go:build linux
+
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Serial link benchmarks over a pty pair
+ *
+ * The agent runs with -s on one pty, the client on another, and a bridge
+ * between the two masters passes bytes at the line rate a UART would (10
+ * bits a byte), optionally corrupting some. Reports the share of the line
+ * rate a pull achieves as line-%.
+ */
+
+package protocol
+
+import (
+	"errors"
+	"fmt"
+	"math/rand"
+	"os"
+	"os/exec"
+	"path/filepath"
+	"syscall"
+	"testing"
+	"time"
+	"unsafe"
+
+	"github.com/Necromancer-Labs/embbridge/client/serial"
+)
+
+// openPTY returns a pty master and the path of its slave
+func openPTY(b *testing.B) (*os.File, string) {
+	b.Helper()
+
+	m, err := os.OpenFile("/dev/ptmx", os.O_RDWR|syscall.O_NOCTTY, 0)
+	if err != nil {
+		b.Skipf("no ptys: %v", err)
+	}
+	var n, unlock uint32
+	rc, _ := m.SyscallConn()
+	var errno syscall.Errno
+	rc.Control(func(fd uintptr) {
+		_, _, errno = syscall.Syscall(syscall.SYS_IOCTL, fd, syscall.TIOCSPTLCK, uintptr(unsafe.Pointer(&unlock)))
+		if errno == 0 {
+			_, _, errno = syscall.Syscall(syscall.SYS_IOCTL, fd, syscall.TIOCGPTN, uintptr(unsafe.Pointer(&n)))
+		}
+	})
+	if errno != 0 {
+		m.Close()
+		b.Skipf("no ptys: %v", errno)
+	}
+	b.Cleanup(func() { m.Close() })
+	return m, fmt.Sprintf("/dev/pts/%d", n)
+}
+
+// uart copies src to dst no faster than baud, corrupting a byte now and
+// then if errRate > 0
+func uart(dst, src *os.File, baud int, errRate float64) {
+	buf := make([]byte, 256)
+	next := time.Now()
+	for {
+		n, err := src.Read(buf)
+		if errors.Is(err, syscall.EIO) {
+			// The slave side is closed until a client opens it again
+			time.Sleep(10 * time.Millisecond)
+			continue
+		}
+		if err != nil {
+			return
+		}
+		for i := range buf[:n] {
+			if errRate > 0 && rand.Float64() < errRate {
+				buf[i] ^= byte(1 << rand.Intn(8))
+			}
+		}
+		next = next.Add(time.Duration(n) * 10 * time.Second / time.Duration(baud))
+		if d := time.Until(next); d > 0 {
+			time.Sleep(d)
+		} else {
+			next = time.Now()
+		}
+		if _, err := dst.Write(buf[:n]); err != nil {
+			return
+		}
+	}
+}
+
+// startSerialAgent runs the agent on one pty and returns the other, joined
+// by a UART at baud
+func startSerialAgent(b *testing.B, baud int, errRate float64) string {
+	b.Helper()
+
+	bin := os.Getenv("EDB_AGENT")
+	if bin == "" {
+		bin = filepath.Join("..", "..", "agent", "edb-agent")
+	}
+	if _, err := os.Stat(bin); err != nil {
+		b.Skipf("agent binary not found (%s), set EDB_AGENT", bin)
+	}
+
+	agentMaster, agentTTY := openPTY(b)
+	clientMaster, clientTTY := openPTY(b)
+	go uart(clientMaster, agentMaster, baud, errRate)
+	go uart(agentMaster, clientMaster, baud, errRate)
+
+	cmd := exec.Command(bin, "-s", agentTTY, "-b", fmt.Sprint(baud))
+	if err := cmd.Start(); err != nil {
+		b.Fatalf("start agent: %v", err)
+	}
+	b.Cleanup(func() {
+		cmd.Process.Kill()
+		cmd.Wait()
+	})
+	return clientTTY
+}
+
+// BenchmarkSerialPull pulls a config-sized file over a UART
+func BenchmarkSerialPull(b *testing.B) {
+	cases := []struct {
+		baud    int
+		size    int
+		errRate float64
+	}{
+		{115200, 16 << 10, 0},
+		{921600, 64 << 10, 0},
+		{921600, 64 << 10, 1e-4},
+	}
+
+	for _, c := range cases {
+		name := fmt.Sprintf("%d/%s", c.baud, sizeName(c.size))
+		if c.errRate > 0 {
+			name += fmt.Sprintf("/err=%g", c.errRate)
+		}
+		b.Run(name, func(b *testing.B) {
+			tty := startSerialAgent(b, c.baud, c.errRate)
+			path := writeRandomFile(b, b.TempDir(), c.size)
+
+			conn, err := serial.Dial(tty, c.baud)
+			if err != nil {
+				b.Fatal(err)
+			}
+			p := New(conn)
+			b.Cleanup(func() { p.Close() })
+			if err := p.SendHello(); err != nil {
+				b.Fatal(err)
+			}
+			if _, err := p.RecvHelloAck(); err != nil {
+				b.Fatal(err)
+			}
+
+			b.SetBytes(int64(c.size))
+			b.ResetTimer()
+			start := time.Now()
+			for i := 0; i < b.N; i++ {
+				data, _, _, err := p.Pull(path, nil)
+				if err != nil {
+					b.Fatal(err)
+				}
+				if len(data) != c.size {
+					b.Fatalf("pulled %d bytes, want %d", len(data), c.size)
+				}
+			}
+			rate := float64(c.size*b.N) / time.Since(start).Seconds()
+			b.ReportMetric(100*rate/float64(c.baud/10), "line-%")
+		})
+	}
+}
@@ -0,0 +1,551 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Serial link - the protocol over a UART, client side of agent/src/serial.c
+ */
+
+package serial
+
+import (
+	"crypto/rand"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"hash/crc32"
+	"io"
+	"net"
+	"time"
+)
+
+// Frame types, see agent/src/serial.c for the layout
+const (
+	frameData   = 0x01
+	frameAck    = 0x02
+	frameSyn    = 0x03
+	frameSynAck = 0x04
+	frameFin    = 0x05
+)
+
+const (
+	// Window is how many data frames may be in flight (at most 16, the
+	// width of the sack bitmap); FrameSize is the most data per frame
+	Window    = 16
+	FrameSize = 1024
+
+	headerSize = 5
+	crcSize    = 4
+	rawMax     = headerSize + FrameSize + crcSize
+	cobsMax    = rawMax + rawMax/254 + 2
+
+	rtoSlack   = 200 * time.Millisecond
+	lingerTime = 5 * time.Second
+
+	synInterval = 250 * time.Millisecond
+	synTimeout  = 5 * time.Second
+)
+
+// ErrNoAgent is returned by Open when nothing answers on the line
+var ErrNoAgent = errors.New("no answer from agent")
+
+type txSlot struct {
+	data   []byte
+	sent   time.Time
+	tx     uint32
+	resent bool // No round trip sample from it
+	sacked bool
+}
+
+type rxSlot struct {
+	data []byte
+	have bool
+}
+
+// link runs the windowed, selectively retransmitting protocol over a line
+// and passes the byte stream to the other end of a net.Pipe
+type link struct {
+	line  io.ReadWriteCloser
+	app   net.Conn // Our end of the pipe
+	nonce uint32
+
+	window int // Frames the agent takes in flight
+	frame  int // Data the agent takes per frame
+
+	frames   chan []byte   // Checked frames off the line
+	out      chan []byte   // Encoded frames for the line writer
+	wrote    chan struct{} // A frame went out, there is room again
+	appData  chan []byte   // Data from the application
+	deliver  chan []byte   // In-order data for the application
+	consumed chan struct{} // The application took some data
+
+	txBase, txNext uint8
+	txCount, txHi  uint32
+	rto            time.Duration // Retransmit timeout, as the agent's
+	rtoMin         time.Duration
+	srtt, rttvar   time.Duration
+	txq            [Window]txSlot
+	progress       time.Time
+	closing        bool
+
+	rxNext  uint8
+	ackOwed bool
+	rxq     [Window]rxSlot
+}
+
+// Open runs the link over an open line at baud (used for timeouts only) and
+// returns the byte stream to the agent. The line is closed with the
+// returned connection.
+func Open(line io.ReadWriteCloser, baud int) (net.Conn, error) {
+	var nb [4]byte
+	rand.Read(nb[:])
+
+	app, ours := net.Pipe()
+	l := &link{
+		line:     line,
+		app:      ours,
+		nonce:    binary.BigEndian.Uint32(nb[:]) | 1,
+		frames:   make(chan []byte, 4*Window),
+		out:      make(chan []byte, 2),
+		wrote:    make(chan struct{}, 1),
+		appData:  make(chan []byte),
+		deliver:  make(chan []byte, Window),
+		consumed: make(chan struct{}, 1),
+	}
+
+	// Same as the agent: a window on the line (10 bits a byte), plus the
+	// buffers ahead of a frame and of its ack
+	frameTime := cobsMax * 10 * time.Second / time.Duration(baud)
+	l.rto = rtoSlack + (Window+4)*frameTime
+	l.rtoMin = 2*frameTime + 20*time.Millisecond
+
+	go l.reader()
+	go l.writer()
+
+	if err := l.handshake(); err != nil {
+		close(l.out) // The writer closes the line
+		go drain(l.frames)
+		app.Close()
+		return nil, err
+	}
+
+	go l.appReader()
+	go l.appWriter()
+	go l.run()
+	return app, nil
+}
+
+// handshake sends SYN until the agent answers with our nonce
+func (l *link) handshake() error {
+	tick := time.NewTicker(synInterval)
+	defer tick.Stop()
+	deadline := time.After(synTimeout)
+
+	l.queueCtl(frameSyn)
+	for {
+		select {
+		case raw, ok := <-l.frames:
+			if !ok {
+				return fmt.Errorf("serial line closed")
+			}
+			if raw[0] != frameSynAck || len(raw) < headerSize+7 {
+				continue
+			}
+			data := raw[headerSize:]
+			if binary.BigEndian.Uint32(data) != l.nonce {
+				continue
+			}
+			l.window = min(int(data[4]), Window)
+			l.frame = min(int(binary.BigEndian.Uint16(data[5:])), FrameSize)
+			if l.window == 0 || l.frame == 0 {
+				return fmt.Errorf("agent sent an invalid link setup")
+			}
+			l.progress = time.Now()
+			return nil
+		case <-tick.C:
+			if len(l.out) < cap(l.out) {
+				l.queueCtl(frameSyn)
+			}
+		case <-deadline:
+			return ErrNoAgent
+		}
+	}
+}
+
+// run is the link's event loop, it owns all link state
+func (l *link) run() {
+	defer l.shutdown()
+
+	timer := time.NewTimer(time.Hour)
+	defer timer.Stop()
+
+	for {
+		l.deliverData()
+		if done := l.transmit(); done {
+			return
+		}
+
+		// Take application data only while the window and the line allow
+		var appData chan []byte
+		if !l.closing && int(l.txNext-l.txBase) < l.window && l.room() {
+			appData = l.appData
+		}
+
+		timer.Reset(l.nextTimeout())
+
+		select {
+		case raw, ok := <-l.frames:
+			if !ok {
+				return // Line gone
+			}
+			if !l.input(raw) {
+				return // Agent closed the link
+			}
+		case data, ok := <-appData:
+			if !ok {
+				l.closing = true
+				l.progress = time.Now()
+				continue
+			}
+			slot := &l.txq[l.txNext%Window]
+			slot.data = data
+			slot.sacked = false
+			l.sendData(l.txNext, false)
+			l.txNext++
+		case <-l.wrote:
+		case <-l.consumed:
+		case <-timer.C:
+		}
+	}
+}
+
+// nextTimeout is how long until the first unacknowledged frame times out
+func (l *link) nextTimeout() time.Duration {
+	if l.txBase != l.txNext {
+		next := time.Hour
+		for seq := l.txBase; seq != l.txNext; seq++ {
+			s := &l.txq[seq%Window]
+			if !s.sacked || seq == l.txBase {
+				next = min(next, time.Until(s.sent.Add(l.rto)))
+			}
+		}
+		return max(next, 0)
+	}
+	if l.closing {
+		return rtoSlack
+	}
+	return time.Hour
+}
+
+// transmit sends lost frames, retransmits on timeout and acknowledges.
+// Returns true once the link is closed.
+func (l *link) transmit() bool {
+	// Lost: a frame sent after it arrived, or nothing heard of it for too
+	// long. The oldest also goes again when held, to have its ack resent.
+	for seq := l.txBase; seq != l.txNext && l.room(); seq++ {
+		s := &l.txq[seq%Window]
+		lost := !s.sacked && s.tx < l.txHi
+		expired := (!s.sacked || seq == l.txBase) && time.Since(s.sent) >= l.rto
+		if lost || expired {
+			l.sendData(seq, true)
+		}
+	}
+
+	if l.closing && (l.txBase == l.txNext || time.Since(l.progress) >= lingerTime) && l.room() {
+		l.queueCtl(frameFin)
+		return true
+	}
+
+	if l.ackOwed && l.room() {
+		l.queue(frameAck, 0, nil)
+	}
+	return false
+}
+
+// input applies one frame from the agent. Returns false if it closed the link.
+func (l *link) input(raw []byte) bool {
+	typ, seq, ack := raw[0], raw[1], raw[2]
+	sack := binary.BigEndian.Uint16(raw[3:])
+	data := raw[headerSize:]
+
+	switch typ {
+	case frameFin:
+		// One for an older link is ignored; the nonce is 0 when the agent
+		// has no link open at all
+		if len(data) >= 4 {
+			nonce := binary.BigEndian.Uint32(data)
+			return nonce != 0 && nonce != l.nonce
+		}
+		return false
+	case frameSynAck:
+		return true // Repeated answer to our SYN
+	case frameData, frameAck:
+	default:
+		return true
+	}
+
+	l.acked(ack, sack)
+
+	if typ == frameData {
+		// Answer duplicates too: our last ack may be what was lost
+		l.ackOwed = true
+		if seq-l.rxNext < Window && len(data) > 0 {
+			s := &l.rxq[seq%Window]
+			if !s.have {
+				s.data = append([]byte(nil), data...)
+				s.have = true
+			}
+		}
+	}
+	return true
+}
+
+// acked applies the agent's receive state to what is in flight
+func (l *link) acked(ack uint8, sack uint16) {
+	inflight := l.txNext - l.txBase
+	if ack-l.txBase > inflight {
+		return // Stale
+	}
+
+	for l.txBase != ack {
+		s := &l.txq[l.txBase%Window]
+		l.txHi = max(l.txHi, s.tx)
+		// Timed from the first news of it, not from the gap before it closing
+		if !s.resent && !s.sacked {
+			l.sampleRTT(time.Since(s.sent))
+		}
+		s.data = nil
+		s.sacked = false
+		l.txBase++
+		l.progress = time.Now()
+	}
+
+	inflight = l.txNext - l.txBase
+	for i := uint8(0); i < Window && i < inflight; i++ {
+		s := &l.txq[(ack+i)%Window]
+		if sack&(1<<i) != 0 && !s.sacked {
+			s.sacked = true
+			l.txHi = max(l.txHi, s.tx)
+			if !s.resent {
+				l.sampleRTT(time.Since(s.sent))
+			}
+		}
+	}
+}
+
+// sampleRTT updates the retransmit timeout from the round trip of a frame
+// sent once (RFC 6298, without backoff)
+func (l *link) sampleRTT(rtt time.Duration) {
+	if l.srtt == 0 {
+		l.srtt, l.rttvar = rtt, rtt/2
+	} else {
+		diff := l.srtt - rtt
+		if diff < 0 {
+			diff = -diff
+		}
+		l.rttvar = (3*l.rttvar + diff) / 4
+		l.srtt = (7*l.srtt + rtt) / 8
+	}
+	l.rto = l.srtt + max(4*l.rttvar, l.rtoMin)
+}
+
+// deliverData passes in-order data to the application as far as it takes it
+func (l *link) deliverData() {
+	for {
+		s := &l.rxq[l.rxNext%Window]
+		if !s.have {
+			return
+		}
+		select {
+		case l.deliver <- s.data:
+		default:
+			return // Application is behind; hold the rest (the agent sees it in sack)
+		}
+		s.data = nil
+		s.have = false
+		l.rxNext++
+		l.ackOwed = true
+	}
+}
+
+func (l *link) room() bool {
+	return len(l.out) < cap(l.out)
+}
+
+func (l *link) sendData(seq uint8, resend bool) {
+	s := &l.txq[seq%Window]
+	s.sent = time.Now()
+	l.txCount++
+	s.tx = l.txCount
+	s.resent = resend
+	l.queue(frameData, seq, s.data)
+}
+
+// queueCtl sends SYN or FIN: nonce, our window and frame size
+func (l *link) queueCtl(typ byte) {
+	var data [7]byte
+	binary.BigEndian.PutUint32(data[:], l.nonce)
+	data[4] = Window
+	binary.BigEndian.PutUint16(data[5:], FrameSize)
+	l.queue(typ, 0, data[:])
+}
+
+// queue encodes a frame for the writer; the caller checks room()
+func (l *link) queue(typ, seq byte, data []byte) {
+	var sack uint16
+	for i := uint8(0); i < Window; i++ {
+		if l.rxq[(l.rxNext+i)%Window].have {
+			sack |= 1 << i
+		}
+	}
+
+	raw := make([]byte, headerSize, headerSize+len(data)+crcSize)
+	raw[0], raw[1], raw[2] = typ, seq, l.rxNext
+	binary.BigEndian.PutUint16(raw[3:], sack)
+	raw = append(raw, data...)
+	raw = binary.BigEndian.AppendUint32(raw, crc32.ChecksumIEEE(raw))
+
+	l.out <- append(cobsEncode(raw), 0)
+	l.ackOwed = false
+}
+
+// reader splits the line into frames and passes on those that check out
+func (l *link) reader() {
+	defer close(l.frames)
+
+	buf := make([]byte, 4096)
+	enc := make([]byte, 0, cobsMax)
+	skip := false
+	for {
+		n, err := l.line.Read(buf)
+		for _, b := range buf[:n] {
+			if b != 0 {
+				if len(enc) < cobsMax {
+					enc = append(enc, b)
+				} else {
+					skip = true
+				}
+				continue
+			}
+			if !skip && len(enc) > 0 {
+				if raw, ok := checkFrame(enc); ok {
+					l.frames <- raw
+				}
+			}
+			enc = enc[:0]
+			skip = false
+		}
+		if err != nil {
+			return
+		}
+	}
+}
+
+// writer puts encoded frames on the line, and closes it after the last
+func (l *link) writer() {
+	defer l.line.Close() // Ends the reader, and with it the link
+	for frame := range l.out {
+		if _, err := l.line.Write(frame); err != nil {
+			drain(l.out)
+			return
+		}
+		select {
+		case l.wrote <- struct{}{}:
+		default:
+		}
+	}
+}
+
+// appReader takes what the application writes, a frame at a time
+func (l *link) appReader() {
+	defer close(l.appData)
+	for {
+		buf := make([]byte, l.frame)
+		n, err := l.app.Read(buf)
+		if n > 0 {
+			l.appData <- buf[:n]
+		}
+		if err != nil {
+			return
+		}
+	}
+}
+
+// appWriter hands in-order data to the application
+func (l *link) appWriter() {
+	for data := range l.deliver {
+		l.app.Write(data) // After a close, data is dropped
+		select {
+		case l.consumed <- struct{}{}:
+		default:
+		}
+	}
+}
+
+// shutdown ends the link: the application sees end of file, and the line
+// is closed once what is queued (FIN) has gone out
+func (l *link) shutdown() {
+	l.app.Close()
+	close(l.deliver)
+	close(l.out)
+	go drain(l.appData)
+	go drain(l.frames)
+}
+
+// drain discards what is left on a channel until it is closed, so its
+// sender can finish
+func drain[T any](ch chan T) {
+	for range ch {
+	}
+}
+
+// checkFrame decodes a frame and verifies its CRC
+func checkFrame(enc []byte) ([]byte, bool) {
+	raw, ok := cobsDecode(enc)
+	if !ok || len(raw) < headerSize+crcSize {
+		return nil, false
+	}
+	n := len(raw) - crcSize
+	if crc32.ChecksumIEEE(raw[:n]) != binary.BigEndian.Uint32(raw[n:]) {
+		return nil, false
+	}
+	return raw[:n], true
+}
+
+// cobsEncode replaces every zero byte by the distance to the next one
+func cobsEncode(src []byte) []byte {
+	dst := make([]byte, 1, len(src)+len(src)/254+2)
+	codeAt, code := 0, byte(1)
+	for _, b := range src {
+		if b == 0 {
+			dst[codeAt] = code
+			codeAt, code = len(dst), 1
+			dst = append(dst, 0)
+			continue
+		}
+		dst = append(dst, b)
+		if code++; code == 0xff {
+			dst[codeAt] = code
+			codeAt, code = len(dst), 1
+			dst = append(dst, 0)
+		}
+	}
+	dst[codeAt] = code
+	return dst
+}
+
+func cobsDecode(src []byte) ([]byte, bool) {
+	dst := make([]byte, 0, len(src))
+	for i := 0; i < len(src); {
+		code := int(src[i])
+		i++
+		if code == 0 || i+code-1 > len(src) {
+			return nil, false
+		}
+		dst = append(dst, src[i:i+code-1]...)
+		i += code - 1
+		if code != 0xff && i < len(src) {
+			dst = append(dst, 0)
+		}
+	}
+	return dst, true
+}
@@ -0,0 +1,108 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Serial line setup (Linux termios)
+ */
+
+package serial
+
+import (
+	"fmt"
+	"net"
+	"os"
+	"syscall"
+	"unsafe"
+)
+
+// Not in package syscall (asm-generic values, as on x86, ARM and MIPS)
+const (
+	cbaud   = 0x100f
+	crtscts = 0x80000000
+)
+
+var bauds = map[int]uint32{
+	9600:    syscall.B9600,
+	19200:   syscall.B19200,
+	38400:   syscall.B38400,
+	57600:   syscall.B57600,
+	115200:  syscall.B115200,
+	230400:  syscall.B230400,
+	460800:  syscall.B460800,
+	500000:  syscall.B500000,
+	576000:  syscall.B576000,
+	921600:  syscall.B921600,
+	1000000: syscall.B1000000,
+	1500000: syscall.B1500000,
+	2000000: syscall.B2000000,
+	3000000: syscall.B3000000,
+	4000000: syscall.B4000000,
+}
+
+// tty restores the line's settings when closed
+type tty struct {
+	*os.File
+	saved syscall.Termios
+}
+
+func (t *tty) Close() error {
+	t.ioctl(syscall.TCSETS, &t.saved)
+	return t.File.Close()
+}
+
+func (t *tty) ioctl(req uintptr, arg *syscall.Termios) error {
+	rc, err := t.SyscallConn()
+	if err != nil {
+		return err
+	}
+	var errno syscall.Errno
+	rc.Control(func(fd uintptr) {
+		_, _, errno = syscall.Syscall(syscall.SYS_IOCTL, fd, req, uintptr(unsafe.Pointer(arg)))
+	})
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+// Dial opens a serial device in raw mode at baud and connects to the agent
+// waiting on the other end (edb-agent -s)
+func Dial(path string, baud int) (net.Conn, error) {
+	speed, ok := bauds[baud]
+	if !ok {
+		return nil, fmt.Errorf("unsupported baud rate %d", baud)
+	}
+
+	f, err := os.OpenFile(path, os.O_RDWR|syscall.O_NOCTTY, 0)
+	if err != nil {
+		return nil, err
+	}
+	t := &tty{File: f}
+	if err := t.ioctl(syscall.TCGETS, &t.saved); err != nil {
+		f.Close()
+		return nil, fmt.Errorf("%s: %w", path, err)
+	}
+
+	// Raw 8N1: no echo, no line editing, no XON/XOFF, no CR/LF mapping
+	raw := t.saved
+	raw.Iflag &^= syscall.IGNBRK | syscall.BRKINT | syscall.PARMRK | syscall.ISTRIP |
+		syscall.INLCR | syscall.IGNCR | syscall.ICRNL | syscall.IXON | syscall.IXOFF | syscall.IXANY
+	raw.Oflag &^= syscall.OPOST
+	raw.Lflag &^= syscall.ECHO | syscall.ECHONL | syscall.ICANON | syscall.ISIG | syscall.IEXTEN
+	raw.Cflag &^= syscall.CSIZE | syscall.PARENB | syscall.CSTOPB | crtscts | cbaud
+	raw.Cflag |= syscall.CS8 | syscall.CREAD | syscall.CLOCAL | speed
+	raw.Ispeed = speed
+	raw.Ospeed = speed
+	raw.Cc[syscall.VMIN] = 1
+	raw.Cc[syscall.VTIME] = 0
+	if err := t.ioctl(syscall.TCSETS, &raw); err != nil {
+		f.Close()
+		return nil, fmt.Errorf("%s: %w", path, err)
+	}
+
+	conn, err := Open(t, baud)
+	if err != nil {
+		return nil, fmt.Errorf("%s: %w", path, err)
+	}
+	return conn, nil
+}
@@ -0,0 +1,20 @@
+//go:build !linux
+
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Serial line setup (not supported on this OS)
+ */
+
+package serial
+
+import (
+	"fmt"
+	"net"
+)
+
+// Dial is only implemented for Linux; Open works anywhere
+func Dial(path string, baud int) (net.Conn, error) {
+	return nil, fmt.Errorf("serial devices are only supported on Linux")
+}
@@ -2,15 +2,25 @@
  * embbridge - Embedded Debug Bridge
  * https://github.com/Necromancer-Labs/embbridge
  *
- * System commands: uname, ps, ss, exec
+ * System commands: uname, ps, ss, exec, profile, systrace, elfinfo, verify,
+ * upgrade
  */
 
 package shell
 
 import (
+	"crypto/sha256"
 	"fmt"
+	"io"
+	"io/fs"
+	"os"
+	"path"
+	"path/filepath"
 	"sort"
 	"strings"
+	"time"
+
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
 )
 
 func (m *EDBModule) doUname() {
@@ -104,6 +114,7 @@ func (m *EDBModule) doPs() {
 	for _, pid := range roots {
 		m.printProcessNode(processes, children, pid, "", true)
 	}
+	printTruncated(resp)
 }
 
 // printProcessNode recursively prints the process tree with box-drawing characters
@@ -245,10 +256,13 @@ func (m *EDBModule) doSs() {
 		fmt.Printf("%-6s %-22s %-22s %-12s %7s  %s\n",
 			proto, local, remote, state, pidStr, process)
 	}
+	printTruncated(resp)
 }
 
 func (m *EDBModule) doExec(command string) {
+	stop := m.cancelOnInterrupt()
 	resp, err := m.proto.Exec(command)
+	stop()
 	if err != nil {
 		fmt.Printf("Error: %v\n", err)
 		return
@@ -265,6 +279,7 @@ func (m *EDBModule) doExec(command string) {
 	if stderr, ok := resp.Data["stderr"].([]byte); ok && len(stderr) > 0 {
 		fmt.Printf("\033[31m%s\033[0m", string(stderr)) // Red for stderr
 	}
+	printTruncated(resp)
 }
 
 func (m *EDBModule) doKillAgent() {
@@ -283,6 +298,43 @@ func (m *EDBModule) doKillAgent() {
 	fmt.Printf("Agent parent process (pid %d) killed\n", killedPid)
 }
 
+// doUpgrade sends a new agent binary and prints the fingerprint of the
+// image that took the session over. The shell's command list stays as it
+// was; reconnect to pick up commands the new build adds or drops.
+func (m *EDBModule) doUpgrade(localPath, keepPath string) {
+	data, err := os.ReadFile(localPath)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	fmt.Printf("↑ Upgrading agent with %s (%s)...\n", localPath, formatBytes(int64(len(data))))
+	var lastPrint time.Time
+	progress := func(transferred, total int64) {
+		if time.Since(lastPrint) > 100*time.Millisecond {
+			percent := float64(transferred) / float64(total) * 100
+			fmt.Printf("\r  %s / %s (%.1f%%)", formatBytes(transferred), formatBytes(total), percent)
+			lastPrint = time.Now()
+		}
+	}
+
+	start := time.Now()
+	device, err := m.proto.Upgrade(data, keepPath, progress)
+	if err != nil {
+		fmt.Printf("\nError: %v\n", err)
+		return
+	}
+
+	fmt.Printf("\r  Agent upgraded in %v\n", time.Since(start).Round(time.Millisecond))
+	if keepPath != "" {
+		fmt.Printf("  Binary kept at %s\n", keepPath)
+	}
+	if device != nil {
+		m.device = device
+		fmt.Printf("  %s %s %s, %d commands\n", device.Nodename, device.Machine, device.Release, len(device.Features))
+	}
+}
+
 func (m *EDBModule) doReboot() {
 	resp, err := m.proto.Reboot()
 	if err != nil {
@@ -349,6 +401,7 @@ func (m *EDBModule) doStrings(path string) {
 	if content, ok := resp.Data["content"].([]byte); ok {
 		fmt.Print(string(content))
 	}
+	printTruncated(resp)
 }
 
 func (m *EDBModule) doCpuinfo() {
@@ -419,3 +472,327 @@ func (m *EDBModule) doIpRoute() {
 		fmt.Print(string(content))
 	}
 }
+
+func (m *EDBModule) doProfile(pid, seconds int) {
+	if pid > 0 {
+		fmt.Printf("Profiling pid %d for %ds...\n", pid, seconds)
+	} else {
+		fmt.Printf("Profiling all CPUs for %ds...\n", seconds)
+	}
+
+	stop := m.cancelOnInterrupt()
+	defer stop()
+	resp, samples, err := m.proto.Profile(protocol.ProfileOptions{
+		PID:      pid,
+		Duration: seconds * 1000,
+	})
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	if !resp.OK {
+		fmt.Printf("Error: %s\n", resp.Error)
+		return
+	}
+
+	total := toInt64(resp.Data["samples"])
+	lost := toInt64(resp.Data["lost"])
+	fmt.Printf("%d samples (%d streamed, %d lost)\n\n", total, len(samples), lost)
+	if total == 0 {
+		return
+	}
+
+	printProfileTable("SYMBOL", "sym", resp.Data["top"], total)
+	fmt.Println()
+	printProfileTable("MODULE", "name", resp.Data["modules"], total)
+}
+
+func printProfileTable(title, key string, v interface{}, total int64) {
+	rows, _ := v.([]interface{})
+
+	fmt.Printf("%7s %7s  %s\n", "SAMPLES", "PCT", title)
+	for _, r := range rows {
+		row, ok := r.(map[string]interface{})
+		if !ok {
+			continue
+		}
+		name := toString(row[key])
+		count := toInt64(row["count"])
+		fmt.Printf("%7d %6.1f%%  %s\n", count, float64(count)*100/float64(total), name)
+	}
+}
+
+func (m *EDBModule) doSystrace(pid, seconds int) {
+	fmt.Printf("Tracing syscalls of pid %d for %ds...\n", pid, seconds)
+
+	stop := m.cancelOnInterrupt()
+	defer stop()
+	resp, err := m.proto.Systrace(protocol.SystraceOptions{
+		PID:      pid,
+		Duration: seconds * 1000,
+	}, func(elapsedMs int64, syscalls []interface{}) {
+		var parts []string
+		for i, s := range syscalls {
+			if i == 3 {
+				break
+			}
+			row, _ := s.(map[string]interface{})
+			parts = append(parts, fmt.Sprintf("%s x%d %.1fms", systraceName(row),
+				toInt64(row["count"]), float64(toInt64(row["total_us"]))/1000))
+		}
+		fmt.Printf("[%5.1fs] %s\n", float64(elapsedMs)/1000, strings.Join(parts, ", "))
+	})
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	if !resp.OK {
+		fmt.Printf("Error: %s\n", resp.Error)
+		return
+	}
+
+	syscalls, _ := resp.Data["syscalls"].([]interface{})
+	fmt.Println()
+	fmt.Printf("%-18s %8s %7s %10s %9s %9s %9s %9s\n",
+		"SYSCALL", "CALLS", "ERRORS", "TOTAL(ms)", "AVG(us)", "P50(us)", "P99(us)", "MAX(us)")
+	for _, s := range syscalls {
+		row, ok := s.(map[string]interface{})
+		if !ok {
+			continue
+		}
+		count := toInt64(row["count"])
+		total := toInt64(row["total_us"])
+		avg := int64(0)
+		if count > 0 {
+			avg = total / count
+		}
+		hist, _ := row["hist"].([]interface{})
+		fmt.Printf("%-18s %8d %7d %10.1f %9d %9s %9s %9d\n",
+			systraceName(row), count, toInt64(row["errors"]), float64(total)/1000, avg,
+			histPercentile(hist, count, 0.50), histPercentile(hist, count, 0.99), toInt64(row["max_us"]))
+	}
+
+	if exited, _ := resp.Data["exited"].(bool); exited {
+		fmt.Println("\nTarget exited during tracing")
+	}
+}
+
+func systraceName(row map[string]interface{}) string {
+	if name, ok := row["name"].(string); ok {
+		return name
+	}
+	return fmt.Sprintf("syscall_%d", toInt64(row["nr"]))
+}
+
+// histPercentile returns the upper bound of the log2 microsecond bucket
+// containing the given percentile
+func histPercentile(hist []interface{}, count int64, pct float64) string {
+	if count == 0 {
+		return "-"
+	}
+	target := int64(float64(count)*pct + 0.5)
+	if target < 1 {
+		target = 1
+	}
+	var seen int64
+	for i, h := range hist {
+		seen += toInt64(h)
+		if seen >= target {
+			return fmt.Sprintf("<%d", int64(1)<<uint(i+1))
+		}
+	}
+	return "-"
+}
+
+func (m *EDBModule) doElfinfo(paths []string) {
+	// Full tables only make sense for a single file
+	resp, err := m.proto.Elfinfo(paths, len(paths) > 1)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	if !resp.OK {
+		fmt.Printf("Error: %s\n", resp.Error)
+		return
+	}
+
+	files, _ := resp.Data["files"].([]interface{})
+	for i, f := range files {
+		info, ok := f.(map[string]interface{})
+		if !ok {
+			continue
+		}
+		if i > 0 {
+			fmt.Println()
+		}
+		printElfinfo(info)
+	}
+}
+
+func printElfinfo(info map[string]interface{}) {
+	path := toString(info["path"])
+	if errMsg, ok := info["error"].(string); ok {
+		fmt.Printf("%s: %s\n", path, errMsg)
+		return
+	}
+
+	fmt.Printf("%s: ELF%d %s-endian %s, %s\n", path, toInt64(info["class"]),
+		toString(info["endian"]), toString(info["type"]), toString(info["machine"]))
+	if interp, ok := info["interp"].(string); ok {
+		fmt.Printf("  interp:   %s\n", interp)
+	}
+	if soname, ok := info["soname"].(string); ok {
+		fmt.Printf("  soname:   %s\n", soname)
+	}
+
+	if needed, ok := info["needed"].([]interface{}); ok && len(needed) > 0 {
+		var libs []string
+		for _, n := range needed {
+			libs = append(libs, toString(n))
+		}
+		fmt.Printf("  needed:   %s\n", strings.Join(libs, ", "))
+	}
+
+	if sec, ok := info["security"].(map[string]interface{}); ok {
+		var flags []string
+		for _, k := range []string{"nx", "pie", "canary", "fortify", "stripped", "rpath"} {
+			if v, _ := sec[k].(bool); v {
+				flags = append(flags, k)
+			} else {
+				flags = append(flags, "no-"+k)
+			}
+		}
+		flags = append(flags, "relro="+toString(sec["relro"]))
+		fmt.Printf("  security: %s\n", strings.Join(flags, " "))
+	}
+
+	fmt.Printf("  sections: %d, dynamic symbols: %d\n",
+		toInt64(info["num_sections"]), toInt64(info["num_symbols"]))
+
+	if segments, ok := info["segments"].([]interface{}); ok && len(segments) > 0 {
+		fmt.Printf("\n  %-14s %10s %10s %10s %10s %s\n", "SEGMENT", "OFFSET", "VADDR", "FILESZ", "MEMSZ", "FLAGS")
+		for _, s := range segments {
+			seg, _ := s.(map[string]interface{})
+			fmt.Printf("  %-14s %#10x %#10x %#10x %#10x %s\n", toString(seg["type"]),
+				toInt64(seg["offset"]), toInt64(seg["vaddr"]), toInt64(seg["filesz"]),
+				toInt64(seg["memsz"]), toString(seg["flags"]))
+		}
+	}
+
+	if symbols, ok := info["symbols"].([]interface{}); ok && len(symbols) > 0 {
+		var imports, exports []string
+		for _, s := range symbols {
+			sym, _ := s.(map[string]interface{})
+			if defined, _ := sym["defined"].(bool); defined {
+				exports = append(exports, toString(sym["name"]))
+			} else {
+				imports = append(imports, toString(sym["name"]))
+			}
+		}
+		fmt.Printf("\n  imports (%d): %s\n", len(imports), strings.Join(imports, " "))
+		fmt.Printf("  exports (%d): %s\n", len(exports), strings.Join(exports, " "))
+	}
+}
+
+func (m *EDBModule) doVerify(localDir, remoteRoot string) {
+	entries, err := buildManifest(localDir, remoteRoot)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+	if len(entries) == 0 {
+		fmt.Printf("No files found in %s\n", localDir)
+		return
+	}
+
+	fmt.Printf("Verifying %d files under %s...\n", len(entries), remoteRoot)
+	resp, err := m.proto.Verify(entries, 0)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	if !resp.OK {
+		fmt.Printf("Error: %s\n", resp.Error)
+		return
+	}
+
+	mismatches, _ := resp.Data["mismatches"].([]interface{})
+	for _, mm := range mismatches {
+		e, _ := mm.(map[string]interface{})
+		if toString(e["reason"]) == "hash" {
+			hash, _ := e["hash"].([]byte)
+			fmt.Printf("  MODIFIED  %s (sha256 %x)\n", toString(e["path"]), hash)
+		} else {
+			fmt.Printf("  SIZE      %s (%d bytes on device)\n", toString(e["path"]), toInt64(e["size"]))
+		}
+	}
+
+	missing, _ := resp.Data["missing"].([]interface{})
+	for _, p := range missing {
+		fmt.Printf("  MISSING   %s\n", toString(p))
+	}
+
+	errs, _ := resp.Data["errors"].([]interface{})
+	for _, ee := range errs {
+		e, _ := ee.(map[string]interface{})
+		fmt.Printf("  ERROR     %s: %s\n", toString(e["path"]), toString(e["error"]))
+	}
+
+	// Lists are capped by the agent, totals has the real counts
+	totals, _ := resp.Data["totals"].(map[string]interface{})
+	nBad, nMissing, nErr := int64(len(mismatches)), int64(len(missing)), int64(len(errs))
+	if totals != nil {
+		nBad, nMissing, nErr = toInt64(totals["mismatches"]), toInt64(totals["missing"]), toInt64(totals["errors"])
+	}
+	if hidden := nBad + nMissing + nErr - int64(len(mismatches)+len(missing)+len(errs)); hidden > 0 {
+		fmt.Printf("  ... %d more not shown\n", hidden)
+	}
+
+	fmt.Printf("\n%d checked, %d ok, %d mismatched, %d missing, %d errors (%d ms, %d threads)\n",
+		toInt64(resp.Data["checked"]), toInt64(resp.Data["ok"]), nBad,
+		nMissing, nErr, toInt64(resp.Data["elapsed_ms"]), toInt64(resp.Data["threads"]))
+}
+
+// buildManifest hashes every regular file under localDir and maps it to the
+// same relative path under remoteRoot on the device
+func buildManifest(localDir, remoteRoot string) ([]protocol.ManifestEntry, error) {
+	var entries []protocol.ManifestEntry
+	err := filepath.WalkDir(localDir, func(p string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		if !d.Type().IsRegular() {
+			return nil
+		}
+
+		rel, err := filepath.Rel(localDir, p)
+		if err != nil {
+			return err
+		}
+
+		f, err := os.Open(p)
+		if err != nil {
+			return err
+		}
+		defer f.Close()
+
+		h := sha256.New()
+		n, err := io.Copy(h, f)
+		if err != nil {
+			return err
+		}
+
+		e := protocol.ManifestEntry{
+			Path: path.Join(remoteRoot, filepath.ToSlash(rel)),
+			Size: uint64(n),
+		}
+		copy(e.Hash[:], h.Sum(nil))
+		entries = append(entries, e)
+		return nil
+	})
+	return entries, err
+}
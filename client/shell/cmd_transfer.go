@@ -2,15 +2,21 @@
  * embbridge - Embedded Debug Bridge
  * https://github.com/Necromancer-Labs/embbridge
  *
- * File transfer commands: pull, push
+ * File transfer commands: pull, push, throttle, dump
  */
 
 package shell
 
 import (
 	"fmt"
+	"io"
 	"os"
+	"path/filepath"
+	"strconv"
 	"time"
+
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
+	"github.com/Necromancer-Labs/embbridge/client/store"
 )
 
 func (m *EDBModule) doGet(remotePath, localPath string) {
@@ -28,7 +34,9 @@ func (m *EDBModule) doGet(remotePath, localPath string) {
 		}
 	}
 
+	stop := m.cancelOnInterrupt()
 	data, _, mode, err := m.proto.Pull(remotePath, progress)
+	stop()
 	if err != nil {
 		fmt.Printf("\nError: %v\n", err)
 		return
@@ -52,6 +60,64 @@ func (m *EDBModule) doGet(remotePath, localPath string) {
 	fmt.Printf("\r  %s downloaded in %v (%s/s)\n", formatBytes(int64(len(data))), elapsed.Round(time.Millisecond), formatBytes(int64(speed)))
 }
 
+// doGetMany downloads every file matching pattern into localDir, named by
+// their base names, with one pull_many request
+func (m *EDBModule) doGetMany(pattern, localDir string) {
+	fmt.Printf("↓ Downloading %s...\n", pattern)
+	startTime := time.Now()
+
+	var lastPrint time.Time
+	progress := func(transferred, total int64) {
+		if time.Since(lastPrint) > 100*time.Millisecond && total > 0 {
+			percent := float64(transferred) / float64(total) * 100
+			fmt.Printf("\r  %s / %s (%.1f%%)", formatBytes(transferred), formatBytes(total), percent)
+			lastPrint = time.Now()
+		}
+	}
+
+	stop := m.cancelOnInterrupt()
+	files, skipped, err := m.proto.PullMany([]string{pattern}, progress)
+	stop()
+	if err != nil {
+		fmt.Printf("\nError: %v\n", err)
+		return
+	}
+
+	if err := os.MkdirAll(localDir, 0755); err != nil {
+		fmt.Printf("\nError: %v\n", err)
+		return
+	}
+
+	var written int64
+	count := 0
+	seen := make(map[string]string)
+	for _, f := range files {
+		name := filepath.Base(f.Path)
+		if prev, ok := seen[name]; ok {
+			fmt.Printf("\r  skipped %s: same name as %s\n", f.Path, prev)
+			continue
+		}
+		seen[name] = f.Path
+
+		if err := os.WriteFile(filepath.Join(localDir, name), f.Data, os.FileMode(f.Mode)); err != nil {
+			fmt.Printf("\r  Error writing %s: %v\n", name, err)
+			continue
+		}
+		count++
+		written += int64(len(f.Data))
+		if int64(len(f.Data)) < f.Size {
+			fmt.Printf("\r  %s: got %s of %s (file shrank)\n", f.Path, formatBytes(int64(len(f.Data))), formatBytes(f.Size))
+		}
+	}
+	for _, s := range skipped {
+		fmt.Printf("\r  skipped %s: %s\n", s.Path, s.Error)
+	}
+
+	elapsed := time.Since(startTime)
+	speed := float64(written) / elapsed.Seconds()
+	fmt.Printf("\r  %d files, %s downloaded in %v (%s/s)\n", count, formatBytes(written), elapsed.Round(time.Millisecond), formatBytes(int64(speed)))
+}
+
 func (m *EDBModule) doPut(localPath, remotePath string) {
 	// Read local file
 	data, err := os.ReadFile(localPath)
@@ -81,7 +147,10 @@ func (m *EDBModule) doPut(localPath, remotePath string) {
 		}
 	}
 
-	if err := m.proto.Push(remotePath, data, mode, progress); err != nil {
+	stop := m.cancelOnInterrupt()
+	err = m.proto.Push(remotePath, data, mode, progress)
+	stop()
+	if err != nil {
 		fmt.Printf("\nError: %v\n", err)
 		return
 	}
@@ -90,3 +159,267 @@ func (m *EDBModule) doPut(localPath, remotePath string) {
 	speed := float64(len(data)) / elapsed.Seconds()
 	fmt.Printf("\r  %s uploaded in %v (%s/s)\n", formatBytes(int64(len(data))), elapsed.Round(time.Millisecond), formatBytes(int64(speed)))
 }
+
+// doThrottle parses "throttle" keyword/value pairs, applies them and prints
+// the limits in effect. "rate" and the priorities are set on the agent for
+// the whole session; "each" is sent with every following pull and push.
+func (m *EDBModule) doThrottle(args []string) {
+	if len(args)%2 != 0 {
+		fmt.Println("Usage: throttle [rate <size>|off] [each <size>|off] [nice <0-19>] [io idle|be[:0-7]|rt[:0-7]]")
+		return
+	}
+
+	var opts protocol.ThrottleOptions
+	each := m.proto.TransferRate()
+	for i := 0; i < len(args); i += 2 {
+		key, val := args[i], args[i+1]
+		switch key {
+		case "rate", "each":
+			rate, err := protocol.ParseRate(val)
+			if err != nil {
+				fmt.Printf("Error: %v\n", err)
+				return
+			}
+			if key == "rate" {
+				opts.Rate = &rate
+			} else {
+				each = rate
+			}
+		case "nice":
+			n, err := strconv.Atoi(val)
+			if err != nil || n < 0 || n > 19 {
+				fmt.Println("Error: nice must be between 0 and 19")
+				return
+			}
+			opts.Nice = &n
+		case "io":
+			class, level, err := protocol.ParseIOPriority(val)
+			if err != nil {
+				fmt.Printf("Error: %v\n", err)
+				return
+			}
+			opts.IOClass, opts.IOLevel = class, level
+		default:
+			fmt.Printf("Error: unknown setting: %s\n", key)
+			return
+		}
+	}
+
+	resp, err := m.proto.Throttle(opts)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+	if !resp.OK {
+		fmt.Printf("Error: %s\n", resp.Error)
+		return
+	}
+
+	m.proto.SetTransferRate(each)
+
+	ioNames := map[int64]string{0: "default", 1: "realtime", 2: "best-effort", 3: "idle"}
+	fmt.Printf("  session rate  %s\n", formatRate(uint64(toInt64(resp.Data["rate"]))))
+	fmt.Printf("  per transfer  %s\n", formatRate(each))
+	fmt.Printf("  nice          %d\n", toInt64(resp.Data["nice"]))
+	fmt.Printf("  io            %s", ioNames[toInt64(resp.Data["ioclass"])])
+	if class := toInt64(resp.Data["ioclass"]); class == 1 || class == 2 {
+		fmt.Printf(" (level %d)", toInt64(resp.Data["iolevel"]))
+	}
+	fmt.Println()
+}
+
+func formatRate(rate uint64) string {
+	if rate == 0 {
+		return "unlimited"
+	}
+	return formatBytes(int64(rate)) + "/s"
+}
+
+// dumpRangeMax bounds one ranged pull of missing chunks, and so the memory
+// a dump holds at once
+const dumpRangeMax = 8 << 20
+
+// doDump downloads a file or partition through the dump store: the agent
+// hashes its content-defined chunks, and only chunks the store lacks are
+// pulled. The dump is recorded as a manifest in the store; with a local
+// path the file is also written out.
+func (m *EDBModule) doDump(remotePath, localPath string) {
+	st, err := store.Open(m.storeDir)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	fmt.Printf("↓ Dumping %s...\n", remotePath)
+	startTime := time.Now()
+
+	stop := m.cancelOnInterrupt()
+	defer stop()
+
+	size, mode, chunks, err := m.proto.HashChunks(remotePath)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	// Runs of consecutive chunks the store lacks, each pulled as one range.
+	// A chunk repeated within the file is only pulled the first time.
+	type span struct {
+		first, last int
+		offset      int64
+		length      int64
+	}
+	var spans []span
+	var missing int64
+	want := make(map[[32]byte]bool)
+	for i, c := range chunks {
+		if want[c.Hash] || st.Has(c.Hash) {
+			continue
+		}
+		want[c.Hash] = true
+		missing += int64(c.Size)
+		if n := len(spans); n > 0 && spans[n-1].last == i-1 && spans[n-1].length+int64(c.Size) <= dumpRangeMax {
+			spans[n-1].last = i
+			spans[n-1].length += int64(c.Size)
+			continue
+		}
+		spans = append(spans, span{first: i, last: i, offset: c.Offset, length: int64(c.Size)})
+	}
+
+	var done int64
+	var lastPrint time.Time
+	for _, sp := range spans {
+		progress := func(transferred, total int64) {
+			if time.Since(lastPrint) > 100*time.Millisecond {
+				percent := float64(done+transferred) / float64(missing) * 100
+				fmt.Printf("\r  %s / %s new (%.1f%%)", formatBytes(done+transferred), formatBytes(missing), percent)
+				lastPrint = time.Now()
+			}
+		}
+		data, err := m.proto.PullRange(remotePath, sp.offset, sp.length, progress)
+		if err != nil {
+			fmt.Printf("\nError: %v\n", err)
+			return
+		}
+		if int64(len(data)) != sp.length {
+			fmt.Printf("\nError: %s changed while dumping (got %s of a %s range)\n", remotePath, formatBytes(int64(len(data))), formatBytes(sp.length))
+			return
+		}
+		for i, off := sp.first, int64(0); i <= sp.last; i++ {
+			c := chunks[i]
+			if err := st.Put(c.Hash, data[off:off+int64(c.Size)]); err != nil {
+				fmt.Printf("\nError: %s changed while dumping: %v\n", remotePath, err)
+				return
+			}
+			off += int64(c.Size)
+		}
+		done += sp.length
+	}
+
+	man := &store.Manifest{
+		Device: "unknown",
+		Path:   remotePath,
+		Size:   size,
+		Mode:   mode,
+		Time:   time.Now(),
+		Chunks: make([]store.ManifestChunk, len(chunks)),
+	}
+	if m.device != nil && m.device.Nodename != "" {
+		man.Device = m.device.Nodename
+	}
+	for i, c := range chunks {
+		man.Chunks[i] = store.ManifestChunk{Hash: store.HashString(c.Hash), Size: c.Size}
+	}
+
+	// Reassembling checks every chunk and gives the whole file's hash
+	var out io.Writer = io.Discard
+	if localPath != "" {
+		f, err := os.OpenFile(localPath, os.O_WRONLY|os.O_CREATE|os.O_TRUNC, os.FileMode(mode))
+		if err != nil {
+			fmt.Printf("\nError creating file: %v\n", err)
+			return
+		}
+		defer f.Close()
+		out = f
+	}
+	if man.SHA256, err = st.Export(man, out); err != nil {
+		fmt.Printf("\nError: %v\n", err)
+		return
+	}
+
+	manPath, err := st.SaveManifest(man)
+	if err != nil {
+		fmt.Printf("\nError: %v\n", err)
+		return
+	}
+
+	elapsed := time.Since(startTime)
+	fmt.Printf("\r  %s in %d chunks, %d new (%s transferred) in %v\n", formatBytes(size), len(chunks), len(want), formatBytes(missing), elapsed.Round(time.Millisecond))
+	fmt.Printf("  sha256   %s\n", man.SHA256)
+	fmt.Printf("  manifest %s\n", manPath)
+}
+
+// doDumps lists the dumps recorded in the store, or with "export" writes
+// one back out as a file
+func (m *EDBModule) doDumps(args []string) {
+	st, err := store.Open(m.storeDir)
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	if len(args) > 0 {
+		if args[0] != "export" || len(args) != 3 {
+			fmt.Println("Usage: dumps [export <manifest> <local-path>]")
+			return
+		}
+		man, err := store.LoadManifest(args[1])
+		if err != nil {
+			fmt.Printf("Error: %v\n", err)
+			return
+		}
+		f, err := os.OpenFile(args[2], os.O_WRONLY|os.O_CREATE|os.O_TRUNC, os.FileMode(man.Mode))
+		if err != nil {
+			fmt.Printf("Error creating file: %v\n", err)
+			return
+		}
+		defer f.Close()
+		if _, err := st.Export(man, f); err != nil {
+			fmt.Printf("Error: %v\n", err)
+			return
+		}
+		fmt.Printf("  %s (%s from %s) written to %s\n", man.Path, formatBytes(man.Size), man.Device, args[2])
+		return
+	}
+
+	paths, err := st.Manifests()
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+
+	var total int64
+	for _, p := range paths {
+		man, err := store.LoadManifest(p)
+		if err != nil {
+			fmt.Printf("  %v\n", err)
+			continue
+		}
+		total += man.Size
+
+		// Manifests are plain JSON and may have been edited or cut short
+		sum := man.SHA256
+		if len(sum) > 16 {
+			sum = sum[:16]
+		}
+		fmt.Printf("  %s  %-16s %-24s %10s  %s\n", man.Time.Local().Format("2006-01-02 15:04"), man.Device, man.Path, formatBytes(man.Size), sum)
+		fmt.Printf("    %s\n", p)
+	}
+
+	count, used, err := st.Usage()
+	if err != nil {
+		fmt.Printf("Error: %v\n", err)
+		return
+	}
+	fmt.Printf("\n  %d dumps, %s of data in %d chunks using %s (%s)\n", len(paths), formatBytes(total), count, formatBytes(used), st.Root())
+}
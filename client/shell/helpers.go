@@ -9,7 +9,11 @@ package shell
 
 import (
 	"fmt"
+	"os"
+	"os/signal"
 	"strings"
+
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
 )
 
 // requireAbsolutePath checks if a path is absolute and prints an error if not.
@@ -131,3 +135,34 @@ func formatBytes(b int64) string {
 	}
 	return fmt.Sprintf("%.1f %cB", float64(b)/float64(div), "KMGTPE"[exp])
 }
+
+// printTruncated notes when the agent cut output short to stay within its
+// memory budget or the request deadline
+func printTruncated(resp *protocol.Response) {
+	if truncated, ok := resp.Data["truncated"].(bool); ok && truncated {
+		fmt.Println("\033[33m[output truncated: agent memory budget or deadline reached]\033[0m")
+	}
+}
+
+// cancelOnInterrupt makes Ctrl-C cancel the running request on the agent
+// instead of killing the shell, so the session and cwd survive. Call the
+// returned function once the command has finished.
+func (m *EDBModule) cancelOnInterrupt() func() {
+	sig := make(chan os.Signal, 1)
+	signal.Notify(sig, os.Interrupt)
+	done := make(chan struct{})
+
+	go func() {
+		select {
+		case <-sig:
+			fmt.Println("\n^C cancelling...")
+			m.proto.Cancel()
+		case <-done:
+		}
+	}()
+
+	return func() {
+		signal.Stop(sig)
+		close(done)
+	}
+}
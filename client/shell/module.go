@@ -10,6 +10,7 @@ package shell
 import (
 	"fmt"
 	"path/filepath"
+	"strconv"
 	"strings"
 
 	"github.com/Necromancer-Labs/embbridge/client/protocol"
@@ -19,16 +20,20 @@ import (
 
 // EDBModule provides device interaction commands
 type EDBModule struct {
-	shell shellapi.ShellAPI
-	proto *protocol.Protocol
-	cwd   string
+	shell    shellapi.ShellAPI
+	proto    *protocol.Protocol
+	device   *protocol.DeviceInfo
+	cwd      string
+	storeDir string // Dump store for dump/dumps
 }
 
 // NewEDBModule creates a new EDB module
-func NewEDBModule(proto *protocol.Protocol) *EDBModule {
+func NewEDBModule(proto *protocol.Protocol, device *protocol.DeviceInfo, storeDir string) *EDBModule {
 	return &EDBModule{
-		proto: proto,
-		cwd:   "/",
+		proto:    proto,
+		device:   device,
+		cwd:      "/",
+		storeDir: storeDir,
 	}
 }
 
@@ -41,11 +46,15 @@ func (m *EDBModule) Name() string {
 func (m *EDBModule) Initialize(s shellapi.ShellAPI) {
 	m.shell = s
 
-	// Fetch initial cwd from agent
-	resp, err := m.proto.Pwd()
-	if err == nil && resp.OK {
-		if path, ok := resp.Data["path"].(string); ok {
-			m.cwd = path
+	// Initial cwd comes with the handshake; older agents need a pwd request
+	if m.device != nil && m.device.Cwd != "" {
+		m.cwd = m.device.Cwd
+	} else {
+		resp, err := m.proto.Pwd()
+		if err == nil && resp.OK {
+			if path, ok := resp.Data["path"].(string); ok {
+				m.cwd = path
+			}
 		}
 	}
 
@@ -181,6 +190,24 @@ func (m *EDBModule) GetCommands() []*cobra.Command {
 	}
 	commands = append(commands, killAgentCmd)
 
+	// upgrade command
+	upgradeCmd := &cobra.Command{
+		Use:   "upgrade <local-binary> [remote-path]",
+		Short: "Replace the running agent with a new binary, keeping the session",
+		Args:  cobra.RangeArgs(1, 2),
+		Run: func(cmd *cobra.Command, args []string) {
+			keepPath := ""
+			if len(args) > 1 {
+				if !requireAbsolutePath(args[1], "remote-path") {
+					return
+				}
+				keepPath = args[1]
+			}
+			m.doUpgrade(args[0], keepPath)
+		},
+	}
+	commands = append(commands, upgradeCmd)
+
 	// reboot command
 	rebootCmd := &cobra.Command{
 		Use:   "reboot",
@@ -225,6 +252,36 @@ func (m *EDBModule) GetCommands() []*cobra.Command {
 	}
 	commands = append(commands, stringsCmd)
 
+	// elfinfo command
+	elfinfoCmd := &cobra.Command{
+		Use:   "elfinfo <file> [file...]",
+		Short: "Show ELF headers, libraries, symbols and hardening flags",
+		Args:  cobra.MinimumNArgs(1),
+		Run: func(cmd *cobra.Command, args []string) {
+			for _, p := range args {
+				if !requireAbsolutePath(p, "file") {
+					return
+				}
+			}
+			m.doElfinfo(args)
+		},
+	}
+	commands = append(commands, elfinfoCmd)
+
+	// verify command
+	verifyCmd := &cobra.Command{
+		Use:   "verify <local-dir> <remote-root>",
+		Short: "Check device files against SHA-256 hashes of a local tree",
+		Args:  cobra.ExactArgs(2),
+		Run: func(cmd *cobra.Command, args []string) {
+			if !requireAbsolutePath(args[1], "remote-root") {
+				return
+			}
+			m.doVerify(args[0], args[1])
+		},
+	}
+	commands = append(commands, verifyCmd)
+
 	// cpuinfo command
 	cpuinfoCmd := &cobra.Command{
 		Use:   "cpuinfo",
@@ -265,20 +322,81 @@ func (m *EDBModule) GetCommands() []*cobra.Command {
 	}
 	commands = append(commands, ipRouteCmd)
 
+	// profile command
+	profileCmd := &cobra.Command{
+		Use:   "profile [pid] [seconds]",
+		Short: "Sample CPU usage and show the hottest symbols",
+		Args:  cobra.MaximumNArgs(2),
+		Run: func(cmd *cobra.Command, args []string) {
+			pid, seconds := 0, 5
+			if len(args) > 0 {
+				n, err := strconv.Atoi(args[0])
+				if err != nil || n < 0 {
+					fmt.Printf("Error: invalid pid: %s\n", args[0])
+					return
+				}
+				pid = n
+			}
+			if len(args) > 1 {
+				n, err := strconv.Atoi(args[1])
+				if err != nil || n <= 0 || n > 60 {
+					fmt.Println("Error: seconds must be between 1 and 60")
+					return
+				}
+				seconds = n
+			}
+			m.doProfile(pid, seconds)
+		},
+	}
+	commands = append(commands, profileCmd)
+
+	// systrace command
+	systraceCmd := &cobra.Command{
+		Use:   "systrace <pid> [seconds]",
+		Short: "Trace syscall counts and latencies of a process",
+		Args:  cobra.RangeArgs(1, 2),
+		Run: func(cmd *cobra.Command, args []string) {
+			pid, err := strconv.Atoi(args[0])
+			if err != nil || pid <= 0 {
+				fmt.Printf("Error: invalid pid: %s\n", args[0])
+				return
+			}
+			seconds := 5
+			if len(args) > 1 {
+				n, err := strconv.Atoi(args[1])
+				if err != nil || n <= 0 || n > 300 {
+					fmt.Println("Error: seconds must be between 1 and 300")
+					return
+				}
+				seconds = n
+			}
+			m.doSystrace(pid, seconds)
+		},
+	}
+	commands = append(commands, systraceCmd)
+
 	// ==========================================================================
 	// File transfer commands
 	// ==========================================================================
 
 	// pull command (download from device)
 	pullCmd := &cobra.Command{
-		Use:   "pull <remote-file> [local-path]",
-		Short: "Download a file from the device to your local machine",
+		Use:   "pull <remote-file|glob> [local-path]",
+		Short: "Download a file, or every file matching a glob into a directory, from the device",
 		Args:  cobra.RangeArgs(1, 2),
 		Run: func(cmd *cobra.Command, args []string) {
 			remotePath := args[0]
 			if !requireAbsolutePath(remotePath, "remote-path") {
 				return
 			}
+			if strings.ContainsAny(remotePath, "*?[") {
+				localDir := "."
+				if len(args) > 1 {
+					localDir = args[1]
+				}
+				m.doGetMany(remotePath, localDir)
+				return
+			}
 			localPath := filepath.Base(remotePath)
 			if len(args) > 1 {
 				localPath = args[1]
@@ -302,6 +420,44 @@ func (m *EDBModule) GetCommands() []*cobra.Command {
 	}
 	commands = append(commands, pushCmd)
 
+	// dump command (download through the dedup store)
+	dumpCmd := &cobra.Command{
+		Use:   "dump <remote-file> [local-path]",
+		Short: "Download a file or partition through the local dump store, transferring only chunks it lacks",
+		Args:  cobra.RangeArgs(1, 2),
+		Run: func(cmd *cobra.Command, args []string) {
+			if !requireAbsolutePath(args[0], "remote-file") {
+				return
+			}
+			localPath := ""
+			if len(args) > 1 {
+				localPath = args[1]
+			}
+			m.doDump(args[0], localPath)
+		},
+	}
+	commands = append(commands, dumpCmd)
+
+	// dumps command (list or export what the store holds)
+	dumpsCmd := &cobra.Command{
+		Use:   "dumps [export <manifest> <local-path>]",
+		Short: "List dumps in the local store, or write one out as a file",
+		Run: func(cmd *cobra.Command, args []string) {
+			m.doDumps(args)
+		},
+	}
+	commands = append(commands, dumpsCmd)
+
+	// throttle command (transfer rate and priority limits)
+	throttleCmd := &cobra.Command{
+		Use:   "throttle [rate <size>|off] [each <size>|off] [nice <0-19>] [io idle|be[:0-7]|rt[:0-7]]",
+		Short: "Limit transfer bandwidth and the agent's CPU/IO priority",
+		Run: func(cmd *cobra.Command, args []string) {
+			m.doThrottle(args)
+		},
+	}
+	commands = append(commands, throttleCmd)
+
 	// ==========================================================================
 	// File operation commands
 	// ==========================================================================
@@ -382,5 +538,31 @@ func (m *EDBModule) GetCommands() []*cobra.Command {
 	}
 	commands = append(commands, chmodCmd)
 
-	return commands
+	return m.supported(commands)
+}
+
+// agentCommandNames maps shell commands to agent commands where they differ
+var agentCommandNames = map[string]string{
+	"ip":       "ip_addr",
+	"ip-route": "ip_route",
+}
+
+// supported drops commands the agent was built without (see the agent's
+// feature selection). Agents that send no fingerprint keep every command.
+func (m *EDBModule) supported(commands []*cobra.Command) []*cobra.Command {
+	if m.device == nil || len(m.device.Features) == 0 {
+		return commands
+	}
+
+	out := commands[:0]
+	for _, c := range commands {
+		name := c.Name()
+		if agentName, ok := agentCommandNames[name]; ok {
+			name = agentName
+		}
+		if m.device.HasFeature(name) {
+			out = append(out, c)
+		}
+	}
+	return out
 }
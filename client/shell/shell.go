@@ -14,8 +14,10 @@ import (
 	"github.com/Necromancerlabs/gocmd2/pkg/shell"
 )
 
-// RunShell starts the interactive shell
-func RunShell(proto *protocol.Protocol) error {
+// RunShell starts the interactive shell. device is the fingerprint from the
+// handshake, or nil if the agent did not send one. storeDir is the dump
+// store used by dump and dumps.
+func RunShell(proto *protocol.Protocol, device *protocol.DeviceInfo, storeDir string) error {
 	// Create the shell
 	sh, err := shell.NewShell("edb", `
 	────────────────────────────────────────────────────────────
@@ -29,7 +31,7 @@ func RunShell(proto *protocol.Protocol) error {
 	defer sh.Close()
 
 	// Register the EDB module
-	edbModule := NewEDBModule(proto)
+	edbModule := NewEDBModule(proto, device, storeDir)
 	sh.RegisterModule(edbModule)
 
 	// Set history file
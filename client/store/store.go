@@ -0,0 +1,242 @@
+/*
+ * embbridge - Embedded Debug Bridge
+ * https://github.com/Necromancer-Labs/embbridge
+ *
+ * Dump store - content-addressed, deduplicating storage for pulled files
+ */
+
+package store
+
+import (
+	"crypto/sha256"
+	"encoding/hex"
+	"encoding/json"
+	"fmt"
+	"io"
+	"io/fs"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"time"
+)
+
+// Store keeps file contents as chunks named by their SHA-256 under
+// root/chunks, and what was dumped as manifests (the chunk list of one
+// file from one device) under root/dumps. A chunk shared by any number of
+// dumps is stored once, so disk use grows with unique data only.
+type Store struct {
+	root string
+}
+
+// ManifestChunk is one chunk of a dumped file, in file order
+type ManifestChunk struct {
+	Hash string `json:"hash"`
+	Size uint32 `json:"size"`
+}
+
+// Manifest describes one dumped file
+type Manifest struct {
+	Device string          `json:"device"`
+	Path   string          `json:"path"`
+	Size   int64           `json:"size"`
+	Mode   uint32          `json:"mode"`
+	SHA256 string          `json:"sha256"`
+	Time   time.Time       `json:"time"`
+	Chunks []ManifestChunk `json:"chunks"`
+}
+
+// DefaultDir returns ~/.edb_store
+func DefaultDir() string {
+	home, err := os.UserHomeDir()
+	if err != nil {
+		return ".edb_store"
+	}
+	return filepath.Join(home, ".edb_store")
+}
+
+// Open opens the store at root, creating it if needed
+func Open(root string) (*Store, error) {
+	for _, dir := range []string{"chunks", "dumps"} {
+		if err := os.MkdirAll(filepath.Join(root, dir), 0755); err != nil {
+			return nil, err
+		}
+	}
+	return &Store{root: root}, nil
+}
+
+// Root returns the store's directory
+func (s *Store) Root() string {
+	return s.root
+}
+
+// chunkPath fans chunks out over 256 directories by their first byte
+func (s *Store) chunkPath(hash [32]byte) string {
+	name := hex.EncodeToString(hash[:])
+	return filepath.Join(s.root, "chunks", name[:2], name)
+}
+
+// Has reports whether the store holds the chunk with this hash
+func (s *Store) Has(hash [32]byte) bool {
+	_, err := os.Stat(s.chunkPath(hash))
+	return err == nil
+}
+
+// Put stores a chunk after checking it matches hash. The chunk is written
+// under a temporary name and renamed, so an interrupted dump never leaves a
+// truncated chunk behind under its real name.
+func (s *Store) Put(hash [32]byte, data []byte) error {
+	if sha256.Sum256(data) != hash {
+		return fmt.Errorf("chunk %x does not match its hash", hash[:8])
+	}
+
+	path := s.chunkPath(hash)
+	if err := os.MkdirAll(filepath.Dir(path), 0755); err != nil {
+		return err
+	}
+	tmp, err := os.CreateTemp(filepath.Dir(path), ".tmp-*")
+	if err != nil {
+		return err
+	}
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		os.Remove(tmp.Name())
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		os.Remove(tmp.Name())
+		return err
+	}
+	return os.Rename(tmp.Name(), path)
+}
+
+// Export writes the file a manifest describes to w, and returns the
+// SHA-256 of what was written. If the manifest already records one, a
+// mismatch (a damaged chunk) is an error.
+func (s *Store) Export(m *Manifest, w io.Writer) (string, error) {
+	sum := sha256.New()
+	out := io.MultiWriter(w, sum)
+
+	for _, c := range m.Chunks {
+		hash, err := parseHash(c.Hash)
+		if err != nil {
+			return "", err
+		}
+		data, err := os.ReadFile(s.chunkPath(hash))
+		if err != nil {
+			return "", fmt.Errorf("chunk %s: %w", c.Hash[:16], err)
+		}
+		if uint32(len(data)) != c.Size {
+			return "", fmt.Errorf("chunk %s: size %d, expected %d", c.Hash[:16], len(data), c.Size)
+		}
+		if _, err := out.Write(data); err != nil {
+			return "", err
+		}
+	}
+
+	got := hex.EncodeToString(sum.Sum(nil))
+	if m.SHA256 != "" && got != m.SHA256 {
+		return "", fmt.Errorf("content does not match manifest (sha256 %s, expected %s)", got, m.SHA256)
+	}
+	return got, nil
+}
+
+// SaveManifest records a dump under root/dumps/<device>/<path>/<time>.json
+// and returns the file's path
+func (s *Store) SaveManifest(m *Manifest) (string, error) {
+	dir := filepath.Join(s.root, "dumps", safeName(m.Device), safeName(m.Path))
+	if err := os.MkdirAll(dir, 0755); err != nil {
+		return "", err
+	}
+
+	data, err := json.MarshalIndent(m, "", "  ")
+	if err != nil {
+		return "", err
+	}
+	path := filepath.Join(dir, m.Time.UTC().Format("20060102T150405.000Z")+".json")
+	if err := os.WriteFile(path, data, 0644); err != nil {
+		return "", err
+	}
+	return path, nil
+}
+
+// Manifests returns the paths of all recorded dumps, oldest first within
+// each device and file
+func (s *Store) Manifests() ([]string, error) {
+	var paths []string
+	err := filepath.WalkDir(filepath.Join(s.root, "dumps"), func(path string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		if !d.IsDir() && strings.HasSuffix(path, ".json") {
+			paths = append(paths, path)
+		}
+		return nil
+	})
+	sort.Strings(paths)
+	return paths, err
+}
+
+// Usage returns the number of chunks in the store and their total size
+func (s *Store) Usage() (int, int64, error) {
+	var count int
+	var bytes int64
+	err := filepath.WalkDir(filepath.Join(s.root, "chunks"), func(path string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		if d.IsDir() || strings.HasPrefix(d.Name(), ".tmp-") {
+			return nil
+		}
+		info, err := d.Info()
+		if err != nil {
+			return err
+		}
+		count++
+		bytes += info.Size()
+		return nil
+	})
+	return count, bytes, err
+}
+
+// LoadManifest reads a manifest written by SaveManifest
+func LoadManifest(path string) (*Manifest, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+	var m Manifest
+	if err := json.Unmarshal(data, &m); err != nil {
+		return nil, fmt.Errorf("%s: %w", path, err)
+	}
+	return &m, nil
+}
+
+// HashString formats a chunk hash the way manifests record it
+func HashString(hash [32]byte) string {
+	return hex.EncodeToString(hash[:])
+}
+
+func parseHash(s string) ([32]byte, error) {
+	var hash [32]byte
+	b, err := hex.DecodeString(s)
+	if err != nil || len(b) != len(hash) {
+		return hash, fmt.Errorf("invalid chunk hash %q", s)
+	}
+	copy(hash[:], b)
+	return hash, nil
+}
+
+// safeName turns a device name or remote path into one directory name
+func safeName(s string) string {
+	s = strings.Trim(s, "/")
+	if s == "" || s == "." || s == ".." {
+		return "_"
+	}
+	return strings.Map(func(r rune) rune {
+		if r == '/' || r == '\\' || r == ':' || r < ' ' {
+			return '_'
+		}
+		return r
+	}, s)
+}
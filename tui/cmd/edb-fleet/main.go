@@ -0,0 +1,327 @@
+// Command edb-fleet scale-tests the Graveyard connection manager with a fleet
+// of simulated agents.
+//
+// By default it starts a connection manager on a loopback port, launches N
+// simulated agents in reverse mode against it (in a child process, so their
+// memory does not count against the manager) and reports accept, handshake
+// and initialization latency distributions plus memory per device.
+//
+//	edb-fleet -n 500
+//	edb-fleet -n 500 -latency 20ms -jitter 10ms -no-fingerprint
+//
+// With -agents it only runs the simulated agents, e.g. against a real
+// Graveyard instance:
+//
+//	edb-fleet -agents -connect 192.168.1.10:1337 -n 200
+package main
+
+import (
+	"bufio"
+	"context"
+	"encoding/json"
+	"flag"
+	"fmt"
+	"os"
+	"os/exec"
+	"os/signal"
+	"runtime"
+	"sort"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/Necromancer-Labs/embbridge-tui/internal/connection"
+	"github.com/Necromancer-Labs/embbridge-tui/internal/simagent"
+)
+
+func main() {
+	n := flag.Int("n", 100, "Number of simulated agents")
+	agentsOnly := flag.Bool("agents", false, "Only run the simulated agents (requires -connect)")
+	connect := flag.String("connect", "", "Address of the Graveyard listener to connect to")
+	ramp := flag.Duration("ramp", 0, "Spread agent start times over this duration")
+	timeout := flag.Duration("timeout", 60*time.Second, "Give up waiting for the fleet after this long")
+	jsonOut := flag.Bool("json", false, "Print the report as JSON")
+
+	var cfg simagent.Config
+	flag.DurationVar(&cfg.Latency, "latency", 0, "Delay before every agent response")
+	flag.DurationVar(&cfg.Jitter, "jitter", 0, "Extra random delay, up to this much")
+	flag.IntVar(&cfg.Bandwidth, "bandwidth", 0, "Agent upload limit in bytes/s (0 = unlimited)")
+	flag.Float64Var(&cfg.HandshakeFailRate, "handshake-fail", 0, "Probability an agent hangs up instead of sending hello")
+	flag.Float64Var(&cfg.DropRate, "drop", 0, "Probability an agent hangs up instead of answering a request")
+	flag.Float64Var(&cfg.ErrorRate, "error", 0, "Probability an agent answers a request with an error")
+	flag.BoolVar(&cfg.NoFingerprint, "no-fingerprint", false, "Send hello without the device fingerprint (forces uname/whoami/pwd)")
+	flag.Parse()
+
+	if *agentsOnly {
+		if *connect == "" {
+			fmt.Fprintln(os.Stderr, "edb-fleet: -agents requires -connect")
+			os.Exit(2)
+		}
+		runAgents(*connect, *n, *ramp, cfg)
+		return
+	}
+
+	rep, err := runFleet(*n, *timeout, os.Args[1:])
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "edb-fleet: %v\n", err)
+		os.Exit(1)
+	}
+	if *jsonOut {
+		enc := json.NewEncoder(os.Stdout)
+		enc.SetIndent("", "  ")
+		enc.Encode(rep)
+		return
+	}
+	rep.print(cfg)
+}
+
+// runAgents runs n simulated agents until interrupted, printing one JSON line
+// per agent once its handshake completes or fails
+func runAgents(addr string, n int, ramp time.Duration, cfg simagent.Config) {
+	ctx, stop := signal.NotifyContext(context.Background(), os.Interrupt, syscall.SIGTERM)
+	defer stop()
+
+	var mu sync.Mutex
+	enc := json.NewEncoder(os.Stdout)
+	emit := func(t simagent.Timing) {
+		mu.Lock()
+		enc.Encode(t)
+		mu.Unlock()
+	}
+
+	var wg sync.WaitGroup
+	for i := 0; i < n; i++ {
+		if ramp > 0 && i > 0 {
+			select {
+			case <-ctx.Done():
+			case <-time.After(ramp / time.Duration(n)):
+			}
+		}
+		if ctx.Err() != nil {
+			break
+		}
+
+		wg.Add(1)
+		go func(i int) {
+			defer wg.Done()
+			t := simagent.New(cfg, i).Run(ctx, addr, emit)
+			if t.HandshakeDone.IsZero() {
+				emit(t)
+			}
+		}(i)
+	}
+	wg.Wait()
+}
+
+// report is the result of one fleet run
+type report struct {
+	Agents      int             `json:"agents"`
+	Ready       int             `json:"ready"`
+	Failed      int             `json:"failed"`
+	Missing     int             `json:"missing"`
+	Events      int             `json:"events"`
+	StoreWrites int             `json:"store_writes"`
+	Wall        time.Duration   `json:"wall_ns"`
+	Phases      map[string]dist `json:"phases"`
+	HeapBytes   int64           `json:"heap_bytes"`
+	Goroutines  int             `json:"goroutines"`
+	BytesPerDev int64           `json:"bytes_per_device"`
+}
+
+// dist summarizes a latency distribution
+type dist struct {
+	Min time.Duration `json:"min_ns"`
+	P50 time.Duration `json:"p50_ns"`
+	P90 time.Duration `json:"p90_ns"`
+	P99 time.Duration `json:"p99_ns"`
+	Max time.Duration `json:"max_ns"`
+}
+
+func newDist(samples []time.Duration) dist {
+	if len(samples) == 0 {
+		return dist{}
+	}
+	sort.Slice(samples, func(i, j int) bool { return samples[i] < samples[j] })
+	pct := func(p int) time.Duration {
+		idx := (len(samples)*p+99)/100 - 1
+		if idx < 0 {
+			idx = 0
+		}
+		return samples[idx]
+	}
+	return dist{samples[0], pct(50), pct(90), pct(99), samples[len(samples)-1]}
+}
+
+// phaseOrder is the row order of the latency table
+var phaseOrder = []string{"dial", "accept", "handshake", "init", "ready"}
+
+// runFleet starts a manager, runs the simulated agents in a child process and
+// collects timings from both sides
+func runFleet(n int, timeout time.Duration, args []string) (*report, error) {
+	// Keep the manager away from the user's saved device list
+	home, err := os.MkdirTemp("", "edb-fleet-")
+	if err != nil {
+		return nil, err
+	}
+	defer os.RemoveAll(home)
+	os.Setenv("HOME", home)
+
+	runtime.GC()
+	var before runtime.MemStats
+	runtime.ReadMemStats(&before)
+	goroutinesBefore := runtime.NumGoroutine()
+
+	traces := make(chan connection.ConnTrace, n)
+	m := connection.NewManager()
+	m.SetTrace(func(tr connection.ConnTrace) { traces <- tr })
+	if err := m.Listen("127.0.0.1:0"); err != nil {
+		return nil, err
+	}
+	defer m.Stop()
+
+	// Drain events like the TUI would; the manager drops them if nobody reads
+	var events int
+	var eventsMu sync.Mutex
+	go func() {
+		for range m.Events() {
+			eventsMu.Lock()
+			events++
+			eventsMu.Unlock()
+		}
+	}()
+
+	self, err := os.Executable()
+	if err != nil {
+		return nil, err
+	}
+	child := exec.Command(self, append(args, "-agents", "-connect", m.ListenAddr())...)
+	child.Stderr = os.Stderr
+	stdout, err := child.StdoutPipe()
+	if err != nil {
+		return nil, err
+	}
+
+	start := time.Now()
+	if err := child.Start(); err != nil {
+		return nil, fmt.Errorf("start agents: %w", err)
+	}
+	defer func() {
+		child.Process.Kill()
+		child.Wait()
+	}()
+
+	timings := make(chan simagent.Timing, n)
+	go func() {
+		sc := bufio.NewScanner(stdout)
+		for sc.Scan() {
+			var t simagent.Timing
+			if json.Unmarshal(sc.Bytes(), &t) == nil {
+				timings <- t
+			}
+		}
+	}()
+
+	// Wait for every agent to report and the manager to finish with it
+	agents := make(map[string]simagent.Timing, n)
+	byAddr := make(map[string]connection.ConnTrace, n)
+	var agentErrs int
+	deadline := time.After(timeout)
+wait:
+	for len(agents)+agentErrs < n || len(byAddr) < len(agents) {
+		select {
+		case t := <-timings:
+			if t.LocalAddr == "" {
+				agentErrs++ // never connected
+			} else {
+				agents[t.LocalAddr] = t
+			}
+		case tr := <-traces:
+			byAddr[tr.RemoteAddr] = tr
+		case <-deadline:
+			break wait
+		}
+	}
+	wall := time.Since(start)
+
+	rep := &report{Agents: n, Wall: wall, Phases: make(map[string]dist)}
+	samples := make(map[string][]time.Duration)
+	for addr, t := range agents {
+		samples["dial"] = append(samples["dial"], t.Connected.Sub(t.DialStart))
+
+		tr, ok := byAddr[addr]
+		if !ok {
+			rep.Missing++
+			continue
+		}
+		if tr.Err != nil {
+			rep.Failed++
+			continue
+		}
+		rep.Ready++
+		samples["accept"] = append(samples["accept"], tr.Accepted.Sub(t.DialStart))
+		samples["handshake"] = append(samples["handshake"], tr.Handshake)
+		samples["init"] = append(samples["init"], tr.Init)
+		samples["ready"] = append(samples["ready"], tr.Accepted.Add(tr.Handshake+tr.Init).Sub(t.DialStart))
+	}
+	rep.Failed += agentErrs
+	rep.Missing += n - len(agents) - agentErrs
+	for _, phase := range phaseOrder {
+		rep.Phases[phase] = newDist(samples[phase])
+	}
+
+	// Memory held by the manager for the connected fleet (drop our own
+	// per-agent bookkeeping first so it is not counted)
+	agents, byAddr, samples = nil, nil, nil
+	runtime.GC()
+	var after runtime.MemStats
+	runtime.ReadMemStats(&after)
+	rep.HeapBytes = int64(after.HeapInuse+after.StackInuse) - int64(before.HeapInuse+before.StackInuse)
+	rep.Goroutines = runtime.NumGoroutine() - goroutinesBefore
+	if rep.Ready > 0 {
+		rep.BytesPerDev = rep.HeapBytes / int64(rep.Ready)
+	}
+
+	eventsMu.Lock()
+	rep.Events = events
+	eventsMu.Unlock()
+	rep.StoreWrites = m.StoreWrites()
+
+	return rep, nil
+}
+
+func (r *report) print(cfg simagent.Config) {
+	fp := "on"
+	if cfg.NoFingerprint {
+		fp = "off"
+	}
+	fmt.Printf("edb-fleet: %d agents, latency %v (+%v jitter), fingerprint %s\n",
+		r.Agents, cfg.Latency, cfg.Jitter, fp)
+	fmt.Printf("ready %d, failed %d, missing %d in %v (%d events)\n\n",
+		r.Ready, r.Failed, r.Missing, r.Wall.Round(time.Millisecond), r.Events)
+
+	fmt.Printf("%-10s %10s %10s %10s %10s %10s\n", "phase", "min", "p50", "p90", "p99", "max")
+	for _, phase := range phaseOrder {
+		d := r.Phases[phase]
+		fmt.Printf("%-10s %10s %10s %10s %10s %10s\n", phase,
+			fmtDur(d.Min), fmtDur(d.P50), fmtDur(d.P90), fmtDur(d.P99), fmtDur(d.Max))
+	}
+
+	perDev := 0.0
+	if r.Ready > 0 {
+		perDev = float64(r.Goroutines) / float64(r.Ready)
+	}
+	fmt.Printf("\nmemory     %.1f MB total, %.1f KB/device\n",
+		float64(r.HeapBytes)/(1<<20), float64(r.BytesPerDev)/1024)
+	fmt.Printf("goroutines %d total, %.1f/device\n", r.Goroutines, perDev)
+	fmt.Printf("saves      %d device file writes\n", r.StoreWrites)
+}
+
+func fmtDur(d time.Duration) string {
+	switch {
+	case d >= time.Second:
+		return fmt.Sprintf("%.2fs", d.Seconds())
+	case d >= time.Millisecond:
+		return fmt.Sprintf("%.2fms", float64(d)/float64(time.Millisecond))
+	}
+	return fmt.Sprintf("%.0fus", float64(d)/float64(time.Microsecond))
+}
@@ -63,6 +63,12 @@ type Device struct {
 	UID          int
 	GID          int
 
+	// Hardware info (populated from the handshake fingerprint)
+	CPU        string
+	MemTotalKB uint64
+	MTDCount   int
+	Features   []string
+
 	// Current state
 	CurrentDir string
 
@@ -166,6 +172,32 @@ func (d *Device) UpdateUser(user string, uid, gid int) {
 	d.GID = gid
 }
 
+// UpdateHardware updates hardware info from the handshake fingerprint
+func (d *Device) UpdateHardware(cpu string, memTotalKB uint64, mtdCount int, features []string) {
+	d.mu.Lock()
+	defer d.mu.Unlock()
+	d.CPU = cpu
+	d.MemTotalKB = memTotalKB
+	d.MTDCount = mtdCount
+	d.Features = features
+}
+
+// HasFeature reports whether the agent was built with the named command.
+// Devices without a fingerprint (older agents) report every command.
+func (d *Device) HasFeature(name string) bool {
+	d.mu.RLock()
+	defer d.mu.RUnlock()
+	if len(d.Features) == 0 {
+		return true
+	}
+	for _, f := range d.Features {
+		if f == name {
+			return true
+		}
+	}
+	return false
+}
+
 // SetCurrentDir sets the current directory
 func (d *Device) SetCurrentDir(dir string) {
 	d.mu.Lock()
@@ -4,6 +4,7 @@ import (
 	"context"
 	"fmt"
 	"net"
+	"sort"
 	"sync"
 	"time"
 
@@ -44,6 +45,24 @@ type Manager struct {
 
 	// Saved device data (for matching reconnections)
 	savedDevices map[string]SavedDevice // keyed by RemoteAddr
+
+	// Write-behind store for ~/.graveyard_devices.yaml (see SaveAllDevices)
+	store *deviceWriter
+
+	// Optional per-connection timing callback (see SetTrace)
+	trace func(ConnTrace)
+
+	// Time limit sent with shell requests (see SetRequestDeadline)
+	deadline time.Duration
+}
+
+// ConnTrace reports how long an incoming connection took to become usable
+type ConnTrace struct {
+	RemoteAddr string
+	Accepted   time.Time     // When the connection was picked up
+	Handshake  time.Duration // Accept to hello/hello_ack done
+	Init       time.Duration // Handshake done to device info ready
+	Err        error         // Set if the handshake or initialization failed
 }
 
 // NewManager creates a new connection manager.
@@ -57,6 +76,7 @@ func NewManager() *Manager {
 		ctx:          ctx,
 		cancel:       cancel,
 	}
+	m.store = newDeviceWriter(m.snapshotDevices)
 
 	// Load saved devices from YAML
 	saved, err := LoadDevices()
@@ -96,6 +116,20 @@ func (m *Manager) Listen(addr string) error {
 	return nil
 }
 
+// SetTrace installs a callback that is invoked once for every incoming
+// connection, after it has been initialized or has failed. It must be set
+// before Listen. Used by the fleet simulator to measure the manager.
+func (m *Manager) SetTrace(fn func(ConnTrace)) {
+	m.trace = fn
+}
+
+// SetRequestDeadline sets the deadline sent with every request once a
+// device is initialized, so slow scans on overloaded devices come back
+// partial instead of blocking the shell. It must be set before Listen.
+func (m *Manager) SetRequestDeadline(d time.Duration) {
+	m.deadline = d
+}
+
 // ListenAddr returns the address the manager is listening on
 func (m *Manager) ListenAddr() string {
 	if m.listener == nil {
@@ -131,6 +165,7 @@ func (m *Manager) acceptLoop() {
 // handleIncomingConnection handles a new incoming agent connection (reverse mode)
 func (m *Manager) handleIncomingConnection(conn net.Conn) {
 	remoteAddr := conn.RemoteAddr().String()
+	tr := ConnTrace{RemoteAddr: remoteAddr, Accepted: time.Now()}
 
 	// Check if we have a saved device for this address (reconnection)
 	var device *Device
@@ -169,23 +204,38 @@ func (m *Manager) handleIncomingConnection(conn net.Conn) {
 	// Perform handshake (we're the server, agent sends hello first)
 	if err := session.PerformHandshakeAsServer(); err != nil {
 		conn.Close()
+		tr.Err = err
+		m.emitTrace(tr)
 		return
 	}
+	tr.Handshake = time.Since(tr.Accepted)
 
 	// Initialize device info
 	if err := session.Initialize(); err != nil {
 		device.SetError(err)
 		conn.Close()
+		tr.Err = err
+		m.emitTrace(tr)
 		return
 	}
+	session.SetDeadline(m.deadline)
 
 	// Add to tracking (handles both new and reconnected devices)
 	m.addDevice(device)
+	tr.Init = time.Since(tr.Accepted) - tr.Handshake
+	m.emitTrace(tr)
 
 	// Start monitoring
 	go m.monitorDevice(device)
 }
 
+// emitTrace hands a connection trace to the callback, if one is set
+func (m *Manager) emitTrace(tr ConnTrace) {
+	if m.trace != nil {
+		m.trace(tr)
+	}
+}
+
 // Connect connects to an agent in bind mode
 func (m *Manager) Connect(addr string) error {
 	conn, err := net.DialTimeout("tcp", addr, 10*time.Second)
@@ -212,6 +262,7 @@ func (m *Manager) Connect(addr string) error {
 		conn.Close()
 		return fmt.Errorf("initialize failed: %w", err)
 	}
+	session.SetDeadline(m.deadline)
 
 	// Add to tracking
 	m.addDevice(device)
@@ -348,7 +399,8 @@ func (m *Manager) Disconnect(id string) error {
 	return nil
 }
 
-// Stop stops the manager and closes all connections
+// Stop stops the manager and closes all connections. Returns the error if
+// the device list could not be saved.
 func (m *Manager) Stop() error {
 	m.cancel()
 
@@ -356,8 +408,9 @@ func (m *Manager) Stop() error {
 		m.listener.Close()
 	}
 
-	// Save all devices before shutdown
+	// Save all devices before shutdown, and nothing after it
 	m.SaveAllDevices()
+	saveErr := m.store.Close()
 
 	// Close all device sessions
 	m.mu.Lock()
@@ -370,22 +423,40 @@ func (m *Manager) Stop() error {
 	m.mu.Unlock()
 
 	close(m.events)
-	return nil
+	return saveErr
 }
 
 // SaveAllDevices persists all devices to YAML.
-// Called on customization changes, disconnections, and shutdown.
+// Called on customization changes, disconnections, and shutdown. The write
+// happens in the background shortly after, covering every change made in
+// the meantime; Stop writes anything still pending.
 func (m *Manager) SaveAllDevices() {
+	m.store.Save()
+}
+
+// SaveError returns why the device file could not be written, or nil. A
+// failed write is retried until one succeeds.
+func (m *Manager) SaveError() error {
+	return m.store.Err()
+}
+
+// StoreWrites returns how many times the device file has been rewritten
+func (m *Manager) StoreWrites() int {
+	return m.store.Writes()
+}
+
+// snapshotDevices returns the device list as saved to YAML, sorted by ID
+// so that an unchanged list gives an unchanged file
+func (m *Manager) snapshotDevices() []SavedDevice {
 	m.mu.RLock()
 	defer m.mu.RUnlock()
 
-	var saved []SavedDevice
+	saved := make([]SavedDevice, 0, len(m.devices))
 	for _, device := range m.devices {
 		saved = append(saved, DeviceToSaved(device))
 	}
-
-	// Fire and forget - don't block on save errors
-	go SaveDevices(saved)
+	sort.Slice(saved, func(i, j int) bool { return saved[i].ID < saved[j].ID })
+	return saved
 }
 
 // RemoveDevicePermanently removes a device from tracking and from saved storage.
@@ -452,6 +523,7 @@ func (m *Manager) connectToExisting(existingDevice *Device) error {
 		conn.Close()
 		return fmt.Errorf("initialize failed: %w", err)
 	}
+	session.SetDeadline(m.deadline)
 
 	// Update timestamps
 	existingDevice.mu.Lock()
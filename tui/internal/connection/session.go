@@ -4,7 +4,9 @@ import (
 	"context"
 	"fmt"
 	"net"
+	"path"
 	"sync"
+	"time"
 
 	"github.com/Necromancer-Labs/embbridge/client/protocol"
 )
@@ -17,6 +19,23 @@ type Session struct {
 	ctx    context.Context
 	cancel context.CancelFunc
 	closed bool
+
+	// Fingerprint from the handshake (nil for agents that don't send one)
+	info *protocol.DeviceInfo
+
+	// Watched directory listings for LsCached, oldest first in listingOrder
+	listings     map[string]*listing
+	listingOrder []string
+}
+
+// maxListings is how many directories LsCached keeps watched at once
+const maxListings = 8
+
+// listing is a cached directory listing, marked stale by its watch
+type listing struct {
+	resp  *protocol.Response
+	id    uint32
+	stale bool
 }
 
 // NewSession creates a session from an accepted connection
@@ -70,9 +89,11 @@ func (s *Session) PerformHandshakeAsClient() error {
 		return fmt.Errorf("send hello: %w", err)
 	}
 
-	if _, err := s.proto.RecvHelloAck(); err != nil {
+	ack, err := s.proto.RecvHelloAck()
+	if err != nil {
 		return fmt.Errorf("receive hello_ack: %w", err)
 	}
+	s.info = ack.Device
 
 	return nil
 }
@@ -83,9 +104,11 @@ func (s *Session) PerformHandshakeAsServer() error {
 	s.mu.Lock()
 	defer s.mu.Unlock()
 
-	if _, err := s.proto.RecvHello(); err != nil {
+	hello, err := s.proto.RecvHello()
+	if err != nil {
 		return fmt.Errorf("receive hello: %w", err)
 	}
+	s.info = hello.Device
 
 	if err := s.proto.SendHelloAck(); err != nil {
 		return fmt.Errorf("send hello_ack: %w", err)
@@ -94,8 +117,19 @@ func (s *Session) PerformHandshakeAsServer() error {
 	return nil
 }
 
-// Initialize fetches device info (uname, whoami, pwd) after handshake
+// Initialize fills in device info after the handshake. Agents that send a
+// fingerprint with hello/hello_ack need no requests; older agents are asked
+// for uname, whoami and pwd.
 func (s *Session) Initialize() error {
+	if info := s.info; info != nil {
+		s.device.UpdateInfo(info.Nodename, info.Release, info.Machine, info.Sysname)
+		s.device.UpdateUser(info.User, info.UID, info.GID)
+		s.device.UpdateHardware(info.CPU, info.MemTotalKB, info.MTDCount, info.Features)
+		s.device.SetCurrentDir(info.Cwd)
+		s.device.SetState(DeviceConnected)
+		return nil
+	}
+
 	// Get system info
 	resp, err := s.Uname()
 	if err != nil {
@@ -163,6 +197,93 @@ func (s *Session) Ls(path string) (*protocol.Response, error) {
 	return s.proto.Ls(path)
 }
 
+// LsCached lists a directory like Ls, but keeps the listing and watches
+// the directory with watch_dir, so asking again (path completion on every
+// Tab) costs nothing until something in it changes. Agents without
+// watch_dir get a plain Ls.
+func (s *Session) LsCached(dir string) (*protocol.Response, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if s.closed {
+		return nil, fmt.Errorf("session closed")
+	}
+
+	if !path.IsAbs(dir) {
+		dir = path.Join(s.device.GetCurrentDir(), dir)
+	}
+	if s.info == nil || !s.info.HasFeature("watch_dir") || !path.IsAbs(dir) {
+		return s.proto.Ls(dir)
+	}
+	dir = path.Clean(dir)
+
+	// Changes that arrived since the last request mark listings stale
+	if err := s.proto.PollWatches(); err != nil {
+		return nil, err
+	}
+
+	l := s.listings[dir]
+	if l != nil && !l.stale {
+		return l.resp, nil
+	}
+	if l == nil {
+		// Watch before listing, so nothing changes unnoticed in between
+		l = &listing{}
+		id, err := s.proto.WatchDir(dir, 100*time.Millisecond, func(b protocol.WatchBatch) {
+			l.stale = true
+			if b.Done {
+				s.dropListing(dir)
+			}
+		})
+		if err != nil {
+			// Not watchable (not a directory, out of watches): list it
+			return s.proto.Ls(dir)
+		}
+		l.id = id
+		s.addListing(dir, l)
+	}
+
+	// A change reported while listing leaves it stale for next time
+	l.stale = false
+	resp, err := s.proto.Ls(dir)
+	if err != nil {
+		return nil, err
+	}
+	if !resp.OK {
+		l.stale = true
+		return resp, nil
+	}
+	l.resp = resp
+	return resp, nil
+}
+
+// addListing caches a watched listing, unwatching the oldest over the limit
+func (s *Session) addListing(dir string, l *listing) {
+	if s.listings == nil {
+		s.listings = make(map[string]*listing)
+	}
+	if len(s.listingOrder) >= maxListings {
+		oldest := s.listingOrder[0]
+		if old := s.listings[oldest]; old != nil {
+			s.proto.Unwatch(old.id)
+		}
+		s.dropListing(oldest)
+	}
+	s.listings[dir] = l
+	s.listingOrder = append(s.listingOrder, dir)
+}
+
+// dropListing forgets a cached listing whose watch ended
+func (s *Session) dropListing(dir string) {
+	delete(s.listings, dir)
+	for i, d := range s.listingOrder {
+		if d == dir {
+			s.listingOrder = append(s.listingOrder[:i], s.listingOrder[i+1:]...)
+			break
+		}
+	}
+}
+
 // Pwd gets the current working directory
 func (s *Session) Pwd() (*protocol.Response, error) {
 	s.mu.Lock()
@@ -256,6 +377,41 @@ func (s *Session) Ss() (*protocol.Response, error) {
 	return s.proto.Ss()
 }
 
+// SetDeadline sets the time limit sent with every following request
+// (see protocol.Protocol.SetDeadline)
+func (s *Session) SetDeadline(d time.Duration) {
+	s.proto.SetDeadline(d)
+}
+
+// SetTransferRate limits each following pull and push
+// (see protocol.Protocol.SetTransferRate)
+func (s *Session) SetTransferRate(bytesPerSec uint64) {
+	s.proto.SetTransferRate(bytesPerSec)
+}
+
+// TransferRate returns the per-transfer limit set with SetTransferRate
+func (s *Session) TransferRate() uint64 {
+	return s.proto.TransferRate()
+}
+
+// Throttle sets the session-wide transfer limits on the agent
+func (s *Session) Throttle(opts protocol.ThrottleOptions) (*protocol.Response, error) {
+	s.mu.Lock()
+	defer s.mu.Unlock()
+
+	if s.closed {
+		return nil, fmt.Errorf("session closed")
+	}
+
+	return s.proto.Throttle(opts)
+}
+
+// Cancel asks the agent to abort the command in flight. Unlike the other
+// methods it does not take the session lock, which the running command holds.
+func (s *Session) Cancel() error {
+	return s.proto.Cancel()
+}
+
 // Exec runs a command on the device
 func (s *Session) Exec(command string) (*protocol.Response, error) {
 	s.mu.Lock()
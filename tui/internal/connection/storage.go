@@ -1,8 +1,10 @@
 package connection
 
 import (
+	"bytes"
 	"os"
 	"path/filepath"
+	"sync"
 	"time"
 
 	"gopkg.in/yaml.v3"
@@ -26,6 +28,10 @@ type SavedDevice struct {
 	Architecture string `yaml:"architecture,omitempty"`
 	OS           string `yaml:"os,omitempty"`
 	Kernel       string `yaml:"kernel,omitempty"`
+	User         string `yaml:"user,omitempty"`
+	UID          int    `yaml:"uid,omitempty"`
+	GID          int    `yaml:"gid,omitempty"`
+	CurrentDir   string `yaml:"cwd,omitempty"`
 
 	// Connection history
 	LastConnected time.Time `yaml:"last_connected"`
@@ -78,13 +84,169 @@ func SaveDevices(devices []SavedDevice) error {
 		return err
 	}
 
+	data, err := marshalDevices(devices)
+	if err != nil {
+		return err
+	}
+	return writeFileAtomic(path, data)
+}
+
+func marshalDevices(devices []SavedDevice) ([]byte, error) {
 	store := DeviceStore{Devices: devices}
-	data, err := yaml.Marshal(&store)
+	return yaml.Marshal(&store)
+}
+
+// writeFileAtomic replaces path with data through a temporary file in the
+// same directory, so a crash mid-write leaves the old file, never half a
+// new one.
+func writeFileAtomic(path string, data []byte) error {
+	tmp, err := os.CreateTemp(filepath.Dir(path), filepath.Base(path)+".*.tmp")
+	if err != nil {
+		return err
+	}
+	defer os.Remove(tmp.Name()) // No-op once renamed
+
+	if _, err := tmp.Write(data); err != nil {
+		tmp.Close()
+		return err
+	}
+	if err := tmp.Sync(); err != nil {
+		tmp.Close()
+		return err
+	}
+	if err := tmp.Close(); err != nil {
+		return err
+	}
+	if err := os.Chmod(tmp.Name(), 0644); err != nil {
+		return err
+	}
+	return os.Rename(tmp.Name(), path)
+}
+
+// deviceSaveDelay is how long changes collect before the device file is
+// rewritten
+const deviceSaveDelay = time.Second
+
+// deviceWriter is a write-behind store for the device file. Save only marks
+// the list dirty; the snapshot is taken and written once deviceSaveDelay
+// after the first change, so a burst of connects and disconnects costs one
+// rewrite instead of one per device. Identical contents are not rewritten.
+// A failed write leaves the list dirty and is tried again after the same
+// delay.
+type deviceWriter struct {
+	snapshot func() []SavedDevice
+	delay    time.Duration
+
+	mu      sync.Mutex
+	timer   *time.Timer // Pending write
+	changes uint64      // Save calls so far
+	closed  bool
+	err     error // From the last write, nil once one succeeds
+
+	writeMu sync.Mutex // Serializes flushes
+	saved   uint64     // changes covered by the file on disk
+	last    []byte     // Contents last written
+	writes  int
+}
+
+func newDeviceWriter(snapshot func() []SavedDevice) *deviceWriter {
+	return &deviceWriter{snapshot: snapshot, delay: deviceSaveDelay}
+}
+
+// Save schedules a write of the current device list
+func (w *deviceWriter) Save() {
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	if w.closed {
+		return
+	}
+	w.changes++
+	w.schedule()
+}
+
+// schedule arms the write timer unless it is already running. Called with
+// mu held.
+func (w *deviceWriter) schedule() {
+	if w.timer == nil {
+		w.timer = time.AfterFunc(w.delay, func() { w.Flush() })
+	}
+}
+
+// Flush writes pending changes now. On failure they stay pending and, unless
+// the writer is closed, another attempt is scheduled.
+func (w *deviceWriter) Flush() error {
+	w.writeMu.Lock()
+	defer w.writeMu.Unlock()
+
+	w.mu.Lock()
+	if w.timer != nil {
+		w.timer.Stop()
+		w.timer = nil
+	}
+	changes := w.changes
+	w.mu.Unlock()
+	if changes == w.saved {
+		return nil
+	}
+
+	err := w.write()
+
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	w.err = err
 	if err != nil {
+		if !w.closed {
+			w.schedule()
+		}
 		return err
 	}
+	// Changes made during the write are left for the timer they armed
+	w.saved = changes
+	return nil
+}
 
-	return os.WriteFile(path, data, 0644)
+// write stores a snapshot of the device list. Called with writeMu held.
+func (w *deviceWriter) write() error {
+	path, err := getStorePath()
+	if err != nil {
+		return err
+	}
+	data, err := marshalDevices(w.snapshot())
+	if err != nil {
+		return err
+	}
+	if bytes.Equal(data, w.last) {
+		return nil
+	}
+	if err := writeFileAtomic(path, data); err != nil {
+		return err
+	}
+	w.last = data
+	w.writes++
+	return nil
+}
+
+// Close writes pending changes and stops accepting new ones, so sessions
+// torn down during shutdown cannot overwrite the final list
+func (w *deviceWriter) Close() error {
+	w.mu.Lock()
+	w.closed = true
+	w.mu.Unlock()
+	return w.Flush()
+}
+
+// Err returns the error from the last write, nil if it succeeded
+func (w *deviceWriter) Err() error {
+	w.mu.Lock()
+	defer w.mu.Unlock()
+	return w.err
+}
+
+// Writes returns how many times the device file has been rewritten
+func (w *deviceWriter) Writes() int {
+	w.writeMu.Lock()
+	defer w.writeMu.Unlock()
+	return w.writes
 }
 
 // DeviceToSaved converts a live Device to SavedDevice for persistence.
@@ -102,6 +264,10 @@ func DeviceToSaved(d *Device) SavedDevice {
 		Architecture:  d.Architecture,
 		OS:            d.OS,
 		Kernel:        d.Kernel,
+		User:          d.User,
+		UID:           d.UID,
+		GID:           d.GID,
+		CurrentDir:    d.CurrentDir,
 		LastConnected: d.ConnectedAt,
 	}
 }
@@ -109,6 +275,9 @@ func DeviceToSaved(d *Device) SavedDevice {
 // SavedToDevice creates a Device from SavedDevice (for offline display).
 // The device starts in Disconnected state.
 func SavedToDevice(s SavedDevice) *Device {
+	if s.CurrentDir == "" {
+		s.CurrentDir = "/"
+	}
 	return &Device{
 		ID:           s.ID,
 		RemoteAddr:   s.RemoteAddr,
@@ -119,6 +288,10 @@ func SavedToDevice(s SavedDevice) *Device {
 		Architecture: s.Architecture,
 		OS:           s.OS,
 		Kernel:       s.Kernel,
+		User:         s.User,
+		UID:          s.UID,
+		GID:          s.GID,
+		CurrentDir:   s.CurrentDir,
 		ConnectedAt:  s.LastConnected,
 		LastActivity: s.LastConnected,
 		State:        DeviceDisconnected,
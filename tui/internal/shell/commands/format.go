@@ -346,3 +346,26 @@ func toInt64(v interface{}) int64 {
 		return 0
 	}
 }
+
+// FormatThrottleOutput formats the limits reported by throttle, plus the
+// client-side per-transfer rate.
+func FormatThrottleOutput(data map[string]interface{}, each uint64) string {
+	rate := func(r int64) string {
+		if r == 0 {
+			return "unlimited"
+		}
+		return formatSize(r) + "/s"
+	}
+	ioNames := map[int64]string{0: "default", 1: "realtime", 2: "best-effort", 3: "idle"}
+
+	var sb strings.Builder
+	fmt.Fprintf(&sb, "  session rate  %s\n", rate(toInt64(data["rate"])))
+	fmt.Fprintf(&sb, "  per transfer  %s\n", rate(int64(each)))
+	fmt.Fprintf(&sb, "  nice          %d\n", toInt64(data["nice"]))
+	fmt.Fprintf(&sb, "  io            %s", ioNames[toInt64(data["ioclass"])])
+	if class := toInt64(data["ioclass"]); class == 1 || class == 2 {
+		fmt.Fprintf(&sb, " (level %d)", toInt64(data["iolevel"]))
+	}
+	sb.WriteString("\n")
+	return sb.String()
+}
@@ -2,6 +2,10 @@ package commands
 
 import (
 	"fmt"
+	"os"
+	"os/signal"
+
+	"github.com/Necromancer-Labs/embbridge-tui/internal/connection"
 
 	"github.com/Necromancer-Labs/embbridge-tui/internal/ui/theme"
 )
@@ -17,3 +21,33 @@ func PrintError(msg string) {
 func PrintSuccess(msg string) {
 	fmt.Println(theme.StatusConnected.Render(msg))
 }
+
+// PrintTruncated notes when the agent cut output short to stay within its
+// memory budget or the request deadline.
+func PrintTruncated(data map[string]interface{}) {
+	if truncated, ok := data["truncated"].(bool); ok && truncated {
+		fmt.Println(theme.StatusBusy.Render("[output truncated: agent memory budget or deadline reached]"))
+	}
+}
+
+// CancelOnInterrupt makes Ctrl-C cancel the command running on the agent
+// instead of ending the shell. Call the returned function once it finished.
+func CancelOnInterrupt(session *connection.Session) func() {
+	sig := make(chan os.Signal, 1)
+	signal.Notify(sig, os.Interrupt)
+	done := make(chan struct{})
+
+	go func() {
+		select {
+		case <-sig:
+			fmt.Println("\n^C cancelling...")
+			session.Cancel()
+		case <-done:
+		}
+	}()
+
+	return func() {
+		signal.Stop(sig)
+		close(done)
+	}
+}
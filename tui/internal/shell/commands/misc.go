@@ -33,7 +33,9 @@ func (m *Module) ExecCmd() *cobra.Command {
 				command += arg
 			}
 
+			stop := CancelOnInterrupt(session)
 			resp, err := session.Exec(command)
+			stop()
 			if err != nil {
 				PrintError(err.Error())
 				return
@@ -66,6 +68,7 @@ func (m *Module) ExecCmd() *cobra.Command {
 					fmt.Print(stderr)
 				}
 			}
+			PrintTruncated(resp.Data)
 		},
 	}
 }
@@ -103,6 +106,7 @@ func (m *Module) StringsCmd() *cobra.Command {
 			case string:
 				fmt.Print(content)
 			}
+			PrintTruncated(resp.Data)
 		},
 	}
 	cmd.Flags().IntVarP(&minLen, "min", "n", 4, "Minimum string length")
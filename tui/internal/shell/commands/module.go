@@ -7,7 +7,7 @@
 //   - Filesystem: ls, cd, pwd, cat, rm, mv, cp, mkdir, chmod
 //   - System: ps, ss, uname, whoami, dmesg, cpuinfo, mtd
 //   - Network: ip-addr, ip-route
-//   - Transfer: pull (download), push (upload)
+//   - Transfer: pull (download), push (upload), throttle
 //   - Misc: exec (shell command), strings, reboot
 //
 // Commands communicate with the device via the embbridge protocol session,
@@ -48,9 +48,10 @@ func (m *Module) Initialize(shell shellapi.ShellAPI) {
 }
 
 // GetCommands returns all cobra commands provided by this module.
-// These commands are added to the shell's root command.
+// These commands are added to the shell's root command, minus any the
+// device's agent was built without.
 func (m *Module) GetCommands() []*cobra.Command {
-	return []*cobra.Command{
+	return m.supported([]*cobra.Command{
 		// Filesystem commands (fs.go)
 		m.LsCmd(),
 		m.CdCmd(),
@@ -78,12 +79,42 @@ func (m *Module) GetCommands() []*cobra.Command {
 		// Transfer commands (transfer.go)
 		m.PullCmd(),
 		m.PushCmd(),
+		m.ThrottleCmd(),
 
 		// Misc commands (misc.go)
 		m.ExecCmd(),
 		m.StringsCmd(),
 		m.RebootCmd(),
+	})
+}
+
+// agentCommandNames maps shell commands to agent commands where they differ
+var agentCommandNames = map[string]string{
+	"ip-addr":  "ip_addr",
+	"ip-route": "ip_route",
+}
+
+// supported drops commands missing from the device's advertised features
+func (m *Module) supported(commands []*cobra.Command) []*cobra.Command {
+	if m.shell == nil {
+		return commands
+	}
+	device := m.GetDevice()
+	if device == nil {
+		return commands
+	}
+
+	out := commands[:0]
+	for _, c := range commands {
+		name := c.Name()
+		if agentName, ok := agentCommandNames[name]; ok {
+			name = agentName
+		}
+		if device.HasFeature(name) {
+			out = append(out, c)
+		}
 	}
+	return out
 }
 
 // GetSession retrieves the active device session from shell state.
@@ -35,6 +35,7 @@ func (m *Module) PsCmd() *cobra.Command {
 			}
 
 			fmt.Print(FormatPsOutput(resp.Data))
+			PrintTruncated(resp.Data)
 		},
 	}
 }
@@ -64,6 +65,7 @@ func (m *Module) SsCmd() *cobra.Command {
 			}
 
 			fmt.Print(FormatSsOutput(resp.Data))
+			PrintTruncated(resp.Data)
 		},
 	}
 }
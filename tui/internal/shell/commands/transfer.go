@@ -6,8 +6,10 @@ package commands
 import (
 	"fmt"
 	"os"
+	"strconv"
 
 	"github.com/Necromancer-Labs/embbridge-tui/internal/connection"
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
 	"github.com/spf13/cobra"
 )
 
@@ -40,7 +42,8 @@ func (m *Module) PullCmd() *cobra.Command {
 				defer device.EndTransfer()
 			}
 
-			// Pull file with progress callback
+			// Pull file with progress callback (Ctrl-C cancels)
+			stop := CancelOnInterrupt(session)
 			data, size, mode, err := session.Pull(remotePath, func(transferred, total int64) {
 				// Update device transfer progress for TUI display
 				if device != nil {
@@ -50,6 +53,7 @@ func (m *Module) PullCmd() *cobra.Command {
 				pct := float64(transferred) / float64(total) * 100
 				fmt.Printf("\rDownloading: %.1f%% (%d/%d bytes)", pct, transferred, total)
 			})
+			stop()
 			fmt.Println() // Newline after progress
 
 			if err != nil {
@@ -111,7 +115,8 @@ func (m *Module) PushCmd() *cobra.Command {
 				defer device.EndTransfer()
 			}
 
-			// Push file with progress callback
+			// Push file with progress callback (Ctrl-C cancels)
+			stop := CancelOnInterrupt(session)
 			err = session.Push(remotePath, data, uint32(info.Mode()), func(transferred, total int64) {
 				// Update device transfer progress for TUI display
 				if device != nil {
@@ -121,6 +126,7 @@ func (m *Module) PushCmd() *cobra.Command {
 				pct := float64(transferred) / float64(total) * 100
 				fmt.Printf("\rUploading: %.1f%% (%d/%d bytes)", pct, transferred, total)
 			})
+			stop()
 			fmt.Println() // Newline after progress
 
 			if err != nil {
@@ -132,3 +138,75 @@ func (m *Module) PushCmd() *cobra.Command {
 		},
 	}
 }
+
+// ThrottleCmd limits transfer bandwidth and the agent's CPU/IO priority.
+// Usage: throttle [rate <size>|off] [each <size>|off] [nice <0-19>] [io idle|be[:0-7]|rt[:0-7]]
+// "rate" caps all transfers of the session together and "each" every
+// single pull/push; nice and io lower the priority of the agent process
+// serving this session. With no arguments, shows the current limits.
+func (m *Module) ThrottleCmd() *cobra.Command {
+	return &cobra.Command{
+		Use:   "throttle [rate <size>|off] [each <size>|off] [nice <0-19>] [io idle|be[:0-7]|rt[:0-7]]",
+		Short: "Limit transfer bandwidth and agent priority",
+		Run: func(cmd *cobra.Command, args []string) {
+			session := m.GetSession()
+			if session == nil {
+				PrintError("No active session")
+				return
+			}
+			if len(args)%2 != 0 {
+				PrintError("Usage: " + cmd.Use)
+				return
+			}
+
+			var opts protocol.ThrottleOptions
+			each := session.TransferRate()
+			for i := 0; i < len(args); i += 2 {
+				key, val := args[i], args[i+1]
+				switch key {
+				case "rate", "each":
+					rate, err := protocol.ParseRate(val)
+					if err != nil {
+						PrintError(err.Error())
+						return
+					}
+					if key == "rate" {
+						opts.Rate = &rate
+					} else {
+						each = rate
+					}
+				case "nice":
+					n, err := strconv.Atoi(val)
+					if err != nil || n < 0 || n > 19 {
+						PrintError("nice must be between 0 and 19")
+						return
+					}
+					opts.Nice = &n
+				case "io":
+					class, level, err := protocol.ParseIOPriority(val)
+					if err != nil {
+						PrintError(err.Error())
+						return
+					}
+					opts.IOClass, opts.IOLevel = class, level
+				default:
+					PrintError("unknown setting: " + key)
+					return
+				}
+			}
+
+			resp, err := session.Throttle(opts)
+			if err != nil {
+				PrintError(err.Error())
+				return
+			}
+			if !resp.OK {
+				PrintError(resp.Error)
+				return
+			}
+			session.SetTransferRate(each)
+
+			fmt.Print(FormatThrottleOutput(resp.Data, each))
+		},
+	}
+}
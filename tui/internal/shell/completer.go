@@ -145,7 +145,7 @@ func (c *PathCompleter) completePath(partial string) ([][]rune, int) {
 	}
 
 	// Query the remote device for directory listing
-	resp, err := session.Ls(dir)
+	resp, err := session.LsCached(dir)
 	if err != nil || !resp.OK {
 		return nil, 0
 	}
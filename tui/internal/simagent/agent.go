@@ -0,0 +1,239 @@
+// Package simagent implements a simulated embbridge agent for scale-testing
+// the connection manager without real devices.
+//
+// A simulated agent connects in reverse mode, performs the agent side of the
+// handshake and answers a handful of commands (uname, whoami, pwd, cd, ls,
+// ps) with canned data. Latency, bandwidth and failures can be injected.
+package simagent
+
+import (
+	"context"
+	"fmt"
+	"math/rand"
+	"net"
+	"sync"
+	"time"
+
+	"github.com/Necromancer-Labs/embbridge/client/protocol"
+)
+
+// Config controls the behaviour of a simulated agent
+type Config struct {
+	// Latency is added before every response; Jitter adds up to that much more
+	Latency time.Duration
+	Jitter  time.Duration
+
+	// Bandwidth limits writes to this many bytes per second (0 = unlimited)
+	Bandwidth int
+
+	// HandshakeFailRate is the probability of closing the connection instead
+	// of sending hello
+	HandshakeFailRate float64
+
+	// DropRate is the probability of closing the connection instead of
+	// answering a request
+	DropRate float64
+
+	// ErrorRate is the probability of answering a request with an error
+	ErrorRate float64
+
+	// NoFingerprint sends a hello without the device block, like agents
+	// older than the fingerprint support, so the manager falls back to
+	// uname/whoami/pwd requests
+	NoFingerprint bool
+}
+
+// Timing records when each connection phase finished for one agent
+type Timing struct {
+	LocalAddr     string    `json:"local"`
+	DialStart     time.Time `json:"dial_start"`
+	Connected     time.Time `json:"connected"`
+	HandshakeDone time.Time `json:"handshake_done"`
+	Requests      int       `json:"requests"`
+	Err           string    `json:"err,omitempty"`
+}
+
+// Agent is one simulated device
+type Agent struct {
+	cfg      Config
+	hostname string
+	rng      *rand.Rand
+	cwd      string
+}
+
+// New creates a simulated agent. index makes the hostname unique and seeds
+// the failure injection, so runs are reproducible.
+func New(cfg Config, index int) *Agent {
+	return &Agent{
+		cfg:      cfg,
+		hostname: fmt.Sprintf("sim-%04d", index),
+		rng:      rand.New(rand.NewSource(int64(index) + 1)),
+		cwd:      "/",
+	}
+}
+
+// Run connects to addr and serves requests until ctx is cancelled, the
+// connection drops or a failure is injected. onHandshake, if set, is called
+// once the handshake completes.
+func (a *Agent) Run(ctx context.Context, addr string, onHandshake func(Timing)) Timing {
+	t := Timing{DialStart: time.Now()}
+
+	var d net.Dialer
+	conn, err := d.DialContext(ctx, "tcp", addr)
+	if err != nil {
+		t.Err = err.Error()
+		return t
+	}
+	t.Connected = time.Now()
+	t.LocalAddr = conn.LocalAddr().String()
+
+	if a.cfg.Bandwidth > 0 {
+		conn = &throttledConn{Conn: conn, bps: a.cfg.Bandwidth}
+	}
+	p := protocol.New(conn)
+	defer p.Close()
+
+	// Close the connection on cancel so blocking reads return
+	stop := context.AfterFunc(ctx, func() { p.Close() })
+	defer stop()
+
+	if a.roll(a.cfg.HandshakeFailRate) {
+		t.Err = "injected handshake failure"
+		return t
+	}
+
+	hello := protocol.HelloMsg{Type: "hello", Version: protocol.Version, IsAgent: true}
+	if !a.cfg.NoFingerprint {
+		hello.Device = a.fingerprint()
+	}
+	if err := p.Send(hello); err != nil {
+		t.Err = err.Error()
+		return t
+	}
+	if _, err := p.RecvHelloAck(); err != nil {
+		t.Err = err.Error()
+		return t
+	}
+	t.HandshakeDone = time.Now()
+	if onHandshake != nil {
+		onHandshake(t)
+	}
+
+	for {
+		var req protocol.Request
+		if err := p.Recv(&req); err != nil {
+			if ctx.Err() == nil {
+				t.Err = err.Error()
+			}
+			return t
+		}
+		t.Requests++
+
+		if a.roll(a.cfg.DropRate) {
+			t.Err = "injected drop"
+			return t
+		}
+
+		a.delay()
+		if err := p.Send(a.handle(&req)); err != nil {
+			t.Err = err.Error()
+			return t
+		}
+	}
+}
+
+func (a *Agent) roll(p float64) bool {
+	return p > 0 && a.rng.Float64() < p
+}
+
+func (a *Agent) delay() {
+	d := a.cfg.Latency
+	if a.cfg.Jitter > 0 {
+		d += time.Duration(a.rng.Int63n(int64(a.cfg.Jitter)))
+	}
+	if d > 0 {
+		time.Sleep(d)
+	}
+}
+
+func (a *Agent) fingerprint() *protocol.DeviceInfo {
+	return &protocol.DeviceInfo{
+		Sysname:    "Linux",
+		Nodename:   a.hostname,
+		Release:    "4.14.90",
+		Version:    "#1 SMP PREEMPT",
+		Machine:    "mips",
+		User:       "root",
+		Cwd:        a.cwd,
+		CPU:        "MIPS 24Kc V7.4",
+		MemTotalKB: 126976,
+		MTDCount:   7,
+		Features:   []string{"ls", "cat", "pwd", "cd", "uname", "whoami", "ps"},
+	}
+}
+
+// handle builds the response for one request
+func (a *Agent) handle(req *protocol.Request) protocol.Response {
+	resp := protocol.Response{Type: "resp", ID: req.ID, OK: true}
+
+	if a.roll(a.cfg.ErrorRate) {
+		resp.OK = false
+		resp.Error = "injected error"
+		return resp
+	}
+
+	switch req.Cmd {
+	case "uname":
+		resp.Data = map[string]interface{}{
+			"sysname": "Linux", "nodename": a.hostname, "release": "4.14.90",
+			"version": "#1 SMP PREEMPT", "machine": "mips",
+		}
+	case "whoami":
+		resp.Data = map[string]interface{}{"user": "root", "uid": 0, "gid": 0}
+	case "pwd":
+		resp.Data = map[string]interface{}{"path": a.cwd}
+	case "cd":
+		if path, ok := req.Args["path"].(string); ok && path != "" {
+			a.cwd = path
+		}
+		resp.Data = map[string]interface{}{"path": a.cwd}
+	case "ls":
+		entries := make([]interface{}, 0, 20)
+		for i := 0; i < 20; i++ {
+			entries = append(entries, map[string]interface{}{
+				"name": fmt.Sprintf("file%02d", i), "type": "file",
+				"size": 1024 * i, "mode": 0644, "mtime": 1700000000,
+			})
+		}
+		resp.Data = map[string]interface{}{"entries": entries}
+	case "ps":
+		procs := make([]interface{}, 0, 40)
+		for i := 0; i < 40; i++ {
+			procs = append(procs, map[string]interface{}{
+				"pid": i + 1, "ppid": 1, "name": "daemon", "state": "sleeping",
+				"cmdline": fmt.Sprintf("/usr/sbin/daemon -n %d", i),
+			})
+		}
+		resp.Data = map[string]interface{}{"processes": procs}
+	default:
+		resp.OK = false
+		resp.Error = "unknown command"
+	}
+	return resp
+}
+
+// throttledConn limits write bandwidth by sleeping after each write
+type throttledConn struct {
+	net.Conn
+	bps int
+	mu  sync.Mutex
+}
+
+func (c *throttledConn) Write(b []byte) (int, error) {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	n, err := c.Conn.Write(b)
+	time.Sleep(time.Duration(int64(n) * int64(time.Second) / int64(c.bps)))
+	return n, err
+}
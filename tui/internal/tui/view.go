@@ -213,7 +213,11 @@ func (m Model) renderHelp() string {
 		parts = append(parts, fmt.Sprintf("%s %s", key, desc))
 	}
 
-	return strings.Join(parts, "  ")
+	bar := strings.Join(parts, "  ")
+	if err := m.manager.SaveError(); err != nil {
+		bar += "\n" + theme.ErrorStyle.Render(fmt.Sprintf("Saving devices failed: %v", err))
+	}
+	return bar
 }
 
 // renderConnectDialog renders the address input dialog.
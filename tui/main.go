@@ -23,10 +23,12 @@ import (
 func main() {
 	// Parse command line flags
 	port := flag.Int("port", 1337, "Port to listen on for agent connections")
+	deadline := flag.Duration("deadline", 0, "Limit slow agent scans (ps, ss, strings, exec) to this long, returning partial output")
 	flag.Parse()
 
 	// Create connection manager - handles all device connections and state
 	manager := connection.NewManager()
+	manager.SetRequestDeadline(*deadline)
 
 	// Start TCP listener for incoming agent connections
 	listenAddr := fmt.Sprintf(":%d", *port)
@@ -34,7 +36,6 @@ func main() {
 		fmt.Fprintf(os.Stderr, "Failed to listen on %s: %v\n", listenAddr, err)
 		os.Exit(1)
 	}
-	defer manager.Stop()
 
 	fmt.Printf("Graveyard listening on %s\n", listenAddr)
 
@@ -53,5 +54,8 @@ func main() {
 		// When shell exits (user types 'exit'), loop back to device list
 	}
 
+	if err := manager.Stop(); err != nil {
+		fmt.Fprintf(os.Stderr, "Failed to save devices: %v\n", err)
+	}
 	fmt.Println("Rest in peace...")
 }